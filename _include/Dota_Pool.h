@@ -12,7 +12,17 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <deque>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdint.h>
 #include <unistd.h>
 using namespace std;
 
@@ -21,6 +31,24 @@ using namespace std;
 #define Dota_Mat 0
 #define Dota_Dat 1
 
+// 环形数据池满时的处理方式：丢弃新数据、丢弃最旧的数据、阻塞等待
+#define Dota_Drop_Newest 0
+#define Dota_Drop_Oldest 1
+#define Dota_Block 2
+
+// 环形数据池的生产者模式：多生产者、单生产者
+#define Dota_MPSC 0
+#define Dota_SPSC 1
+
+// 持久化段文件
+#define Dota_Seg_Magic 0x47455344        // 文件开头的 "DSEG"
+#define Dota_Seg_Version 1
+#define Dota_Seg_Header 4096             // 段文件头占的字节数，记录从这里开始
+#define Dota_Seg_Default_Size (64 << 20) // 默认每个段文件的大小
+#define Dota_Persist_Batch 4096          // 待写入的记录攒到这么多时提前唤醒后台线程
+#define Dota_Persist_SyncMs 1000         // 默认每隔多少毫秒 msync 一次
+#define Dota_Persist_MaxPending (1 << 20) // 默认最多积压多少条待写入的记录（32MB），再多的直接丢掉并计数
+
 // 类声明
 class Mat;
 class Dat;
@@ -35,7 +63,7 @@ class Mat
     friend Dota_Pool;
 
 public:
-    Mat(double _time = 10.0) : time_stamp(_time);
+    Mat(double _time = 10.0);
 
     Mat(const Mat &m);
 
@@ -52,7 +80,7 @@ class Dat
     friend Dota_Pool;
 
 public:
-    Dat(double _steer = 5.0, double _speed = 20.0, double _time = 10.0) : steer(_steer), speed(_speed), time_stamp(_time);
+    Dat(double _steer = 5.0, double _speed = 20.0, double _time = 10.0);
 
     Dat(const Dat &d);
 
@@ -70,7 +98,7 @@ class Dota
 
 public:
     // 根据标识，初始化指定数据指针
-    Dota(int _sign = Dota_Nul) : sign(_sign);
+    Dota(int _sign = Dota_Nul);
 
     Dota(const Mat &m);
 
@@ -89,6 +117,46 @@ private:
 
 public:
     void show() const;
+
+    // 返回数据类型标识
+    int getsign() const;
+};
+
+// 段文件中的一条记录，映射到内存后直接按结构体读写，不需要序列化；Mat 的 steer、speed 为 0
+struct Dota_Record
+{
+    int32_t sign;
+    int32_t reserved;
+    double time_stamp;
+    double steer;
+    double speed;
+};
+
+// 段文件头，位于文件开头，记录个数和时间范围用来读历史数据时整段跳过
+struct Dota_Seg_Head
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size; // sizeof(Dota_Record)
+    uint32_t reserved;
+    uint64_t seq;         // 段文件序号，也是文件名的一部分
+    uint64_t capacity;    // 最多能放的记录数
+    uint64_t count;       // 已写入的记录数
+    double t_min;         // 段中记录的最早时间戳
+    double t_max;         // 段中记录的最晚时间戳
+};
+
+// 一个映射到内存的段文件
+struct Dota_Segment
+{
+    string path;
+    int fd;
+    char *base;           // 映射的起始地址
+    size_t size;          // 文件大小
+    bool writable;        // 只有最后一个段可写，启动时找到的段都只读
+    size_t synced;        // 已经 msync 过的记录数
+    Dota_Seg_Head *head;
+    Dota_Record *records;
 };
 
 class Dota_Pool
@@ -102,7 +170,62 @@ private:
     deque<Dota> dotabox; // 保存元素队列容器
     mutex dota_mutex;    // 保护数据队列锁
 
+    // 持久化，生产者只把记录放进 pending，写段文件和 msync 都在后台线程做
+    bool persisting;               // 是否开启了持久化
+    bool persist_stop;             // 通知后台线程退出
+    string persist_dir;            // 段文件所在目录
+    size_t seg_size;               // 每个段文件的大小
+    size_t max_segments;           // 最多保留的段文件个数，0 表示不限制
+    int sync_ms;                   // msync 的间隔
+    size_t persist_dropped;        // 段文件创建失败时丢掉的记录数，由 seg_mutex 保护
+    size_t max_pending;            // pending 最多积压的记录数
+    size_t pending_dropped;        // pending 积压满了丢掉的记录数，由 dota_mutex 保护
+    vector<Dota_Record> pending;   // 等待写入段文件的记录，由 dota_mutex 保护
+    condition_variable flush_cond; // 唤醒后台线程，和 dota_mutex 配合使用
+    thread flusher;                // 后台线程
+    vector<Dota_Segment> segments; // 按序号排列，最后一个可能可写
+    mutex seg_mutex;               // 保护 segments 和各段文件头
+
+    Dota_Pool(const Dota_Pool &) = delete;
+    Dota_Pool &operator=(const Dota_Pool &) = delete;
+
+    // 持有 dota_mutex 时调用，把一条数据放进 pending，积压满了丢掉
+    void persist(const Dota &d);
+
+    // 后台线程，攒够一批或到了 msync 的时间就写段文件
+    void flush_loop();
+
+    // 把一批记录写进可写的段文件，写满了换一个新的
+    void write_records(const Dota_Record *r, size_t n);
+
+    // 把可写段中新写入的部分 msync 到磁盘
+    void sync_active();
+
+    // 当前可写段变为只读，新建下一个段文件，返回 false 表示创建失败
+    bool roll_segment();
+
+    // 打开一个已有的段文件，只读映射，文件头不对时返回 false
+    static bool open_segment(const string &path, Dota_Segment &seg);
+
+    static void close_segment(Dota_Segment &seg);
+
 public:
+    // 开启持久化：目录中已有的段文件只读打开，之后的数据写到新的段文件中
+    // segBytes 为每个段文件的大小，syncMs 为 msync 的间隔，maxSegments 为最多保留的段文件个数（0 不限制），
+    // maxPending 为后台线程跟不上时最多积压的记录数
+    bool enable_persist(const char *dir, size_t segBytes = Dota_Seg_Default_Size, int syncMs = Dota_Persist_SyncMs,
+                        size_t maxSegments = 0, size_t maxPending = Dota_Persist_MaxPending);
+
+    // 关闭持久化：写完剩下的数据，msync 后解除映射
+    void disable_persist();
+
+    // 读出段文件中时间范围和 [tBegin, tEnd] 有交集的各段，fn 直接拿到映射内存中的一段连续记录，
+    // 段内记录按写入顺序存放，由 fn 自己按时间过滤；调用期间不会换段或删段，返回传给 fn 的记录总数
+    size_t read_history(double tBegin, double tEnd, const function<void(const Dota_Record *, size_t)> &fn);
+
+    // 没能写进段文件的记录数：积压满了丢掉的，加上段文件创建失败时丢掉的
+    size_t persist_drop_count();
+
     void push(Mat m);
 
     void push(Dat d);
@@ -119,4 +242,268 @@ public:
     void clear();
 };
 
+/***********************************
+ * @brief  有界无锁环形数据池，容量固定，生产者入队、消费者出队都不加锁
+ * @param  T    元素类型，默认为 Dota
+ * @note   每个槽有一个序号，生产者和消费者靠序号判断槽是否可写、可读（Vyukov 有界队列）；
+ *         Dota_SPSC 模式下只能有一个生产者，入队时不用 CAS；
+ *         消费者可以有多个，Dota_Drop_Oldest 时生产者也会从队头取走最旧的数据
+ ***********************************/
+template <typename T = Dota>
+class Dota_Ring
+{
+public:
+    // 容量向上取 2 的幂
+    Dota_Ring(size_t _capacity, int _policy = Dota_Drop_Newest, int _mode = Dota_MPSC);
+
+    ~Dota_Ring();
+
+private:
+    // 一个槽，seq 等于写入位置时可写，等于写入位置 +1 时可读
+    struct Cell
+    {
+        atomic<size_t> seq;
+        typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    Cell *cells;  // 槽数组
+    size_t mask;  // 容量 - 1
+    int policy;   // 满时的处理方式
+    int mode;     // 生产者模式
+
+    alignas(64) atomic<size_t> tail; // 下一个写入位置
+    alignas(64) atomic<size_t> head; // 下一个读取位置
+
+    atomic<size_t> dropped;    // 满时丢掉的数据个数
+    atomic<int> waiters;       // Dota_Block 时正在等待空位的生产者个数
+    mutex wait_mutex;          // 生产者等待空位用
+    condition_variable wait_cond;
+
+    Dota_Ring(const Dota_Ring &) = delete;
+    Dota_Ring &operator=(const Dota_Ring &) = delete;
+
+    // 尝试写入一个元素，满了返回 false，这时参数还没有被使用
+    template <typename... Args>
+    bool try_emplace(Args &&...args);
+
+    // 读出一批后唤醒等待空位的生产者
+    void wake_producers();
+
+public:
+    // 放入一个元素，满时按 policy 处理；丢弃新数据时返回 false
+    bool push(const T &v) { return emplace(v); }
+    bool push(T &&v) { return emplace(std::move(v)); }
+
+    // 用参数在槽中直接构造元素
+    template <typename... Args>
+    bool emplace(Args &&...args);
+
+    // 取出一个元素，空时返回 false
+    bool pop(T &out);
+
+    // 最多取出 n 个元素，返回取出的个数；一次 CAS 认领一整批
+    size_t pop_batch(T *out, size_t n);
+
+    // 当前元素个数，并发时只是近似值
+    size_t size() const;
+
+    // 容量
+    size_t capacity() const { return mask + 1; }
+
+    // 满时丢掉的数据个数
+    size_t drop_count() const { return dropped.load(memory_order_relaxed); }
+};
+
+// 模板的实现必须在使用处可见，所以放在头文件中
+
+template <typename T>
+Dota_Ring<T>::Dota_Ring(size_t _capacity, int _policy, int _mode) : policy(_policy), mode(_mode)
+{
+    size_t cap = 2;
+    while (cap < _capacity)
+    {
+        cap <<= 1;
+    }
+    mask = cap - 1;
+
+    cells = new Cell[cap];
+    for (size_t i = 0; i < cap; ++i)
+    {
+        cells[i].seq.store(i, memory_order_relaxed);
+    }
+
+    tail.store(0);
+    head.store(0);
+    dropped.store(0);
+    waiters.store(0);
+}
+
+template <typename T>
+Dota_Ring<T>::~Dota_Ring()
+{
+    // 销毁还没取走的元素
+    T tmp;
+    while (pop(tmp))
+    {
+    }
+    delete[] cells;
+}
+
+template <typename T>
+template <typename... Args>
+bool Dota_Ring<T>::try_emplace(Args &&...args)
+{
+    Cell *cell;
+    size_t pos = tail.load(memory_order_relaxed);
+    for (;;)
+    {
+        cell = &cells[pos & mask];
+        size_t seq = cell->seq.load(memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0)
+        {
+            if (mode == Dota_SPSC)
+            {
+                tail.store(pos + 1, memory_order_relaxed);
+                break;
+            }
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            // 这个槽上一圈的数据还没被取走，满了
+            return false;
+        }
+        else
+        {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+
+    new (&cell->storage) T(std::forward<Args>(args)...);
+    cell->seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+template <typename T>
+template <typename... Args>
+bool Dota_Ring<T>::emplace(Args &&...args)
+{
+    for (int spins = 0;; ++spins)
+    {
+        if (try_emplace(std::forward<Args>(args)...))
+        {
+            return true;
+        }
+
+        if (policy == Dota_Drop_Newest)
+        {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+
+        if (policy == Dota_Drop_Oldest)
+        {
+            // 取走最旧的一个腾出位置，取不到说明消费者刚取走了，直接重试
+            T tmp;
+            if (pop(tmp))
+            {
+                dropped.fetch_add(1, memory_order_relaxed);
+            }
+            continue;
+        }
+
+        // Dota_Block：先让出几次 CPU，还是满的就睡眠等消费者唤醒；定时醒来重试，不怕错过唤醒
+        if (spins < 64)
+        {
+            this_thread::yield();
+            continue;
+        }
+        unique_lock<mutex> lock(wait_mutex);
+        waiters.fetch_add(1);
+        wait_cond.wait_for(lock, chrono::milliseconds(1));
+        waiters.fetch_sub(1);
+    }
+}
+
+template <typename T>
+void Dota_Ring<T>::wake_producers()
+{
+    if (waiters.load() > 0)
+    {
+        lock_guard<mutex> lock(wait_mutex);
+        wait_cond.notify_all();
+    }
+}
+
+template <typename T>
+bool Dota_Ring<T>::pop(T &out)
+{
+    return pop_batch(&out, 1) == 1;
+}
+
+template <typename T>
+size_t Dota_Ring<T>::pop_batch(T *out, size_t n)
+{
+    size_t pos = head.load(memory_order_relaxed);
+    size_t m;
+    for (;;)
+    {
+        // 从读取位置往后数出连续可读的槽
+        for (m = 0; m < n; ++m)
+        {
+            size_t seq = cells[(pos + m) & mask].seq.load(memory_order_acquire);
+            if (seq != pos + m + 1)
+            {
+                break;
+            }
+        }
+
+        if (m == 0)
+        {
+            size_t seq = cells[pos & mask].seq.load(memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+            {
+                // 空了
+                return 0;
+            }
+            // 被别的消费者抢先取走了，重新读取位置
+            pos = head.load(memory_order_relaxed);
+            continue;
+        }
+
+        if (head.compare_exchange_weak(pos, pos + m, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < m; ++i)
+    {
+        Cell *cell = &cells[(pos + i) & mask];
+        T *p = reinterpret_cast<T *>(&cell->storage);
+        out[i] = std::move(*p);
+        p->~T();
+        // 下一圈的写入位置
+        cell->seq.store(pos + i + mask + 1, memory_order_release);
+    }
+
+    if (policy == Dota_Block)
+    {
+        wake_producers();
+    }
+    return m;
+}
+
+template <typename T>
+size_t Dota_Ring<T>::size() const
+{
+    size_t t = tail.load(memory_order_relaxed);
+    size_t h = head.load(memory_order_relaxed);
+    return (t > h) ? t - h : 0;
+}
+
 #endif
\ No newline at end of file
@@ -1,7 +1,7 @@
 /***********************************
  * @author uichuan47
  * @since  2023.12.23
- * @brief  本文件实现一个用于测试内存性能分配的模板链表栈，声明文件
+ * @brief  本文件实现一个多线程可用的模板内存池，对象在一个线程中分配、在另一个线程中释放也可以
  * @date   2024.1.2
  ***********************************/
 
@@ -10,23 +10,65 @@
 
 #include <climits>
 #include <cstddef>
+#include <cstdlib>
 #include <utility>
 #include <cstdint>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
 
 /***********************************
- * @brief  模板链表栈，可以通过给定的分配器进行内存分配操作
+ * @brief  多线程内存池，每次分配 T 大小的对象槽，可以作为 StackAlloc 等容器的分配器
  * @param  T            数据类型
- * @param  BlockSize    内存块大小，默认为 4096
+ * @param  BlockSize    内存区块大小，默认为 4096，必须是 2 的幂，区块按这个大小对齐
+ * @note   每个线程有自己的空闲对象槽链表，分配和释放大多数时候不加锁；
+ *         链表太长时把一批对象槽还给全局仓库，链表空了再从仓库取一批，仓库是无锁的批次栈；
+ *         仓库也空了才加锁从当前区块中切出新的对象槽，区块用完再向系统申请新的区块；
+ *         trim() 把仓库中全部对象槽都空闲的区块还给系统
  ***********************************/
 template <typename T, size_t BlockSize = 4096>
 class MemoryPool
 {
 private:
-    // 用于存储内存池中的对象槽，要么被实例化为一个存放对象的槽，要么被实例化为一个指向存放对象槽的槽指针
+    union Slot_;
+
+    // 对象槽空闲时的链接信息
+    struct Link_
+    {
+        // 同一批中的下一个对象槽
+        Slot_ *next;
+        // 仓库中下一批的第一个对象槽，只有一批中的第一个对象槽才用
+        Slot_ *nextBatch;
+        // 本批对象槽个数，只有一批中的第一个对象槽才用
+        size_t count;
+    };
+
+    // 用于存储内存池中的对象槽，要么被实例化为一个存放对象的槽，要么是空闲时的链接信息
     union Slot_
     {
         T element;
-        Slot_ *next;
+        Link_ link;
+    };
+
+    // 内存区块头部，放在区块的开头，后面是对象槽
+    struct Block_
+    {
+        // 下一个内存区块
+        Block_ *next;
+        // 从本区块切出去的对象槽个数
+        size_t carved;
+        // trim() 时统计本区块在仓库中的空闲对象槽个数
+        size_t freeCount;
+    };
+
+    // 每个线程的空闲对象槽链表
+    struct ThreadCache_
+    {
+        MemoryPool *pool;
+        Slot_ *head;
+        size_t count;
     };
 
     // 数据指针
@@ -36,18 +78,62 @@ private:
     // 对象槽指针
     typedef Slot_ *slot_pointer_;
 
-    // 指向当前内存区块
-    slot_pointer_ currentBlock_;
+    // 区块中第一个对象槽的偏移，按对象槽对齐
+    static const size_t headerSize_ = (sizeof(Block_) + alignof(slot_type_) - 1) / alignof(slot_type_) * alignof(slot_type_);
+    // 每个区块可以放下的对象槽个数
+    static const size_t slotsPerBlock_ = (BlockSize - headerSize_) / sizeof(slot_type_);
+    // 线程和仓库之间每次交换的对象槽个数，线程的链表超过两批时还回一批
+    static const size_t batchSize_ = (slotsPerBlock_ / 2 > 64) ? 64 : ((slotsPerBlock_ / 2 > 0) ? slotsPerBlock_ / 2 : 1);
+
+    // 检查定义的内存池大小是否过小
+    static_assert(BlockSize >= headerSize_ + 2 * sizeof(slot_type_), "BlockSize too small.");
+    // 对象槽所在的区块靠地址对齐算出来
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "BlockSize must be a power of two.");
+    // 仓库栈顶在 64 位里存指针和版本号，指针只用低 48 位
+    static_assert(sizeof(void *) == 8, "MemoryPool needs 64-bit pointers.");
 
-    // 指向当前内存区块的一个对象槽
+    // 全部内存区块，只在持有 blockMutex_ 时访问
+    Block_ *currentBlock_;
+    // 指向当前内存区块中下一个未切出的对象槽
     slot_pointer_ currentSlot_;
-    // 指向当前内存区块的最后一个对象槽
+    // 指向当前内存区块中最后一个对象槽之后
     slot_pointer_ lastSlot_;
-    // 指向当前内存区块中的空闲对象槽
-    slot_pointer_ freeSlots_;
+    // 和区块有关的互斥量
+    pthread_mutex_t blockMutex_;
 
-    // 检查定义的内存池大小是否过小
-    static_assert(BlockSize >= 2 * sizeof(slot_type_), "BlockSize too small.");
+    // 全局仓库：成批空闲对象槽组成的栈，高 16 位是版本号，防止 ABA，低 48 位是栈顶一批的第一个对象槽
+    std::atomic<uint64_t> depot_;
+    // 正在从仓库中取批次的线程数，trim() 等它归零后才释放区块
+    std::atomic<int> depotReaders_;
+
+    // 每个线程的空闲对象槽链表，线程退出时还给仓库
+    pthread_key_t cacheKey_;
+    // 全部线程的空闲对象槽链表，析构时释放
+    std::vector<ThreadCache_ *> caches_;
+    pthread_mutex_t cacheMutex_;
+
+    // 取得本线程的空闲对象槽链表，没有就创建
+    ThreadCache_ *getCache_();
+    // 把本线程链表中的对象槽全部还给仓库
+    void flushCache_(ThreadCache_ *cache);
+    // 线程退出时调用
+    static void cacheDestructor_(void *p);
+
+    // 把一批对象槽放入仓库
+    void pushBatch_(slot_pointer_ first);
+    // 从仓库中取一批对象槽，仓库空时返回 nullptr
+    slot_pointer_ popBatch_();
+    // 从当前区块中切出 n 个连续的对象槽，区块不够时申请新的区块，剩下的对象槽交给本线程
+    slot_pointer_ carve_(size_t n, ThreadCache_ *cache);
+
+    // 对象槽所在的区块
+    static Block_ *blockOf_(slot_pointer_ p)
+    {
+        return reinterpret_cast<Block_ *>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t)(BlockSize - 1));
+    }
+
+    MemoryPool(const MemoryPool &) = delete;
+    MemoryPool &operator=(const MemoryPool &) = delete;
 
 public:
     // 数据类型指针
@@ -57,20 +143,20 @@ public:
     template <typename U>
     struct rebind
     {
-        typedef MemoryPool<U> other;
+        typedef MemoryPool<U, BlockSize> other;
     };
 
     // 默认构造, 初始化所有的槽指针
     MemoryPool() noexcept;
 
-    // 析构函数，销毁当前内存池
+    // 析构函数，销毁当前内存池；这时不能再有其他线程使用本内存池
     ~MemoryPool() noexcept;
 
-    // 分配内存区块，并返回一个数据指针
-    // 同一时间只能分配一个对象, n 和 hint 会被忽略
+    // 分配 n 个连续的对象槽，并返回一个数据指针，hint 会被忽略
+    // n 为 1 时从本线程的空闲链表中取；n 大于 1 时从区块中连续切出，超过一个区块的直接向系统申请
     pointer allocate(size_t n = 1, const T *hint = 0);
 
-    // 销毁指针 p 指向的内存区块
+    // 释放指针 p 指向的 n 个对象槽，n 必须和分配时相同，可以在任意线程中调用
     void deallocate(pointer p, size_t n = 1);
 
     // 调用对象构造函数，使用 std::forward 转发变参模板
@@ -80,6 +166,387 @@ public:
     // 调用对象析构函数
     template <typename U>
     void destroy(U *p);
+
+    // 先把本线程的空闲对象槽还给仓库，再把仓库中对象槽全部空闲的区块还给系统，返回释放的区块数
+    // 其他线程链表中的对象槽不算空闲，所在区块不会被释放
+    size_t trim();
 };
 
-#endif // MEMORY_POOL_HPP
\ No newline at end of file
+// 模板的实现必须在使用处可见，所以放在头文件中
+
+// 默认构造, 初始化所有的槽指针
+template <typename T, size_t BlockSize>
+MemoryPool<T, BlockSize>::MemoryPool() noexcept
+{
+    currentBlock_ = nullptr;
+    currentSlot_ = nullptr;
+    lastSlot_ = nullptr;
+    pthread_mutex_init(&blockMutex_, nullptr);
+
+    depot_.store(0);
+    depotReaders_.store(0);
+
+    pthread_key_create(&cacheKey_, &MemoryPool::cacheDestructor_);
+    pthread_mutex_init(&cacheMutex_, nullptr);
+}
+
+// 析构函数，销毁当前内存池
+template <typename T, size_t BlockSize>
+MemoryPool<T, BlockSize>::~MemoryPool() noexcept
+{
+    // 删掉之后线程退出时不再调用 cacheDestructor_()
+    pthread_key_delete(cacheKey_);
+    for (size_t i = 0; i < caches_.size(); ++i)
+    {
+        delete caches_[i];
+    }
+    caches_.clear();
+
+    // 循环销毁内存池中分配的内存区块
+    Block_ *curr = currentBlock_;
+    while (curr != nullptr)
+    {
+        Block_ *prev = curr->next;
+        free(curr);
+        curr = prev;
+    }
+
+    pthread_mutex_destroy(&blockMutex_);
+    pthread_mutex_destroy(&cacheMutex_);
+}
+
+// 取得本线程的空闲对象槽链表，没有就创建
+template <typename T, size_t BlockSize>
+typename MemoryPool<T, BlockSize>::ThreadCache_ *MemoryPool<T, BlockSize>::getCache_()
+{
+    ThreadCache_ *cache = static_cast<ThreadCache_ *>(pthread_getspecific(cacheKey_));
+    if (cache == nullptr)
+    {
+        cache = new ThreadCache_;
+        cache->pool = this;
+        cache->head = nullptr;
+        cache->count = 0;
+
+        pthread_mutex_lock(&cacheMutex_);
+        caches_.push_back(cache);
+        pthread_mutex_unlock(&cacheMutex_);
+
+        pthread_setspecific(cacheKey_, cache);
+    }
+    return cache;
+}
+
+// 把本线程链表中的对象槽全部还给仓库，每批最多 batchSize_ 个
+template <typename T, size_t BlockSize>
+void MemoryPool<T, BlockSize>::flushCache_(ThreadCache_ *cache)
+{
+    while (cache->head != nullptr)
+    {
+        slot_pointer_ first = cache->head;
+        slot_pointer_ last = first;
+        size_t n = 1;
+        while (n < batchSize_ && last->link.next != nullptr)
+        {
+            last = last->link.next;
+            ++n;
+        }
+        cache->head = last->link.next;
+        cache->count -= n;
+
+        last->link.next = nullptr;
+        first->link.count = n;
+        pushBatch_(first);
+    }
+}
+
+// 线程退出时调用，链表中的对象槽还给仓库，其他线程还能用
+template <typename T, size_t BlockSize>
+void MemoryPool<T, BlockSize>::cacheDestructor_(void *p)
+{
+    ThreadCache_ *cache = static_cast<ThreadCache_ *>(p);
+    MemoryPool *pool = cache->pool;
+
+    pool->flushCache_(cache);
+
+    pthread_mutex_lock(&pool->cacheMutex_);
+    for (size_t i = 0; i < pool->caches_.size(); ++i)
+    {
+        if (pool->caches_[i] == cache)
+        {
+            pool->caches_[i] = pool->caches_.back();
+            pool->caches_.pop_back();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->cacheMutex_);
+
+    delete cache;
+}
+
+// 把一批对象槽放入仓库
+template <typename T, size_t BlockSize>
+void MemoryPool<T, BlockSize>::pushBatch_(slot_pointer_ first)
+{
+    uint64_t old = depot_.load(std::memory_order_relaxed);
+    uint64_t tag;
+    do
+    {
+        first->link.nextBatch = reinterpret_cast<slot_pointer_>(old & 0xffffffffffffULL);
+        tag = (old >> 48) + 1;
+    } while (!depot_.compare_exchange_weak(old, (tag << 48) | reinterpret_cast<uintptr_t>(first), std::memory_order_release, std::memory_order_relaxed));
+}
+
+// 从仓库中取一批对象槽，仓库空时返回 nullptr
+template <typename T, size_t BlockSize>
+typename MemoryPool<T, BlockSize>::slot_pointer_ MemoryPool<T, BlockSize>::popBatch_()
+{
+    // 读栈顶一批的 nextBatch 时，这一批可能已经被别的线程取走，所以登记一下，trim() 不会在这期间释放区块
+    depotReaders_.fetch_add(1);
+
+    uint64_t old = depot_.load();
+    slot_pointer_ first = nullptr;
+    while ((old & 0xffffffffffffULL) != 0)
+    {
+        first = reinterpret_cast<slot_pointer_>(old & 0xffffffffffffULL);
+        uint64_t tag = (old >> 48) + 1;
+        if (depot_.compare_exchange_weak(old, (tag << 48) | reinterpret_cast<uintptr_t>(first->link.nextBatch), std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            break;
+        }
+        first = nullptr;
+    }
+
+    depotReaders_.fetch_sub(1, std::memory_order_release);
+    return first;
+}
+
+// 从当前区块中切出 n 个连续的对象槽，区块不够时申请新的区块，旧区块剩下的对象槽交给本线程
+template <typename T, size_t BlockSize>
+typename MemoryPool<T, BlockSize>::slot_pointer_ MemoryPool<T, BlockSize>::carve_(size_t n, ThreadCache_ *cache)
+{
+    pthread_mutex_lock(&blockMutex_);
+
+    if (currentSlot_ == nullptr || static_cast<size_t>(lastSlot_ - currentSlot_) < n)
+    {
+        // 旧区块剩下的零头切出来放进本线程链表，不浪费
+        while (currentSlot_ != nullptr && currentSlot_ < lastSlot_)
+        {
+            ++currentBlock_->carved;
+            currentSlot_->link.next = cache->head;
+            cache->head = currentSlot_++;
+            ++cache->count;
+        }
+
+        // 申请一个按区块大小对齐的新区块，找对象槽所在的区块只需要把地址低位清零
+        void *newBlock = nullptr;
+        if (posix_memalign(&newBlock, BlockSize, BlockSize) != 0)
+        {
+            pthread_mutex_unlock(&blockMutex_);
+            throw std::bad_alloc();
+        }
+
+        Block_ *block = static_cast<Block_ *>(newBlock);
+        block->next = currentBlock_;
+        block->carved = 0;
+        block->freeCount = 0;
+        currentBlock_ = block;
+
+        currentSlot_ = reinterpret_cast<slot_pointer_>(static_cast<data_pointer_>(newBlock) + headerSize_);
+        lastSlot_ = currentSlot_ + slotsPerBlock_;
+    }
+
+    slot_pointer_ result = currentSlot_;
+    currentSlot_ += n;
+    currentBlock_->carved += n;
+
+    pthread_mutex_unlock(&blockMutex_);
+    return result;
+}
+
+// 分配 n 个连续的对象槽，并返回一个数据指针
+template <typename T, size_t BlockSize>
+typename MemoryPool<T, BlockSize>::pointer MemoryPool<T, BlockSize>::allocate(size_t n, const T *hint)
+{
+    (void)hint;
+
+    if (n > slotsPerBlock_)
+    {
+        // 一个区块都放不下，直接向系统申请，释放时按 n 区分
+        return static_cast<pointer>(operator new(n * sizeof(slot_type_)));
+    }
+
+    ThreadCache_ *cache = getCache_();
+
+    if (n > 1)
+    {
+        return reinterpret_cast<pointer>(carve_(n, cache));
+    }
+
+    // 本线程链表空了，先从仓库取一批，仓库也空了再从区块中切一批
+    if (cache->head == nullptr)
+    {
+        slot_pointer_ first = popBatch_();
+        if (first != nullptr)
+        {
+            cache->head = first;
+            cache->count = first->link.count;
+        }
+        else
+        {
+            first = carve_(batchSize_, cache);
+            for (size_t i = 0; i < batchSize_; ++i)
+            {
+                first[i].link.next = cache->head;
+                cache->head = &first[i];
+            }
+            cache->count += batchSize_;
+        }
+    }
+
+    slot_pointer_ result = cache->head;
+    cache->head = result->link.next;
+    --cache->count;
+    return reinterpret_cast<pointer>(result);
+}
+
+// 释放指针 p 指向的 n 个对象槽
+template <typename T, size_t BlockSize>
+void MemoryPool<T, BlockSize>::deallocate(pointer p, size_t n)
+{
+    if (p == nullptr)
+    {
+        return;
+    }
+
+    if (n > slotsPerBlock_)
+    {
+        operator delete(static_cast<void *>(p));
+        return;
+    }
+
+    // 连续的 n 个对象槽拆开，逐个放进本线程链表
+    ThreadCache_ *cache = getCache_();
+    slot_pointer_ slot = reinterpret_cast<slot_pointer_>(p);
+    for (size_t i = 0; i < n; ++i)
+    {
+        slot[i].link.next = cache->head;
+        cache->head = &slot[i];
+    }
+    cache->count += n;
+
+    // 链表太长了，把最前面的一批还给仓库，剩下的留着下次分配
+    while (cache->count >= 2 * batchSize_)
+    {
+        slot_pointer_ first = cache->head;
+        slot_pointer_ last = first;
+        for (size_t i = 1; i < batchSize_; ++i)
+        {
+            last = last->link.next;
+        }
+        cache->head = last->link.next;
+        cache->count -= batchSize_;
+
+        last->link.next = nullptr;
+        first->link.count = batchSize_;
+        pushBatch_(first);
+    }
+}
+
+// 调用对象构造函数，使用 std::forward 转发变参模板
+template <typename T, size_t BlockSize>
+template <typename U, typename... Args>
+void MemoryPool<T, BlockSize>::construct(U *p, Args &&...args)
+{
+    new (p) U(std::forward<Args>(args)...);
+}
+
+// 调用对象析构函数
+template <typename T, size_t BlockSize>
+template <typename U>
+void MemoryPool<T, BlockSize>::destroy(U *p)
+{
+    p->~U();
+}
+
+// 把仓库中对象槽全部空闲的区块还给系统，返回释放的区块数
+template <typename T, size_t BlockSize>
+size_t MemoryPool<T, BlockSize>::trim()
+{
+    flushCache_(getCache_());
+
+    pthread_mutex_lock(&blockMutex_);
+
+    // 把仓库整个取下来，之后其他线程还回来的批次不受影响
+    uint64_t old = depot_.load();
+    while (!depot_.compare_exchange_weak(old, ((old >> 48) + 1) << 48))
+    {
+    }
+    slot_pointer_ batches = reinterpret_cast<slot_pointer_>(old & 0xffffffffffffULL);
+
+    // 等取下来之前就开始读仓库的线程都读完
+    while (depotReaders_.load() != 0)
+    {
+        sched_yield();
+    }
+
+    // 统计每个区块在仓库中的空闲对象槽
+    for (slot_pointer_ b = batches; b != nullptr; b = b->link.nextBatch)
+    {
+        for (slot_pointer_ s = b; s != nullptr; s = s->link.next)
+        {
+            ++blockOf_(s)->freeCount;
+        }
+    }
+
+    // 不在要释放的区块中的对象槽重新成批放回仓库
+    std::vector<slot_pointer_> keep;
+    for (slot_pointer_ b = batches; b != nullptr;)
+    {
+        slot_pointer_ nextBatch = b->link.nextBatch;
+        for (slot_pointer_ s = b; s != nullptr;)
+        {
+            slot_pointer_ next = s->link.next;
+            Block_ *block = blockOf_(s);
+            if (block == currentBlock_ || block->freeCount != block->carved)
+            {
+                keep.push_back(s);
+            }
+            s = next;
+        }
+        b = nextBatch;
+    }
+    for (size_t i = 0; i < keep.size(); i += batchSize_)
+    {
+        size_t n = (keep.size() - i < batchSize_) ? keep.size() - i : batchSize_;
+        for (size_t j = 0; j < n; ++j)
+        {
+            keep[i + j]->link.next = (j + 1 < n) ? keep[i + j + 1] : nullptr;
+        }
+        keep[i]->link.count = n;
+        pushBatch_(keep[i]);
+    }
+
+    // 释放全部对象槽都空闲的区块，当前区块还要继续切，留着
+    size_t released = 0;
+    Block_ **pprev = &currentBlock_;
+    while (*pprev != nullptr)
+    {
+        Block_ *block = *pprev;
+        if (block != currentBlock_ && block->freeCount == block->carved)
+        {
+            *pprev = block->next;
+            free(block);
+            ++released;
+        }
+        else
+        {
+            block->freeCount = 0;
+            pprev = &block->next;
+        }
+    }
+
+    pthread_mutex_unlock(&blockMutex_);
+    return released;
+}
+
+#endif // MEMORY_POOL_HPP
@@ -0,0 +1,83 @@
+﻿// 本文件存放按列存储的时序数据仓库相关类的声明
+
+#ifndef __NGX_C_DOTASTORE_H__
+#define __NGX_C_DOTASTORE_H__
+
+#include <stddef.h> //NULL
+#include <pthread.h>
+
+#include <vector>
+
+// 样本类型，和 Dota_Pool.h 中的 Dota_Mat、Dota_Dat 取值相同
+#define NGX_DOTA_MAT 0
+#define NGX_DOTA_DAT 1
+
+// 可以聚合的列
+#define NGX_DOTA_COL_STEER 0
+#define NGX_DOTA_COL_SPEED 1
+
+// 默认最多保留的样本数，Mat、Dat 各自计算，超出后丢掉最旧的
+#define NGX_DOTA_MAX_SAMPLES 1000000
+
+// 一个样本，Mat 只有时间戳，steer、speed 不用
+typedef struct ngx_dota_sample_s
+{
+	int sign;
+	double time_stamp;
+	double steer;
+	double speed;
+} ngx_dota_sample_t;
+
+// 一个时间窗口的聚合结果，没有 Dat 样本时 min、max、mean、percentile 都是 0
+typedef struct ngx_dota_window_s
+{
+	double tBegin;	   // 窗口起始时间，窗口为 [tBegin, 下一个窗口的 tBegin)
+	size_t iDatCount;  // 窗口中 Dat 样本的个数
+	size_t iMatCount;  // 窗口中 Mat 样本的个数
+	double min;
+	double max;
+	double mean;
+	double percentile; // 按最近秩取的分位数
+} ngx_dota_window_t;
+
+// 按列存储 Dat、Mat 样本：time_stamp、steer、speed 各是一列连续的 double，按时间戳有序，
+// 时间范围用二分查找定位，窗口内的最小、最大、均值用 SIMD 一次处理多个值
+// 写入取写锁，查询取读锁，可以被多个线程同时使用
+class CDotaStore
+{
+public:
+	CDotaStore();
+	~CDotaStore();
+
+public:
+	// 设置 Mat、Dat 各自最多保留的样本数，0 表示不限制
+	void Init(size_t maxSamples);
+	// 加入一批样本，整批只取一次写锁；整批先按时间排好序，再和已有样本归并，时间戳早于已有样本的也能放到对应位置
+	void Append(const ngx_dota_sample_t *pSamples, size_t n);
+	// 把 [tBegin, tEnd) 等分成 iWindows 个窗口，对 iColumn 列逐个窗口聚合，permille 为千分位（0~1000）
+	// 结果写入 pOut，返回 false 表示参数不对
+	bool Aggregate(double tBegin, double tEnd, int iWindows, int iColumn, int permille, ngx_dota_window_t *pOut);
+	// 当前保存的 Dat、Mat 样本数
+	size_t DatSize();
+	size_t MatSize();
+
+private:
+	// 把按时间排好序的一批样本和已有样本归并，只挪动比这批最早的样本还晚的那一段
+	void MergeDat(const ngx_dota_sample_t *pBatch, size_t n);
+	void MergeMat(const double *pBatch, size_t n);
+	// 超出上限一定比例后，一次丢掉最旧的一批，摊下来每次写入只多搬几个数
+	void Trim();
+
+private:
+	// Dat 的三列，下标相同的是同一个样本
+	std::vector<double> m_datTime;
+	std::vector<double> m_steer;
+	std::vector<double> m_speed;
+	// Mat 只有时间戳一列
+	std::vector<double> m_matTime;
+
+	size_t m_maxSamples;	   // Mat、Dat 各自最多保留的样本数
+	pthread_rwlock_t m_rwlock; // 保护以上各列
+};
+
+#endif
@@ -3,6 +3,11 @@
 #define __NGX_LOCKMUTEX_H__
 
 #include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>		 //syscall
+#include <sys/syscall.h> //SYS_futex
+#include <linux/futex.h> //FUTEX_WAIT_PRIVATE
+#include <atomic>		 //c++11里的原子操作
 
 // 本文件存放可实现自动上锁、解锁的类，防止在程序中因未解锁导致的意外发生
 
@@ -27,4 +32,61 @@ private:
 	pthread_mutex_t *m_pMutex;
 };
 
+// 只占 4 个字节的互斥锁，给连接这种数量很多的对象每个带一把；没有竞争时加锁、解锁都只是一次原子操作，有竞争时用 futex 睡眠
+// 取值 0：没有加锁，1：加锁了没有人等，2：加锁了可能有人在等
+class CFutexMutex
+{
+public:
+	CFutexMutex() : m_state(0) {}
+
+	void Lock()
+	{
+		uint32_t c = 0;
+		if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+		{
+			return;
+		}
+		// 有竞争，标成 2 再睡，解锁的一方看到 2 才去唤醒
+		if (c != 2)
+		{
+			c = m_state.exchange(2, std::memory_order_acquire);
+		}
+		while (c != 0)
+		{
+			syscall(SYS_futex, (uint32_t *)&m_state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+			c = m_state.exchange(2, std::memory_order_acquire);
+		}
+	}
+
+	void Unlock()
+	{
+		if (m_state.exchange(0, std::memory_order_release) == 2)
+		{
+			syscall(SYS_futex, (uint32_t *)&m_state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		}
+	}
+
+private:
+	std::atomic<uint32_t> m_state;
+};
+
+// 和 CLock 一样，构造时加锁、析构时解锁，锁的是 CFutexMutex
+class CFutexLock
+{
+public:
+	CFutexLock(CFutexMutex *pMutex)
+	{
+		m_pMutex = pMutex;
+		m_pMutex->Lock();
+	}
+
+	~CFutexLock()
+	{
+		m_pMutex->Unlock();
+	}
+
+private:
+	CFutexMutex *m_pMutex;
+};
+
 #endif
@@ -3,13 +3,67 @@
 #define __NGX_MEMORY_H__
 
 #include <stddef.h> //NULL
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
 
 // 本文件声明了一个内存相关的单例类
+// 小于等于 NGX_MEM_MAX_SIZE 的内存按大小分级，从大块内存中切出来，用完不还给系统而是放回本级的空闲内存中；
+// 每个线程自己缓存一批各级的空闲内存（弹匣），取用和归还大多数时候不加锁，弹匣空了或满了才和全局仓库成批交换，
+// 收包线程申请、处理线程释放这种跨线程的用法，每一批内存只需要加一次锁
+
+// 最小的一级 64 字节，每个 2 的幂之间再均分 4 级，最大一级 64KB，比这大的直接 new
+#define NGX_MEM_MIN_SHIFT 6
+#define NGX_MEM_MAX_SHIFT 16
+#define NGX_MEM_MAX_SIZE (1 << NGX_MEM_MAX_SHIFT)
+#define NGX_MEM_CLASS_COUNT ((NGX_MEM_MAX_SHIFT - NGX_MEM_MIN_SHIFT) * 4 + 1)
+// 大块内存不够时一次向系统申请的最小字节数
+#define NGX_MEM_SLAB_SIZE (256 * 1024)
+// 每个线程每一级最多缓存多少字节，决定弹匣的容量
+#define NGX_MEM_CACHE_BYTES (256 * 1024)
+// 弹匣容量的上下限
+#define NGX_MEM_CACHE_MIN 8
+#define NGX_MEM_CACHE_MAX 256
+
+// 大页的大小，arena 按它对齐，透明大页才能整页映射
+#define NGX_MEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// arena 使用大页的方式：不用、透明大页、先试 MAP_HUGETLB 预留的大页（失败再退到透明大页）
+#define NGX_MEM_HUGE_NONE 0
+#define NGX_MEM_HUGE_THP 1
+#define NGX_MEM_HUGE_TLB 2
+// arena 预先缺页的方式：不预先缺页、启动时逐页写一遍、再 mlock 锁在内存中
+#define NGX_MEM_PREFAULT_NONE 0
+#define NGX_MEM_PREFAULT_TOUCH 1
+#define NGX_MEM_PREFAULT_LOCK 2
+
+// 每块内存前面的头部，返回给调用者的内存紧跟在后面，16 字节对齐
+typedef struct ngx_mem_block_s
+{
+	// 空闲时串成单向链表
+	struct ngx_mem_block_s *next;
+	// 所属级别，NGX_MEM_CLASS_COUNT 表示不分级、直接 new 出来的内存
+	uint32_t cls;
+	// 固定值，释放时检查，发现传进来的不是本类分配的内存
+	uint32_t magic;
+} ngx_mem_block_t;
+
+// 一级内存的全局仓库，存放各线程还回来的、和新切出来的成批空闲内存
+typedef struct ngx_mem_depot_s
+{
+	// 本级每块内存的大小，含头部
+	uint32_t size;
+	// 每批多少块，是线程弹匣容量的一半
+	int batch;
+	pthread_mutex_t mutex;
+	// 每批用 next 串好，这里只存每批的第一块，每批正好 batch 块
+	std::vector<ngx_mem_block_t *> batches;
+} ngx_mem_depot_t;
 
 class CMemory
 {
 private:
-	CMemory() {}
+	CMemory();
 
 public:
 	~CMemory(){};
@@ -55,6 +109,34 @@ public:
 	void *AllocMemory(int memCount, bool ifmemset);
 	// 释放申请得到的内存
 	void FreeMemory(void *point);
+
+	// 以下供线程缓存使用
+	// 根据大小（含头部）算出级别
+	static int SizeToClass(size_t size);
+	// 从仓库取一批空闲内存，没有就切一块新的大块内存，返回这一批的第一块
+	ngx_mem_block_t *PopBatch(int cls);
+	// 把用 next 串好的一批（正好 batch 块）空闲内存放回仓库
+	void PushBatch(int cls, ngx_mem_block_t *pHead);
+	// 每一级的仓库
+	ngx_mem_depot_t m_depot[NGX_MEM_CLASS_COUNT];
+
+public:
+	// 映射一块 arena 内存，按要求使用大页、预先缺页，大页不可用时退回普通页；返回内存首地址，失败返回 NULL
+	static void *MapArena(size_t size, int hugePages, int prefault, size_t *pMapSize);
+	// 释放 MapArena() 得到的内存，mapSize 是 MapArena() 给出的映射大小
+	static void UnmapArena(void *p, size_t mapSize);
+	// 在 worker 进程启动时调用，预留一块 arena，之后各级新切的大块内存都从这里出，用完再向系统申请
+	bool InitArena(size_t size, int hugePages, int prefault);
+
+private:
+	// 申请一块用来切分的大块内存，优先从 arena 中取
+	char *AllocSlab(size_t size);
+
+	// 预留的 arena
+	char *m_arena;
+	size_t m_arenaSize;
+	// arena 中已经切出去的字节数
+	std::atomic<size_t> m_arenaUsed;
 };
 
 #endif
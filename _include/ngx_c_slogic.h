@@ -5,6 +5,7 @@
 
 #include <sys/socket.h>
 #include "ngx_c_socket.h"
+#include "ngx_c_dotastore.h"
 
 // 处理逻辑和通讯的子类
 class CLogicSocket : public CSocekt // 继承自父类CScoekt
@@ -25,13 +26,24 @@ public:
 	bool _HandleRegister(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength);
 	bool _HandleLogIn(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength);
 	bool _HandlePing(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength);
+	// 上传样本、查询样本的聚合结果
+	bool _HandleDotaPush(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength);
+	bool _HandleDotaQuery(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength);
 
-	// 心跳包检测时间到，该去检测心跳包是否超时的事宜，本函数只是把内存释放，子类应该重新事先该函数以实现具体的判断动作
-	virtual void procPingTimeOutChecking(LPSTRUC_MSG_HEADER tmpmsg, time_t cur_time);
+	// 心跳包检测时间到，该去检测心跳包是否超时的事宜
+	virtual void procPingTimeOutChecking(lpngx_connection_t pConn, uint64_t iCurrsequence, time_t cur_time);
 
 public:
 	// 处理收到完整消息函数
 	virtual void threadRecvProcFunc(char *pMsgBuf);
+
+private:
+	// 处理消息中的一个完整数据包
+	void threadRecvProcPkg(LPSTRUC_MSG_HEADER pMsgHeader, char *pPkg);
+
+private:
+	// 客户端上传的 Mat、Dat 样本，按列存储，每个 worker 进程一份
+	CDotaStore m_dotaStore;
 };
 
 #endif
@@ -6,12 +6,21 @@
 #include <list>		   //list
 #include <sys/epoll.h> //epoll
 #include <sys/socket.h>
+#include <sys/uio.h>   //readv
+#include <netinet/in.h> //sockaddr_in
+#include <sys/un.h>     //sockaddr_un
 #include <pthread.h>   //多线程
 #include <semaphore.h> //信号量
 #include <atomic>	   //c++11里的原子操作
-#include <map>		   //multimap
+#include <functional>  //std::function
+#include <unordered_map>
+#include <linux/io_uring.h> //io_uring
 
 #include "ngx_comm.h"
+#include "ngx_shm_ring.h"
+#include "ngx_c_timerwheel.h"
+#include "ngx_c_lockmutex.h"
+#include "MemoryPool.h"
 
 // 本文件使用的一些宏定义
 
@@ -19,6 +28,18 @@
 #define NGX_LISTEN_BACKLOG 511
 // epoll_wait 单次接收的最大事件个数
 #define NGX_MAX_EVENTS 512
+// io_uring 提交队列的大小，完成队列是它的 4 倍
+#define NGX_URING_ENTRIES 1024
+// recvmmsg()/sendmmsg() 一次最多收发的数据报个数
+#define NGX_UDP_BATCH 64
+// 一个 UDP 数据报最多多少字节，和 TCP 上的包一样不能超过最大包长
+#define NGX_UDP_DGRAM_MAX (_PKG_MAX_LENGTH - 1000)
+// 连接池扩容时一次增加的连接数，也是按编号找连接时一块的大小，必须是 2 的幂
+#define NGX_CONN_SLAB_SIZE 1024
+// 连接池最多有多少块，总连接数上限为 NGX_CONN_SLAB_SIZE * NGX_CONN_SLAB_MAX
+#define NGX_CONN_SLAB_MAX 4096
+// 每个线程缓存的空闲连接数上限，满了把一半还给全局空闲链表，空了从全局空闲链表取一半
+#define NGX_CONN_CACHE_SIZE 32
 
 // 结构体声明
 
@@ -26,6 +47,10 @@
 typedef struct ngx_listening_s ngx_listening_t, *lpngx_listening_t;
 // TCP 连接结构体
 typedef struct ngx_connection_s ngx_connection_t, *lpngx_connection_t;
+// TCP 连接中不常用的部分
+typedef struct ngx_connection_cold_s ngx_connection_cold_t, *lpngx_connection_cold_t;
+// 共享内存通道结构体
+typedef struct ngx_shm_channel_s ngx_shm_channel_t, *lpngx_shm_channel_t;
 // socket 相关类
 typedef class CSocekt CSocekt;
 
@@ -37,12 +62,73 @@ typedef void (CSocekt::*ngx_event_handler_pt)(lpngx_connection_t c);
 // 监听端口相关的结构体
 struct ngx_listening_s
 {
-	// 监听的端口号
+	// 监听的端口号，AF_UNIX 监听套接字为 0
 	int port;
+	// AF_UNIX 监听套接字的路径，TCP 监听套接字为空串
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
 	// 套接字句柄 socket
 	int fd;
 	// 连接池中的一个连接的指针
 	lpngx_connection_t connection;
+	// 是否因为 accept 压力过大暂停了接受新连接，1：是，0：否
+	int paused;
+	// 是否是共享内存通道的握手监听套接字，1：是，0：否
+	int shm;
+};
+
+// 一个共享内存通道，客户端通过 AF_UNIX 连接把共享内存和两个 eventfd 交给服务器，
+// 之后数据都走共享内存中的两个环，AF_UNIX 连接只用来发现客户端断开
+struct ngx_shm_channel_s
+{
+	// 映射进来的共享内存
+	ngx_shm_area_t *area;
+	size_t areaSize;
+	// 握手时检查过的环大小，共享内存中的 ringSize 客户端随时能改，不能再用
+	uint32_t ringSize;
+	// 处理线程写应答时发现环的读位置被写坏了，1：是，0：否；处理线程不能关通道，由 epoll 线程下次进 ngx_shm_recv_handler() 时关闭
+	std::atomic<int> iBroken;
+	// 服务器写完应答后用来唤醒客户端的 eventfd
+	int notifyFd;
+	// 握手用的 AF_UNIX 连接
+	lpngx_connection_t pSockConn;
+	// 客户端 eventfd 对应的连接，收到的消息都挂在它上边
+	lpngx_connection_t pEventConn;
+};
+
+// 以零拷贝方式发送过、要等内核报告发送完成才能释放的内存
+typedef struct _STRUC_ZC_PENDING
+{
+	// 对应那次零拷贝发送的序号，内核按这个序号报告完成
+	uint32_t id;
+	// 内核是否已经报告这次发送完成，1：是，0：否
+	int done;
+	// 待释放的内存，消息头+包头+包体，可以为 NULL，只用来占住这个序号
+	char *pMemPointer;
+} STRUC_ZC_PENDING, *LPSTRUC_ZC_PENDING;
+
+// TCP 连接中收发数据时用不到的部分：对端地址、flood 统计、零拷贝发送的记录
+// 和连接分开放在另一块连续内存里，收发数据时连接本身占的缓存行更少
+struct ngx_connection_cold_s
+{
+	ngx_connection_cold_s();
+	~ngx_connection_cold_s();
+
+	// 保存 TCP 连接的对方的套接字信息
+	struct sockaddr s_sockaddr;
+	// s_sockaddr 中有效内容的长度，AF_UNIX 的对端地址可能只有地址族，也可能被截断
+	socklen_t s_socklen;
+
+	// Flood 攻击上次收到包的时间
+	uint64_t FloodkickLastTime;
+	// Flood 攻击在该时间内收到包的次数统计
+	int FloodAttackCount;
+
+	// 下一次零拷贝发送的序号，和内核中的计数保持一致
+	uint32_t izcNextId;
+	// 按发送顺序排列的、等待内核报告完成的内存，只从头部按顺序释放
+	std::list<STRUC_ZC_PENDING> zcPendingList;
+	// 保护 izcNextId、zcPendingList
+	pthread_mutex_t zcMutex;
 };
 
 // 表示一个 TCP 连接的结构体（客户端主动发起的、服务器被动接受的TCP连接）
@@ -50,89 +136,106 @@ struct ngx_connection_s
 {
 	// 构造函数
 	ngx_connection_s();
-	// 析构函数
-	virtual ~ngx_connection_s(); // 析构函数
+	// 析构函数，没有派生类，不需要是虚函数，省下虚表指针
+	~ngx_connection_s();
 	// 分配一个连接时进行初始化
 	void GetOneToUse();
 	// 回收一个连接时处理
 	void PutOneToFree();
 
+	// 成员按使用频率排列：收包时用到的放在最前面，尽量落在同一个缓存行里；
+	// 对端地址、flood 统计、零拷贝记录等不常用的放在 cold 指向的另一块内存中
+
 	// 套接字句柄
 	int fd;
-	// 当连接被分配给一个监听套接字时，指向对应的监听套接字的内存
-	lpngx_listening_t listening;
-
-	// 【位域】失效标志位：0：有效，1：失效 【这个是官方nginx提供，到底有什么用，ngx_epoll_process_events()中详解】
-	// unsigned instance : 1;
-
+	// epoll 事件相关
+	uint32_t events;
 	// 引入的一个序号，每次分配出去时 +1，可在一定程度上检测错包废包，具体使用方式后续展开
 	uint64_t iCurrsequence;
-	// 保存 TCP 连接的对方的套接字信息
-	struct sockaddr s_sockaddr;
-	// 保存 ip 地址的文本信息，F
-	// char addr_text[100];
 
-	// 和读有关的标志-----------------------
-	// 保存读相关的标志
-	// uint8_t                   r_ready;        //读准备好标记
-	// uint8_t                   w_ready;        //写准备好标记
+	// 【位域】失效标志位：0：有效，1：失效 【这个是官方nginx提供，到底有什么用，ngx_epoll_process_events()中详解】
+	// unsigned instance : 1;
 
 	// 读事件的处理方法
 	ngx_event_handler_pt rhandler;
 	// 写事件的处理方法
 	ngx_event_handler_pt whandler;
 
-	// epoll 事件相关
-	uint32_t events;
-
 	// 收包相关变量
 
+	// 收包缓冲区，前面留出消息头的位置，后面是收到的原始数据，完整的包在原地拆出来交给线程池；
+	// 有数据到来时才分配，C1M 模式下缓冲区中没有残留数据时就释放
+	char *precvChunk;
+	// 收包缓冲区中已有数据的长度，不含消息头
+	unsigned int irecvChunkLen;
 	// 当前收包状态
 	unsigned char curStat;
-	// 保存数据包头信息
-	char dataHeadInfo[_DATA_BUFSIZE_];
-	// 接收数据的缓冲区的指针，用于暂存未收全的包
-	char *precvbuf;
-	// 收到数据的大小，和 precvbuf 配合使用
+	// 大包还需接收的长度，和 precvbuf 配合使用
 	unsigned int irecvlen;
-	// 用于收包的内存首地址
+	// 大包剩余部分的接收位置
+	char *precvbuf;
+	// 正在接收的大包（装不进收包缓冲区）的内存首地址，其余情况为 NULL
 	char *precvMemPointer;
 
-	// 逻辑处理相关的互斥量，处理本链接发送的信息时需要互斥
-	pthread_mutex_t logicPorcMutex;
-
 	// 发包相关变量
 
 	// 标记缓冲区满的变量
 	std::atomic<int> iThrowsendCount;
+	// ET 模式下 epoll 线程收到、但还没有被发送流程消费的可写边沿，1：有，0：无
+	std::atomic<int> iWriteEdge;
+	// io_uring 模式下，是否需要等待可写通知，相当于 LT 模式下 epoll 中有没有 EPOLLOUT，1：要，0：不要
+	std::atomic<int> iUringWantWrite;
+	// io_uring 模式下，是否已经有一个等待可写的 poll 请求提交给了内核还没完成，1：有，0：无
+	std::atomic<int> iUringPollOut;
 	// 整个数据的头指针，指向 消息头 + 包头 + 包体，用于发送完成后释放内存
 	char *psendMemPointer;
 	// 发送数据的缓冲区的头指针，开始指向 包头+包体
 	char *psendbuf;
 	// 发送数据的大小
 	unsigned int isendlen;
-
-	// 回收相关变量
-
-	// 入到资源回收站中的时间
-	time_t inRecyTime;
+	// 发送队列中有的数据条目数，若 client 只发不收，则可能造成此数过大，依据此数做出踢出处理
+	std::atomic<int> iSendCount;
+	// 本连接的发送队列，消息通过消息头中的 pNext 串成单向链表，先进先出
+	char *psendQueueHead;
+	char *psendQueueTail;
+	// 处理本连接的业务逻辑时要持有的锁，只占 4 个字节，不同连接之间互不影响
+	CFutexMutex logicMutex;
+	// 是否已经在发送就绪连接列表中，1：在，0：不在
+	int ifSendReady;
+	// 本连接的 socket 是否开启了 SO_ZEROCOPY，1：是，0：否，开启后发送完的内存都要经过 cold->zcPendingList 释放
+	int ifZeroCopy;
+	// 发送队列相关的互斥量，保护 psendQueueHead、psendQueueTail、ifSendReady，以及 iThrowsendCount 的变化
+	pthread_mutex_t sendMutex;
 
 	// 心跳包相关变量
 
 	// 上次 ping 的时间（上次发送心跳包的事件）
 	time_t lastPingTime;
+	// 踢人时钟在时间轮中的节点，由 m_timequeueMutex 保护
+	ngx_timer_node_t timerNode;
 
-	// 网络安全相关变量
+	// 回收相关变量
 
-	// Flood 攻击上次收到包的时间
-	uint64_t FloodkickLastTime;
-	// Flood 攻击在该时间内收到包的次数统计
-	int FloodAttackCount;
-	// 发送队列中有的数据条目数，若 client 只发不收，则可能造成此数过大，依据此数做出踢出处理
-	std::atomic<int> iSendCount;
+	// 入到资源回收站中的时间，单位毫秒，和 ngx_timer_now_ms() 同一个时钟
+	uint64_t inRecyTime;
+	// 回收队列中的下一个连接，回收队列按入队时间先后串成单向链表
+	lpngx_connection_t recyNext;
+	// 是否已经在回收队列中，1：在，0：不在，由 m_recyconnqueueMutex 保护
+	int ifInRecy;
 
-	// 指向下一个本类型对象的指针，可将空闲的连接池中的对象相连，构成一个单向链表，方便取用
-	lpngx_connection_t next;
+	// 连接池相关变量
+
+	// 在连接池中的编号，从 0 开始，创建后不变
+	uint32_t iPoolIndex;
+	// 空闲时，空闲链表中下一个连接的编号 +1，0 表示没有；别的线程可能同时读到，所以是原子的
+	std::atomic<uint32_t> iFreeNext;
+	// 不常用的部分，和连接一起创建，一一对应
+	lpngx_connection_cold_t cold;
+
+	// 当连接被分配给一个监听套接字时，指向对应的监听套接字的内存
+	lpngx_listening_t listening;
+	// 共享内存通道，只有共享内存通道的两个连接不为 NULL，由 pEventConn 回收时释放
+	lpngx_shm_channel_t shm;
 };
 
 // 消息头结构体，额外记录收到数据包时的一些信息以备将来使用
@@ -143,9 +246,35 @@ typedef struct _STRUC_MSG_HEADER
 
 	// 收到数据包时，记录对应连接的序号，可用于将来比较连接是否废用
 	uint64_t iCurrsequence;
+	// 消息头后面连续存放的完整数据包个数，收包时一次拆出多个包就一起交给线程池
+	unsigned int iPkgCount;
+	// 待发送消息在连接的发送队列中时，指向下一条待发送消息
+	char *pNext;
+	// UDP 消息的对端地址，处理函数拷贝消息头组应答时一起带过去，应答按这个地址发回
+	struct sockaddr_in udpAddr;
 
 } STRUC_MSG_HEADER, *LPSTRUC_MSG_HEADER;
 
+// 到期的踢人时钟，从时间轮中取出时记下连接的序号，交给 procPingTimeOutChecking() 判断连接是否还是原来那个
+typedef struct _STRUC_TIMER_EXPIRED
+{
+	lpngx_connection_t pConn;
+	uint64_t iCurrsequence;
+} STRUC_TIMER_EXPIRED, *LPSTRUC_TIMER_EXPIRED;
+
+// 定时任务，节点挂在 m_schedWheel 中，到期时把 fn 交给线程池执行
+typedef struct _STRUC_SCHED_TASK
+{
+	// 时间轮节点，data 指向本结构
+	ngx_timer_node_t node;
+	// 任务号，取消任务时用
+	uint64_t id;
+	// 周期任务的间隔，单位毫秒，0 表示只执行一次
+	uint64_t interval;
+	// 任务本身
+	std::function<void()> fn;
+} STRUC_SCHED_TASK, *LPSTRUC_SCHED_TASK;
+
 // socket 类
 class CSocekt
 {
@@ -167,8 +296,18 @@ public:
 public:
 	// 处理客户端请求函数
 	virtual void threadRecvProcFunc(char *pMsgBuf);
-	// 心跳包检测时间到，检测心跳包是否超时等事宜，本函数仅释放内存，子类应实现该函数的具体判断操作
-	virtual void procPingTimeOutChecking(LPSTRUC_MSG_HEADER tmpmsg, time_t cur_time);
+	// 心跳包检测时间到，检测心跳包是否超时等事宜，本函数什么也不做，子类应实现该函数的具体判断操作
+	// iCurrsequence 是时钟到期时连接的序号，和连接当前的序号不一致说明连接已经断开
+	virtual void procPingTimeOutChecking(lpngx_connection_t pConn, uint64_t iCurrsequence, time_t cur_time);
+
+public:
+	// 定时任务，可以在任何线程中调用，到期后在线程池中执行；只能在 worker 进程的 ngx_epoll_init() 之后使用
+	// delay 毫秒后执行一次 fn，返回任务号，失败返回 0
+	uint64_t ScheduleAfter(uint64_t delay, const std::function<void()> &fn);
+	// 每隔 interval 毫秒执行一次 fn，第一次在 interval 毫秒后，返回任务号，失败返回 0
+	uint64_t ScheduleEvery(uint64_t interval, const std::function<void()> &fn);
+	// 取消定时任务，任务还在等待时返回 true；已经交给线程池的那一次仍会执行
+	bool CancelSchedule(uint64_t id);
 
 public:
 	// epoll功能初始化
@@ -183,9 +322,31 @@ public:
 	// epoll操作事件
 	int ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag, int bcaction, lpngx_connection_t pConn);
 
+private:
+	// io_uring 事件驱动，Sock_UseIoUring = 1 时代替 epoll，接口和上边三个函数一致
+	bool ngx_uring_init();
+	int ngx_uring_process_events(int timer);
+	int ngx_uring_oper_event(int fd, uint32_t eventtype, uint32_t flag, int bcaction, lpngx_connection_t pConn);
+	void ngx_uring_close();
+	// 取一个空闲的 sqe，调用者持有 m_uringMutex
+	struct io_uring_sqe *ngx_uring_get_sqe();
+	// 把填好的 sqe 放进提交队列，调用者持有 m_uringMutex
+	void ngx_uring_commit_sqe();
+	// 把已经填好的 sqe 提交给内核，调用者持有 m_uringMutex
+	void ngx_uring_submit();
+	// 为连接提交一个请求，种类见 ngx_c_socket_uring.cxx 中的 NGX_URING_xxx
+	void ngx_uring_prep(lpngx_connection_t pConn, int type);
+	// 处理一个完成事件
+	void ngx_uring_handle_cqe(struct io_uring_cqe *cqe);
+	// 把 io_uring 收到的数据交给收包流程
+	void ngx_uring_recv_data(lpngx_connection_t pConn, char *pData, size_t len);
+
 protected:
 	// 数据发送相关
 	void msgSend(char *psendbuf);					   // 把数据扔到待发送对列中
+	void msgSendDirect(lpngx_connection_t pConn, char *psendbuf); // 连接空闲时在当前线程直接发送
+	void msgSendUdp(lpngx_connection_t pConn, char *psendbuf);	  // UDP 应答入队，没有线程在发时由当前线程用 sendmmsg() 发出
+	void msgSendShm(lpngx_connection_t pConn, char *psendbuf);	  // 共享内存通道的应答直接写进环里
 	void zdClosesocketProc(lpngx_connection_t p_Conn); // 主动关闭一个连接时的要做些善后的处理函数
 
 private:
@@ -193,51 +354,107 @@ private:
 	void ReadConf();
 	// 监听必须的端口【支持多个端口】
 	bool ngx_open_listening_sockets();
+	// 打开 AF_UNIX 监听套接字，一个路径只能 bind() 一次，所以总是在 master 进程中打开，各 worker 共享
+	bool ngx_open_unix_listening_sockets();
+	bool ngx_open_unix_listening_socket(const char *ppath, int shm);
 	// 关闭监听套接字
 	void ngx_close_listening_sockets();
+	// 关闭并释放已经打开的 TCP、UDP 监听套接字，不写日志
+	void ngx_drop_listening_sockets();
 	// 设置非阻塞套接字
 	bool setnonblocking(int sockfd);
+	// 发送缓冲区满时，把剩余数据的发送移交给 epoll 驱动
+	int ngx_epoll_arm_write(lpngx_connection_t pConn);
 
 	// 一些业务处理函数handler
 
 	// 建立新连接
 	void ngx_event_accept(lpngx_connection_t oldc);
+	// accept 成功后的处理，为新的 socket 分配连接、加入事件驱动
+	void ngx_event_accept_proc(lpngx_connection_t oldc, int s, struct sockaddr *psockaddr, socklen_t socklen);
+	// 句柄用尽时，借备用句柄接进一个连接再关掉，然后暂停 accept
+	void ngx_accept_overload(lpngx_connection_t oldc);
+	// 暂停/恢复所有监听套接字上的 accept
+	void ngx_accept_pause();
+	void ngx_accept_resume();
 	// 设置数据来时的读处理函数
 	void ngx_read_request_handler(lpngx_connection_t pConn);
+	// UDP 套接字可读时的处理函数，用 recvmmsg() 批量收数据报
+	void ngx_udp_recv_handler(lpngx_connection_t pConn);
+	// 检查一个数据报中的包，合法就作为一条消息交给线程池
+	void ngx_udp_recv_proc(lpngx_connection_t pConn, char *pData, size_t len, struct sockaddr_in *paddr);
+	// 把 UDP 套接字发送队列中的应答全部用 sendmmsg() 发出去
+	void ngx_udp_flush(lpngx_connection_t pConn);
+	// 共享内存通道握手连接的读处理函数，第一次收到的是共享内存和 eventfd，之后只用来发现客户端断开
+	void ngx_shm_sock_handler(lpngx_connection_t pConn);
+	// 共享内存通道的握手
+	bool ngx_shm_attach(lpngx_connection_t pConn);
+	// 客户端写 eventfd 通知有数据时的处理函数，把环中的完整包交给线程池
+	void ngx_shm_recv_handler(lpngx_connection_t pConn);
+	// 关闭一个共享内存通道的两个连接
+	void ngx_shm_close(lpngx_shm_channel_t pChannel);
 	// 设置数据发送时的写处理函数
 	void ngx_write_request_handler(lpngx_connection_t pConn);
+	// eventfd 可读时的处理函数，由 epoll 线程发送数据
+	void ngx_send_event_handler(lpngx_connection_t pConn);
+	// 发送所有就绪连接中的数据
+	void ngx_flush_send_ready();
+	// timerfd 可读时的处理函数，处理到期的定时任务和踢人时钟
+	void ngx_timerfd_handler(lpngx_connection_t pConn);
+	// 需要的话把 timerfd 提前到 expire 时刻
+	void ngx_timerfd_arm(uint64_t expire);
 	// 通用连接关闭函数，资源用这个函数释放【因为这里涉及到好几个要释放的资源，所以写成函数】
 	void ngx_close_connection(lpngx_connection_t pConn);
 
 	// 接收从客户端来的数据专用函数
-	ssize_t recvproc(lpngx_connection_t pConn, char *buff, ssize_t buflen);
-	// 包头收完整后的处理，我们称为包处理阶段1：写成函数，方便复用
+	ssize_t recvproc(lpngx_connection_t pConn, struct iovec *iov, int iovcnt);
+	// 从收包缓冲区中拆出所有完整的包，我们称为包处理阶段1：写成函数，方便复用
 	void ngx_wait_request_handler_proc_p1(lpngx_connection_t pConn, bool &isflood);
-	// 收到一个完整包后的处理，放到一个函数中，方便调用
+	// 把收包缓冲区前面的若干个完整包作为一条消息交给线程池
+	void ngx_wait_request_handler_proc_batch(lpngx_connection_t pConn, size_t iDataLen, unsigned int iPkgCount);
+	// 大包收完整后的处理，放到一个函数中，方便调用
 	void ngx_wait_request_handler_proc_plast(lpngx_connection_t pConn, bool &isflood);
 
 	// 处理发送消息队列
 	void clearMsgSendQueue();
+	// 清空一个连接的发送队列
+	void clearConnSendQueue(lpngx_connection_t pConn);
+	// 把有数据待发送的连接放进发送就绪列表，并唤醒发送线程
+	void inSendReadyList(lpngx_connection_t pConn);
 
 	ssize_t sendproc(lpngx_connection_t c, char *buff, ssize_t size); // 将数据发送到客户端
+	ssize_t sendprocv(lpngx_connection_t c, struct iovec *iov, int iovcnt); // 将多段数据用一次系统调用发送到客户端
+	void sendMemFree(lpngx_connection_t pConn, char *pMemPointer);			// 释放已经发送完的消息，零拷贝发送的要等内核报告完成
+	void ngx_zerocopy_sent(lpngx_connection_t pConn);						// 登记一次成功的零拷贝发送
+	int ngx_zerocopy_reap(lpngx_connection_t pConn);						// 收取内核的零拷贝发送完成通知，释放对应的内存
 
 	// 获取对端信息相关
-	size_t ngx_sock_ntop(struct sockaddr *sa, int port, u_char *text, size_t len); // 根据参数1给定的信息，获取地址端口字符串，返回这个字符串的长度
+	size_t ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, int port, u_char *text, size_t len); // 根据参数1给定的信息，获取地址端口字符串，返回这个字符串的长度
 
 	// 连接池 或 连接 相关
 	void initconnection();								// 初始化连接池
 	void clearconnection();								// 回收连接池
 	lpngx_connection_t ngx_get_connection(int isock);	// 从连接池中获取一个空闲连接
 	void ngx_free_connection(lpngx_connection_t pConn); // 归还参数pConn所代表的连接到到连接池中
+	bool ngx_grow_connection(int n);					// 连接池扩容 n 个连接，n 是 NGX_CONN_SLAB_SIZE 的倍数
+	void *ngx_alloc_connection_block(size_t size);		// 为连接池申请一块清零的内存，arena 模式下用大页、预先缺页
+	void ngx_free_connection_block(const std::pair<void *, size_t> &block); // 释放连接池的一块内存
+	lpngx_connection_t ngx_conn_by_index(uint32_t index) // 根据编号找到连接
+	{
+		return (lpngx_connection_t)(m_connSlabs[index / NGX_CONN_SLAB_SIZE] + (size_t)(index % NGX_CONN_SLAB_SIZE) * m_connStride);
+	}
+	lpngx_connection_t ngx_pop_free_connection();						  // 从全局无锁空闲链表取一个连接
+	void ngx_push_free_connection(lpngx_connection_t pHead, lpngx_connection_t pTail); // 把串好的一串连接放回全局无锁空闲链表
+	void ngx_flush_conn_cache();													  // 把本线程缓存的空闲连接全部放回全局无锁空闲链表
 	void inRecyConnectQueue(lpngx_connection_t pConn);	// 将要回收的连接放到一个队列中来
 
 	// 和时间相关的函数
-	void AddToTimerQueue(lpngx_connection_t pConn);		  // 设置踢出时钟(向map表中增加内容)
-	time_t GetEarliestTime();							  // 从multimap中取得最早的时间返回去
-	LPSTRUC_MSG_HEADER RemoveFirstTimer();				  // 从m_timeQueuemap移除最早的时间，并把最早这个时间所在的项的值所对应的指针 返回，调用者负责互斥，所以本函数不用互斥，
-	LPSTRUC_MSG_HEADER GetOverTimeTimer(time_t cur_time); // 根据给的当前时间，从m_timeQueuemap找到比这个时间更老（更早）的节点【1个】返回去，这些节点都是时间超过了，要处理的节点
-	void DeleteFromTimerQueue(lpngx_connection_t pConn);  // 把指定用户tcp连接从timer表中抠出去
-	void clearAllFromTimerQueue();						  // 清理时间队列中所有内容
+	void AddToTimerQueue(lpngx_connection_t pConn);		  // 设置踢出时钟(把连接的节点加入时间轮)
+	void GetOverTimeTimer(uint64_t cur_msec, std::vector<STRUC_TIMER_EXPIRED> &expired); // 根据给的当前时间，把时间轮中所有到期的连接取出来，不踢人的还要重新加入，调用者负责互斥
+	void DeleteFromTimerQueue(lpngx_connection_t pConn);  // 把指定用户tcp连接从时间轮中抠出去
+	void clearAllFromTimerQueue();						  // 清理时间轮中所有内容
+	uint64_t ScheduleTask(uint64_t delay, uint64_t interval, const std::function<void()> &fn); // 加入一个定时任务
+	void clearAllSchedule();							  // 清理全部定时任务
 
 	// 和网络安全有关
 	bool TestFlood(lpngx_connection_t pConn); // 测试是否flood攻击成立，成立则返回true，否则返回false
@@ -245,7 +462,6 @@ private:
 	// 线程相关函数
 	static void *ServerSendQueueThread(void *threadData);		  // 专门用来发送数据的线程
 	static void *ServerRecyConnectionThread(void *threadData);	  // 专门用来回收连接的线程
-	static void *ServerTimerQueueMonitorThread(void *threadData); // 时间队列监视线程，处理到期不发心跳包的用户踢出的线程
 
 protected:
 	// 一些和网络通讯有关的成员变量
@@ -276,25 +492,95 @@ private:
 	int m_worker_connections;
 	// 所监听的端口数量
 	int m_ListenPortCount;
+	// 所监听的 AF_UNIX 路径数量
+	int m_UnixListenCount;
+	// 所监听的 UDP 端口数量
+	int m_UdpPortCount;
+	// UDP 套接字的接收缓冲区字节数，0：系统默认
+	int m_udpRcvBuf;
+	// 共享内存通道的握手路径，空串表示不开启
+	char m_shmListenPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	// 监听套接字的打开方式，0：master 进程打开，各 worker 共享，1：每个 worker 进程在 fork() 之后用 SO_REUSEPORT 各自打开，
+	// 2：master 进程打开，各 worker 共享，并以 EPOLLEXCLUSIVE 加入 epoll
+	int m_listenMode;
+	// 一次监听事件最多 accept 多少个连接
+	int m_acceptBatch;
+	// 监听套接字的 TCP_DEFER_ACCEPT 秒数，0：不设置
+	int m_deferAccept;
+	// 句柄用尽等情况下暂停 accept 的毫秒数，0：不暂停
+	int m_acceptPauseMs;
+	// 暂停 accept 到什么时候（毫秒），0：没有暂停
+	uint64_t m_acceptPauseUntil;
+	// 备用句柄，句柄用尽时关掉它腾出一个位置
+	int m_spareFd;
 	// epoll_create返回的句柄，每个进程仅有一个
 	int m_epollhandle;
+	// 客户端连接使用的 epoll 触发模式，0：水平触发（LT），1：边缘触发（ET）
+	int m_epollET;
+	// 谁来发送数据，0：独立的发送线程，1：epoll 线程
+	int m_reactorSend;
+	// 连接空闲时是否由处理线程直接发送，0：否，1：是
+	int m_directSend;
+	// 一次发送的数据不少于这么多字节时使用 MSG_ZEROCOPY 零拷贝发送，0：不使用
+	int m_zeroCopyThreshold;
+
+	// io_uring 相关
+	int m_useUring;					 // 配置是否使用 io_uring 代替 epoll，1：是，0：否
+	int m_uringFd;					 // io_uring 句柄，-1 表示没有使用 io_uring
+	pthread_t m_uringOwner;			 // 等待完成事件的线程，也就是 epoll 线程
+	pthread_mutex_t m_uringMutex;	 // 提交队列相关互斥量，处理线程、发送线程也会提交请求
+	void *m_sqRingPtr;				 // 提交队列、完成队列共用的映射内存
+	size_t m_sqRingSize;
+	struct io_uring_sqe *m_sqes;	 // sqe 数组
+	size_t m_sqesSize;
+	unsigned *m_sqHead, *m_sqTail, *m_sqMask;
+	unsigned m_sqEntries;
+	unsigned m_sqLocalTail;			 // 已经填写的 sqe 的尾部
+	unsigned m_sqToSubmit;			 // 已经填写、还没提交给内核的 sqe 个数
+	unsigned *m_cqHead, *m_cqTail, *m_cqMask;
+	struct io_uring_cqe *m_cqes;
+	struct io_uring_buf_ring *m_bufRing; // 提供给内核的收包缓冲区环，multishot recv 从中取缓冲区
+	size_t m_bufRingSize;
+	char *m_bufBase;				 // 收包缓冲区的内存，每块 m_iRecvBufSize 字节
+	int m_bufCount;					 // 收包缓冲区块数，2 的幂
+	unsigned short m_bufTail;		 // 已经还给内核的缓冲区的尾部
+	// m_reactorSend 为 1 时，用来唤醒 epoll 线程发送数据的 eventfd
+	int m_sendEventFd;
+	// eventfd 已经写过、epoll 线程还没处理，1：是，0：否
+	std::atomic<int> m_sendEventPending;
+	// 每个连接的收包缓冲区大小，不含消息头
+	int m_iRecvBufSize;
+	// C1M 模式，1：开启，0：不开启；开启后收包缓冲区中没有残留的半个包时就释放，大量空闲连接不占收包缓冲区
+	int m_c1mMode;
+	// 连接池的 arena 模式：使用大页的方式和预先缺页的方式，见 NGX_MEM_HUGE_xxx、NGX_MEM_PREFAULT_xxx，都为 0 时用 posix_memalign()
+	int m_memHugePages;
+	int m_memPrefault;
 
 	// 和连接池有关的
 
-	// 连接池，存放全部连接，每个连接代表一个封装后的 TCP 连接
-	std::list<lpngx_connection_t> m_connectionList;
-	// 空闲连接列表，存放全部空闲的连接
-	std::list<lpngx_connection_t> m_freeconnectionList;
+	// 连接池，全部连接放在若干块连续内存中，每块 NGX_CONN_SLAB_SIZE 个连接，编号为 i 的连接在第 i / NGX_CONN_SLAB_SIZE 块中
+	char **m_connSlabs;
+	// 已经有的块数
+	int m_connSlabCount;
+	// 每个连接占的字节数，按缓存行对齐，相邻连接不会共用缓存行
+	size_t m_connStride;
+	// 向系统申请的内存和 arena 模式下的映射大小，第一次申请的一大块包含好几块
+	std::vector<std::pair<void *, size_t> > m_connBlocks;
+	// 无锁空闲链表的表头，高 32 位是版本号，每次修改 +1 避免 ABA，低 32 位是栈顶连接的编号 +1，0 表示空
+	std::atomic<uint64_t> m_freeConnHead;
 	// 连接池总连接数
 	std::atomic<int> m_total_connection_n;
-	// 空闲连接数
+	// 空闲连接数，包括各线程缓存中的
 	std::atomic<int> m_free_connection_n;
-	// 连接相关互斥量，用于互斥 m_freeconnectionList，m_connectionList
+	// 连接相关互斥量，只在连接池扩容时使用，保护 m_connSlabs、m_connSlabCount、m_connBlocks
 	pthread_mutex_t m_connectionMutex;
 	// 连接回收队列相关的互斥量
 	pthread_mutex_t m_recyconnqueueMutex;
-	// 将要释放的连接放这里
-	std::list<lpngx_connection_t> m_recyconnectionList;
+	// 回收队列有新连接或者要退出时通知 ServerRecyConnectionThread()，用 CLOCK_MONOTONIC 计时
+	pthread_cond_t m_recyconnqueueCond;
+	// 将要释放的连接放这里，用连接中的 recyNext 串起来；等待时间都一样，所以先入队的总是先到期
+	lpngx_connection_t m_recyconnectionHead;
+	lpngx_connection_t m_recyconnectionTail;
 	// 待释放连接队列大小
 	std::atomic<int> m_totol_recyconnection_n;
 	// 回收连接延迟时间
@@ -305,29 +591,45 @@ private:
 
 	// 监听套接字队列，存放全部用于监听各个端口的封装后的套接字
 	std::vector<lpngx_listening_t> m_ListenSocketList;
+	// UDP 套接字队列，每个 UDP 端口一个，不参与 accept 的暂停/恢复
+	std::vector<lpngx_listening_t> m_UdpSocketList;
+	// recvmmsg() 的收包区，NGX_UDP_BATCH 块，每块能放下一个最大的包，只由 epoll 线程使用
+	char *m_udpRecvBuf;
 	// 存储 epoll_wait() 返回的事件
 	struct epoll_event m_events[NGX_MAX_EVENTS];
 
 	// 消息队列
 
-	std::list<char *> m_MsgSendQueue;	   // 发送数据消息队列
+	std::list<lpngx_connection_t> m_sendReadyList; // 发送就绪连接列表，只放发送队列非空、且没有在等 epoll 驱动发送的连接
+	std::vector<char *> m_sendMsgs;				   // 从一个连接的发送队列中摘下来的、仍然有效的消息，只由负责发送的那一个线程使用
 	std::atomic<int> m_iSendMsgQueueCount; // 发消息队列大小
 
 	// 多线程相关
 
 	// 存储封装后的线程对象
 	std::vector<ThreadItem *> m_threadVector;
-	// 发消息队列互斥量
+	// 发送就绪连接列表互斥量
 	pthread_mutex_t m_sendMessageQueueMutex;
 	// 处理发消息线程相关的信号量
 	sem_t m_semEventSendQueue;
 
 	// 时间相关
 	int m_ifkickTimeCount;									   // 是否开启踢人时钟，1：开启   0：不开启
-	pthread_mutex_t m_timequeueMutex;						   // 和时间队列有关的互斥量
-	std::multimap<time_t, LPSTRUC_MSG_HEADER> m_timerQueuemap; // 时间队列
-	size_t m_cur_size_;										   // 时间队列的尺寸
-	time_t m_timer_value_;									   // 当前计时队列头部时间值
+	pthread_mutex_t m_timequeueMutex;						   // 和时间轮有关的互斥量
+	CTimerWheel m_timerWheel;								   // 踢人时钟的时间轮，节点就是各连接的 timerNode
+	std::vector<lpngx_timer_node_t> m_timerExpired;			   // 时间轮中取出的到期节点，只在 epoll 线程中用，反复使用不再分配内存
+
+	// 定时任务相关
+	int m_timerFd;											   // 在 epoll 中的 timerfd，定在两个时间轮中最早可能到期的时刻
+	pthread_mutex_t m_timerFdMutex;							   // 保护 m_timerFdExpire
+	uint64_t m_timerFdExpire;								   // timerfd 当前定的时刻，单位毫秒，UINT64_MAX 表示没有定
+	pthread_mutex_t m_schedMutex;							   // 和定时任务有关的互斥量
+	CTimerWheel m_schedWheel;								   // 定时任务的时间轮
+	std::unordered_map<uint64_t, LPSTRUC_SCHED_TASK> m_schedTasks; // 还在等待的定时任务，按任务号查找
+	MemoryPool<STRUC_SCHED_TASK> m_schedTaskPool;				   // 定时任务的内存，任务由调用者线程加入、由 epoll 线程或取消者释放
+	uint64_t m_schedNextId;									   // 下一个任务号，从 1 开始
+	std::vector<lpngx_timer_node_t> m_schedExpired;			   // 时间轮中取出的到期任务，只在 epoll 线程中用
+	std::vector<std::function<void()> > m_schedReady;		   // 本轮要交给线程池的任务，只在 epoll 线程中用
 
 	// 在线用户相关
 
@@ -341,7 +643,25 @@ private:
 
 	// 统计用途
 	time_t m_lastprintTime;		// 上次打印统计信息的时间(10秒钟打印一次)
-	int m_iDiscardSendPkgCount; // 丢弃的发送数据包数量
+	std::atomic<int> m_iDiscardSendPkgCount; // 丢弃的发送数据包数量
+	std::atomic<int64_t> m_iAcceptCount;	 // 本进程累计接受的连接数，用来观察各 worker 之间是否均衡
+	int64_t m_iAcceptPauseCount;			 // 因为句柄用尽等原因暂停 accept 的次数
+	int64_t m_iAcceptDropCount;				 // 句柄用尽时借备用句柄接进来直接关掉的连接数
+	std::atomic<int64_t> m_iSendPkgCount;  // 已经完整发送出去的数据包数量
+	std::atomic<int64_t> m_iSendCallCount; // 发送数据所用的系统调用次数，和上面一起算出平均每次系统调用发送的包数
+	std::atomic<int64_t> m_iDirectSendCount; // 其中由处理线程直接发送、没有经过发送队列的次数
+	std::atomic<int64_t> m_iZeroCopySendCount;	 // 其中使用 MSG_ZEROCOPY 的次数
+	std::atomic<int64_t> m_iZeroCopyCopiedCount; // 零拷贝发送中内核报告实际退化为拷贝的次数
+	int64_t m_iUringEnterCount;		 // io_uring_enter() 等待完成事件的次数，只由 epoll 线程修改
+	int64_t m_iUringCqeCount;		 // 处理的完成事件个数，和上面一起算出平均每次系统调用处理的事件数
+	int64_t m_iUdpRecvCount;		 // 收到的合法 UDP 数据报个数，只由 epoll 线程修改
+	int64_t m_iUdpRecvCallCount;	 // recvmmsg() 的调用次数
+	std::atomic<int64_t> m_iUdpSendCount;	  // 发出的 UDP 数据报个数
+	std::atomic<int64_t> m_iUdpSendCallCount; // sendmmsg() 的调用次数
+	std::atomic<int64_t> m_iUdpDropCount;	  // 不合法被丢掉的、发送缓冲区满没发出去的 UDP 数据报个数
+	std::atomic<int> m_iShmChannelCount;	  // 当前的共享内存通道数
+	int64_t m_iShmPkgCount;					  // 从共享内存通道收到的包数，只由 epoll 线程修改
+	int64_t m_iShmWakeupCount;				  // 其中被 eventfd 唤醒的次数，和上面一起看出合并了多少
 };
 
 #endif
@@ -4,6 +4,8 @@
 #define __NGX_THREADPOOL_H__
 
 #include <vector>
+#include <list>
+#include <functional> //std::function
 #include <pthread.h>
 #include <atomic> //c++11里的原子操作
 
@@ -25,6 +27,8 @@ public:
 
     // 将收到的的完整消息（消息头 + 包头 + 包体）放入消息队列，并触发线程处理
     void inMsgRecvQueueAndSignal(char *buf);
+    // 将一个任务放入任务队列，并触发线程执行，定时任务到期时由 epoll 线程调用
+    void inTaskQueueAndSignal(const std::function<void()> &task);
     // 呼唤线程处理消息
     void Call();
     // 获取接收消息队列大小
@@ -33,7 +37,7 @@ public:
 private:
     // 新线程的线程回调函数
     static void *ThreadFunc(void *threadData);
-    // 清理接收消息队列
+    // 清理接收消息队列和任务队列
     void clearMsgRecvQueue();
 
     // 将一个消息出消息队列	，不需要，直接在ThreadFunc()中处理
@@ -81,6 +85,8 @@ private:
     std::list<char *> m_MsgRecvQueue;
     // 收消息队列大小
     int m_iRecvMsgQueueCount;
+    // 任务队列，和接收消息队列共用互斥量和条件变量，线程先执行任务再处理消息
+    std::list<std::function<void()> > m_TaskQueue;
 };
 
 #endif
@@ -0,0 +1,89 @@
+﻿// 本文件存放分层时间轮相关类的声明
+
+#ifndef __NGX_C_TIMERWHEEL_H__
+#define __NGX_C_TIMERWHEEL_H__
+
+#include <stddef.h> //NULL
+#include <stdint.h>
+#include <time.h>	//clock_gettime
+
+#include <vector>
+
+// 第 0 层的槽数，每个槽 1 毫秒
+#define NGX_TW_ROOT_BITS 8
+#define NGX_TW_ROOT_SIZE (1 << NGX_TW_ROOT_BITS)
+#define NGX_TW_ROOT_MASK (NGX_TW_ROOT_SIZE - 1)
+// 上面各层的槽数，每个槽的跨度是下一层一整圈
+#define NGX_TW_LEVEL_BITS 6
+#define NGX_TW_LEVEL_SIZE (1 << NGX_TW_LEVEL_BITS)
+#define NGX_TW_LEVEL_MASK (NGX_TW_LEVEL_SIZE - 1)
+// 第 0 层以上的层数，总共能表示 2^32 毫秒（约 49 天）以内的定时，更远的按最远算
+#define NGX_TW_LEVELS 4
+
+// 定时器节点，嵌在需要定时的对象里，加入、删除都不分配内存
+typedef struct ngx_timer_node_s ngx_timer_node_t, *lpngx_timer_node_t;
+
+struct ngx_timer_node_s
+{
+	// 所在槽的双向循环链表，不在时间轮中时都是 NULL
+	lpngx_timer_node_t prev;
+	lpngx_timer_node_t next;
+	// 到期时间，单位毫秒，和 ngx_timer_now_ms() 同一个时钟
+	uint64_t expire;
+	// 节点所属的对象
+	void *data;
+};
+
+// 单调时钟，单位毫秒，不受修改系统时间的影响
+inline uint64_t ngx_timer_now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 分层时间轮：第 0 层每个槽 1 毫秒，上层的槽到期时把节点重新分配到下层；加入、删除、到期都是 O(1)
+// 不是线程安全的，由调用者负责互斥
+class CTimerWheel
+{
+public:
+	CTimerWheel();
+	~CTimerWheel();
+
+public:
+	// 设置时间轮的起点，加入任何节点之前调用
+	void Init(uint64_t now);
+	// 加入一个节点，已经在时间轮中的先删掉；早于当前时间的下一毫秒到期
+	void Add(lpngx_timer_node_t node, uint64_t expire);
+	// 删除一个节点，不在时间轮中时什么也不做
+	void Del(lpngx_timer_node_t node);
+	// 节点是否在时间轮中
+	static bool IsArmed(lpngx_timer_node_t node) { return node->next != NULL; }
+	// 走到 now，把到期的节点都摘下来放进 expired
+	void Expire(uint64_t now, std::vector<lpngx_timer_node_t> &expired);
+	// 距离下一次可能有节点到期还有多少毫秒，最多 maxwait；时间轮为空时返回 maxwait
+	uint64_t NextTimeout(uint64_t now, uint64_t maxwait);
+	// 时间轮中的节点数
+	size_t Size() const { return m_size; }
+	// 删除全部节点
+	void Clear();
+
+private:
+	// 删除一个槽中的全部节点
+	void ClearSlot(lpngx_timer_node_t head);
+	// 把节点挂到对应的槽上，不检查是否已经在时间轮中
+	void Link(lpngx_timer_node_t node);
+	// 把上层一个槽中的节点全部重新分配，返回槽的下标
+	int Cascade(int level);
+
+private:
+	// 下一个要处理的毫秒
+	uint64_t m_tick;
+	// 节点数
+	size_t m_size;
+	// 各层的槽，都是双向循环链表的哨兵
+	ngx_timer_node_t m_root[NGX_TW_ROOT_SIZE];
+	ngx_timer_node_t m_levels[NGX_TW_LEVELS][NGX_TW_LEVEL_SIZE];
+};
+
+#endif
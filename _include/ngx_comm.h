@@ -17,9 +17,6 @@
 #define _PKG_BD_RECVING 3  // 正在接受包体，但包体不完整，仍需继续接收
 #define _PKG_RV_FINISHED 4 // 完整包收完，在程序中并无实际用处，可直接返回 _PKG_HD_INIT 状态
 
-// 专门存放接收到的包头的数据的数组大小，应当大于包头所占内存 > sizeof(COMM_PKG_HEADER)
-#define _DATA_BUFSIZE_ 20
-
 // 结构体定义
 
 // 修改对齐方式为一字节对齐，防止因内存对齐导致在传输过程中出现混乱
@@ -2,12 +2,25 @@
 #ifndef __NGX_LOGICCOMM_H__
 #define __NGX_LOGICCOMM_H__
 
+#include <stdint.h>
+#include <string.h>   //memcpy
+#include <endian.h>   //htobe64
+
 // 收发命令宏定义
 
 #define _CMD_START	                    0  
 #define _CMD_PING				   	    _CMD_START + 0   //ping命令【心跳包】
 #define _CMD_REGISTER 		            _CMD_START + 5   //注册
 #define _CMD_LOGIN 		                _CMD_START + 6   //登录
+#define _CMD_DOTA_PUSH 	                _CMD_START + 7   //上传一批 Mat、Dat 样本
+#define _CMD_DOTA_QUERY 	            _CMD_START + 8   //按时间窗口查询聚合结果
+
+// 一次查询最多的窗口数，应答包不超过 _PKG_MAX_LENGTH
+#define _DOTA_MAX_WINDOWS               256
+
+// 上传样本的结果码
+#define _DOTA_PUSH_OK                   0                //整批存入
+#define _DOTA_PUSH_NONFINITE            1                //有样本用到的时间戳、方向或速度是 NaN 或无穷大，整批拒收
 
 
 
@@ -33,7 +46,75 @@ typedef struct _STRUCT_LOGIN
 
 }STRUCT_LOGIN, *LPSTRUCT_LOGIN;
 
+// 样本中的 double 都按 IEEE 754 的 8 字节位模式以网络序传输，用 ngx_htond()、ngx_ntohd() 转换
+
+// 一个样本，iSign 为 0 表示 Mat（只有时间戳），为 1 表示 Dat
+typedef struct _STRUCT_DOTA_SAMPLE
+{
+	int           iSign;          //样本类型
+	uint64_t      time_stamp;     //时间戳
+	uint64_t      steer;          //引导方向
+	uint64_t      speed;          //行驶速度
+
+}STRUCT_DOTA_SAMPLE, *LPSTRUCT_DOTA_SAMPLE;
+
+// 上传样本，包体为本结构后跟 iCount 个 STRUCT_DOTA_SAMPLE，服务器回一个 _CMD_DOTA_PUSH 包，包体为 STRUCT_DOTA_PUSH_RESULT
+typedef struct _STRUCT_DOTA_PUSH
+{
+	int           iCount;         //样本个数
+
+}STRUCT_DOTA_PUSH, *LPSTRUCT_DOTA_PUSH;
+
+// 上传样本的结果
+typedef struct _STRUCT_DOTA_PUSH_RESULT
+{
+	int           iResult;        //结果码，_DOTA_PUSH_OK 等
+	int           iBadIndex;      //第一个被拒收的样本的下标，成功时为 -1
+
+}STRUCT_DOTA_PUSH_RESULT, *LPSTRUCT_DOTA_PUSH_RESULT;
+
+// 查询聚合结果，[tBegin, tEnd) 等分成 iWindows 个窗口；应答包体为本结构原样返回，后跟 iWindows 个 STRUCT_DOTA_WINDOW
+typedef struct _STRUCT_DOTA_QUERY
+{
+	uint64_t      tBegin;         //起始时间（含）
+	uint64_t      tEnd;           //结束时间（不含）
+	int           iWindows;       //窗口个数，1 ~ _DOTA_MAX_WINDOWS
+	int           iColumn;        //0 引导方向，1 行驶速度
+	int           iPermille;      //分位数，千分之几，0 ~ 1000
+
+}STRUCT_DOTA_QUERY, *LPSTRUCT_DOTA_QUERY;
+
+// 一个窗口的聚合结果，窗口中没有 Dat 样本时 min、max、mean、percentile 都是 0
+typedef struct _STRUCT_DOTA_WINDOW
+{
+	uint64_t      tBegin;         //窗口起始时间
+	int           iDatCount;      //Dat 样本个数
+	int           iMatCount;      //Mat 样本个数
+	uint64_t      min;            //最小值
+	uint64_t      max;            //最大值
+	uint64_t      mean;           //均值
+	uint64_t      percentile;     //分位数
+
+}STRUCT_DOTA_WINDOW, *LPSTRUCT_DOTA_WINDOW;
+
 //取消指定对齐，恢复缺省对齐
 #pragma pack() 
 
+// double 转为网络序的 8 字节
+static inline uint64_t ngx_htond(double d)
+{
+	uint64_t v;
+	memcpy(&v, &d, sizeof(v));
+	return htobe64(v);
+}
+
+// 网络序的 8 字节转回 double
+static inline double ngx_ntohd(uint64_t v)
+{
+	double d;
+	v = be64toh(v);
+	memcpy(&d, &v, sizeof(d));
+	return d;
+}
+
 #endif
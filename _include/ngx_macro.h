@@ -37,6 +37,9 @@
 // 标记当前进程类型
 #define NGX_PROCESS_MASTER 0 // master进程，管理进程
 #define NGX_PROCESS_WORKER 1 // worker进程，工作进程
+
+// worker 进程打开监听端口失败时的退出码，master 进程收到后停止整个服务，不留下一个没有 worker 的 master
+#define NGX_EXIT_LISTEN 3
 //.......其他待扩展
 
 #endif
@@ -0,0 +1,150 @@
+﻿// 本文件存放共享内存通道的内存布局和环形缓冲区的操作，服务器和客户端库共用
+
+#ifndef __NGX_SHM_RING_H__
+#define __NGX_SHM_RING_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic> //c++11里的原子操作
+
+// 共享内存通道的标识和版本，服务器据此拒绝格式不对的共享内存
+#define NGX_SHM_MAGIC 0x4e47584d
+#define NGX_SHM_VERSION 1
+// 每个环的大小范围，必须是 2 的幂
+#define NGX_SHM_RING_MIN (4 * 1024)
+#define NGX_SHM_RING_MAX (64 * 1024 * 1024)
+// 两个环的下标：客户端发给服务器、服务器发给客户端
+#define NGX_SHM_RING_C2S 0
+#define NGX_SHM_RING_S2C 1
+
+// 单生产者单消费者的字节环，读写位置只增不减，用时对环大小取模
+// 生产者和消费者各写各的位置，放在不同的缓存行里，避免来回抢缓存行
+typedef struct ngx_shm_ring_s
+{
+	// 消费者已经读到的位置
+	alignas(64) std::atomic<uint32_t> head;
+	// 消费者准备睡眠、需要生产者写 eventfd 唤醒，1：是，0：否
+	std::atomic<uint32_t> waiting;
+	// 生产者已经写到的位置
+	alignas(64) std::atomic<uint32_t> tail;
+} ngx_shm_ring_t;
+
+// 共享内存的开头，后面依次是两个环的数据区，每个 ringSize 字节
+// 共享内存对方也能写，ringSize 只在建立通道时检查一次，之后两边都用自己保存的值，不再从共享内存中读
+typedef struct ngx_shm_area_s
+{
+	uint32_t magic;
+	uint32_t version;
+	// 每个环数据区的大小
+	uint32_t ringSize;
+	uint32_t reserved;
+	ngx_shm_ring_t ring[2];
+} ngx_shm_area_t;
+
+// 共享内存总大小
+inline size_t ngx_shm_area_size(uint32_t ringSize)
+{
+	return sizeof(ngx_shm_area_t) + (size_t)ringSize * 2;
+}
+
+// 初始化一块共享内存，由客户端在交给服务器之前调用；服务器一开始就在等客户端的数据
+inline void ngx_shm_area_init(ngx_shm_area_t *area, uint32_t ringSize)
+{
+	area->magic = NGX_SHM_MAGIC;
+	area->version = NGX_SHM_VERSION;
+	area->ringSize = ringSize;
+	area->reserved = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		area->ring[i].head.store(0);
+		area->ring[i].tail.store(0);
+	}
+	area->ring[NGX_SHM_RING_C2S].waiting.store(1);
+	area->ring[NGX_SHM_RING_S2C].waiting.store(0);
+}
+
+// 一个环的数据区，size 为建立通道时检查过的环大小
+inline char *ngx_shm_ring_data(ngx_shm_area_t *area, uint32_t size, int idx)
+{
+	return (char *)(area + 1) + (size_t)size * idx;
+}
+
+// 消费者调用：环中已有数据的字节数；对方是另一个进程，数值可能被写坏，调用者要检查不超过 ringSize
+inline uint32_t ngx_shm_ring_used(ngx_shm_area_t *area, int idx)
+{
+	ngx_shm_ring_t *ring = &area->ring[idx];
+	return ring->tail.load(std::memory_order_acquire) - ring->head.load(std::memory_order_relaxed);
+}
+
+// 消费者调用：从读位置往后 offset 字节处拷贝 len 字节出来，处理绕回
+inline void ngx_shm_ring_peek(ngx_shm_area_t *area, uint32_t size, int idx, uint32_t offset, void *dst, uint32_t len)
+{
+	uint32_t pos = (area->ring[idx].head.load(std::memory_order_relaxed) + offset) & (size - 1);
+	uint32_t first = (len < size - pos) ? len : size - pos;
+	char *data = ngx_shm_ring_data(area, size, idx);
+
+	memcpy(dst, data + pos, first);
+	memcpy((char *)dst + first, data, len - first);
+}
+
+// 消费者调用：读位置前移 len 字节，空出来的地方生产者可以再用
+inline void ngx_shm_ring_consume(ngx_shm_area_t *area, int idx, uint32_t len)
+{
+	ngx_shm_ring_t *ring = &area->ring[idx];
+	ring->head.store(ring->head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+// 生产者调用：写入一段数据，返回 1 表示写入了；返回 0 表示空间不够，什么也没写；
+// 返回 -1 表示数据比整个环还大，或者读位置被对方写坏了（已用的比环还大），这个通道不能再用，什么也没写
+inline int ngx_shm_ring_write(ngx_shm_area_t *area, uint32_t size, int idx, const void *src, uint32_t len)
+{
+	ngx_shm_ring_t *ring = &area->ring[idx];
+	uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	// head 在共享内存中，对方随时能改，先检查再算剩余空间，否则减法绕回后会写出数据区
+	uint32_t used = tail - ring->head.load(std::memory_order_acquire);
+
+	if (len > size || used > size)
+	{
+		return -1;
+	}
+	if (size - used < len)
+	{
+		return 0;
+	}
+
+	uint32_t pos = tail & (size - 1);
+	uint32_t first = (len < size - pos) ? len : size - pos;
+	char *data = ngx_shm_ring_data(area, size, idx);
+
+	memcpy(data + pos, src, first);
+	memcpy(data, (const char *)src + first, len - first);
+	ring->tail.store(tail + len, std::memory_order_release);
+
+	return 1;
+}
+
+// 生产者调用：写完一批数据之后判断要不要写 eventfd 唤醒消费者，只有消费者准备睡眠时才需要
+// 和 ngx_shm_ring_prepare_wait() 中的顺序相反，两边至少有一方能看到对方，不会丢失唤醒
+inline bool ngx_shm_ring_need_wakeup(ngx_shm_area_t *area, int idx)
+{
+	ngx_shm_ring_t *ring = &area->ring[idx];
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return ring->waiting.load(std::memory_order_relaxed) == 1 && ring->waiting.exchange(0) == 1;
+}
+
+// 消费者调用：准备睡眠等待 eventfd，返回 true 表示环确实是空的，可以去等；返回 false 表示又有了数据，接着读
+inline bool ngx_shm_ring_prepare_wait(ngx_shm_area_t *area, int idx)
+{
+	ngx_shm_ring_t *ring = &area->ring[idx];
+
+	ring->waiting.store(1, std::memory_order_seq_cst);
+	if (ngx_shm_ring_used(area, idx) == 0)
+	{
+		return true;
+	}
+	ring->waiting.store(0, std::memory_order_relaxed);
+	return false;
+}
+
+#endif
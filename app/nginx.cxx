@@ -46,6 +46,7 @@ int g_stopEvent;  // 标志程序退出,0不退出1，退出
 
 sig_atomic_t ngx_reap; // 标记子进程状态变化[一般是子进程发来SIGCHLD信号表示退出],sig_atomic_t:系统定义的类型：访问或改变这些变量需要在计算机的一条指令内完成
                        // 一般等价于int【通常情况下，int类型的变量通常是原子访问的，也可以认为 sig_atomic_t就是int类型的数据】
+sig_atomic_t ngx_terminate; // 标记 master 进程需要停止整个服务，比如 worker 打开监听端口失败
 
 int main(int argc, char *const *argv)
 {
@@ -89,6 +90,7 @@ int main(int argc, char *const *argv)
     ngx_process = NGX_PROCESS_MASTER;
     // 标记子进程无变化
     ngx_reap = 0;
+    ngx_terminate = 0;
 
     // 完成初始化
 
@@ -153,6 +155,11 @@ int main(int argc, char *const *argv)
 
     // 产生的子进程作为 master 进程
     ngx_master_process_cycle();
+    // master 进程因为 worker 无法工作而停止，返回非 0
+    if (ngx_terminate)
+    {
+        exitcode = 1;
+    }
 
     //--------------------------------------------------------------
     // for(;;)
@@ -0,0 +1,36 @@
+#!/bin/bash
+# C1M 内存占用测试：分别以普通模式和 C1M 模式（Sock_C1MMode = 1）启动服务器，用 ngx_c1m_bench 建立大量回环连接，比较每条连接占用的 RSS
+# 用法：bench/bench_c1m.sh [端口] [连接数]
+# 先在根目录执行 make bench；连接数大时需要 root 权限提高描述符上限，并把 net.ipv4.ip_local_port_range、fs.nr_open 之类的内核参数调大
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+PORT=${1:-18080}
+CONNS=${2:-1000000}
+
+# 服务器和测试程序都要能打开这么多描述符，提不上去就用能拿到的最大值
+ulimit -n $((CONNS + 1024)) 2> /dev/null || ulimit -n "$(ulimit -Hn)"
+
+for mode in 0 1; do
+	workdir=$(mktemp -d)
+	cat > "$workdir/nginx.conf" <<CONF
+ListenPortCount = 1
+ListenPort0 = $PORT
+worker_connections = $CONNS
+WorkerProcesses = 1
+ProcMsgRecvWorkThreadCount = 4
+Sock_C1MMode = $mode
+CONF
+
+	# 放到单独的进程组里启动，结束时把 master 和 worker 一起干掉
+	(cd "$workdir" && exec setsid "$ROOT/nginx" > /dev/null 2>&1) &
+	pid=$!
+	sleep 2
+
+	worker=$(pgrep -P "$(pgrep -o -s "$(ps -o sid= -p "$pid" | tr -d ' ')" nginx)" | head -1)
+	echo "==== Sock_C1MMode = $mode，worker 进程 $worker ===="
+	"$ROOT/bench/ngx_c1m_bench" -p "$PORT" -c "$CONNS" -s "$worker"
+
+	kill -9 -- -"$pid" 2> /dev/null
+	wait "$pid" 2> /dev/null
+	rm -rf "$workdir"
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+# LT 与 ET 两种 epoll 模式的对比压测：分别用 Sock_EpollET=0/1 启动服务器，再用 ngx_bench_client 打同样的负载
+# 用法：bench/bench_epoll_mode.sh [端口] [连接数] [秒数] [每连接在途包数]
+# 先在根目录执行 make bench
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+PORT=${1:-18080}
+CONNS=${2:-200}
+SECS=${3:-10}
+PIPE=${4:-8}
+
+for mode in 0 1; do
+    workdir=$(mktemp -d)
+    cat > "$workdir/nginx.conf" <<CONF
+ListenPortCount = 1
+ListenPort0 = $PORT
+worker_connections = 8192
+WorkerProcesses = 1
+ProcMsgRecvWorkThreadCount = 4
+Sock_EpollET = $mode
+CONF
+
+    # 放到单独的进程组里启动，结束时把 master 和 worker 一起干掉
+    (cd "$workdir" && exec setsid "$ROOT/nginx" > /dev/null 2>&1) &
+    pid=$!
+    sleep 2
+
+    if [ $mode -eq 0 ]; then tag="LT"; else tag="ET"; fi
+    "$ROOT/bench/ngx_bench_client" -p "$PORT" -c "$CONNS" -d "$SECS" -P "$PIPE" -t "$tag"
+
+    kill -9 -- -"$pid" 2> /dev/null
+    wait "$pid" 2> /dev/null
+    sleep 1
+    rm -rf "$workdir"
+done
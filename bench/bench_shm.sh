@@ -0,0 +1,32 @@
+#!/bin/bash
+# 共享内存通道与本机回环 TCP 的对比压测：同一个服务器同时监听 TCP 端口和 ShmListenPath，分别用 ngx_bench_client、ngx_shm_bench 打同样的负载
+# 用法：bench/bench_shm.sh [端口] [连接数] [秒数] [每连接在途包数]
+# 先在根目录执行 make bench
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+PORT=${1:-18080}
+CONNS=${2:-4}
+SECS=${3:-10}
+PIPE=${4:-1}
+
+workdir=$(mktemp -d)
+cat > "$workdir/nginx.conf" <<CONF
+ListenPortCount = 1
+ListenPort0 = $PORT
+ShmListenPath = $workdir/shm.sock
+worker_connections = 8192
+WorkerProcesses = 1
+ProcMsgRecvWorkThreadCount = 4
+CONF
+
+# 放到单独的进程组里启动，结束时把 master 和 worker 一起干掉
+(cd "$workdir" && exec setsid "$ROOT/nginx" > /dev/null 2>&1) &
+pid=$!
+sleep 2
+
+"$ROOT/bench/ngx_bench_client" -p "$PORT" -c "$CONNS" -d "$SECS" -P "$PIPE" -t "TCP"
+"$ROOT/bench/ngx_shm_bench" -u "$workdir/shm.sock" -c "$CONNS" -d "$SECS" -P "$PIPE" -t "SHM"
+
+kill -9 -- -"$pid" 2> /dev/null
+wait "$pid" 2> /dev/null
+rm -rf "$workdir"
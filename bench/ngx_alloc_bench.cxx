@@ -0,0 +1,512 @@
+// 本文件实现分配器对比测试：std::allocator、MemoryPool、CMemory、malloc 在同样的几种场景下各跑一遍，
+// 输出每秒操作数（一次分配或一次释放算一次操作）、单次操作耗时的分位数和峰值 RSS，给挑选生产环境的分配器提供数据
+// 场景：
+//   stack     单线程，StackAlloc 链表栈先压入 N 个再全部弹出，反复几轮
+//   st-mix    单线程，按服务器收包的大小分布申请，同时存活一个窗口的内存，最早的先释放
+//   xt-fixed  跨线程，收包线程申请固定大小的消息头，处理线程释放
+//   xt-mix    跨线程，收包线程按收包的大小分布申请，处理线程释放，和服务器里消息内存的流转方式一样
+// 每个场景和分配器的组合在单独 fork 出的子进程里跑，峰值 RSS 互不影响
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "ngx_comm.h"
+#include "ngx_c_memory.h"
+#include "MemoryPool.h"
+#include "StackAlloc.h"
+
+// 队列里一次搬多少个指针，不让队列的锁成为瓶颈
+#define ALLOC_BENCH_BATCH 64
+// 消息头的大小，和 ngx_c_socket.h 中的 STRUC_MSG_HEADER 相同，这里不引入整个网络层的头文件
+#define ALLOC_BENCH_MSG_HEADER 48
+// 每隔多少次操作取一次耗时样本，取样本本身要读两次时钟
+#define ALLOC_BENCH_SAMPLE 8
+// st-mix 中同时存活的内存块数
+#define ALLOC_BENCH_WINDOW 4096
+
+// ngx_c_memory.cxx 中用到的日志函数，压测程序不带日志模块，直接打到标准错误
+void ngx_log_stderr(int err, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	if (err != 0)
+		fprintf(stderr, " (%d: %s)", err, strerror(err));
+	fprintf(stderr, "\n");
+}
+
+// 取得单调时钟，单位：纳秒
+static inline uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//---------------------------------------------------------------
+// 把 malloc 和 CMemory 包装成 StackAlloc 能用的分配器
+
+template <typename T>
+struct MallocAllocator
+{
+	typedef T *pointer;
+	template <typename U>
+	struct rebind
+	{
+		typedef MallocAllocator<U> other;
+	};
+	pointer allocate(size_t n = 1, const T * = 0) { return (pointer)malloc(n * sizeof(T)); }
+	void deallocate(pointer p, size_t = 1) { free(p); }
+	template <typename U, typename... Args>
+	void construct(U *p, Args &&...args) { new (p) U(std::forward<Args>(args)...); }
+	template <typename U>
+	void destroy(U *p) { p->~U(); }
+};
+
+template <typename T>
+struct CMemoryAllocator
+{
+	typedef T *pointer;
+	template <typename U>
+	struct rebind
+	{
+		typedef CMemoryAllocator<U> other;
+	};
+	pointer allocate(size_t n = 1, const T * = 0) { return (pointer)CMemory::GetInstance()->AllocMemory(n * sizeof(T), false); }
+	void deallocate(pointer p, size_t = 1) { CMemory::GetInstance()->FreeMemory(p); }
+	template <typename U, typename... Args>
+	void construct(U *p, Args &&...args) { new (p) U(std::forward<Args>(args)...); }
+	template <typename U>
+	void destroy(U *p) { p->~U(); }
+};
+
+//---------------------------------------------------------------
+// 按大小申请、释放的统一接口，st-mix、xt-fixed、xt-mix 用
+
+// MemoryPool 只分配固定大小的对象，按 2 的幂分级，每级一个内存池，这也是在生产中使用它的方式
+template <size_t N>
+struct Chunk
+{
+	char data[N];
+};
+// 每个区块至少放得下几十个对象
+#define POOL_BLOCK(N) ((N) * 64 > 4096 ? (N) * 64 : 4096)
+static MemoryPool<Chunk<64>, POOL_BLOCK(64)> g_pool64;
+static MemoryPool<Chunk<128>, POOL_BLOCK(128)> g_pool128;
+static MemoryPool<Chunk<256>, POOL_BLOCK(256)> g_pool256;
+static MemoryPool<Chunk<512>, POOL_BLOCK(512)> g_pool512;
+static MemoryPool<Chunk<1024>, POOL_BLOCK(1024)> g_pool1k;
+static MemoryPool<Chunk<2048>, POOL_BLOCK(2048)> g_pool2k;
+static MemoryPool<Chunk<4096>, POOL_BLOCK(4096)> g_pool4k;
+static MemoryPool<Chunk<8192>, POOL_BLOCK(8192)> g_pool8k;
+static MemoryPool<Chunk<16384>, POOL_BLOCK(16384)> g_pool16k;
+static MemoryPool<Chunk<32768>, POOL_BLOCK(32768)> g_pool32k;
+
+static void *pool_alloc(size_t size)
+{
+	if (size <= 64) return g_pool64.allocate();
+	if (size <= 128) return g_pool128.allocate();
+	if (size <= 256) return g_pool256.allocate();
+	if (size <= 512) return g_pool512.allocate();
+	if (size <= 1024) return g_pool1k.allocate();
+	if (size <= 2048) return g_pool2k.allocate();
+	if (size <= 4096) return g_pool4k.allocate();
+	if (size <= 8192) return g_pool8k.allocate();
+	if (size <= 16384) return g_pool16k.allocate();
+	return g_pool32k.allocate();
+}
+
+static void pool_free(void *p, size_t size)
+{
+	if (size <= 64) g_pool64.deallocate((Chunk<64> *)p);
+	else if (size <= 128) g_pool128.deallocate((Chunk<128> *)p);
+	else if (size <= 256) g_pool256.deallocate((Chunk<256> *)p);
+	else if (size <= 512) g_pool512.deallocate((Chunk<512> *)p);
+	else if (size <= 1024) g_pool1k.deallocate((Chunk<1024> *)p);
+	else if (size <= 2048) g_pool2k.deallocate((Chunk<2048> *)p);
+	else if (size <= 4096) g_pool4k.deallocate((Chunk<4096> *)p);
+	else if (size <= 8192) g_pool8k.deallocate((Chunk<8192> *)p);
+	else if (size <= 16384) g_pool16k.deallocate((Chunk<16384> *)p);
+	else g_pool32k.deallocate((Chunk<32768> *)p);
+}
+
+static void *std_alloc(size_t size) { return std::allocator<char>().allocate(size); }
+static void std_free(void *p, size_t size) { std::allocator<char>().deallocate((char *)p, size); }
+static void *cmem_alloc(size_t size) { return CMemory::GetInstance()->AllocMemory((int)size, false); }
+static void cmem_free(void *p, size_t) { CMemory::GetInstance()->FreeMemory(p); }
+static void *malloc_alloc(size_t size) { return malloc(size); }
+static void malloc_free(void *p, size_t) { free(p); }
+
+struct alloc_ops_s
+{
+	const char *name;
+	void *(*alloc)(size_t size);
+	void (*release)(void *p, size_t size);
+};
+
+static const alloc_ops_s g_allocs[] = {
+	{"std::allocator", std_alloc, std_free},
+	{"MemoryPool", pool_alloc, pool_free},
+	{"CMemory", cmem_alloc, cmem_free},
+	{"malloc", malloc_alloc, malloc_free},
+};
+#define ALLOC_COUNT (int)(sizeof(g_allocs) / sizeof(g_allocs[0]))
+
+//---------------------------------------------------------------
+// 测试参数和结果
+
+static long g_ops = 2000000;   // 每个场景的分配次数，释放次数相同
+static int g_workers = 4;      // 跨线程场景的处理线程数
+static const alloc_ops_s *g_cur; // 当前分配器
+
+// 一个线程的耗时样本，单位：纳秒
+struct samples_s
+{
+	std::vector<uint32_t> ns;
+	uint64_t counter;
+	samples_s() : counter(0) { ns.reserve(1 << 16); }
+};
+
+// 计时执行一次操作，每 ALLOC_BENCH_SAMPLE 次记一个样本
+#define TIMED(smp, op)                                              \
+	do                                                              \
+	{                                                               \
+		if (((smp).counter++ % ALLOC_BENCH_SAMPLE) == 0)            \
+		{                                                           \
+			uint64_t t0_ = now_ns();                                \
+			op;                                                     \
+			(smp).ns.push_back((uint32_t)(now_ns() - t0_));         \
+		}                                                           \
+		else                                                        \
+		{                                                           \
+			op;                                                     \
+		}                                                           \
+	} while (0)
+
+// 服务器收到的消息大小：大部分是几十到几百字节的小包，少量接近最大包长，另外是整块收包缓冲区
+static size_t msg_size(unsigned int r)
+{
+	size_t header = ALLOC_BENCH_MSG_HEADER + sizeof(COMM_PKG_HEADER);
+	unsigned int k = r % 100;
+	if (k < 70)
+		return header + 16 + (r >> 8) % 240;
+	if (k < 90)
+		return header + 256 + (r >> 8) % 1800;
+	if (k < 98)
+		return header + 2048 + (r >> 8) % (_PKG_MAX_LENGTH - 3048);
+	return ALLOC_BENCH_MSG_HEADER + 16384;
+}
+
+//---------------------------------------------------------------
+// stack：单线程链表栈压入、弹出
+
+template <class Alloc>
+static void run_stack(samples_s &smp)
+{
+	// 每轮压入的元素个数
+	const long depth = 100000;
+	StackAlloc<long, Alloc> stack;
+	for (long done = 0; done < g_ops; done += depth)
+	{
+		for (long i = 0; i < depth; ++i)
+			TIMED(smp, stack.push(i));
+		for (long i = 0; i < depth; ++i)
+			TIMED(smp, stack.pop());
+	}
+}
+
+//---------------------------------------------------------------
+// st-mix：单线程按收包大小分布申请，同时存活一个窗口
+
+static void run_st_mix(samples_s &smp)
+{
+	std::vector<void *> ptrs(ALLOC_BENCH_WINDOW, (void *)NULL);
+	std::vector<size_t> sizes(ALLOC_BENCH_WINDOW, 0);
+	unsigned int seed = 12345;
+	for (long i = 0; i < g_ops; ++i)
+	{
+		size_t slot = i % ALLOC_BENCH_WINDOW;
+		if (ptrs[slot] != NULL)
+			TIMED(smp, g_cur->release(ptrs[slot], sizes[slot]));
+		seed = seed * 1103515245 + 12345;
+		sizes[slot] = msg_size(seed);
+		TIMED(smp, ptrs[slot] = g_cur->alloc(sizes[slot]));
+		// 写一下内存，和收包时拷贝数据一样让内存真正被用到
+		((char *)ptrs[slot])[0] = (char)i;
+	}
+	for (size_t slot = 0; slot < ptrs.size(); ++slot)
+	{
+		if (ptrs[slot] != NULL)
+			g_cur->release(ptrs[slot], sizes[slot]);
+	}
+}
+
+//---------------------------------------------------------------
+// xt-fixed、xt-mix：收包线程申请，处理线程释放
+
+struct bench_item_s
+{
+	void *p;
+	size_t size;
+};
+
+// 简单的多生产者多消费者队列，每个元素是一批指针
+struct bench_queue_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	std::vector<std::vector<bench_item_s> > items;
+	bool closed;
+
+	bench_queue_s() : closed(false)
+	{
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+
+	void push(std::vector<bench_item_s> &batch)
+	{
+		pthread_mutex_lock(&mutex);
+		items.push_back(std::vector<bench_item_s>());
+		items.back().swap(batch);
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	// 队列关闭且为空时返回 false
+	bool pop(std::vector<bench_item_s> &batch)
+	{
+		pthread_mutex_lock(&mutex);
+		while (items.empty() && !closed)
+			pthread_cond_wait(&cond, &mutex);
+		if (items.empty())
+		{
+			pthread_mutex_unlock(&mutex);
+			return false;
+		}
+		batch.swap(items.back());
+		items.pop_back();
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+
+	void close()
+	{
+		pthread_mutex_lock(&mutex);
+		closed = true;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+};
+
+static bench_queue_s g_queue;
+static bool g_mixSizes = false;
+static std::vector<samples_s> g_threadSamples;
+
+static void *recv_thread(void *)
+{
+	samples_s &smp = g_threadSamples[0];
+	unsigned int seed = 12345;
+	std::vector<bench_item_s> batch;
+	for (long i = 0; i < g_ops; ++i)
+	{
+		bench_item_s item;
+		if (g_mixSizes)
+		{
+			seed = seed * 1103515245 + 12345;
+			item.size = msg_size(seed);
+		}
+		else
+		{
+			item.size = ALLOC_BENCH_MSG_HEADER + sizeof(COMM_PKG_HEADER);
+		}
+		TIMED(smp, item.p = g_cur->alloc(item.size));
+		((char *)item.p)[0] = (char)i;
+		batch.push_back(item);
+		if (batch.size() == ALLOC_BENCH_BATCH)
+			g_queue.push(batch);
+	}
+	if (!batch.empty())
+		g_queue.push(batch);
+	g_queue.close();
+	return NULL;
+}
+
+static void *work_thread(void *arg)
+{
+	samples_s &smp = g_threadSamples[(intptr_t)arg];
+	std::vector<bench_item_s> batch;
+	while (g_queue.pop(batch))
+	{
+		for (size_t i = 0; i < batch.size(); ++i)
+			TIMED(smp, g_cur->release(batch[i].p, batch[i].size));
+		batch.clear();
+	}
+	return NULL;
+}
+
+static void run_cross_thread()
+{
+	pthread_t recvTid;
+	std::vector<pthread_t> workTids(g_workers);
+	for (int i = 0; i < g_workers; ++i)
+		pthread_create(&workTids[i], NULL, work_thread, (void *)(intptr_t)(i + 1));
+	pthread_create(&recvTid, NULL, recv_thread, NULL);
+	pthread_join(recvTid, NULL);
+	for (int i = 0; i < g_workers; ++i)
+		pthread_join(workTids[i], NULL);
+}
+
+//---------------------------------------------------------------
+// 在子进程中跑一个场景，结果写到管道里
+
+struct bench_result_s
+{
+	double opsPerSec;
+	uint32_t p50, p99, p999, max;
+};
+
+static void run_child(const char *scenario, int allocIdx, int fd)
+{
+	g_cur = &g_allocs[allocIdx];
+	// 单例第一次调用放在主线程
+	CMemory::GetInstance();
+	g_threadSamples.assign(g_workers + 1, samples_s());
+
+	long ops = g_ops * 2;
+	uint64_t start = now_ns();
+	if (strcmp(scenario, "stack") == 0)
+	{
+		switch (allocIdx)
+		{
+		case 0: run_stack<std::allocator<long> >(g_threadSamples[0]); break;
+		case 1: run_stack<MemoryPool<long> >(g_threadSamples[0]); break;
+		case 2: run_stack<CMemoryAllocator<long> >(g_threadSamples[0]); break;
+		default: run_stack<MallocAllocator<long> >(g_threadSamples[0]); break;
+		}
+		// 每轮压入、弹出的次数向上取整
+		ops = (g_ops + 99999) / 100000 * 100000 * 2;
+	}
+	else if (strcmp(scenario, "st-mix") == 0)
+	{
+		run_st_mix(g_threadSamples[0]);
+	}
+	else
+	{
+		g_mixSizes = (strcmp(scenario, "xt-mix") == 0);
+		run_cross_thread();
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	std::vector<uint32_t> all;
+	for (size_t i = 0; i < g_threadSamples.size(); ++i)
+		all.insert(all.end(), g_threadSamples[i].ns.begin(), g_threadSamples[i].ns.end());
+	std::sort(all.begin(), all.end());
+
+	bench_result_s r;
+	memset(&r, 0, sizeof(r));
+	r.opsPerSec = elapsed > 0 ? ops * 1e9 / elapsed : 0.0;
+	if (!all.empty())
+	{
+		r.p50 = all[all.size() * 50 / 100];
+		r.p99 = all[all.size() * 99 / 100];
+		r.p999 = all[all.size() * 999 / 1000];
+		r.max = all.back();
+	}
+	if (write(fd, &r, sizeof(r)) != (ssize_t)sizeof(r))
+		_exit(1);
+	_exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-n 每个场景的分配次数] [-t 跨线程场景的处理线程数] [-s 场景，可以多次指定]\n", prog);
+	fprintf(stderr, "场景: stack st-mix xt-fixed xt-mix，默认全部\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char *> scenarios;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': g_ops = atol(optarg); break;
+		case 't': g_workers = atoi(optarg); break;
+		case 's': scenarios.push_back(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (g_ops <= 0 || g_workers <= 0)
+		usage(argv[0]);
+	if (scenarios.empty())
+	{
+		scenarios.push_back("stack");
+		scenarios.push_back("st-mix");
+		scenarios.push_back("xt-fixed");
+		scenarios.push_back("xt-mix");
+	}
+	for (size_t i = 0; i < scenarios.size(); ++i)
+	{
+		if (strcmp(scenarios[i], "stack") != 0 && strcmp(scenarios[i], "st-mix") != 0 && strcmp(scenarios[i], "xt-fixed") != 0 && strcmp(scenarios[i], "xt-mix") != 0)
+			usage(argv[0]);
+	}
+
+	printf("每个场景分配 %ld 次、释放 %ld 次；跨线程场景 1 个收包线程、%d 个处理线程；耗时每 %d 次操作取一个样本，含读时钟的开销\n",
+		   g_ops, g_ops, g_workers, ALLOC_BENCH_SAMPLE);
+	printf("%-9s %-15s %12s %8s %8s %8s %9s %10s\n", "场景", "分配器", "操作/秒", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)", "峰值RSS(MB)");
+
+	for (size_t s = 0; s < scenarios.size(); ++s)
+	{
+		for (int a = 0; a < ALLOC_COUNT; ++a)
+		{
+			int fds[2];
+			if (pipe(fds) == -1)
+			{
+				perror("pipe");
+				return 1;
+			}
+			pid_t pid = fork();
+			if (pid == 0)
+			{
+				close(fds[0]);
+				run_child(scenarios[s], a, fds[1]);
+			}
+			close(fds[1]);
+
+			bench_result_s r;
+			bool ok = (read(fds[0], &r, sizeof(r)) == (ssize_t)sizeof(r));
+			close(fds[0]);
+
+			int status;
+			struct rusage ru;
+			wait4(pid, &status, 0, &ru);
+			if (!ok)
+			{
+				printf("%-9s %-15s 子进程失败\n", scenarios[s], g_allocs[a].name);
+				continue;
+			}
+			printf("%-9s %-15s %12.0f %8u %8u %9u %9u %10.1f\n", scenarios[s], g_allocs[a].name, r.opsPerSec, r.p50, r.p99, r.p999, r.max,
+				   ru.ru_maxrss / 1024.0);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+}
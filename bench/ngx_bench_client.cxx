@@ -0,0 +1,254 @@
+// 本文件实现一个压测用的客户端：建立若干条 TCP 连接，每条连接上保持固定数量的在途心跳包，统计吞吐和往返时延
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+
+#include "ngx_comm.h"
+#include "ngx_logiccomm.h"
+
+// 一条压测连接
+struct bench_conn
+{
+	int fd;
+	// 在途请求的发送时间，先进先出，服务器按序应答
+	std::deque<uint64_t> sendtimes;
+	// 没发完的数据
+	std::string outbuf;
+	// 没收全的应答
+	char inbuf[_PKG_MAX_LENGTH];
+	size_t inlen;
+};
+
+// 取得单调时钟，单位：微秒
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 组一个只有包头的心跳包
+static void make_ping(char *buf)
+{
+	LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)buf;
+	pPkgHeader->pkgLen = htons(sizeof(COMM_PKG_HEADER));
+	pPkgHeader->msgCode = htons(_CMD_PING);
+	pPkgHeader->crc32 = 0;
+}
+
+// 尽量把 outbuf 中的数据发出去，返回 false 表示连接出错
+static bool flush_out(bench_conn *c)
+{
+	while (!c->outbuf.empty())
+	{
+		ssize_t n = send(c->fd, c->outbuf.data(), c->outbuf.size(), MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			c->outbuf.erase(0, n);
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return true;
+		return false;
+	}
+	return true;
+}
+
+// 发出一个心跳包
+static bool send_ping(bench_conn *c)
+{
+	char buf[sizeof(COMM_PKG_HEADER)];
+	make_ping(buf);
+	c->outbuf.append(buf, sizeof(buf));
+	c->sendtimes.push_back(now_us());
+	return flush_out(c);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-h ip] [-p port] [-u unix路径] [-c 连接数] [-d 秒数] [-P 每连接在途包数] [-t 标签]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = "127.0.0.1";
+	int port = 80;
+	int nconn = 100;
+	int seconds = 10;
+	int pipeline = 1;
+	const char *tag = "";
+	// 给了 AF_UNIX 路径就不走 TCP
+	const char *unixpath = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "h:p:u:c:d:P:t:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'u': unixpath = optarg; break;
+		case 'c': nconn = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'P': pipeline = atoi(optarg); break;
+		case 't': tag = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nconn <= 0 || seconds <= 0 || pipeline <= 0)
+		usage(argv[0]);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	if (unixpath == NULL && inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+	{
+		fprintf(stderr, "地址 %s 不合法\n", host);
+		return 1;
+	}
+
+	struct sockaddr_un uaddr;
+	memset(&uaddr, 0, sizeof(uaddr));
+	uaddr.sun_family = AF_UNIX;
+	if (unixpath != NULL)
+	{
+		if (strlen(unixpath) >= sizeof(uaddr.sun_path))
+		{
+			fprintf(stderr, "路径 %s 太长\n", unixpath);
+			return 1;
+		}
+		strcpy(uaddr.sun_path, unixpath);
+	}
+
+	int ep = epoll_create1(0);
+	std::vector<bench_conn *> conns;
+	for (int i = 0; i < nconn; ++i)
+	{
+		int fd = socket((unixpath != NULL) ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+		int ret = (unixpath != NULL) ? connect(fd, (struct sockaddr *)&uaddr, sizeof(uaddr)) : connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+		if (fd == -1 || ret == -1)
+		{
+			fprintf(stderr, "第 %d 条连接建立失败: %s\n", i, strerror(errno));
+			return 1;
+		}
+		int one = 1;
+		if (unixpath == NULL)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		bench_conn *c = new bench_conn;
+		c->fd = fd;
+		c->inlen = 0;
+		conns.push_back(c);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.ptr = c;
+		epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	// 每条连接先把在途包填满
+	for (size_t i = 0; i < conns.size(); ++i)
+	{
+		for (int k = 0; k < pipeline; ++k)
+			send_ping(conns[i]);
+	}
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(1 << 20);
+	uint64_t replies = 0;
+	int broken = 0;
+	uint64_t start = now_us();
+	uint64_t deadline = start + (uint64_t)seconds * 1000000;
+	struct epoll_event events[512];
+
+	while (now_us() < deadline)
+	{
+		int n = epoll_wait(ep, events, 512, 100);
+		for (int i = 0; i < n; ++i)
+		{
+			bench_conn *c = (bench_conn *)events[i].data.ptr;
+			if (c->fd == -1)
+				continue;
+
+			for (;;)
+			{
+				ssize_t r = recv(c->fd, c->inbuf + c->inlen, sizeof(c->inbuf) - c->inlen, 0);
+				if (r < 0 && (errno == EAGAIN || errno == EINTR))
+					break;
+				if (r <= 0)
+				{
+					close(c->fd);
+					c->fd = -1;
+					++broken;
+					break;
+				}
+				c->inlen += r;
+
+				// 拆出所有完整的应答
+				size_t off = 0;
+				while (c->inlen - off >= sizeof(COMM_PKG_HEADER))
+				{
+					LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(c->inbuf + off);
+					size_t pkglen = ntohs(pPkgHeader->pkgLen);
+					if (pkglen < sizeof(COMM_PKG_HEADER) || c->inlen - off < pkglen)
+						break;
+					off += pkglen;
+
+					uint64_t t = now_us();
+					if (!c->sendtimes.empty())
+					{
+						latencies.push_back((uint32_t)(t - c->sendtimes.front()));
+						c->sendtimes.pop_front();
+					}
+					++replies;
+					send_ping(c);
+				}
+				memmove(c->inbuf, c->inbuf + off, c->inlen - off);
+				c->inlen -= off;
+			}
+			if (c->fd != -1)
+				flush_out(c);
+		}
+	}
+
+	double elapsed = (now_us() - start) / 1000000.0;
+	std::sort(latencies.begin(), latencies.end());
+	uint32_t p50 = 0, p99 = 0, p999 = 0;
+	if (!latencies.empty())
+	{
+		p50 = latencies[latencies.size() * 50 / 100];
+		p99 = latencies[latencies.size() * 99 / 100];
+		p999 = latencies[latencies.size() * 999 / 1000];
+	}
+
+	printf("%s 连接=%d 在途=%d 时长=%.1fs 应答=%llu 吞吐=%.0f/s p50=%uus p99=%uus p99.9=%uus 断开=%d\n",
+		   tag, nconn, pipeline, elapsed, (unsigned long long)replies, replies / elapsed, p50, p99, p999, broken);
+
+	for (size_t i = 0; i < conns.size(); ++i)
+	{
+		if (conns[i]->fd != -1)
+			close(conns[i]->fd);
+		delete conns[i];
+	}
+	close(ep);
+	return 0;
+}
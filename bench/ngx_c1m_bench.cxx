@@ -0,0 +1,201 @@
+// 本文件实现 C1M 内存占用测试：建立大量本机回环 TCP 连接，每条连接发一个心跳包，分别统计服务器 worker 进程的 RSS 增量，算出每条连接占多少内存
+// 一个源地址最多只有几万个临时端口，所以轮流从 127.0.0.2、127.0.0.3 …… 发起连接
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <vector>
+
+#include "ngx_comm.h"
+#include "ngx_logiccomm.h"
+
+// 每个源地址发起的连接数，留出余量，不用满临时端口范围
+#define C1M_CONNS_PER_SRC 25000
+
+// 取得单调时钟，单位：毫秒
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 读出进程的 VmRSS，单位：KB，失败返回 -1
+static long read_rss_kb(int pid)
+{
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	long kb = -1;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (strncmp(line, "VmRSS:", 6) == 0)
+		{
+			kb = atol(line + 6);
+			break;
+		}
+	}
+	fclose(fp);
+	return kb;
+}
+
+// 打印一个阶段的 RSS 增量；连接池在 worker 启动时就建好了，算在开始时的 RSS 里，所以另外按总 RSS 再算一次
+static void report(const char *stage, long base_kb, long kb, int conns)
+{
+	printf("%-10s 服务器RSS %8ld KB  增量 %8ld KB  每连接增量 %7.0f 字节  每连接总RSS %7.0f 字节\n", stage, kb, kb - base_kb,
+		   conns > 0 ? (double)(kb - base_kb) * 1024 / conns : 0.0, conns > 0 ? (double)kb * 1024 / conns : 0.0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s -s worker进程号 [-h ip] [-p port] [-c 连接数] [-w 建好连接后等待的秒数]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ip = "127.0.0.1";
+	int port = 80;
+	int conns = 1000000;
+	int pid = 0;
+	int settle = 2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:p:c:s:w:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h': ip = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'c': conns = atoi(optarg); break;
+		case 's': pid = atoi(optarg); break;
+		case 'w': settle = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (pid <= 0 || conns <= 0)
+		usage(argv[0]);
+
+	// 每条连接一个描述符，软限制不够时尽量提到硬限制
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur < (rlim_t)conns + 64)
+	{
+		rl.rlim_cur = (rl.rlim_max < (rlim_t)conns + 64) ? rl.rlim_max : (rlim_t)conns + 64;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if ((rlim_t)conns + 64 > rl.rlim_cur)
+		{
+			conns = (int)rl.rlim_cur - 64;
+			fprintf(stderr, "描述符上限只有 %lu，连接数减为 %d\n", (unsigned long)rl.rlim_cur, conns);
+		}
+	}
+
+	struct sockaddr_in srv;
+	memset(&srv, 0, sizeof(srv));
+	srv.sin_family = AF_INET;
+	srv.sin_port = htons(port);
+	inet_pton(AF_INET, ip, &srv.sin_addr);
+
+	long base_kb = read_rss_kb(pid);
+	if (base_kb < 0)
+	{
+		fprintf(stderr, "读不到进程 %d 的 RSS\n", pid);
+		return 1;
+	}
+	report("开始", base_kb, base_kb, 0);
+
+	// 第一阶段：建立全部连接，不发数据
+	std::vector<int> fds;
+	fds.reserve(conns);
+	uint64_t start = now_ms();
+	for (int i = 0; i < conns; ++i)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1)
+		{
+			fprintf(stderr, "socket() 失败：%s，已建立 %d 条连接\n", strerror(errno), i);
+			break;
+		}
+
+		// 源地址 127.0.0.2 开始轮换，端口到 connect() 时才分配
+		struct sockaddr_in src;
+		memset(&src, 0, sizeof(src));
+		src.sin_family = AF_INET;
+		src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / C1M_CONNS_PER_SRC);
+		int on = 1;
+		setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+		if (bind(fd, (struct sockaddr *)&src, sizeof(src)) == -1 || connect(fd, (struct sockaddr *)&srv, sizeof(srv)) == -1)
+		{
+			fprintf(stderr, "连接失败：%s，已建立 %d 条连接\n", strerror(errno), i);
+			close(fd);
+			break;
+		}
+		fds.push_back(fd);
+
+		if ((i + 1) % 100000 == 0)
+			printf("已建立 %d 条连接，用时 %.1f 秒\n", i + 1, (now_ms() - start) / 1000.0);
+	}
+	conns = (int)fds.size();
+	printf("共建立 %d 条连接，用时 %.1f 秒\n", conns, (now_ms() - start) / 1000.0);
+
+	sleep(settle);
+	report("空闲连接", base_kb, read_rss_kb(pid), conns);
+
+	// 第二阶段：每条连接发一个心跳包并收回应答，之后连接又回到空闲状态
+	COMM_PKG_HEADER ping;
+	ping.pkgLen = htons(sizeof(COMM_PKG_HEADER));
+	ping.msgCode = htons(_CMD_PING);
+	ping.crc32 = 0;
+
+	int ep = epoll_create1(0);
+	int pending = 0;
+	for (int i = 0; i < conns; ++i)
+	{
+		if (send(fds[i], &ping, sizeof(ping), MSG_NOSIGNAL) != (ssize_t)sizeof(ping))
+			continue;
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+		epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+		++pending;
+	}
+
+	struct epoll_event events[512];
+	char buf[256];
+	uint64_t deadline = now_ms() + 30000;
+	int replies = 0;
+	while (replies < pending && now_ms() < deadline)
+	{
+		int n = epoll_wait(ep, events, 512, 100);
+		for (int i = 0; i < n; ++i)
+		{
+			// 心跳应答只有一个包头，这里只关心收没收到
+			if (recv(events[i].data.fd, buf, sizeof(buf), 0) > 0)
+				++replies;
+			epoll_ctl(ep, EPOLL_CTL_DEL, events[i].data.fd, NULL);
+		}
+	}
+	close(ep);
+	printf("发出心跳包 %d 个，收到应答 %d 个\n", pending, replies);
+
+	sleep(settle);
+	report("收发之后", base_kb, read_rss_kb(pid), conns);
+
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+// 本文件实现数据池吞吐测试：若干生产者线程不断放入 Mat、Dat 数据，一个消费者线程不断取出，
+// 比较加锁的 Dota_Pool（deque + mutex，一次取一个）和无锁的 Dota_Ring（一次取一批）每秒能搬运多少条数据；
+// 给了 -d 目录时再测一遍开启持久化的 Dota_Pool，并重新打开段文件核对写进去的条数
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+#include <thread>
+#include <limits>
+
+#include "Dota_Pool.h"
+
+// 消费者一次最多取出的条数
+#define DOTA_BENCH_BATCH 64
+
+// 取得单调时钟，单位：毫秒
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long g_count = 2000000; // 每个生产者放入的条数
+static int g_producers = 4;
+static size_t g_capacity = 65536;
+static const char *g_persistDir = NULL; // 持久化的段文件目录
+
+// 生产者交替放入 Mat 和 Dat
+template <class Pool>
+static void produce(Pool &pool, int id)
+{
+	for (long i = 0; i < g_count; ++i)
+	{
+		if ((i & 1) == 0)
+			pool.push(Mat((double)i));
+		else
+			pool.push(Dat(id, (double)i, (double)i));
+	}
+}
+
+// 加锁的 Dota_Pool：消费者一次取一个，取空了让出 CPU；persist 为 true 时同时写段文件
+static void run_pool(bool persist)
+{
+	Dota_Pool pool;
+	if (persist && !pool.enable_persist(g_persistDir))
+	{
+		fprintf(stderr, "打开目录 %s 失败\n", g_persistDir);
+		exit(1);
+	}
+	long total = g_count * g_producers;
+	long got = 0;
+
+	uint64_t start = now_ms();
+	std::vector<std::thread> producers;
+	for (int i = 0; i < g_producers; ++i)
+		producers.push_back(std::thread(produce<Dota_Pool>, std::ref(pool), i));
+
+	while (got < total)
+	{
+		Dota d = pool.pop();
+		if (d.getsign() == Dota_Nul)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		++got;
+	}
+	for (size_t i = 0; i < producers.size(); ++i)
+		producers[i].join();
+
+	uint64_t ms = now_ms() - start;
+	printf("%-28s %10.0f 条/秒  收到 %ld 条  队列不限长度\n", persist ? "Dota_Pool（持久化）" : "Dota_Pool（deque+mutex）",
+		   ms > 0 ? total * 1000.0 / ms : 0.0, got);
+
+	if (persist)
+	{
+		// 写完剩下的数据、msync 也算进去
+		pool.disable_persist();
+		printf("%-28s %10llu 毫秒  丢弃 %zu 条\n", "  关闭持久化（含 msync）", (unsigned long long)(now_ms() - start - ms),
+			   pool.persist_drop_count());
+	}
+}
+
+// 模拟重启：新的 Dota_Pool 只读打开段文件，直接在映射的内存上数出全部记录
+static void check_history()
+{
+	Dota_Pool pool;
+	uint64_t start = now_ms();
+	pool.enable_persist(g_persistDir);
+	long mats = 0, dats = 0;
+	double inf = std::numeric_limits<double>::infinity();
+	size_t n = pool.read_history(-inf, inf, [&mats, &dats](const Dota_Record *r, size_t cnt)
+	{
+		for (size_t i = 0; i < cnt; ++i)
+		{
+			if (r[i].sign == Dota_Mat)
+				++mats;
+			else
+				++dats;
+		}
+	});
+	printf("%-28s %10llu 毫秒  读到 %zu 条（Mat %ld，Dat %ld）\n", "  重新打开段文件", (unsigned long long)(now_ms() - start), n, mats, dats);
+}
+
+// 无锁的 Dota_Ring：消费者一次取一批，生产者全部结束、环也取空了才算完；丢数据的策略下收到的条数会少于放入的
+static void run_ring(int policy, const char *name)
+{
+	int mode = (g_producers == 1) ? Dota_SPSC : Dota_MPSC;
+	Dota_Ring<Dota> ring(g_capacity, policy, mode);
+	long total = g_count * g_producers;
+	long got = 0;
+	std::vector<Dota> buf(DOTA_BENCH_BATCH);
+	std::atomic<int> finished(0);
+
+	uint64_t start = now_ms();
+	std::vector<std::thread> producers;
+	for (int i = 0; i < g_producers; ++i)
+	{
+		producers.push_back(std::thread([&ring, &finished, i]()
+		{
+			produce(ring, i);
+			finished.fetch_add(1);
+		}));
+	}
+
+	while (true)
+	{
+		// 先看生产者是否都结束了，再取；取空了就说明全部取完了
+		bool last = (finished.load() == g_producers);
+		size_t n = ring.pop_batch(&buf[0], DOTA_BENCH_BATCH);
+		got += n;
+		if (n > 0)
+			continue;
+		if (last)
+			break;
+		std::this_thread::yield();
+	}
+	for (size_t i = 0; i < producers.size(); ++i)
+		producers[i].join();
+
+	uint64_t ms = now_ms() - start;
+	printf("%-28s %10.0f 条/秒  收到 %ld 条  丢弃 %zu 条  容量 %zu\n", name, ms > 0 ? total * 1000.0 / ms : 0.0, got,
+		   ring.drop_count(), ring.capacity());
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-n 每个生产者放入的条数] [-p 生产者线程数] [-c 环形数据池容量] [-d 持久化目录]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:p:c:d:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': g_count = atol(optarg); break;
+		case 'p': g_producers = atoi(optarg); break;
+		case 'c': g_capacity = (size_t)atol(optarg); break;
+		case 'd': g_persistDir = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (g_count <= 0 || g_producers <= 0 || g_capacity == 0)
+		usage(argv[0]);
+
+	printf("生产者 %d 个，每个放入 %ld 条（Mat、Dat 交替），消费者 1 个，Dota_Ring 每次最多取 %d 条\n", g_producers, g_count, DOTA_BENCH_BATCH);
+	run_pool(false);
+	if (g_persistDir != NULL)
+	{
+		run_pool(true);
+		check_history();
+	}
+	run_ring(Dota_Block, "Dota_Ring（满时阻塞）");
+	run_ring(Dota_Drop_Newest, "Dota_Ring（满时丢新数据）");
+	run_ring(Dota_Drop_Oldest, "Dota_Ring（满时丢旧数据）");
+	return 0;
+}
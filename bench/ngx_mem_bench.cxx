@@ -0,0 +1,247 @@
+// 本文件实现 CMemory 的吞吐测试，模拟服务器里内存的流转方式：
+// 收包线程申请消息内存放进队列，处理线程取出、释放，再申请应答放进发送队列，发送线程发完释放
+// 同样的流程分别用 new/delete（原来的 CMemory）和分级缓存的 CMemory 跑一遍，比较每秒处理的消息数
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+#include <vector>
+
+#include "ngx_comm.h"
+#include "ngx_c_memory.h"
+
+// 队列里一次搬多少条消息，和线程池一次取一批消息的做法一致，不让队列的锁成为瓶颈
+#define MEM_BENCH_BATCH 64
+// 消息头的大小，和 ngx_c_socket.h 中的 STRUC_MSG_HEADER 相同，这里不引入整个网络层的头文件
+#define MEM_BENCH_MSG_HEADER 48
+
+// ngx_c_memory.cxx 中用到的日志函数，压测程序不带日志模块，直接打到标准错误
+void ngx_log_stderr(int err, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	if (err != 0)
+		fprintf(stderr, " (%d: %s)", err, strerror(err));
+	fprintf(stderr, "\n");
+}
+
+// 取得单调时钟，单位：毫秒
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 两种分配方式
+static bool g_useCMemory = false;
+
+static void *bench_alloc(int size)
+{
+	if (g_useCMemory)
+		return CMemory::GetInstance()->AllocMemory(size, false);
+	return new char[size];
+}
+
+static void bench_free(void *p)
+{
+	if (g_useCMemory)
+		CMemory::GetInstance()->FreeMemory(p);
+	else
+		delete[] ((char *)p);
+}
+
+// 简单的多生产者多消费者队列，每个元素是一批消息
+struct bench_queue_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	std::vector<std::vector<char *> > items;
+	bool closed;
+
+	bench_queue_s() : closed(false)
+	{
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+
+	void push(std::vector<char *> &batch)
+	{
+		pthread_mutex_lock(&mutex);
+		items.push_back(std::vector<char *>());
+		items.back().swap(batch);
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	// 队列关闭且为空时返回 false
+	bool pop(std::vector<char *> &batch)
+	{
+		pthread_mutex_lock(&mutex);
+		while (items.empty() && !closed)
+			pthread_cond_wait(&cond, &mutex);
+		if (items.empty())
+		{
+			pthread_mutex_unlock(&mutex);
+			return false;
+		}
+		batch.swap(items.back());
+		items.pop_back();
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+
+	void close()
+	{
+		pthread_mutex_lock(&mutex);
+		closed = true;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+};
+
+static bench_queue_s g_recvQueue;
+static bench_queue_s g_sendQueue;
+static long g_msgCount = 1000000;
+
+// 收包线程申请的消息大小：大部分是几十到几百字节的小包，少量接近最大包长，另外是整块收包缓冲区
+static int msg_size(unsigned int r)
+{
+	int header = MEM_BENCH_MSG_HEADER + sizeof(COMM_PKG_HEADER);
+	unsigned int k = r % 100;
+	if (k < 70)
+		return header + 16 + (r >> 8) % 240;
+	if (k < 90)
+		return header + 256 + (r >> 8) % 1800;
+	if (k < 98)
+		return header + 2048 + (r >> 8) % (_PKG_MAX_LENGTH - 3048);
+	return MEM_BENCH_MSG_HEADER + 16384;
+}
+
+static void *recv_thread(void *)
+{
+	unsigned int seed = 12345;
+	std::vector<char *> batch;
+	for (long i = 0; i < g_msgCount; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		char *p = (char *)bench_alloc(msg_size(seed));
+		// 写一下内存，和收包时拷贝数据一样让内存真正被用到
+		p[0] = (char)i;
+		batch.push_back(p);
+		if (batch.size() == MEM_BENCH_BATCH)
+			g_recvQueue.push(batch);
+	}
+	if (!batch.empty())
+		g_recvQueue.push(batch);
+	g_recvQueue.close();
+	return NULL;
+}
+
+static void *work_thread(void *)
+{
+	std::vector<char *> batch, replies;
+	int replySize = MEM_BENCH_MSG_HEADER + sizeof(COMM_PKG_HEADER) + 64;
+	while (g_recvQueue.pop(batch))
+	{
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			char *pReply = (char *)bench_alloc(replySize);
+			pReply[0] = batch[i][0];
+			bench_free(batch[i]);
+			replies.push_back(pReply);
+		}
+		batch.clear();
+		g_sendQueue.push(replies);
+	}
+	return NULL;
+}
+
+static void *send_thread(void *)
+{
+	std::vector<char *> batch;
+	while (g_sendQueue.pop(batch))
+	{
+		for (size_t i = 0; i < batch.size(); ++i)
+			bench_free(batch[i]);
+		batch.clear();
+	}
+	return NULL;
+}
+
+// 跑一轮，返回每秒处理的消息数
+static double run_once(int workers)
+{
+	g_recvQueue.closed = false;
+	g_sendQueue.closed = false;
+
+	uint64_t start = now_ms();
+	pthread_t recvTid, sendTid;
+	std::vector<pthread_t> workTids(workers);
+	pthread_create(&sendTid, NULL, send_thread, NULL);
+	for (int i = 0; i < workers; ++i)
+		pthread_create(&workTids[i], NULL, work_thread, NULL);
+	pthread_create(&recvTid, NULL, recv_thread, NULL);
+
+	pthread_join(recvTid, NULL);
+	for (int i = 0; i < workers; ++i)
+		pthread_join(workTids[i], NULL);
+	g_sendQueue.close();
+	pthread_join(sendTid, NULL);
+
+	uint64_t ms = now_ms() - start;
+	return ms > 0 ? g_msgCount * 1000.0 / ms : 0.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-n 消息数] [-t 处理线程数] [-r 每种方式跑几轮]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int workers = 4;
+	int rounds = 3;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': g_msgCount = atol(optarg); break;
+		case 't': workers = atoi(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (g_msgCount <= 0 || workers <= 0 || rounds <= 0)
+		usage(argv[0]);
+
+	// 单例第一次调用放在主线程
+	CMemory::GetInstance();
+
+	printf("收包线程 1 个，处理线程 %d 个，发送线程 1 个，每轮 %ld 条消息\n", workers, g_msgCount);
+	const char *names[2] = {"new/delete", "CMemory"};
+	for (int m = 0; m < 2; ++m)
+	{
+		g_useCMemory = (m == 1);
+		double best = 0;
+		for (int r = 0; r < rounds; ++r)
+		{
+			double v = run_once(workers);
+			best = (v > best) ? v : best;
+		}
+		printf("%-12s %10.0f 条消息/秒（%d 轮中最好的一轮）\n", names[m], best, rounds);
+	}
+
+	return 0;
+}
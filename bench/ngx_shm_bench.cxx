@@ -0,0 +1,185 @@
+// 本文件实现共享内存通道的压测客户端：建立若干个通道，每个通道上保持固定数量的在途心跳包，统计吞吐和往返时延
+// 输出格式和 ngx_bench_client 一样，方便和 TCP、AF_UNIX 对比
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "ngx_comm.h"
+#include "ngx_logiccomm.h"
+#include "ngx_shm_client.h"
+
+// 一个压测通道
+struct bench_chan
+{
+	CShmClient client;
+	// 在途请求的发送时间，先进先出，服务器按序应答
+	std::deque<uint64_t> sendtimes;
+	// 还没放进环里的请求数，环满时先欠着
+	int owed;
+	bool broken;
+};
+
+// 取得单调时钟，单位：微秒
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 尽量把欠着的心跳包都发出去
+static void send_pings(bench_chan *c)
+{
+	COMM_PKG_HEADER pkg;
+	pkg.pkgLen = htons(sizeof(COMM_PKG_HEADER));
+	pkg.msgCode = htons(_CMD_PING);
+	pkg.crc32 = 0;
+
+	while (c->owed > 0 && c->client.Send(&pkg, sizeof(pkg)))
+	{
+		c->sendtimes.push_back(now_us());
+		--c->owed;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-u unix路径] [-c 通道数] [-d 秒数] [-P 每通道在途包数] [-t 标签]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = "/tmp/ngx_shm.sock";
+	int nchan = 1;
+	int seconds = 10;
+	int pipeline = 1;
+	const char *tag = "";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "u:c:d:P:t:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'u': path = optarg; break;
+		case 'c': nchan = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'P': pipeline = atoi(optarg); break;
+		case 't': tag = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nchan <= 0 || seconds <= 0 || pipeline <= 0)
+		usage(argv[0]);
+
+	int ep = epoll_create1(0);
+	std::vector<bench_chan *> chans;
+	for (int i = 0; i < nchan; ++i)
+	{
+		bench_chan *c = new bench_chan;
+		if (!c->client.Open(path))
+		{
+			fprintf(stderr, "第 %d 个通道建立失败: %s\n", i, strerror(errno));
+			return 1;
+		}
+		c->owed = pipeline;
+		c->broken = false;
+		chans.push_back(c);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(ep, EPOLL_CTL_ADD, c->client.GetNotifyFd(), &ev);
+	}
+
+	// 每个通道先把在途包填满
+	for (size_t i = 0; i < chans.size(); ++i)
+		send_pings(chans[i]);
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(1 << 20);
+	uint64_t replies = 0;
+	int broken = 0;
+	uint64_t start = now_us();
+	uint64_t deadline = start + (uint64_t)seconds * 1000000;
+	struct epoll_event events[512];
+	char buf[_PKG_MAX_LENGTH];
+
+	while (now_us() < deadline)
+	{
+		// 把所有通道的应答收完
+		bool progress = false;
+		for (size_t i = 0; i < chans.size(); ++i)
+		{
+			bench_chan *c = chans[i];
+			if (c->broken)
+				continue;
+
+			int r;
+			while ((r = c->client.Recv(buf, sizeof(buf))) > 0)
+			{
+				uint64_t t = now_us();
+				if (!c->sendtimes.empty())
+				{
+					latencies.push_back((uint32_t)(t - c->sendtimes.front()));
+					c->sendtimes.pop_front();
+				}
+				++replies;
+				++c->owed;
+				progress = true;
+			}
+			if (r < 0)
+			{
+				c->broken = true;
+				++broken;
+				continue;
+			}
+			send_pings(c);
+		}
+		if (progress)
+			continue;
+
+		// 都没有应答了才去睡，睡之前再确认一遍
+		bool idle = true;
+		for (size_t i = 0; i < chans.size() && idle; ++i)
+		{
+			if (!chans[i]->broken && !chans[i]->client.PrepareWait())
+				idle = false;
+		}
+		if (!idle)
+			continue;
+
+		int n = epoll_wait(ep, events, 512, 100);
+		for (int i = 0; i < n; ++i)
+			((bench_chan *)events[i].data.ptr)->client.ClearNotify();
+	}
+
+	double elapsed = (now_us() - start) / 1000000.0;
+	std::sort(latencies.begin(), latencies.end());
+	uint32_t p50 = 0, p99 = 0, p999 = 0;
+	if (!latencies.empty())
+	{
+		p50 = latencies[latencies.size() * 50 / 100];
+		p99 = latencies[latencies.size() * 99 / 100];
+		p999 = latencies[latencies.size() * 999 / 1000];
+	}
+
+	printf("%s 通道=%d 在途=%d 时长=%.1fs 应答=%llu 吞吐=%.0f/s p50=%uus p99=%uus p99.9=%uus 断开=%d\n",
+		   tag, nchan, pipeline, elapsed, (unsigned long long)replies, replies / elapsed, p50, p99, p999, broken);
+
+	for (size_t i = 0; i < chans.size(); ++i)
+		delete chans[i];
+	close(ep);
+	return 0;
+}
@@ -0,0 +1,202 @@
+// 本文件实现时序数据仓库的查询测试：同样的样本一份按 Dota 的方式逐条存放（每条同时带着 Mat 和 Dat），
+// 一份存进按列存储的 CDotaStore，随机取时间范围按窗口求 steer 的最小、最大、均值和分位数，比较每秒能做多少次查询，
+// 并核对两边结果一致；最后给出客户端拉取原始样本和只拉取聚合结果各要传多少字节
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "ngx_comm.h"
+#include "ngx_logiccomm.h"
+#include "ngx_c_dotastore.h"
+
+// 和 Dota 的成员布局相同：类型标识，Mat 的时间戳，Dat 的方向、速度、时间戳
+struct bench_dota
+{
+	int sign;
+	double mat_time;
+	double steer;
+	double speed;
+	double dat_time;
+};
+
+// 取得单调时钟，单位：微秒
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long g_samples = 2000000;
+static long g_queries = 200;
+static int g_windows = 60;
+static int g_permille = 990;
+// 每次查询覆盖全部时间的几分之一
+static int g_span = 10;
+
+// 逐条扫描：Dota_Pool 没有按时间查找的办法，只能从头看到尾，挑出落在窗口里的 Dat
+static void aggregate_rows(const std::vector<bench_dota> &rows, double tBegin, double tEnd, ngx_dota_window_t *pOut)
+{
+	double width = (tEnd - tBegin) / g_windows;
+	std::vector<std::vector<double> > values(g_windows);
+	for (int i = 0; i < g_windows; ++i)
+	{
+		pOut[i].tBegin = tBegin + width * i;
+		pOut[i].iDatCount = pOut[i].iMatCount = 0;
+		pOut[i].min = pOut[i].max = pOut[i].mean = pOut[i].percentile = 0;
+	}
+	for (size_t k = 0; k < rows.size(); ++k)
+	{
+		bool dat = (rows[k].sign == NGX_DOTA_DAT);
+		double t = dat ? rows[k].dat_time : rows[k].mat_time;
+		if (t < tBegin || t >= tEnd)
+			continue;
+		// 和 CDotaStore 的窗口边界算法相同
+		int w = (int)((t - tBegin) / width);
+		while (w > 0 && t < tBegin + width * w)
+			--w;
+		while (w < g_windows - 1 && t >= tBegin + width * (w + 1))
+			++w;
+		if (!dat)
+		{
+			pOut[w].iMatCount++;
+			continue;
+		}
+		values[w].push_back(rows[k].steer);
+	}
+	for (int i = 0; i < g_windows; ++i)
+	{
+		std::vector<double> &v = values[i];
+		size_t n = v.size();
+		pOut[i].iDatCount = n;
+		if (n == 0)
+			continue;
+		double sum = 0;
+		pOut[i].min = pOut[i].max = v[0];
+		for (size_t k = 0; k < n; ++k)
+		{
+			pOut[i].min = std::min(pOut[i].min, v[k]);
+			pOut[i].max = std::max(pOut[i].max, v[k]);
+			sum += v[k];
+		}
+		pOut[i].mean = sum / n;
+		size_t rank = ((size_t)g_permille * n + 999) / 1000;
+		rank = (rank < 1) ? 1 : rank;
+		std::nth_element(v.begin(), v.begin() + (rank - 1), v.end());
+		pOut[i].percentile = v[rank - 1];
+	}
+}
+
+static bool same_window(const ngx_dota_window_t &a, const ngx_dota_window_t &b)
+{
+	if (a.iDatCount != b.iDatCount || a.iMatCount != b.iMatCount)
+		return false;
+	if (a.min != b.min || a.max != b.max || a.percentile != b.percentile)
+		return false;
+	// 求和的顺序不同，均值只要求足够接近
+	return fabs(a.mean - b.mean) <= 1e-9 * (fabs(a.mean) + 1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "用法: %s [-n 样本数] [-q 查询次数] [-w 每次查询的窗口数] [-p 分位数（千分之几）] [-s 查询范围为全部时间的几分之一]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:q:w:p:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': g_samples = atol(optarg); break;
+		case 'q': g_queries = atol(optarg); break;
+		case 'w': g_windows = atoi(optarg); break;
+		case 'p': g_permille = atoi(optarg); break;
+		case 's': g_span = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (g_samples <= 0 || g_queries <= 0 || g_windows <= 0 || g_windows > _DOTA_MAX_WINDOWS || g_permille < 0 || g_permille > 1000 || g_span <= 0)
+		usage(argv[0]);
+
+	// 每 10 毫秒一个样本，每 4 个里有 1 个 Mat；少量样本迟到，时间戳比前一个早
+	std::vector<bench_dota> rows(g_samples);
+	std::vector<ngx_dota_sample_t> samples(g_samples);
+	unsigned int seed = 12345;
+	for (long i = 0; i < g_samples; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		double t = i * 0.01;
+		if ((seed >> 8) % 100 == 0)
+			t -= 0.05;
+		bench_dota &r = rows[i];
+		r.sign = ((seed >> 16) % 4 == 0) ? NGX_DOTA_MAT : NGX_DOTA_DAT;
+		r.mat_time = r.dat_time = t;
+		r.steer = sin(i * 0.001) * 30 + (double)((seed >> 4) % 1000) / 100;
+		r.speed = 20 + (double)((seed >> 12) % 4000) / 100;
+		samples[i].sign = r.sign;
+		samples[i].time_stamp = t;
+		samples[i].steer = r.steer;
+		samples[i].speed = r.speed;
+	}
+
+	CDotaStore store;
+	store.Init(0);
+	uint64_t start = now_us();
+	// 按上传的方式每批 1000 个写入
+	for (long i = 0; i < g_samples; i += 1000)
+		store.Append(&samples[i], std::min(1000L, g_samples - i));
+	uint64_t appendUs = now_us() - start;
+	printf("样本 %ld 个（Dat %zu，Mat %zu），写入 CDotaStore 用时 %.1f 毫秒\n", g_samples, store.DatSize(), store.MatSize(), appendUs / 1000.0);
+
+	// 预先定好每次查询的范围，两边查同样的范围
+	double total = g_samples * 0.01;
+	double span = total / g_span;
+	std::vector<double> begins(g_queries);
+	for (long q = 0; q < g_queries; ++q)
+	{
+		seed = seed * 1103515245 + 12345;
+		begins[q] = (total - span) * ((seed >> 8) % 10000) / 10000.0;
+	}
+
+	std::vector<ngx_dota_window_t> rowOut(g_windows), colOut(g_windows);
+	size_t mismatch = 0;
+	uint64_t rowUs = 0, colUs = 0;
+	unsigned long long rawBytes = 0;
+	for (long q = 0; q < g_queries; ++q)
+	{
+		start = now_us();
+		aggregate_rows(rows, begins[q], begins[q] + span, &rowOut[0]);
+		rowUs += now_us() - start;
+
+		start = now_us();
+		store.Aggregate(begins[q], begins[q] + span, g_windows, NGX_DOTA_COL_STEER, g_permille, &colOut[0]);
+		colUs += now_us() - start;
+
+		for (int i = 0; i < g_windows; ++i)
+		{
+			if (!same_window(rowOut[i], colOut[i]))
+				++mismatch;
+			rawBytes += (rowOut[i].iDatCount + rowOut[i].iMatCount) * sizeof(STRUCT_DOTA_SAMPLE);
+		}
+	}
+
+	printf("每次查询覆盖 1/%d 的时间，分 %d 个窗口，取千分之 %d 分位数，共 %ld 次\n", g_span, g_windows, g_permille, g_queries);
+	printf("%-26s %10.1f 次/秒\n", "逐条扫描（Dota 方式）", rowUs > 0 ? g_queries * 1000000.0 / rowUs : 0.0);
+	printf("%-26s %10.1f 次/秒\n", "按列存储（CDotaStore）", colUs > 0 ? g_queries * 1000000.0 / colUs : 0.0);
+	printf("结果不一致的窗口 %zu 个\n", mismatch);
+
+	size_t aggBytes = sizeof(COMM_PKG_HEADER) + sizeof(STRUCT_DOTA_QUERY) + g_windows * sizeof(STRUCT_DOTA_WINDOW);
+	printf("每次查询传输：原始样本平均 %llu 字节，聚合结果 %zu 字节\n", rawBytes / g_queries, aggBytes);
+	return mismatch == 0 ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+// 本文件实现共享内存通道的客户端库
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+
+#include "ngx_comm.h"
+#include "ngx_shm_client.h"
+
+CShmClient::CShmClient()
+{
+	m_sock = -1;
+	m_efdToServer = -1;
+	m_efdFromServer = -1;
+	m_area = NULL;
+	m_areaSize = 0;
+	m_ringSize = 0;
+}
+
+CShmClient::~CShmClient()
+{
+	Close();
+}
+
+bool CShmClient::Open(const char *path, uint32_t ringSize)
+{
+	if (m_sock != -1)
+		return false;
+	if (ringSize < NGX_SHM_RING_MIN || ringSize > NGX_SHM_RING_MAX || (ringSize & (ringSize - 1)) != 0)
+		return false;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path, path);
+
+	// 共享内存不需要名字，句柄交给服务器就行
+	int memfd = memfd_create("ngx_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd == -1)
+		return false;
+
+	// 定好大小后封住，服务器只接受封住了大小的共享内存，这样它映射之后不会因为共享内存变小而访问越界
+	m_areaSize = ngx_shm_area_size(ringSize);
+	if (ftruncate(memfd, m_areaSize) == -1 ||
+		fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+	{
+		close(memfd);
+		return false;
+	}
+	void *p = mmap(NULL, m_areaSize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (p == MAP_FAILED)
+	{
+		close(memfd);
+		return false;
+	}
+	m_area = (ngx_shm_area_t *)p;
+	m_ringSize = ringSize;
+	ngx_shm_area_init(m_area, ringSize);
+
+	// 服务器把客户端写的 eventfd 设为非阻塞，文件状态是两边共用的，这里直接创建成非阻塞的
+	m_efdToServer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	m_efdFromServer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	m_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_efdToServer == -1 || m_efdFromServer == -1 || m_sock == -1 ||
+		connect(m_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		close(memfd);
+		Close();
+		return false;
+	}
+
+	// 三个句柄的顺序：共享内存、客户端写服务器读的 eventfd、服务器写客户端读的 eventfd
+	int fds[3] = {memfd, m_efdToServer, m_efdFromServer};
+	char flag = 0;
+	struct iovec iov;
+	iov.iov_base = &flag;
+	iov.iov_len = 1;
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} ctrl;
+	memset(&ctrl, 0, sizeof(ctrl));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t n = sendmsg(m_sock, &msg, MSG_NOSIGNAL);
+	// 服务器已经映射了共享内存，这个句柄没用了
+	close(memfd);
+
+	// 等服务器确认，收到 0 才算建立成功
+	if (n != 1 || recv(m_sock, &flag, 1, 0) != 1 || flag != 0)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void CShmClient::Close()
+{
+	if (m_sock != -1)
+		close(m_sock);
+	if (m_efdToServer != -1)
+		close(m_efdToServer);
+	if (m_efdFromServer != -1)
+		close(m_efdFromServer);
+	if (m_area != NULL)
+		munmap(m_area, m_areaSize);
+
+	m_sock = m_efdToServer = m_efdFromServer = -1;
+	m_area = NULL;
+	m_areaSize = 0;
+	m_ringSize = 0;
+}
+
+bool CShmClient::Send(const void *pkg, uint32_t len)
+{
+	if (m_area == NULL || ngx_shm_ring_write(m_area, m_ringSize, NGX_SHM_RING_C2S, pkg, len) != 1)
+		return false;
+
+	// 服务器正在读环时不用唤醒，读完之前它会看到这个包
+	if (ngx_shm_ring_need_wakeup(m_area, NGX_SHM_RING_C2S))
+	{
+		uint64_t one = 1;
+		if (write(m_efdToServer, &one, sizeof(one)) == -1 && errno != EAGAIN)
+			return false;
+	}
+	return true;
+}
+
+int CShmClient::Recv(void *buf, uint32_t len)
+{
+	if (m_area == NULL)
+		return -1;
+
+	uint32_t used = ngx_shm_ring_used(m_area, NGX_SHM_RING_S2C);
+	if (used == 0)
+		return 0;
+	if (used < sizeof(COMM_PKG_HEADER) || used > m_ringSize)
+		return -1;
+
+	// 服务器总是整包写入，环里不会有半个包
+	COMM_PKG_HEADER pkgHeader;
+	ngx_shm_ring_peek(m_area, m_ringSize, NGX_SHM_RING_S2C, 0, &pkgHeader, sizeof(pkgHeader));
+	uint32_t pkglen = ntohs(pkgHeader.pkgLen);
+	if (pkglen < sizeof(COMM_PKG_HEADER) || pkglen > used || pkglen > len)
+		return -1;
+
+	ngx_shm_ring_peek(m_area, m_ringSize, NGX_SHM_RING_S2C, 0, buf, pkglen);
+	ngx_shm_ring_consume(m_area, NGX_SHM_RING_S2C, pkglen);
+	return (int)pkglen;
+}
+
+bool CShmClient::PrepareWait()
+{
+	return m_area != NULL && ngx_shm_ring_prepare_wait(m_area, NGX_SHM_RING_S2C);
+}
+
+void CShmClient::ClearNotify()
+{
+	uint64_t counter;
+	if (read(m_efdFromServer, &counter, sizeof(counter)) == -1)
+	{
+		// 非阻塞的，没有通知就算了
+	}
+}
+
+int CShmClient::Wait(int timeout)
+{
+	if (!PrepareWait())
+		return 1;
+
+	// 同时等 AF_UNIX 连接，服务器关闭通道时它会可读
+	struct pollfd pfds[2];
+	pfds[0].fd = m_efdFromServer;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = m_sock;
+	pfds[1].events = POLLIN;
+
+	int n = poll(pfds, 2, timeout);
+	if (n <= 0)
+		return (n == 0 || errno == EINTR) ? 0 : -1;
+	if (pfds[1].revents != 0)
+		return -1;
+
+	ClearNotify();
+	return 1;
+}
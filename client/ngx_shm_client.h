@@ -0,0 +1,52 @@
+// 本文件声明共享内存通道的客户端库：和服务器在同一台机器上的服务用它连上 ShmListenPath，
+// 之后收发包都只是读写共享内存中的环，只有对方准备睡眠时才写 eventfd 唤醒
+
+#ifndef __NGX_SHM_CLIENT_H__
+#define __NGX_SHM_CLIENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ngx_shm_ring.h"
+
+// 一个共享内存通道，不是线程安全的：同一时刻只能有一个线程发、一个线程收
+class CShmClient
+{
+public:
+	CShmClient();
+	~CShmClient();
+
+public:
+	// 建立通道：创建共享内存和两个 eventfd，通过 AF_UNIX 连接交给服务器，等服务器确认；ringSize 是每个方向环的大小，必须是 2 的幂
+	bool Open(const char *path, uint32_t ringSize = 1024 * 1024);
+	// 关闭通道，服务器通过 AF_UNIX 连接断开得知
+	void Close();
+
+	// 发送一个包（包头+包体，包头中的长度是网络序），环满了、包比环还大或者环的读位置被写坏了返回 false，什么也不发
+	bool Send(const void *pkg, uint32_t len);
+	// 取一个应答包，返回包长度；没有应答返回 0；buf 装不下或者数据不对返回 -1
+	int Recv(void *buf, uint32_t len);
+
+	// 准备等待应答：返回 true 表示确实没有应答，可以去等 GetNotifyFd() 可读；返回 false 表示又有了应答
+	bool PrepareWait();
+	// 服务器有应答时可读的 eventfd，可以放到调用者自己的 epoll 里；可读后调用 ClearNotify()
+	int GetNotifyFd() const { return m_efdFromServer; }
+	void ClearNotify();
+	// 没有应答时等待最多 timeout 毫秒，返回 1 表示可能有应答，0 超时，-1 服务器断开
+	int Wait(int timeout);
+
+private:
+	// 握手用的 AF_UNIX 连接
+	int m_sock;
+	// 客户端写、服务器读的 eventfd
+	int m_efdToServer;
+	// 服务器写、客户端读的 eventfd
+	int m_efdFromServer;
+	// 共享内存
+	ngx_shm_area_t *m_area;
+	size_t m_areaSize;
+	// 环的大小，服务器也能写共享内存，不用其中的 ringSize
+	uint32_t m_ringSize;
+};
+
+#endif
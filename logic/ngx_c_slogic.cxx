@@ -13,6 +13,7 @@
 #include <sys/ioctl.h> //ioctl
 #include <pthread.h>   //多线程
 #include <arpa/inet.h>
+#include <cmath>       //std::isfinite
 // #include <sys/socket.h>
 
 #include "ngx_c_conf.h"
@@ -50,6 +51,8 @@ static const handler statusHandler[] =
         // 开始处理具体的业务逻辑
         &CLogicSocket::_HandleRegister, // 【5】：实现具体的注册功能
         &CLogicSocket::_HandleLogIn,    // 【6】：实现具体的登录功能
+        &CLogicSocket::_HandleDotaPush, // 【7】：上传 Mat、Dat 样本
+        &CLogicSocket::_HandleDotaQuery, // 【8】：按时间窗口查询样本的聚合结果
 
 };
 
@@ -80,21 +83,50 @@ bool CLogicSocket::Initialize()
     // 做一些和本类相关的初始化工作
     //....日后根据需要扩展
     bool bParentInit = CSocekt::Initialize(); // 调用父类的同名函数
+
+    // 数据仓库中 Mat、Dat 各自最多保留的样本数，0 表示不限制
+    CConfig *p_config = CConfig::GetInstance();
+    int maxSamples = p_config->GetIntDefault("Dota_MaxSamples", NGX_DOTA_MAX_SAMPLES);
+    m_dotaStore.Init(maxSamples > 0 ? (size_t)maxSamples : 0);
     return bParentInit;
 }
 
 /***************************************************************
  *  @brief     处理收到的完整消息
- *  @param     pMsgBuf 收到的完整消息，消息头 + 包头 + 包体
- *  @return    返回值
- *  @note      由线程池中的一个线程调用本函数，本函数在一个单独线程内执行
+ *  @param     pMsgBuf 收到的完整消息，消息头 + 若干个连续存放的（包头 + 包体）
+ *  @note      由线程池中的一个线程调用本函数，本函数在一个单独线程内执行；
+ *             同一条消息中的包来自同一个连接，按收到的顺序逐个处理
  **************************************************************/
 void CLogicSocket::threadRecvProcFunc(char *pMsgBuf)
 {
     // 取出消息中的消息头
     LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
-    // 取出消息中的包头
-    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(pMsgBuf + m_iLenMsgHeader);
+    // 指向当前处理的包
+    char *pPkg = pMsgBuf + m_iLenMsgHeader;
+    // 当前包的长度，拆包时已经检查过
+    unsigned short pkglen;
+
+    for (unsigned int i = 0; i < pMsgHeader->iPkgCount; ++i)
+    {
+        // 处理过程中会改动包头内容，先把包长取出来
+        pkglen = ntohs(((LPCOMM_PKG_HEADER)pPkg)->pkgLen);
+        threadRecvProcPkg(pMsgHeader, pPkg);
+        pPkg += pkglen;
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     处理消息中的一个完整数据包
+ *  @param     pMsgHeader 包所在消息的消息头
+ *  @param     pPkg 包头 + 包体
+ *  @note      包不合法、连接已失效等情况直接丢弃该包
+ **************************************************************/
+void CLogicSocket::threadRecvProcPkg(LPSTRUC_MSG_HEADER pMsgHeader, char *pPkg)
+{
+    // 取出包头
+    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)pPkg;
     // 指向包体的指针
     void *pPkgBody;
     // 取出包头中的包长数据
@@ -118,8 +150,8 @@ void CLogicSocket::threadRecvProcFunc(char *pMsgBuf)
     {
         // 将 CRC 码转为主机序
         pPkgHeader->crc32 = ntohl(pPkgHeader->crc32);
-        // 包体指针跳过消息头和包头大小，指向包体内存
-        pPkgBody = (void *)(pMsgBuf + m_iLenMsgHeader + m_iLenPkgHeader);
+        // 包体指针跳过包头大小，指向包体内存
+        pPkgBody = (void *)(pPkg + m_iLenPkgHeader);
 
         // ngx_log_stderr(0,"CLogicSocket::threadRecvProcFunc()中收到包的crc值为%d!",pPkgHeader->crc32);
 
@@ -160,7 +192,7 @@ void CLogicSocket::threadRecvProcFunc(char *pMsgBuf)
     if (imsgCode >= AUTH_TOTAL_COMMANDS)
     {
         // 消息码不在规定范围内，输出恶意信息来源
-        ngx_log_stderr(0, "CLogicSocket::threadRecvProcFunc()中imsgCode=%d消息码不对!", imsgCode);
+        ngx_log_stderr(0, "CLogicSocket::threadRecvProcPkg()中imsgCode=%d消息码不对!", imsgCode);
         // 不处理，直接返回
         return;
     }
@@ -169,7 +201,7 @@ void CLogicSocket::threadRecvProcFunc(char *pMsgBuf)
     if (statusHandler[imsgCode] == NULL)
     {
         // 消息码没有对应的处理函数，输出恶意信息来源
-        ngx_log_stderr(0, "CLogicSocket::threadRecvProcFunc()中imsgCode=%d消息码找不到对应的处理函数!", imsgCode);
+        ngx_log_stderr(0, "CLogicSocket::threadRecvProcPkg()中imsgCode=%d消息码找不到对应的处理函数!", imsgCode);
         // 无处理函数，直接返回
         return;
     }
@@ -218,10 +250,10 @@ bool CLogicSocket::_HandleRegister(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER
     // 比如以网游为例，用户要在商店中买A物品，又买B物品，而用户的钱 只够买A或者B，不够同时买A和B呢？
     // 那如果用户发送购买命令过来买了一次A，又买了一次B，如果是两个线程来执行同一个用户的这两次不同的购买命令，
     // 很可能造成这个用户购买成功了 A，又购买成功了 B
-    // 所以，为了稳妥起见，针对某个用户的命令，我们一般都要互斥,我们需要增加临界的变量于ngx_connection_s结构中
+    // 所以，为了稳妥起见，针对某个用户的命令，我们一般都要互斥,我们需要按连接加锁，见 ngx_connection_s::logicMutex
 
     // 凡是和本用户有关的访问都互斥
-    CLock lock(&pConn->logicPorcMutex);
+    CFutexLock lock(&pConn->logicMutex);
 
     // 获取包体信息
     LPSTRUCT_REGISTER p_RecvInfo = (LPSTRUCT_REGISTER)pPkgBody;
@@ -334,7 +366,7 @@ bool CLogicSocket::_HandleLogIn(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMs
     {
         return false;
     }
-    CLock lock(&pConn->logicPorcMutex);
+    CFutexLock lock(&pConn->logicMutex);
 
     LPSTRUCT_LOGIN p_RecvInfo = (LPSTRUCT_LOGIN)pPkgBody;
     p_RecvInfo->username[sizeof(p_RecvInfo->username) - 1] = 0;
@@ -375,7 +407,7 @@ bool CLogicSocket::_HandlePing(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsg
         return false;
 
     // 访问本用户连接，需要互斥
-    CLock lock(&pConn->logicPorcMutex);
+    CFutexLock lock(&pConn->logicMutex);
     // 更新最新的心跳包发送时间
     pConn->lastPingTime = time(NULL);
 
@@ -387,6 +419,155 @@ bool CLogicSocket::_HandlePing(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsg
     return true;
 }
 
+/***************************************************************
+ *  @brief     上传一批 Mat、Dat 样本，存入按列存储的数据仓库
+ *  @param     pConn    连接池中连接的指针
+ *  @param     pMsgHeader    消息头指针
+ *  @param     pPkgBody    包体指针
+ *  @param     iBodyLength    包体长度
+ *  @return    true: 正确处理返回 false: 无效包信息，不处理
+ *  @note      包体为 STRUCT_DOTA_PUSH 后跟 iCount 个 STRUCT_DOTA_SAMPLE，应答包体为 STRUCT_DOTA_PUSH_RESULT；
+ *             样本用到的值有 NaN、无穷大时整批拒收，否则它们会打乱按时间的排序、污染聚合结果
+ **************************************************************/
+bool CLogicSocket::_HandleDotaPush(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength)
+{
+    // 数据仓库不属于哪个连接，用不到 pConn
+    (void)pConn;
+
+    if (pPkgBody == NULL || iBodyLength < sizeof(STRUCT_DOTA_PUSH))
+    {
+        return false;
+    }
+
+    // 样本个数和包体长度必须对得上
+    LPSTRUCT_DOTA_PUSH p_RecvInfo = (LPSTRUCT_DOTA_PUSH)pPkgBody;
+    int iCount = ntohl(p_RecvInfo->iCount);
+    if (iCount <= 0 || iBodyLength != sizeof(STRUCT_DOTA_PUSH) + iCount * sizeof(STRUCT_DOTA_SAMPLE))
+    {
+        return false;
+    }
+
+    // 转成主机序的样本，每个线程一份，反复使用
+    static thread_local std::vector<ngx_dota_sample_t> t_samples;
+    t_samples.resize(iCount);
+
+    int iResult = _DOTA_PUSH_OK;
+    int iBadIndex = -1;
+    LPSTRUCT_DOTA_SAMPLE p_sample = (LPSTRUCT_DOTA_SAMPLE)(pPkgBody + sizeof(STRUCT_DOTA_PUSH));
+    for (int i = 0; i < iCount; ++i)
+    {
+        t_samples[i].sign = ntohl(p_sample[i].iSign);
+        t_samples[i].time_stamp = ngx_ntohd(p_sample[i].time_stamp);
+        t_samples[i].steer = ngx_ntohd(p_sample[i].steer);
+        t_samples[i].speed = ngx_ntohd(p_sample[i].speed);
+
+        // Mat 只用时间戳，Dat 三个值都用
+        if (!std::isfinite(t_samples[i].time_stamp) ||
+            (t_samples[i].sign == NGX_DOTA_DAT && (!std::isfinite(t_samples[i].steer) || !std::isfinite(t_samples[i].speed))))
+        {
+            iResult = _DOTA_PUSH_NONFINITE;
+            iBadIndex = i;
+            break;
+        }
+    }
+
+    // 数据仓库自己有读写锁，不和本连接的其他命令互斥，整批只取一次写锁
+    if (iResult == _DOTA_PUSH_OK)
+    {
+        m_dotaStore.Append(&t_samples[0], iCount);
+    }
+
+    CMemory *p_memory = CMemory::GetInstance();
+    CCRC32 *p_crc32 = CCRC32::GetInstance();
+
+    int iSendLen = sizeof(STRUCT_DOTA_PUSH_RESULT);
+    char *p_sendbuf = (char *)p_memory->AllocMemory(m_iLenMsgHeader + m_iLenPkgHeader + iSendLen, false);
+    memcpy(p_sendbuf, pMsgHeader, m_iLenMsgHeader);
+    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(p_sendbuf + m_iLenMsgHeader);
+    pPkgHeader->msgCode = htons(_CMD_DOTA_PUSH);
+    pPkgHeader->pkgLen = htons(m_iLenPkgHeader + iSendLen);
+
+    LPSTRUCT_DOTA_PUSH_RESULT p_sendInfo = (LPSTRUCT_DOTA_PUSH_RESULT)(p_sendbuf + m_iLenMsgHeader + m_iLenPkgHeader);
+    p_sendInfo->iResult = htonl(iResult);
+    p_sendInfo->iBadIndex = htonl(iBadIndex);
+
+    pPkgHeader->crc32 = p_crc32->Get_CRC((unsigned char *)p_sendInfo, iSendLen);
+    pPkgHeader->crc32 = htonl(pPkgHeader->crc32);
+
+    msgSend(p_sendbuf);
+    return true;
+}
+
+/***************************************************************
+ *  @brief     按时间窗口查询一列的最小、最大、均值和分位数
+ *  @param     pConn    连接池中连接的指针
+ *  @param     pMsgHeader    消息头指针
+ *  @param     pPkgBody    包体指针
+ *  @param     iBodyLength    包体长度
+ *  @return    true: 正确处理返回 false: 无效包信息，不处理
+ *  @note      应答包体为原样返回的 STRUCT_DOTA_QUERY 后跟 iWindows 个 STRUCT_DOTA_WINDOW，
+ *             客户端不必拉取原始样本再自己聚合
+ **************************************************************/
+bool CLogicSocket::_HandleDotaQuery(lpngx_connection_t pConn, LPSTRUC_MSG_HEADER pMsgHeader, char *pPkgBody, unsigned short iBodyLength)
+{
+    // 数据仓库不属于哪个连接，用不到 pConn
+    (void)pConn;
+
+    if (pPkgBody == NULL || iBodyLength != sizeof(STRUCT_DOTA_QUERY))
+    {
+        return false;
+    }
+
+    LPSTRUCT_DOTA_QUERY p_RecvInfo = (LPSTRUCT_DOTA_QUERY)pPkgBody;
+    int iWindows = ntohl(p_RecvInfo->iWindows);
+    if (iWindows <= 0 || iWindows > _DOTA_MAX_WINDOWS)
+    {
+        return false;
+    }
+
+    // 聚合结果，每个线程一份，反复使用
+    static thread_local std::vector<ngx_dota_window_t> t_windows;
+    t_windows.resize(iWindows);
+    if (!m_dotaStore.Aggregate(ngx_ntohd(p_RecvInfo->tBegin), ngx_ntohd(p_RecvInfo->tEnd), iWindows,
+                               ntohl(p_RecvInfo->iColumn), ntohl(p_RecvInfo->iPermille), &t_windows[0]))
+    {
+        return false;
+    }
+
+    LPCOMM_PKG_HEADER pPkgHeader;
+    CMemory *p_memory = CMemory::GetInstance();
+    CCRC32 *p_crc32 = CCRC32::GetInstance();
+
+    int iSendLen = sizeof(STRUCT_DOTA_QUERY) + iWindows * sizeof(STRUCT_DOTA_WINDOW);
+    char *p_sendbuf = (char *)p_memory->AllocMemory(m_iLenMsgHeader + m_iLenPkgHeader + iSendLen, false);
+    memcpy(p_sendbuf, pMsgHeader, m_iLenMsgHeader);
+    pPkgHeader = (LPCOMM_PKG_HEADER)(p_sendbuf + m_iLenMsgHeader);
+    pPkgHeader->msgCode = htons(_CMD_DOTA_QUERY);
+    pPkgHeader->pkgLen = htons(m_iLenPkgHeader + iSendLen);
+
+    // 查询条件原样返回，客户端据此对应请求
+    char *p_body = p_sendbuf + m_iLenMsgHeader + m_iLenPkgHeader;
+    memcpy(p_body, p_RecvInfo, sizeof(STRUCT_DOTA_QUERY));
+
+    LPSTRUCT_DOTA_WINDOW p_sendInfo = (LPSTRUCT_DOTA_WINDOW)(p_body + sizeof(STRUCT_DOTA_QUERY));
+    for (int i = 0; i < iWindows; ++i)
+    {
+        p_sendInfo[i].tBegin = ngx_htond(t_windows[i].tBegin);
+        p_sendInfo[i].iDatCount = htonl((int)t_windows[i].iDatCount);
+        p_sendInfo[i].iMatCount = htonl((int)t_windows[i].iMatCount);
+        p_sendInfo[i].min = ngx_htond(t_windows[i].min);
+        p_sendInfo[i].max = ngx_htond(t_windows[i].max);
+        p_sendInfo[i].mean = ngx_htond(t_windows[i].mean);
+        p_sendInfo[i].percentile = ngx_htond(t_windows[i].percentile);
+    }
+
+    pPkgHeader->crc32 = p_crc32->Get_CRC((unsigned char *)p_body, iSendLen);
+    pPkgHeader->crc32 = htonl(pPkgHeader->crc32);
+
+    msgSend(p_sendbuf);
+    return true;
+}
+
 /***************************************************************
  *  @brief     发送没有包体的数据包，即心跳包，给客户端
  *  @param     pMsgHeader    消息头
@@ -422,42 +603,30 @@ void CLogicSocket::SendNoBodyPkgToClient(LPSTRUC_MSG_HEADER pMsgHeader, unsigned
 
 /***************************************************************
  *  @brief     检测心跳包是否超时
- *  @param     tmpmsg    消息头
+ *  @param     pConn    踢人时钟到期的连接
+ *  @param     iCurrsequence    时钟到期时连接的序号
  *  @param     cur_time    当前时间
  **************************************************************/
-void CLogicSocket::procPingTimeOutChecking(LPSTRUC_MSG_HEADER tmpmsg, time_t cur_time)
+void CLogicSocket::procPingTimeOutChecking(lpngx_connection_t pConn, uint64_t iCurrsequence, time_t cur_time)
 {
-    // 内存对象
-    CMemory *p_memory = CMemory::GetInstance();
-
-    // 连接未断开
-    if (tmpmsg->iCurrsequence == tmpmsg->pConn->iCurrsequence)
+    // 连接已断开
+    if (iCurrsequence != pConn->iCurrsequence)
     {
-        // 取出消息头中指向的指针
-        lpngx_connection_t p_Conn = tmpmsg->pConn;
-
-        // 是否踢出
-        if (/*m_ifkickTimeCount == 1 && */ m_ifTimeOutKick == 1)
-        {
-            // 到时间直接踢出去的需求
-            zdClosesocketProc(p_Conn);
-        }
-        // 超出规定时间仍未发送心跳包
-        else if ((cur_time - p_Conn->lastPingTime) > (m_iWaitTime * 3 + 10))
-        {
-            // 踢出去【如果此时此刻该用户正好断线，则这个socket可能立即被后续上来的连接复用  如果真有人这么倒霉，赶上这个点了，那么可能错踢，错踢就错踢】
-            // ngx_log_stderr(0,"时间到不发心跳包，踢出去!");   //感觉OK
-            zdClosesocketProc(p_Conn);
-        }
+        return;
+    }
 
-        // 释放内存
-        p_memory->FreeMemory(tmpmsg);
+    // 是否踢出
+    if (/*m_ifkickTimeCount == 1 && */ m_ifTimeOutKick == 1)
+    {
+        // 到时间直接踢出去的需求
+        zdClosesocketProc(pConn);
     }
-    // 连接已断开
-    else
+    // 超出规定时间仍未发送心跳包
+    else if ((cur_time - pConn->lastPingTime) > (m_iWaitTime * 3 + 10))
     {
-        // 释放内存
-        p_memory->FreeMemory(tmpmsg);
+        // 踢出去【如果此时此刻该用户正好断线，则这个socket可能立即被后续上来的连接复用  如果真有人这么倒霉，赶上这个点了，那么可能错踢，错踢就错踢】
+        // ngx_log_stderr(0,"时间到不发心跳包，踢出去!");   //感觉OK
+        zdClosesocketProc(pConn);
     }
 
     return;
@@ -5,7 +5,20 @@
  * @date   2024.1.2
  ***********************************/
 
-Mat::Mat(double _time = 10.0) : time_stamp(_time)
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "Dota_Pool.h"
+
+Mat::Mat(double _time) : time_stamp(_time)
 {
 	// cout << "Mat construct" << endl;
 }
@@ -25,7 +38,7 @@ void Mat::show() const
 
 
 
-Dat::Dat(double _steer = 5.0, double _speed = 20.0, double _time = 10.0) : steer(_steer), speed(_speed), time_stamp(_time)
+Dat::Dat(double _steer, double _speed, double _time) : steer(_steer), speed(_speed), time_stamp(_time)
 {
 
 	// cout << "Dat construct" << endl;
@@ -47,7 +60,7 @@ void Dat::show() const
 
 
 
-Dota::Dota(int _sign = Dota_Nul) : sign(_sign)
+Dota::Dota(int _sign) : sign(_sign)
 {
 	// cout << "sign = " << sign << "construct" << endl;
 	// cout << "default construct" << endl;
@@ -90,6 +103,12 @@ Dota::~Dota()
 {
 }
 
+// 返回数据类型标识，Dota_Nul 表示无效数据（比如从空数据池中取出的）
+int Dota::getsign() const
+{
+	return sign;
+}
+
 
 void Dota::show() const
 {
@@ -116,12 +135,14 @@ void Dota::show() const
 }
 
 
-Dota_Pool::Dota_Pool()
+Dota_Pool::Dota_Pool() : persisting(false), persist_stop(false), seg_size(0), max_segments(0), sync_ms(0), persist_dropped(0),
+						 max_pending(Dota_Persist_MaxPending), pending_dropped(0)
 {
 }
 
 Dota_Pool::~Dota_Pool()
 {
+	this->disable_persist();
 	this->clear();
 	// cout << "The data pool is cleared. Procedure" << endl;
 }
@@ -137,6 +158,8 @@ void Dota_Pool::push(Mat m)
 	dota_mutex.lock();
 
 	dotabox.push_back(dtmp);
+	if (persisting)
+		persist(dtmp);
 	// cout << "push mat"
 	//      << " size = " << size() << " sign = " << dtmp.sign << endl;
 
@@ -154,6 +177,8 @@ void Dota_Pool::push(Dat d)
 	dota_mutex.lock();
 
 	dotabox.push_back(dtmp);
+	if (persisting)
+		persist(dtmp);
 	// cout << "push dat"
 	//      << " size = " << size() << " sign = " << dtmp.sign << endl;
 
@@ -161,17 +186,16 @@ void Dota_Pool::push(Dat d)
 	dota_mutex.unlock();
 }
 
-Dota_Pool::Dota pop()
+Dota Dota_Pool::pop()
 {
 	// 上锁
 	dota_mutex.lock();
 
-	cout << "pop dota" << endl;
-
 	if (dotabox.empty())
 	{
-		cout << "empty pop" << endl;
-		return Dota(-1);
+		// 解锁
+		dota_mutex.unlock();
+		return Dota(Dota_Nul);
 	}
 
 	Dota dtmp = dotabox.front();
@@ -199,4 +223,404 @@ int Dota_Pool::size() const
 void Dota_Pool::clear()
 {
 	dotabox.clear();
-}
\ No newline at end of file
+}
+
+
+// 持有 dota_mutex 时调用，把一条数据转成记录放进 pending，攒够一批时唤醒后台线程
+// 磁盘跟不上时 pending 不能无限增长，积压满了的记录直接丢掉并计数，不让 push() 等磁盘
+void Dota_Pool::persist(const Dota &d)
+{
+	if (pending.size() >= max_pending)
+	{
+		++pending_dropped;
+		return;
+	}
+
+	Dota_Record r;
+	r.sign = d.sign;
+	r.reserved = 0;
+	if (d.sign == Dota_Dat)
+	{
+		r.time_stamp = d.dat.time_stamp;
+		r.steer = d.dat.steer;
+		r.speed = d.dat.speed;
+	}
+	else
+	{
+		r.time_stamp = d.mat.time_stamp;
+		r.steer = 0;
+		r.speed = 0;
+	}
+	pending.push_back(r);
+
+	// 只在刚好攒够时通知一次，后台线程醒来会把 pending 整个拿走
+	if (pending.size() == Dota_Persist_Batch)
+		flush_cond.notify_one();
+}
+
+// 打开一个已有的段文件，只读映射，文件头不对时返回 false
+bool Dota_Pool::open_segment(const string &path, Dota_Segment &seg)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < Dota_Seg_Header)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	// 记录个数不能超过容量，容量不能超过文件大小，否则是别的文件或者写坏了
+	Dota_Seg_Head *head = (Dota_Seg_Head *)base;
+	size_t maxRecords = (st.st_size - Dota_Seg_Header) / sizeof(Dota_Record);
+	if (head->magic != Dota_Seg_Magic || head->version != Dota_Seg_Version || head->record_size != sizeof(Dota_Record) ||
+		head->capacity > maxRecords || head->count > head->capacity)
+	{
+		munmap(base, st.st_size);
+		close(fd);
+		return false;
+	}
+
+	seg.path = path;
+	seg.fd = fd;
+	seg.base = (char *)base;
+	seg.size = st.st_size;
+	seg.writable = false;
+	seg.synced = head->count;
+	seg.head = head;
+	seg.records = (Dota_Record *)(seg.base + Dota_Seg_Header);
+	return true;
+}
+
+void Dota_Pool::close_segment(Dota_Segment &seg)
+{
+	if (seg.base != NULL)
+		munmap(seg.base, seg.size);
+	if (seg.fd != -1)
+		close(seg.fd);
+	seg.base = NULL;
+	seg.fd = -1;
+}
+
+/***********************************
+ * @brief  开启持久化
+ * @param  dir          段文件所在目录，不存在时创建
+ * @param  segBytes     每个段文件的大小，向上取整到页大小
+ * @param  syncMs       msync 的间隔，单位毫秒
+ * @param  maxSegments  最多保留的段文件个数，超出时删掉最旧的，0 不限制
+ * @param  maxPending   后台线程跟不上时最多积压的记录数，超出的丢掉，由 persist_drop_count() 报告；不小于 Dota_Persist_Batch
+ * @return true 成功，false 目录打不开或已经开启
+ * @note   目录中已有的段文件（dota_<序号>.seg）按序号只读映射，重启之后仍能通过 read_history 读到；
+ *         新数据总是写到序号更大的新段文件中，不会改动已有的文件
+ ***********************************/
+bool Dota_Pool::enable_persist(const char *dir, size_t segBytes, int syncMs, size_t maxSegments, size_t maxPending)
+{
+	if (persisting || dir == NULL)
+		return false;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		return false;
+
+	DIR *dp = opendir(dir);
+	if (dp == NULL)
+		return false;
+
+	// 找出已有的段文件，按序号排好
+	vector<pair<unsigned long long, string> > found;
+	struct dirent *ent;
+	while ((ent = readdir(dp)) != NULL)
+	{
+		unsigned long long seq;
+		char tail;
+		if (sscanf(ent->d_name, "dota_%llu.se%c", &seq, &tail) == 2 && tail == 'g' && strlen(ent->d_name) == 25)
+			found.push_back(make_pair(seq, string(dir) + "/" + ent->d_name));
+	}
+	closedir(dp);
+	sort(found.begin(), found.end());
+
+	vector<Dota_Segment> opened;
+	for (size_t i = 0; i < found.size(); ++i)
+	{
+		Dota_Segment seg;
+		if (open_segment(found[i].second, seg))
+			opened.push_back(seg);
+		else
+			cerr << "Dota_Pool: skip invalid segment " << found[i].second << endl;
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	segBytes = (segBytes + page - 1) / page * page;
+	if (segBytes < Dota_Seg_Header + (size_t)page)
+		segBytes = Dota_Seg_Header + page;
+
+	{
+		lock_guard<mutex> lk(seg_mutex);
+		segments.swap(opened);
+		persist_dir = dir;
+		seg_size = segBytes;
+		max_segments = maxSegments;
+		sync_ms = (syncMs > 0) ? syncMs : Dota_Persist_SyncMs;
+		persist_dropped = 0;
+	}
+
+	lock_guard<mutex> lk(dota_mutex);
+	max_pending = max(maxPending, (size_t)Dota_Persist_Batch);
+	pending_dropped = 0;
+	persist_stop = false;
+	persisting = true;
+	flusher = thread(&Dota_Pool::flush_loop, this);
+	return true;
+}
+
+/***********************************
+ * @brief  关闭持久化，写完 pending 中剩下的数据，msync 后解除全部映射
+ ***********************************/
+void Dota_Pool::disable_persist()
+{
+	{
+		lock_guard<mutex> lk(dota_mutex);
+		if (!persisting)
+			return;
+		// 之后放入的数据不再进 pending
+		persisting = false;
+		persist_stop = true;
+	}
+	flush_cond.notify_one();
+	flusher.join();
+
+	lock_guard<mutex> lk(seg_mutex);
+	for (size_t i = 0; i < segments.size(); ++i)
+		close_segment(segments[i]);
+	segments.clear();
+}
+
+// 后台线程：攒够一批或到了时间就写段文件，到了 msync 的时间再刷盘；生产者只在放入 pending 时和这里争一下 dota_mutex
+void Dota_Pool::flush_loop()
+{
+	vector<Dota_Record> batch;
+	chrono::steady_clock::time_point last_sync = chrono::steady_clock::now();
+
+	unique_lock<mutex> lk(dota_mutex);
+	while (true)
+	{
+		chrono::steady_clock::time_point next_sync = last_sync + chrono::milliseconds(sync_ms);
+		flush_cond.wait_until(lk, next_sync, [this]() { return persist_stop || pending.size() >= Dota_Persist_Batch; });
+
+		// 整个 pending 换出来，pending 接着用上一批留下的空间
+		batch.swap(pending);
+		bool stop = persist_stop;
+		lk.unlock();
+
+		if (!batch.empty())
+		{
+			write_records(&batch[0], batch.size());
+			batch.clear();
+		}
+
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (stop || now >= next_sync)
+		{
+			sync_active();
+			last_sync = now;
+		}
+
+		lk.lock();
+		if (stop && pending.empty())
+			break;
+	}
+}
+
+// 把一批记录写进可写的段文件，写满了换一个新的；只在后台线程中调用
+void Dota_Pool::write_records(const Dota_Record *r, size_t n)
+{
+	while (n > 0)
+	{
+		Dota_Segment *seg = segments.empty() ? NULL : &segments.back();
+		if (seg == NULL || !seg->writable || seg->head->count == seg->head->capacity)
+		{
+			if (!roll_segment())
+			{
+				lock_guard<mutex> lk(seg_mutex);
+				persist_dropped += n;
+				return;
+			}
+			seg = &segments.back();
+		}
+
+		Dota_Seg_Head *head = seg->head;
+		uint64_t count = head->count;
+		size_t k = min((size_t)(head->capacity - count), n);
+
+		// 记录区在 count 之后，读历史数据的线程看不到，不用加锁
+		memcpy(seg->records + count, r, k * sizeof(Dota_Record));
+
+		double t_min = head->t_min, t_max = head->t_max;
+		for (size_t i = 0; i < k; ++i)
+		{
+			t_min = min(t_min, r[i].time_stamp);
+			t_max = max(t_max, r[i].time_stamp);
+		}
+
+		// 文件头和读历史数据的线程共享
+		{
+			lock_guard<mutex> lk(seg_mutex);
+			head->t_min = t_min;
+			head->t_max = t_max;
+			head->count = count + k;
+		}
+
+		r += k;
+		n -= k;
+	}
+}
+
+// 把可写段中新写入的记录 msync 到磁盘，再刷文件头；只在后台线程中调用
+void Dota_Pool::sync_active()
+{
+	if (segments.empty() || !segments.back().writable)
+		return;
+
+	Dota_Segment &seg = segments.back();
+	size_t count = seg.head->count;
+	if (count == seg.synced)
+		return;
+
+	// msync 的起点必须按页对齐
+	long page = sysconf(_SC_PAGESIZE);
+	size_t from = Dota_Seg_Header + seg.synced * sizeof(Dota_Record);
+	size_t to = Dota_Seg_Header + count * sizeof(Dota_Record);
+	from = from / page * page;
+	msync(seg.base + from, to - from, MS_SYNC);
+	msync(seg.base, Dota_Seg_Header, MS_SYNC);
+	seg.synced = count;
+}
+
+// 当前可写段刷盘后变为只读，新建下一个段文件；只在后台线程中调用
+bool Dota_Pool::roll_segment()
+{
+	uint64_t seq = 1;
+	if (!segments.empty())
+	{
+		Dota_Segment &last = segments.back();
+		if (last.writable)
+		{
+			sync_active();
+			mprotect(last.base, last.size, PROT_READ);
+			last.writable = false;
+		}
+		seq = last.head->seq + 1;
+	}
+
+	// 序号被启动时跳过的坏文件占用了，就往后找一个没用过的
+	char name[32];
+	string path;
+	int fd;
+	while (true)
+	{
+		snprintf(name, sizeof(name), "dota_%016llu.seg", (unsigned long long)seq);
+		path = persist_dir + "/" + name;
+		fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (fd != -1 || errno != EEXIST)
+			break;
+		++seq;
+	}
+	if (fd == -1)
+	{
+		cerr << "Dota_Pool: create " << path << " failed: " << strerror(errno) << endl;
+		return false;
+	}
+	// 文件是稀疏的，没写到的部分不占磁盘
+	if (ftruncate(fd, seg_size) == -1)
+	{
+		cerr << "Dota_Pool: ftruncate " << path << " failed: " << strerror(errno) << endl;
+		close(fd);
+		unlink(path.c_str());
+		return false;
+	}
+	void *base = mmap(NULL, seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+	{
+		cerr << "Dota_Pool: mmap " << path << " failed: " << strerror(errno) << endl;
+		close(fd);
+		unlink(path.c_str());
+		return false;
+	}
+
+	Dota_Segment seg;
+	seg.path = path;
+	seg.fd = fd;
+	seg.base = (char *)base;
+	seg.size = seg_size;
+	seg.writable = true;
+	seg.synced = 0;
+	seg.head = (Dota_Seg_Head *)base;
+	seg.records = (Dota_Record *)(seg.base + Dota_Seg_Header);
+
+	seg.head->magic = Dota_Seg_Magic;
+	seg.head->version = Dota_Seg_Version;
+	seg.head->record_size = sizeof(Dota_Record);
+	seg.head->reserved = 0;
+	seg.head->seq = seq;
+	seg.head->capacity = (seg_size - Dota_Seg_Header) / sizeof(Dota_Record);
+	seg.head->count = 0;
+	seg.head->t_min = numeric_limits<double>::infinity();
+	seg.head->t_max = -numeric_limits<double>::infinity();
+	msync(seg.base, Dota_Seg_Header, MS_SYNC);
+
+	lock_guard<mutex> lk(seg_mutex);
+	segments.push_back(seg);
+	// 超出保留个数时删掉最旧的段文件
+	while (max_segments > 0 && segments.size() > max_segments)
+	{
+		unlink(segments.front().path.c_str());
+		close_segment(segments.front());
+		segments.erase(segments.begin());
+	}
+	return true;
+}
+
+/***********************************
+ * @brief  读段文件中的历史数据
+ * @param  tBegin  起始时间
+ * @param  tEnd    结束时间
+ * @param  fn      每个时间范围有交集的段调用一次，参数为映射内存中的记录和个数
+ * @return 传给 fn 的记录总数
+ * @note   记录直接在映射的内存中，不做任何拷贝和反序列化；fn 执行期间持有 seg_mutex，
+ *         后台线程仍可以往可写段中写入新记录，但不会换段、删段
+ ***********************************/
+size_t Dota_Pool::read_history(double tBegin, double tEnd, const function<void(const Dota_Record *, size_t)> &fn)
+{
+	size_t total = 0;
+	lock_guard<mutex> lk(seg_mutex);
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const Dota_Seg_Head *head = segments[i].head;
+		size_t count = head->count;
+		if (count == 0 || head->t_max < tBegin || head->t_min > tEnd)
+			continue;
+		fn(segments[i].records, count);
+		total += count;
+	}
+	return total;
+}
+
+// 没能写进段文件的记录数：积压满了丢掉的，加上段文件创建失败时丢掉的
+size_t Dota_Pool::persist_drop_count()
+{
+	size_t n;
+	{
+		lock_guard<mutex> lk(dota_mutex);
+		n = pending_dropped;
+	}
+	lock_guard<mutex> lk(seg_mutex);
+	return n + persist_dropped;
+}
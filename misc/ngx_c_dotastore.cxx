@@ -0,0 +1,370 @@
+﻿// 本文件存放按列存储的时序数据仓库的实现
+// 每列是一段连续的 double，时间范围先二分查找出下标区间，窗口内的最小、最大、求和用 SIMD 一次处理 2 个（SSE2）或 4 个（AVX）值，
+// 分位数在窗口的拷贝上用 nth_element 选出
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+#include "ngx_c_dotastore.h"
+
+// 求一段 double 的最小、最大和总和，n 至少为 1
+typedef void (*ngx_dota_reduce_pt)(const double *p, size_t n, double *pMin, double *pMax, double *pSum);
+
+#if !defined(__SSE2__)
+static void ngx_dota_reduce_scalar(const double *p, size_t n, double *pMin, double *pMax, double *pSum)
+{
+	double vmin = p[0], vmax = p[0], sum = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		vmin = (p[i] < vmin) ? p[i] : vmin;
+		vmax = (p[i] > vmax) ? p[i] : vmax;
+		sum += p[i];
+	}
+	*pMin = vmin;
+	*pMax = vmax;
+	*pSum = sum;
+}
+#endif
+
+#if defined(__SSE2__)
+// 每次处理 4 个值，两组累加器交替使用，减少前后依赖
+static void ngx_dota_reduce_sse2(const double *p, size_t n, double *pMin, double *pMax, double *pSum)
+{
+	__m128d min0 = _mm_set1_pd(p[0]), min1 = min0;
+	__m128d max0 = min0, max1 = min0;
+	__m128d sum0 = _mm_setzero_pd(), sum1 = sum0;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128d a = _mm_loadu_pd(p + i);
+		__m128d b = _mm_loadu_pd(p + i + 2);
+		min0 = _mm_min_pd(min0, a);
+		min1 = _mm_min_pd(min1, b);
+		max0 = _mm_max_pd(max0, a);
+		max1 = _mm_max_pd(max1, b);
+		sum0 = _mm_add_pd(sum0, a);
+		sum1 = _mm_add_pd(sum1, b);
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_min_pd(min0, min1));
+	double vmin = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+	_mm_storeu_pd(lanes, _mm_max_pd(max0, max1));
+	double vmax = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+	_mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+	double sum = lanes[0] + lanes[1];
+	// 剩下不足 4 个的逐个处理
+	for (; i < n; ++i)
+	{
+		vmin = (p[i] < vmin) ? p[i] : vmin;
+		vmax = (p[i] > vmax) ? p[i] : vmax;
+		sum += p[i];
+	}
+	*pMin = vmin;
+	*pMax = vmax;
+	*pSum = sum;
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// 编译时不要求 AVX，只给这个函数打开，运行时 CPU 支持才用
+__attribute__((target("avx"))) static void ngx_dota_reduce_avx(const double *p, size_t n, double *pMin, double *pMax, double *pSum)
+{
+	__m256d min0 = _mm256_set1_pd(p[0]), min1 = min0;
+	__m256d max0 = min0, max1 = min0;
+	__m256d sum0 = _mm256_setzero_pd(), sum1 = sum0;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256d a = _mm256_loadu_pd(p + i);
+		__m256d b = _mm256_loadu_pd(p + i + 4);
+		min0 = _mm256_min_pd(min0, a);
+		min1 = _mm256_min_pd(min1, b);
+		max0 = _mm256_max_pd(max0, a);
+		max1 = _mm256_max_pd(max1, b);
+		sum0 = _mm256_add_pd(sum0, a);
+		sum1 = _mm256_add_pd(sum1, b);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_min_pd(min0, min1));
+	double vmin = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+	_mm256_storeu_pd(lanes, _mm256_max_pd(max0, max1));
+	double vmax = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	_mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+	double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	for (; i < n; ++i)
+	{
+		vmin = (p[i] < vmin) ? p[i] : vmin;
+		vmax = (p[i] > vmax) ? p[i] : vmax;
+		sum += p[i];
+	}
+	*pMin = vmin;
+	*pMax = vmax;
+	*pSum = sum;
+}
+#endif
+
+// 按 CPU 能力选一个实现，程序启动时选一次
+static ngx_dota_reduce_pt ngx_dota_reduce_select()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return ngx_dota_reduce_avx;
+#endif
+#if defined(__SSE2__)
+	return ngx_dota_reduce_sse2;
+#else
+	return ngx_dota_reduce_scalar;
+#endif
+}
+
+static ngx_dota_reduce_pt ngx_dota_reduce = ngx_dota_reduce_select();
+
+// 分位数用的临时空间，每个线程一份，反复使用不再分配
+static thread_local std::vector<double> t_dotaScratch;
+// 写入时一批样本按类型拆开、排好序的拷贝，每个线程一份
+static thread_local std::vector<ngx_dota_sample_t> t_dotaDatBatch;
+static thread_local std::vector<double> t_dotaMatBatch;
+
+// 按时间戳比较两个 Dat 样本
+static bool ngx_dota_sample_less(const ngx_dota_sample_t &a, const ngx_dota_sample_t &b)
+{
+	return a.time_stamp < b.time_stamp;
+}
+
+// 构造函数
+CDotaStore::CDotaStore()
+{
+	m_maxSamples = NGX_DOTA_MAX_SAMPLES;
+	pthread_rwlock_init(&m_rwlock, NULL);
+}
+
+// 析构函数
+CDotaStore::~CDotaStore()
+{
+	pthread_rwlock_destroy(&m_rwlock);
+}
+
+/***************************************************************
+ *  @brief     设置最多保留的样本数
+ *  @param     maxSamples    Mat、Dat 各自最多保留的样本数，0 表示不限制
+ **************************************************************/
+void CDotaStore::Init(size_t maxSamples)
+{
+	pthread_rwlock_wrlock(&m_rwlock);
+	m_maxSamples = maxSamples;
+	Trim();
+	pthread_rwlock_unlock(&m_rwlock);
+}
+
+// 把按时间排好序的一批 Dat 样本并进各列，调用者持有写锁
+void CDotaStore::MergeDat(const ngx_dota_sample_t *pBatch, size_t n)
+{
+	size_t old = m_datTime.size();
+	// 已有样本中比这批最早的还晚的，从 pos 开始；绝大多数时候这批都在末尾之后，pos 就是 old
+	size_t pos = (old == 0 || pBatch[0].time_stamp >= m_datTime.back())
+					 ? old
+					 : std::upper_bound(m_datTime.begin(), m_datTime.end(), pBatch[0].time_stamp) - m_datTime.begin();
+
+	m_datTime.resize(old + n);
+	m_steer.resize(old + n);
+	m_speed.resize(old + n);
+
+	// 从后往前归并，[pos, old) 中的每个样本只往后挪一次；时间戳相同时新样本放在已有样本后面，三列保持下标一致
+	size_t w = old + n, i = old, j = n;
+	while (j > 0)
+	{
+		--w;
+		if (i > pos && m_datTime[i - 1] > pBatch[j - 1].time_stamp)
+		{
+			--i;
+			m_datTime[w] = m_datTime[i];
+			m_steer[w] = m_steer[i];
+			m_speed[w] = m_speed[i];
+		}
+		else
+		{
+			--j;
+			m_datTime[w] = pBatch[j].time_stamp;
+			m_steer[w] = pBatch[j].steer;
+			m_speed[w] = pBatch[j].speed;
+		}
+	}
+}
+
+// 把排好序的一批 Mat 时间戳并进时间列，调用者持有写锁
+void CDotaStore::MergeMat(const double *pBatch, size_t n)
+{
+	size_t old = m_matTime.size();
+	size_t pos = (old == 0 || pBatch[0] >= m_matTime.back())
+					 ? old
+					 : std::upper_bound(m_matTime.begin(), m_matTime.end(), pBatch[0]) - m_matTime.begin();
+
+	m_matTime.resize(old + n);
+
+	size_t w = old + n, i = old, j = n;
+	while (j > 0)
+	{
+		--w;
+		if (i > pos && m_matTime[i - 1] > pBatch[j - 1])
+			m_matTime[w] = m_matTime[--i];
+		else
+			m_matTime[w] = pBatch[--j];
+	}
+}
+
+// 丢掉超出上限的最旧样本，调用者持有写锁
+void CDotaStore::Trim()
+{
+	if (m_maxSamples == 0)
+		return;
+
+	// 多出上限的 1/8 才丢一次，一次丢回到上限
+	size_t limit = m_maxSamples + (m_maxSamples >> 3);
+	if (m_datTime.size() > limit)
+	{
+		size_t cnt = m_datTime.size() - m_maxSamples;
+		m_datTime.erase(m_datTime.begin(), m_datTime.begin() + cnt);
+		m_steer.erase(m_steer.begin(), m_steer.begin() + cnt);
+		m_speed.erase(m_speed.begin(), m_speed.begin() + cnt);
+	}
+	if (m_matTime.size() > limit)
+	{
+		m_matTime.erase(m_matTime.begin(), m_matTime.begin() + (m_matTime.size() - m_maxSamples));
+	}
+}
+
+/***************************************************************
+ *  @brief     加入一批样本
+ *  @param     pSamples    样本数组
+ *  @param     n    样本个数
+ *  @note      sign 不是 NGX_DOTA_MAT、NGX_DOTA_DAT 的样本忽略；
+ *             拆分、排序在取写锁之前做，持锁期间每种样本只归并一次，迟到的样本再多也不会逐个插入、反复挪动
+ **************************************************************/
+void CDotaStore::Append(const ngx_dota_sample_t *pSamples, size_t n)
+{
+	std::vector<ngx_dota_sample_t> &dat = t_dotaDatBatch;
+	std::vector<double> &mat = t_dotaMatBatch;
+	dat.clear();
+	mat.clear();
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (pSamples[i].sign == NGX_DOTA_DAT)
+			dat.push_back(pSamples[i]);
+		else if (pSamples[i].sign == NGX_DOTA_MAT)
+			mat.push_back(pSamples[i].time_stamp);
+	}
+	// 一批之内时间戳相同的保持上传的先后顺序
+	if (!std::is_sorted(dat.begin(), dat.end(), ngx_dota_sample_less))
+		std::stable_sort(dat.begin(), dat.end(), ngx_dota_sample_less);
+	if (!std::is_sorted(mat.begin(), mat.end()))
+		std::stable_sort(mat.begin(), mat.end());
+
+	pthread_rwlock_wrlock(&m_rwlock);
+	if (!dat.empty())
+		MergeDat(&dat[0], dat.size());
+	if (!mat.empty())
+		MergeMat(&mat[0], mat.size());
+	Trim();
+	pthread_rwlock_unlock(&m_rwlock);
+}
+
+/***************************************************************
+ *  @brief     按时间窗口聚合一列
+ *  @param     tBegin    起始时间（含）
+ *  @param     tEnd    结束时间（不含）
+ *  @param     iWindows    等分成几个窗口
+ *  @param     iColumn    NGX_DOTA_COL_STEER 或 NGX_DOTA_COL_SPEED
+ *  @param     permille    分位数，千分之几，0 即最小值，1000 即最大值
+ *  @param     pOut    至少 iWindows 个元素，逐个窗口写入结果
+ *  @return    true: 成功，false: 参数不对
+ **************************************************************/
+bool CDotaStore::Aggregate(double tBegin, double tEnd, int iWindows, int iColumn, int permille, ngx_dota_window_t *pOut)
+{
+	// 写成 !(tEnd > tBegin)，参数中有 NaN 时也返回 false
+	if (iWindows <= 0 || !(tEnd > tBegin) || permille < 0 || permille > 1000)
+		return false;
+	if (iColumn != NGX_DOTA_COL_STEER && iColumn != NGX_DOTA_COL_SPEED)
+		return false;
+
+	double width = (tEnd - tBegin) / iWindows;
+
+	pthread_rwlock_rdlock(&m_rwlock);
+
+	const std::vector<double> &column = (iColumn == NGX_DOTA_COL_STEER) ? m_steer : m_speed;
+	std::vector<double>::const_iterator datBegin = m_datTime.begin(), datEnd = m_datTime.end();
+	std::vector<double>::const_iterator matEnd = m_matTime.end();
+	// 整个时间范围的起点二分查找一次，之后每个窗口只在剩下的部分里找终点
+	std::vector<double>::const_iterator datPos = std::lower_bound(datBegin, datEnd, tBegin);
+	std::vector<double>::const_iterator matPos = std::lower_bound(m_matTime.cbegin(), matEnd, tBegin);
+
+	for (int i = 0; i < iWindows; ++i)
+	{
+		ngx_dota_window_t *pWin = &pOut[i];
+		double wEnd = (i == iWindows - 1) ? tEnd : tBegin + width * (i + 1);
+
+		std::vector<double>::const_iterator datNext = std::lower_bound(datPos, datEnd, wEnd);
+		std::vector<double>::const_iterator matNext = std::lower_bound(matPos, matEnd, wEnd);
+
+		pWin->tBegin = tBegin + width * i;
+		pWin->iDatCount = datNext - datPos;
+		pWin->iMatCount = matNext - matPos;
+		pWin->min = pWin->max = pWin->mean = pWin->percentile = 0;
+
+		size_t n = pWin->iDatCount;
+		if (n > 0)
+		{
+			const double *p = &column[datPos - datBegin];
+			double sum;
+			ngx_dota_reduce(p, n, &pWin->min, &pWin->max, &sum);
+			pWin->mean = sum / n;
+
+			// 最近秩：第 ceil(permille * n / 1000) 小的值，两端直接用最小、最大值，不必选
+			size_t rank = ((size_t)permille * n + 999) / 1000;
+			if (rank <= 1)
+				pWin->percentile = pWin->min;
+			else if (rank >= n)
+				pWin->percentile = pWin->max;
+			else
+			{
+				t_dotaScratch.assign(p, p + n);
+				std::nth_element(t_dotaScratch.begin(), t_dotaScratch.begin() + (rank - 1), t_dotaScratch.end());
+				pWin->percentile = t_dotaScratch[rank - 1];
+			}
+		}
+
+		datPos = datNext;
+		matPos = matNext;
+	}
+
+	pthread_rwlock_unlock(&m_rwlock);
+	return true;
+}
+
+// 当前保存的 Dat 样本数
+size_t CDotaStore::DatSize()
+{
+	pthread_rwlock_rdlock(&m_rwlock);
+	size_t n = m_datTime.size();
+	pthread_rwlock_unlock(&m_rwlock);
+	return n;
+}
+
+// 当前保存的 Mat 样本数
+size_t CDotaStore::MatSize()
+{
+	pthread_rwlock_rdlock(&m_rwlock);
+	size_t n = m_matTime.size();
+	pthread_rwlock_unlock(&m_rwlock);
+	return n;
+}
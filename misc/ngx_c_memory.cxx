@@ -4,22 +4,219 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 #include "ngx_c_memory.h"
+#include "ngx_c_lockmutex.h"
+#include "ngx_func.h"
 
 // 类静态成员赋值
 CMemory *CMemory::m_instance = NULL;
 
+// 内存块头部中的固定值
+#define NGX_MEM_MAGIC 0x4d454d42
+
+// 每个线程的内存缓存：每一级一个弹匣，存放本线程可以直接取用的空闲内存
+// 线程退出时把弹匣里的内存还给仓库
+struct ngx_mem_cache_s
+{
+    // 各级弹匣
+    ngx_mem_block_t **mags[NGX_MEM_CLASS_COUNT];
+    // 各级弹匣中的块数
+    int counts[NGX_MEM_CLASS_COUNT];
+
+    ngx_mem_cache_s()
+    {
+        for (int i = 0; i < NGX_MEM_CLASS_COUNT; ++i)
+        {
+            mags[i] = NULL;
+            counts[i] = 0;
+        }
+    }
+
+    ~ngx_mem_cache_s()
+    {
+        CMemory *p_memory = CMemory::GetInstance();
+        for (int i = 0; i < NGX_MEM_CLASS_COUNT; ++i)
+        {
+            // 凑够整批的还回仓库，剩下不足一批的就留着了，数量很少
+            int batch = p_memory->m_depot[i].batch;
+            while (counts[i] >= batch)
+            {
+                Spill(p_memory, i);
+            }
+            delete[] mags[i];
+            // 进程退出时全局对象的析构函数可能还会释放内存，这时重新建弹匣即可
+            mags[i] = NULL;
+            counts[i] = 0;
+        }
+    }
+
+    // 弹匣满了，把最早放进来的一批串起来还给仓库
+    void Spill(CMemory *p_memory, int cls)
+    {
+        int batch = p_memory->m_depot[cls].batch;
+        ngx_mem_block_t **mag = mags[cls];
+        for (int i = 0; i < batch - 1; ++i)
+        {
+            mag[i]->next = mag[i + 1];
+        }
+        mag[batch - 1]->next = NULL;
+        p_memory->PushBatch(cls, mag[0]);
+
+        counts[cls] -= batch;
+        memmove(mag, mag + batch, sizeof(ngx_mem_block_t *) * counts[cls]);
+    }
+};
+static thread_local ngx_mem_cache_s t_memCache;
+
+/***************************************************************
+ *  @brief     构造函数，初始化每一级的仓库
+ **************************************************************/
+CMemory::CMemory()
+{
+    m_arena = NULL;
+    m_arenaSize = 0;
+    m_arenaUsed = 0;
+
+    for (int i = 0; i < NGX_MEM_CLASS_COUNT; ++i)
+    {
+        // 第 0 级 64 字节，之后每个 2 的幂 2^s 之后依次是 2^s 的 5/4、6/4、7/4、8/4
+        uint32_t size = 1 << NGX_MEM_MIN_SHIFT;
+        if (i > 0)
+        {
+            int shift = NGX_MEM_MIN_SHIFT + (i - 1) / 4;
+            size = (1 << shift) + ((i - 1) % 4 + 1) * (1 << (shift - 2));
+        }
+        m_depot[i].size = size;
+
+        int cap = NGX_MEM_CACHE_BYTES / size;
+        cap = (cap < NGX_MEM_CACHE_MIN) ? NGX_MEM_CACHE_MIN : cap;
+        cap = (cap > NGX_MEM_CACHE_MAX) ? NGX_MEM_CACHE_MAX : cap;
+        m_depot[i].batch = cap / 2;
+        pthread_mutex_init(&m_depot[i].mutex, NULL);
+    }
+}
+
+/***************************************************************
+ *  @brief     根据大小算出级别
+ *  @param     size    含头部的大小，不超过 NGX_MEM_MAX_SIZE
+ *  @return    级别
+ **************************************************************/
+int CMemory::SizeToClass(size_t size)
+{
+    if (size <= (1 << NGX_MEM_MIN_SHIFT))
+    {
+        return 0;
+    }
+
+    // size - 1 的最高位是 2^shift，接下来两位决定是这个 2 的幂之后的哪一级
+    size_t n = size - 1;
+    int shift = 63 - __builtin_clzll(n);
+    return (shift - NGX_MEM_MIN_SHIFT) * 4 + (int)((n >> (shift - 2)) & 3) + 1;
+}
+
+/***************************************************************
+ *  @brief     从仓库中取一批空闲内存
+ *  @param     cls    级别
+ *  @return    用 next 串好的一批内存的第一块，正好 batch 块
+ *  @note      仓库空了就申请一大块（优先从 arena 中取），切成若干批，第一批返回，其余放进仓库
+ **************************************************************/
+ngx_mem_block_t *CMemory::PopBatch(int cls)
+{
+    ngx_mem_depot_t *pDepot = &m_depot[cls];
+
+    {
+        CLock lock(&pDepot->mutex);
+
+        if (!pDepot->batches.empty())
+        {
+            ngx_mem_block_t *pHead = pDepot->batches.back();
+            pDepot->batches.pop_back();
+            return pHead;
+        }
+    }
+
+    // 一次切出若干整批，不占着锁
+    size_t iBatchBytes = (size_t)pDepot->size * pDepot->batch;
+    size_t iBatches = (NGX_MEM_SLAB_SIZE + iBatchBytes - 1) / iBatchBytes;
+    char *pSlab = AllocSlab(iBatchBytes * iBatches);
+
+    std::vector<ngx_mem_block_t *> heads;
+    for (size_t b = 0; b < iBatches; ++b)
+    {
+        char *pBase = pSlab + iBatchBytes * b;
+        for (int i = 0; i < pDepot->batch; ++i)
+        {
+            ngx_mem_block_t *pBlock = (ngx_mem_block_t *)(pBase + (size_t)pDepot->size * i);
+            pBlock->cls = cls;
+            pBlock->magic = NGX_MEM_MAGIC;
+            pBlock->next = (i + 1 < pDepot->batch) ? (ngx_mem_block_t *)(pBase + (size_t)pDepot->size * (i + 1)) : NULL;
+        }
+        heads.push_back((ngx_mem_block_t *)pBase);
+    }
+
+    if (iBatches > 1)
+    {
+        CLock lock(&pDepot->mutex);
+        pDepot->batches.insert(pDepot->batches.end(), heads.begin() + 1, heads.end());
+    }
+
+    return heads[0];
+}
+
+/***************************************************************
+ *  @brief     把一批空闲内存放回仓库
+ *  @param     cls    级别
+ *  @param     pHead    用 next 串好的一批内存的第一块，正好 batch 块
+ **************************************************************/
+void CMemory::PushBatch(int cls, ngx_mem_block_t *pHead)
+{
+    CLock lock(&m_depot[cls].mutex);
+    m_depot[cls].batches.push_back(pHead);
+}
+
 /***************************************************************
  *  @brief     根据要求分配指定大小的内存
  *  @param     memCount    待分配的内存大小
  *  @param     ifmemset    是否清空分配出的内存
  *  @return    喷配得到的内内存指向的空类型指针
+ *  @note      本线程对应级别的弹匣中有空闲内存就直接取，否则先从仓库取一批装进弹匣
  **************************************************************/
 void *CMemory::AllocMemory(int memCount, bool ifmemset)
 {
-    // 不判断是否成功，失败则直崩溃
-    void *tmpData = (void *)new char[memCount];
+    size_t size = sizeof(ngx_mem_block_t) + memCount;
+    ngx_mem_block_t *pBlock;
+
+    if (size > NGX_MEM_MAX_SIZE)
+    {
+        // 太大了，不分级，不判断是否成功，失败则直崩溃
+        pBlock = (ngx_mem_block_t *)new char[size];
+        pBlock->cls = NGX_MEM_CLASS_COUNT;
+        pBlock->magic = NGX_MEM_MAGIC;
+    }
+    else
+    {
+        int cls = SizeToClass(size);
+        ngx_mem_cache_s *pCache = &t_memCache;
+
+        if (pCache->counts[cls] == 0)
+        {
+            if (pCache->mags[cls] == NULL)
+            {
+                pCache->mags[cls] = new ngx_mem_block_t *[m_depot[cls].batch * 2];
+            }
+            for (ngx_mem_block_t *p = PopBatch(cls); p != NULL; p = p->next)
+            {
+                pCache->mags[cls][pCache->counts[cls]++] = p;
+            }
+        }
+        pBlock = pCache->mags[cls][--pCache->counts[cls]];
+    }
+
+    void *tmpData = (void *)(pBlock + 1);
 
     // 内存清空
     if (ifmemset)
@@ -33,11 +230,202 @@ void *CMemory::AllocMemory(int memCount, bool ifmemset)
 /***************************************************************
  *  @brief     释放指定的区域的内存
  *  @param     point    指向待释放区域内存的指针
+ *  @note      放进本线程对应级别的弹匣，不管是哪个线程分配的；弹匣满了就把一批还给仓库
  **************************************************************/
 void CMemory::FreeMemory(void *point)
 {
-    // delete [] point;  // warning: deleting ‘void*’ is undefined [-Wdelete-incomplete]
+    if (point == NULL)
+    {
+        return;
+    }
 
-    // new 的时候是char *，这里弄回char *，以免出警告
-    delete[] ((char *)point);
+    ngx_mem_block_t *pBlock = (ngx_mem_block_t *)point - 1;
+    if (pBlock->magic != NGX_MEM_MAGIC)
+    {
+        // 不是本类分配的内存，或者头部被写坏了，继续下去只会把问题扩散，直接崩溃
+        abort();
+    }
+
+    if (pBlock->cls == NGX_MEM_CLASS_COUNT)
+    {
+        // new 的时候是char *，这里弄回char *，以免出警告
+        delete[] ((char *)pBlock);
+        return;
+    }
+
+    int cls = pBlock->cls;
+    ngx_mem_cache_s *pCache = &t_memCache;
+    if (pCache->mags[cls] == NULL)
+    {
+        pCache->mags[cls] = new ngx_mem_block_t *[m_depot[cls].batch * 2];
+    }
+    else if (pCache->counts[cls] == m_depot[cls].batch * 2)
+    {
+        pCache->Spill(this, cls);
+    }
+    pCache->mags[cls][pCache->counts[cls]++] = pBlock;
+}
+
+/***************************************************************
+ *  @brief     映射一块 arena 内存
+ *  @param     size    需要的字节数
+ *  @param     hugePages    NGX_MEM_HUGE_NONE、NGX_MEM_HUGE_THP 或 NGX_MEM_HUGE_TLB
+ *  @param     prefault    NGX_MEM_PREFAULT_NONE、NGX_MEM_PREFAULT_TOUCH 或 NGX_MEM_PREFAULT_LOCK
+ *  @param     pMapSize    返回实际映射的大小，释放时要用
+ *  @return    内存首地址，按大页对齐（使用大页时）或按普通页对齐；失败返回 NULL
+ *  @note      MAP_HUGETLB 需要系统预留大页（vm.nr_hugepages），没有就退到透明大页；
+ *             透明大页要在第一次写之前 madvise()，所以不用 MAP_POPULATE，而是 madvise() 之后逐页写一遍
+ **************************************************************/
+void *CMemory::MapArena(size_t size, int hugePages, int prefault, size_t *pMapSize)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    void *p = MAP_FAILED;
+    size_t mapSize;
+
+    // 预留的大页不够时，以后也不会够，只试一次、只报一次
+    static std::atomic<int> s_hugeTlbFailed(0);
+    if (hugePages == NGX_MEM_HUGE_TLB && s_hugeTlbFailed.load(std::memory_order_relaxed) == 1)
+    {
+        hugePages = NGX_MEM_HUGE_THP;
+    }
+
+    if (hugePages == NGX_MEM_HUGE_TLB)
+    {
+        mapSize = (size + NGX_MEM_HUGE_PAGE_SIZE - 1) & ~(size_t)(NGX_MEM_HUGE_PAGE_SIZE - 1);
+        p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | ((prefault != NGX_MEM_PREFAULT_NONE) ? MAP_POPULATE : 0), -1, 0);
+        if (p == MAP_FAILED)
+        {
+            if (s_hugeTlbFailed.exchange(1) == 0)
+            {
+                ngx_log_stderr(errno, "CMemory::MapArena()中mmap(MAP_HUGETLB)失败，改用透明大页.");
+            }
+            hugePages = NGX_MEM_HUGE_THP;
+        }
+    }
+
+    if (p == MAP_FAILED && hugePages == NGX_MEM_HUGE_THP && size >= NGX_MEM_HUGE_PAGE_SIZE)
+    {
+        // 多映射一个大页，再把首尾不对齐的部分还回去，中间的部分才能整页用大页
+        mapSize = (size + NGX_MEM_HUGE_PAGE_SIZE - 1) & ~(size_t)(NGX_MEM_HUGE_PAGE_SIZE - 1);
+        char *pRaw = (char *)mmap(NULL, mapSize + NGX_MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pRaw != MAP_FAILED)
+        {
+            char *pAligned = (char *)(((uintptr_t)pRaw + NGX_MEM_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(NGX_MEM_HUGE_PAGE_SIZE - 1));
+            if (pAligned > pRaw)
+            {
+                munmap(pRaw, pAligned - pRaw);
+            }
+            if (pRaw + NGX_MEM_HUGE_PAGE_SIZE > pAligned)
+            {
+                munmap(pAligned + mapSize, pRaw + NGX_MEM_HUGE_PAGE_SIZE - pAligned);
+            }
+            p = pAligned;
+
+            if (madvise(p, mapSize, MADV_HUGEPAGE) == -1)
+            {
+                ngx_log_stderr(errno, "CMemory::MapArena()中madvise(MADV_HUGEPAGE)失败，使用普通页.");
+            }
+        }
+    }
+
+    if (p == MAP_FAILED)
+    {
+        // 普通页；不够一个大页的也走这里，用大页反而浪费
+        mapSize = (size + pageSize - 1) & ~(pageSize - 1);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (prefault != NGX_MEM_PREFAULT_NONE)
+        {
+            flags |= MAP_POPULATE;
+        }
+        p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            ngx_log_stderr(errno, "CMemory::MapArena()中mmap()失败.");
+            return NULL;
+        }
+    }
+    else if (prefault != NGX_MEM_PREFAULT_NONE && hugePages == NGX_MEM_HUGE_THP)
+    {
+        // 逐页写一遍，每次缺页时内核就分配大页
+        for (size_t off = 0; off < mapSize; off += pageSize)
+        {
+            ((volatile char *)p)[off] = 0;
+        }
+    }
+
+    if (prefault == NGX_MEM_PREFAULT_LOCK && mlock(p, mapSize) == -1)
+    {
+        // 锁不住（比如超过 RLIMIT_MEMLOCK）也能用，只是可能被换出
+        ngx_log_stderr(errno, "CMemory::MapArena()中mlock()失败.");
+    }
+
+    *pMapSize = mapSize;
+    return p;
+}
+
+/***************************************************************
+ *  @brief     释放 MapArena() 得到的内存
+ *  @param     p    MapArena() 的返回值
+ *  @param     mapSize    MapArena() 给出的映射大小
+ **************************************************************/
+void CMemory::UnmapArena(void *p, size_t mapSize)
+{
+    if (p != NULL)
+    {
+        munmap(p, mapSize);
+    }
+}
+
+/***************************************************************
+ *  @brief     预留 arena，之后各级新切的大块内存都从这里出
+ *  @param     size    预留的字节数
+ *  @param     hugePages    使用大页的方式
+ *  @param     prefault    预先缺页的方式
+ *  @return    成功返回 true
+ *  @note      在 worker 进程启动、创建线程之前调用；arena 不释放，进程退出时由系统回收
+ **************************************************************/
+bool CMemory::InitArena(size_t size, int hugePages, int prefault)
+{
+    size_t mapSize;
+    void *p = MapArena(size, hugePages, prefault, &mapSize);
+    if (p == NULL)
+    {
+        return false;
+    }
+
+    m_arena = (char *)p;
+    m_arenaSize = mapSize;
+    m_arenaUsed = 0;
+    return true;
+}
+
+/***************************************************************
+ *  @brief     申请一块用来切分的大块内存
+ *  @param     size    字节数
+ *  @return    大块内存首地址，按 64 字节对齐
+ *  @note      arena 用完了就向系统申请，切出去的大块内存都不释放
+ **************************************************************/
+char *CMemory::AllocSlab(size_t size)
+{
+    size = (size + 63) & ~(size_t)63;
+
+    if (m_arena != NULL)
+    {
+        size_t used = m_arenaUsed.load(std::memory_order_relaxed);
+        while (used + size <= m_arenaSize)
+        {
+            if (m_arenaUsed.compare_exchange_weak(used, used + size, std::memory_order_relaxed))
+            {
+                return m_arena + used;
+            }
+        }
+    }
+
+    void *p = NULL;
+    if (posix_memalign(&p, 64, size) != 0)
+    {
+        // 和 new 失败一样，直接崩溃
+        abort();
+    }
+    return (char *)p;
 }
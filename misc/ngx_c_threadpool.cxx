@@ -66,6 +66,9 @@ void CThreadPool::clearMsgRecvQueue()
         // 释放消息占用内存
         p_memory->FreeMemory(sTmpMempoint);
     }
+
+    // 没来得及执行的任务直接丢掉
+    m_TaskQueue.clear();
 }
 
 /***************************************************************
@@ -163,6 +166,31 @@ void CThreadPool::inMsgRecvQueueAndSignal(char *buf)
     return;
 }
 
+/***************************************************************
+ *  @brief     将一个任务放入任务队列，并触发线程池中的一个线程执行
+ *  @param     task    待执行的任务
+ **************************************************************/
+void CThreadPool::inTaskQueueAndSignal(const std::function<void()> &task)
+{
+    int err = pthread_mutex_lock(&m_pthreadMutex);
+    if (err != 0)
+    {
+        ngx_log_stderr(err, "CThreadPool::inTaskQueueAndSignal()pthread_mutex_lock()失败，返回的错误码为%d!", err);
+    }
+
+    m_TaskQueue.push_back(task);
+
+    err = pthread_mutex_unlock(&m_pthreadMutex);
+    if (err != 0)
+    {
+        ngx_log_stderr(err, "CThreadPool::inTaskQueueAndSignal()pthread_mutex_unlock()失败，返回的错误码为%d!", err);
+    }
+
+    Call();
+
+    return;
+}
+
 /***************************************************************
  *  @brief     调用一个线程，处理消息队列中的消息
  *  @note      往往发生在将一个消息放入接收消息队列之后
@@ -276,7 +304,7 @@ void *CThreadPool::ThreadFunc(void *threadData)
 
         // 通知函数可能会意外唤醒多个线程从队列中取数据，因此即便被唤醒，也需要判断队列内是否存在数据
         //
-        while ((pThreadPoolObj->m_MsgRecvQueue.size() == 0) && m_shutdown == false)
+        while (pThreadPoolObj->m_MsgRecvQueue.empty() && pThreadPoolObj->m_TaskQueue.empty() && m_shutdown == false)
         {
             // 如果这个pthread_cond_wait被唤醒【被唤醒后程序执行流程往下走的前提是拿到了锁--官方：pthread_cond_wait()返回时，互斥量再次被锁住】，
             // 那么会立即再次执行g_socket.outMsgRecvQueue()，如果拿到了一个NULL，则继续在这里wait着();
@@ -334,6 +362,23 @@ void *CThreadPool::ThreadFunc(void *threadData)
             break;
         }
 
+        // 先执行任务，定时任务对时间更敏感
+        if (!pThreadPoolObj->m_TaskQueue.empty())
+        {
+            std::function<void()> task;
+            task.swap(pThreadPoolObj->m_TaskQueue.front());
+            pThreadPoolObj->m_TaskQueue.pop_front();
+
+            err = pthread_mutex_unlock(&m_pthreadMutex);
+            if (err != 0)
+                ngx_log_stderr(err, "CThreadPool::ThreadFunc()中pthread_mutex_unlock()失败，返回的错误码为%d!", err);
+
+            ++pThreadPoolObj->m_iRunningThreadNum;
+            task();
+            --pThreadPoolObj->m_iRunningThreadNum;
+            continue;
+        }
+
         // 走到这里，可以取得消息进行处理了【消息队列中必然有消息】,注意，目前还是互斥着呢
 
         // 消息队列中存在消息
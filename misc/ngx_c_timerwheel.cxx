@@ -0,0 +1,242 @@
+﻿// 本文件存放分层时间轮相关的函数实现
+// 第 0 层 256 个槽，每个槽 1 毫秒；上面 4 层各 64 个槽，每个槽的跨度是下一层一整圈；
+// 第 0 层走完一圈时，把上一层当前槽中的节点重新分配到下层，上一层也走完一圈时再往上一层分配
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ngx_c_timerwheel.h"
+
+// 把槽初始化成空的双向循环链表
+static inline void ngx_tw_slot_init(lpngx_timer_node_t head)
+{
+	head->prev = head->next = head;
+	head->expire = 0;
+	head->data = NULL;
+}
+
+// 构造函数
+CTimerWheel::CTimerWheel()
+{
+	m_tick = 0;
+	m_size = 0;
+	for (int i = 0; i < NGX_TW_ROOT_SIZE; ++i)
+	{
+		ngx_tw_slot_init(&m_root[i]);
+	}
+	for (int i = 0; i < NGX_TW_LEVELS; ++i)
+	{
+		for (int j = 0; j < NGX_TW_LEVEL_SIZE; ++j)
+		{
+			ngx_tw_slot_init(&m_levels[i][j]);
+		}
+	}
+}
+
+// 析构函数，节点属于各自的对象，这里不用释放
+CTimerWheel::~CTimerWheel()
+{
+}
+
+/***************************************************************
+ *  @brief     设置时间轮的起点
+ *  @param     now    当前时间，单位毫秒
+ **************************************************************/
+void CTimerWheel::Init(uint64_t now)
+{
+	m_tick = now;
+}
+
+/***************************************************************
+ *  @brief     按到期时间和当前位置的距离，把节点挂到对应层的对应槽上
+ *  @param     node    定时器节点
+ *  @note      距离越远挂得越高；到期时间本身决定槽的下标，这样上层的槽轮到重新分配时，里边的节点正好都落在下层的这一圈里
+ **************************************************************/
+void CTimerWheel::Link(lpngx_timer_node_t node)
+{
+	uint64_t expire = (node->expire < m_tick) ? m_tick : node->expire;
+	uint64_t idx = expire - m_tick;
+	lpngx_timer_node_t head = NULL;
+
+	if (idx < NGX_TW_ROOT_SIZE)
+	{
+		head = &m_root[expire & NGX_TW_ROOT_MASK];
+	}
+	else
+	{
+		for (int i = 0; i < NGX_TW_LEVELS; ++i)
+		{
+			if (idx < (1ULL << (NGX_TW_ROOT_BITS + (i + 1) * NGX_TW_LEVEL_BITS)))
+			{
+				head = &m_levels[i][(expire >> (NGX_TW_ROOT_BITS + i * NGX_TW_LEVEL_BITS)) & NGX_TW_LEVEL_MASK];
+				break;
+			}
+		}
+		if (head == NULL)
+		{
+			// 超出时间轮能表示的范围，先挂在最远处，到时候重新分配时再往后挂
+			expire = m_tick + (1ULL << (NGX_TW_ROOT_BITS + NGX_TW_LEVELS * NGX_TW_LEVEL_BITS)) - 1;
+			head = &m_levels[NGX_TW_LEVELS - 1][(expire >> (NGX_TW_ROOT_BITS + (NGX_TW_LEVELS - 1) * NGX_TW_LEVEL_BITS)) & NGX_TW_LEVEL_MASK];
+		}
+	}
+
+	// 挂到链表尾部
+	node->next = head;
+	node->prev = head->prev;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+/***************************************************************
+ *  @brief     加入一个节点
+ *  @param     node    定时器节点，data 由调用者设置
+ *  @param     expire    到期时间，单位毫秒
+ **************************************************************/
+void CTimerWheel::Add(lpngx_timer_node_t node, uint64_t expire)
+{
+	if (IsArmed(node))
+	{
+		Del(node);
+	}
+	node->expire = expire;
+	Link(node);
+	++m_size;
+}
+
+/***************************************************************
+ *  @brief     删除一个节点
+ *  @param     node    定时器节点
+ **************************************************************/
+void CTimerWheel::Del(lpngx_timer_node_t node)
+{
+	if (!IsArmed(node))
+	{
+		return;
+	}
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = NULL;
+	--m_size;
+}
+
+/***************************************************************
+ *  @brief     把第 level 层当前槽中的节点全部重新分配到下层
+ *  @param     level    第 0 层以上的第几层，从 0 开始
+ *  @return    当前槽的下标，为 0 说明这一层也走完了一圈，调用者接着分配再上一层
+ **************************************************************/
+int CTimerWheel::Cascade(int level)
+{
+	int index = (int)((m_tick >> (NGX_TW_ROOT_BITS + level * NGX_TW_LEVEL_BITS)) & NGX_TW_LEVEL_MASK);
+	lpngx_timer_node_t head = &m_levels[level][index];
+	if (head->next == head)
+	{
+		return index;
+	}
+
+	// 整个链表摘下来再逐个挂回去，挂回去的节点不会再落到这个槽上
+	lpngx_timer_node_t node = head->next;
+	head->prev->next = NULL;
+	ngx_tw_slot_init(head);
+
+	while (node != NULL)
+	{
+		lpngx_timer_node_t next = node->next;
+		Link(node);
+		node = next;
+	}
+
+	return index;
+}
+
+/***************************************************************
+ *  @brief     时间轮走到 now，摘下所有到期的节点
+ *  @param     now    当前时间，单位毫秒
+ *  @param     expired    到期的节点追加在这里，已经不在时间轮中，可以直接重新加入
+ **************************************************************/
+void CTimerWheel::Expire(uint64_t now, std::vector<lpngx_timer_node_t> &expired)
+{
+	while (m_tick <= now)
+	{
+		// 时间轮空了，直接跳到 now 之后
+		if (m_size == 0)
+		{
+			m_tick = now + 1;
+			break;
+		}
+
+		int index = (int)(m_tick & NGX_TW_ROOT_MASK);
+		if (index == 0)
+		{
+			for (int i = 0; i < NGX_TW_LEVELS && Cascade(i) == 0; ++i)
+				;
+		}
+
+		lpngx_timer_node_t head = &m_root[index];
+		while (head->next != head)
+		{
+			lpngx_timer_node_t node = head->next;
+			Del(node);
+			expired.push_back(node);
+		}
+
+		++m_tick;
+	}
+}
+
+/***************************************************************
+ *  @brief     计算距离下一次可能有节点到期的毫秒数
+ *  @param     now    当前时间，单位毫秒
+ *  @param     maxwait    最多等多久
+ *  @return    第 0 层这一圈里下一个不空的槽，没有的话就是这一圈走完、要从上层重新分配的时候
+ **************************************************************/
+uint64_t CTimerWheel::NextTimeout(uint64_t now, uint64_t maxwait)
+{
+	if (m_size == 0)
+	{
+		return maxwait;
+	}
+
+	uint64_t t = m_tick;
+	uint64_t end = (m_tick | NGX_TW_ROOT_MASK) + 1;
+	while (t < end && m_root[t & NGX_TW_ROOT_MASK].next == &m_root[t & NGX_TW_ROOT_MASK])
+	{
+		++t;
+	}
+
+	if (t <= now)
+	{
+		return 0;
+	}
+	return (t - now < maxwait) ? t - now : maxwait;
+}
+
+/***************************************************************
+ *  @brief     删除一个槽中的全部节点
+ *  @param     head    槽的哨兵
+ **************************************************************/
+void CTimerWheel::ClearSlot(lpngx_timer_node_t head)
+{
+	while (head->next != head)
+	{
+		Del(head->next);
+	}
+}
+
+/***************************************************************
+ *  @brief     删除全部节点，节点都恢复成不在时间轮中的状态
+ **************************************************************/
+void CTimerWheel::Clear()
+{
+	for (int i = 0; i < NGX_TW_ROOT_SIZE; ++i)
+	{
+		ClearSlot(&m_root[i]);
+	}
+	for (int i = 0; i < NGX_TW_LEVELS; ++i)
+	{
+		for (int j = 0; j < NGX_TW_LEVEL_SIZE; ++j)
+		{
+			ClearSlot(&m_levels[i][j]);
+		}
+	}
+}
@@ -12,7 +12,11 @@
 #include <fcntl.h>     //open
 #include <errno.h>     //errno
 #include <sys/ioctl.h> //ioctl
+#include <sys/eventfd.h> //eventfd
+#include <sys/timerfd.h> //timerfd
+#include <limits.h>    //IOV_MAX
 #include <arpa/inet.h>
+#include <netinet/tcp.h> //TCP_DEFER_ACCEPT
 
 #include "ngx_c_conf.h"
 #include "ngx_macro.h"
@@ -33,6 +37,28 @@ CSocekt::CSocekt()
     m_worker_connections = 1;
     // 监听一个端口
     m_ListenPortCount = 1;
+    // 默认不监听 AF_UNIX 路径
+    m_UnixListenCount = 0;
+    // 默认不监听 UDP 端口
+    m_UdpPortCount = 0;
+    // 默认不开启共享内存通道
+    m_shmListenPath[0] = 0;
+    m_iShmChannelCount = 0;
+    m_iShmPkgCount = 0;
+    m_iShmWakeupCount = 0;
+    // UDP 套接字的接收缓冲区用系统默认大小
+    m_udpRcvBuf = 0;
+    m_udpRecvBuf = NULL;
+    // 默认由 master 打开监听套接字，各 worker 共享
+    m_listenMode = 0;
+    // 一次监听事件最多 accept 32 个连接
+    m_acceptBatch = 32;
+    // 默认不设置 TCP_DEFER_ACCEPT
+    m_deferAccept = 0;
+    // 句柄用尽时暂停 accept 100 毫秒
+    m_acceptPauseMs = 100;
+    m_acceptPauseUntil = 0;
+    m_spareFd = -1;
     // 延迟回收连接时间
     m_RecyConnectionWaitTime = 60;
 
@@ -40,6 +66,35 @@ CSocekt::CSocekt()
 
     // epoll返回的句柄
     m_epollhandle = -1;
+    // 默认使用水平触发
+    m_epollET = 0;
+    // 默认由独立的发送线程发送数据
+    m_reactorSend = 0;
+    // 默认由发送线程或 epoll 线程发送，不由处理线程直接发送
+    m_directSend = 0;
+    // 默认不使用零拷贝发送
+    m_zeroCopyThreshold = 0;
+    m_sendEventFd = -1;
+    m_sendEventPending = 0;
+    // timerfd 在 ngx_epoll_init() 中创建
+    m_timerFd = -1;
+    m_timerFdExpire = UINT64_MAX;
+    m_schedNextId = 1;
+    // 默认使用 epoll
+    m_useUring = 0;
+    m_uringFd = -1;
+    m_sqRingPtr = NULL;
+    m_sqes = NULL;
+    m_bufRing = NULL;
+    m_bufBase = NULL;
+    m_bufCount = 512;
+    m_iUringEnterCount = 0;
+    m_iUringCqeCount = 0;
+    m_iUdpRecvCount = 0;
+    m_iUdpRecvCallCount = 0;
+    m_iUdpSendCount = 0;
+    m_iUdpSendCallCount = 0;
+    m_iUdpDropCount = 0;
     // m_pconnections = NULL;       //连接池【连接数组】先给空
     // m_pfree_connections = NULL;  //连接池中空闲的连接链
     // m_pread_events = NULL;       //读事件数组给空
@@ -51,6 +106,11 @@ CSocekt::CSocekt()
     m_iLenPkgHeader = sizeof(COMM_PKG_HEADER);
     // 消息头所占空间大小
     m_iLenMsgHeader = sizeof(STRUC_MSG_HEADER);
+    // 每个连接的收包缓冲区大小
+    m_iRecvBufSize = 16384;
+    m_c1mMode = 0;
+    m_memHugePages = NGX_MEM_HUGE_NONE;
+    m_memPrefault = NGX_MEM_PREFAULT_NONE;
 
     // 多线程相关
     // pthread_mutex_init(&m_recvMessageQueueMutex, NULL); //互斥量初始化
@@ -61,12 +121,24 @@ CSocekt::CSocekt()
     m_iSendMsgQueueCount = 0;
     // 待释放连接队列大小
     m_totol_recyconnection_n = 0;
-    // 当前计时队列尺寸
-    m_cur_size_ = 0;
-    // 当前计时队列头部的时间值
-    m_timer_value_ = 0;
+    m_recyconnectionHead = m_recyconnectionTail = NULL;
+    // 连接池在 initconnection() 中创建
+    m_connSlabs = NULL;
+    m_connSlabCount = 0;
+    m_connStride = 0;
+    m_freeConnHead = 0;
     // 丢弃的发送数据包数量
     m_iDiscardSendPkgCount = 0;
+    // 累计接受的连接数
+    m_iAcceptCount = 0;
+    m_iAcceptPauseCount = 0;
+    m_iAcceptDropCount = 0;
+    // 发送线程合并发送的统计
+    m_iSendPkgCount = 0;
+    m_iSendCallCount = 0;
+    m_iDirectSendCount = 0;
+    m_iZeroCopySendCount = 0;
+    m_iZeroCopyCopiedCount = 0;
 
     // 在线用户相关变量
 
@@ -94,6 +166,12 @@ CSocekt::~CSocekt()
 
     // 清空队列
     m_ListenSocketList.clear();
+
+    for (auto pos = m_UdpSocketList.begin(); pos != m_UdpSocketList.end(); ++pos)
+    {
+        delete (*pos);
+    }
+    m_UdpSocketList.clear();
     return;
 }
 
@@ -109,8 +187,61 @@ void CSocekt::ReadConf()
     m_worker_connections = p_config->GetIntDefault("worker_connections", m_worker_connections);
     // 取得要监听的端口数量
     m_ListenPortCount = p_config->GetIntDefault("ListenPortCount", m_ListenPortCount);
+    // 取得要监听的 AF_UNIX 路径数量，路径由 UnixListenPath0、UnixListenPath1... 给出，同一台机器上的客户端可以绕开 TCP 协议栈
+    m_UnixListenCount = p_config->GetIntDefault("UnixListenCount", m_UnixListenCount);
+    // 共享内存通道的握手路径，同一台机器上对时延敏感的客户端通过它拿到共享内存通道，不配置则不开启
+    const char *pshmpath = p_config->GetString("ShmListenPath");
+    if (pshmpath != NULL && strlen(pshmpath) < sizeof(m_shmListenPath))
+    {
+        strcpy(m_shmListenPath, pshmpath);
+    }
+    // 取得要监听的 UDP 端口数量，端口号由 UdpPort0、UdpPort1... 给出
+    m_UdpPortCount = p_config->GetIntDefault("UdpPortCount", m_UdpPortCount);
+    // UDP 套接字的接收缓冲区字节数，0：系统默认；大量客户端同时上报时默认的缓冲区容易溢出，内核会直接丢掉数据报
+    m_udpRcvBuf = p_config->GetIntDefault("Sock_UdpRcvBuf", m_udpRcvBuf);
+    // 监听套接字的打开方式，0：master 打开后共享，1：每个 worker 用 SO_REUSEPORT 各自打开，由内核在 worker 之间分配连接，2：共享 + EPOLLEXCLUSIVE
+    m_listenMode = p_config->GetIntDefault("Sock_ListenMode", m_listenMode);
+    if (m_listenMode < 0 || m_listenMode > 2)
+    {
+        m_listenMode = 0;
+    }
+    // 一次监听事件最多 accept 多少个连接，重连风暴时既不会一次只接一个，也不会长时间卡在 accept 上
+    m_acceptBatch = p_config->GetIntDefault("Sock_AcceptBatch", m_acceptBatch);
+    m_acceptBatch = (m_acceptBatch > 1) ? m_acceptBatch : 1;
+    // TCP_DEFER_ACCEPT 秒数，客户端连上后这么长时间内没发数据，内核就不把连接交给 accept()，0：不设置
+    m_deferAccept = p_config->GetIntDefault("Sock_DeferAccept", m_deferAccept);
+    // 句柄用尽等情况下暂停 accept 的毫秒数，0：不暂停
+    m_acceptPauseMs = p_config->GetIntDefault("Sock_AcceptPauseMs", m_acceptPauseMs);
     // 延迟回收连接时间
     m_RecyConnectionWaitTime = p_config->GetIntDefault("Sock_RecyConnectionWaitTime", m_RecyConnectionWaitTime);
+    // 客户端连接的 epoll 触发模式，0：水平触发（LT），1：边缘触发（ET），监听套接字始终使用 LT
+    m_epollET = (p_config->GetIntDefault("Sock_EpollET", m_epollET) == 1) ? 1 : 0;
+    // 谁来发送数据，0：独立的发送线程，1：epoll 线程，由 eventfd 唤醒
+    m_reactorSend = (p_config->GetIntDefault("Sock_ReactorSend", m_reactorSend) == 1) ? 1 : 0;
+    // 连接空闲时是否由处理线程直接发送，0：否，全部经过发送队列，1：是
+    m_directSend = (p_config->GetIntDefault("Sock_DirectSend", m_directSend) == 1) ? 1 : 0;
+    // 一次发送不少于这么多字节时使用 MSG_ZEROCOPY，0：不使用；数据量小时零拷贝的开销比拷贝还大，一般至少设成 10K 以上
+    m_zeroCopyThreshold = p_config->GetIntDefault("Sock_ZeroCopyThreshold", m_zeroCopyThreshold);
+    if (m_zeroCopyThreshold < 0)
+    {
+        m_zeroCopyThreshold = 0;
+    }
+    // 是否用 io_uring 代替 epoll，0：否，1：是，内核不支持时自动退回 epoll
+    m_useUring = (p_config->GetIntDefault("Sock_UseIoUring", m_useUring) == 1) ? 1 : 0;
+    // io_uring 收包缓冲区环中缓冲区的个数，向上取整为 2 的幂
+    int bufCount = p_config->GetIntDefault("Sock_UringBufCount", m_bufCount);
+    for (m_bufCount = 16; m_bufCount < bufCount && m_bufCount < 32768; m_bufCount <<= 1)
+        ;
+    // 每个连接的收包缓冲区大小，一次 readv 尽量多收几个包，太小就没有意义了
+    m_iRecvBufSize = p_config->GetIntDefault("Sock_RecvBufSize", m_iRecvBufSize);
+    m_iRecvBufSize = (m_iRecvBufSize > 1024) ? m_iRecvBufSize : 1024;
+    // C1M 模式，面向大量空闲长连接，收包缓冲区用完就还
+    m_c1mMode = (p_config->GetIntDefault("Sock_C1MMode", m_c1mMode) == 1) ? 1 : 0;
+    // 连接池和消息内存的 arena 模式，大页：0 不用，1 透明大页，2 先试预留的大页；预先缺页：0 不做，1 启动时写一遍，2 再 mlock
+    m_memHugePages = p_config->GetIntDefault("Mem_HugePages", m_memHugePages);
+    m_memHugePages = (m_memHugePages >= NGX_MEM_HUGE_NONE && m_memHugePages <= NGX_MEM_HUGE_TLB) ? m_memHugePages : NGX_MEM_HUGE_NONE;
+    m_memPrefault = p_config->GetIntDefault("Mem_Prefault", m_memPrefault);
+    m_memPrefault = (m_memPrefault >= NGX_MEM_PREFAULT_NONE && m_memPrefault <= NGX_MEM_PREFAULT_LOCK) ? m_memPrefault : NGX_MEM_PREFAULT_NONE;
 
     // 是否开启踢人时钟，1：开启   0：不开启
     m_ifkickTimeCount = p_config->GetIntDefault("Sock_WaitTimeEnable", 0);
@@ -140,12 +271,32 @@ bool CSocekt::Initialize()
     // 读配置项信息
     ReadConf();
 
-    // 打开全部监听端口，并加入监听队列
-    if (ngx_open_listening_sockets() == false)
+    // AF_UNIX 监听套接字不受 Sock_ListenMode 影响，总是在这里打开
+    if (ngx_open_unix_listening_sockets() == false)
     {
         return false;
     }
 
+    // 打开全部监听端口，并加入监听队列；SO_REUSEPORT 模式下由每个 worker 进程在 ngx_epoll_init() 中各自打开，
+    // master 进程不能一直开着，否则它的套接字也会被内核分到连接，却没有人 accept()
+    if (m_listenMode != 1 && ngx_open_listening_sockets() == false)
+    {
+        return false;
+    }
+
+    // SO_REUSEPORT 模式下 master 先把全部端口试着打开一遍再关掉，端口被占用等问题在启动时就报错退出，
+    // 而不是 fork 出的 worker 各自打开失败
+    if (m_listenMode == 1)
+    {
+        bool bTestOk = ngx_open_listening_sockets();
+        ngx_drop_listening_sockets();
+        if (bTestOk == false)
+        {
+            ngx_log_stderr(0, "CSocekt::Initialize()中试着打开监听端口失败，Sock_ListenMode = 1时每个worker都要能打开全部端口!");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -208,8 +359,22 @@ bool CSocekt::ngx_open_listening_sockets()
         int reuseport = 1;
         if (setsockopt(isock, SOL_SOCKET, SO_REUSEPORT, (const void *)&reuseport, sizeof(int)) == -1) // 端口复用需要内核支持
         {
-            
-            ngx_log_stderr(errno, "CSocekt::Initialize()中setsockopt(SO_REUSEPORT)失败", i);
+            ngx_log_stderr(errno, "CSocekt::Initialize()中setsockopt(SO_REUSEPORT)失败,i=%d.", i);
+            // 每个 worker 各自监听时，没有 SO_REUSEPORT 第二个 worker 就 bind() 不上
+            if (m_listenMode == 1)
+            {
+                close(isock);
+                return false;
+            }
+        }
+
+        // 客户端连上后不发数据，就一直留在内核里，不占用连接池
+        if (m_deferAccept > 0)
+        {
+            if (setsockopt(isock, IPPROTO_TCP, TCP_DEFER_ACCEPT, (const void *)&m_deferAccept, sizeof(int)) == -1)
+            {
+                ngx_log_stderr(errno, "CSocekt::Initialize()中setsockopt(TCP_DEFER_ACCEPT)失败,i=%d.", i);
+            }
         }
 
         // 设置该 socket 为非阻塞（信箱）
@@ -269,6 +434,159 @@ bool CSocekt::ngx_open_listening_sockets()
         return false;
     }
 
+    // UDP 端口和 TCP 监听端口的打开方式一样，SO_REUSEPORT 模式下由内核按来源地址在 worker 之间分配数据报
+    for (int i = 0; i < m_UdpPortCount; i++)
+    {
+        isock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (isock == -1)
+        {
+            ngx_log_stderr(errno, "CSocekt::Initialize()中socket(SOCK_DGRAM)失败,i=%d.", i);
+            return false;
+        }
+
+        int reuseport = 1;
+        if (setsockopt(isock, SOL_SOCKET, SO_REUSEPORT, (const void *)&reuseport, sizeof(int)) == -1)
+        {
+            ngx_log_stderr(errno, "CSocekt::Initialize()中UDP端口setsockopt(SO_REUSEPORT)失败,i=%d.", i);
+            if (m_listenMode == 1)
+            {
+                close(isock);
+                return false;
+            }
+        }
+
+        if (m_udpRcvBuf > 0)
+        {
+            if (setsockopt(isock, SOL_SOCKET, SO_RCVBUF, (const void *)&m_udpRcvBuf, sizeof(int)) == -1)
+            {
+                ngx_log_stderr(errno, "CSocekt::Initialize()中UDP端口setsockopt(SO_RCVBUF)失败,i=%d.", i);
+            }
+        }
+
+        if (setnonblocking(isock) == false)
+        {
+            ngx_log_stderr(errno, "CSocekt::Initialize()中UDP端口setnonblocking()失败,i=%d.", i);
+            close(isock);
+            return false;
+        }
+
+        sprintf(strinfo, "UdpPort%d", i);
+        iport = p_config->GetIntDefault(strinfo, 10000);
+        serv_addr.sin_port = htons((in_port_t)iport);
+
+        if (bind(isock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) == -1)
+        {
+            ngx_log_stderr(errno, "CSocekt::Initialize()中UDP端口bind()失败,i=%d.", i);
+            close(isock);
+            return false;
+        }
+
+        lpngx_listening_t p_udpsocketitem = new ngx_listening_t;
+        memset(p_udpsocketitem, 0, sizeof(ngx_listening_t));
+        p_udpsocketitem->port = iport;
+        p_udpsocketitem->fd = isock;
+        ngx_log_error_core(NGX_LOG_INFO, 0, "监听UDP %d端口成功!", iport);
+        m_UdpSocketList.push_back(p_udpsocketitem);
+    }
+
+    return true;
+}
+
+/***************************************************************
+ *  @brief     打开配置的全部 AF_UNIX 监听套接字，加入监听队列，和 TCP 监听套接字一样由 ngx_event_accept() 接受连接
+ *  @return    成功返回 true，失败返回 false
+ *  @note      共享内存通道的握手路径也在这里打开
+ **************************************************************/
+bool CSocekt::ngx_open_unix_listening_sockets()
+{
+    const char *ppath;
+    char strinfo[100];
+
+    CConfig *p_config = CConfig::GetInstance();
+
+    for (int i = 0; i < m_UnixListenCount; i++)
+    {
+        sprintf(strinfo, "UnixListenPath%d", i);
+        ppath = p_config->GetString(strinfo);
+        if (ppath == NULL || ppath[0] == 0)
+        {
+            ngx_log_stderr(0, "CSocekt::Initialize()中没有配置%s.", strinfo);
+            return false;
+        }
+
+        if (ngx_open_unix_listening_socket(ppath, 0) == false)
+        {
+            return false;
+        }
+    }
+
+    if (m_shmListenPath[0] != 0 && ngx_open_unix_listening_socket(m_shmListenPath, 1) == false)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/***************************************************************
+ *  @brief     打开一个 AF_UNIX 监听套接字，加入监听队列
+ *  @param     ppath    路径
+ *  @param     shm    是否是共享内存通道的握手路径
+ *  @return    成功返回 true，失败返回 false
+ *  @note      路径上残留的套接字文件（比如上次异常退出留下的）先删掉，否则 bind() 会失败
+ **************************************************************/
+bool CSocekt::ngx_open_unix_listening_socket(const char *ppath, int shm)
+{
+    int isock;
+    struct sockaddr_un serv_addr;
+
+    if (strlen(ppath) >= sizeof(serv_addr.sun_path))
+    {
+        ngx_log_stderr(0, "CSocekt::Initialize()中路径%s太长.", ppath);
+        return false;
+    }
+
+    isock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (isock == -1)
+    {
+        ngx_log_stderr(errno, "CSocekt::Initialize()中socket(AF_UNIX)失败,path=%s.", ppath);
+        return false;
+    }
+
+    if (setnonblocking(isock) == false)
+    {
+        ngx_log_stderr(errno, "CSocekt::Initialize()中AF_UNIX套接字setnonblocking()失败,path=%s.", ppath);
+        close(isock);
+        return false;
+    }
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sun_family = AF_UNIX;
+    strcpy(serv_addr.sun_path, ppath);
+    unlink(ppath);
+
+    if (bind(isock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) == -1)
+    {
+        ngx_log_stderr(errno, "CSocekt::Initialize()中AF_UNIX套接字bind()失败,path=%s.", ppath);
+        close(isock);
+        return false;
+    }
+
+    if (listen(isock, NGX_LISTEN_BACKLOG) == -1)
+    {
+        ngx_log_stderr(errno, "CSocekt::Initialize()中AF_UNIX套接字listen()失败,path=%s.", ppath);
+        close(isock);
+        return false;
+    }
+
+    lpngx_listening_t p_listensocketitem = new ngx_listening_t;
+    memset(p_listensocketitem, 0, sizeof(ngx_listening_t));
+    p_listensocketitem->fd = isock;
+    p_listensocketitem->shm = shm;
+    strcpy(p_listensocketitem->path, ppath);
+    ngx_log_error_core(NGX_LOG_INFO, 0, "监听%s成功!", ppath);
+    m_ListenSocketList.push_back(p_listensocketitem);
+
     return true;
 }
 
@@ -279,16 +597,45 @@ bool CSocekt::ngx_open_listening_sockets()
  **************************************************************/
 int CSocekt::ngx_epoll_init()
 {
-    // 很多内核版本不处理 epoll_create 的参数，只要该参数 >0 即可
-    // 创建一个epoll对象，其中包含一个红黑树和一个双向链表
+    // SO_REUSEPORT 模式下，每个 worker 进程在这里打开自己的监听套接字
+    if (m_listenMode == 1 && ngx_open_listening_sockets() == false)
+    {
+        // 用专门的退出码告诉 master，由它停止整个服务
+        ngx_log_error_core(NGX_LOG_ALERT, 0, "CSocekt::ngx_epoll_init()中ngx_open_listening_sockets()失败!");
+        exit(NGX_EXIT_LISTEN);
+    }
 
-    // 直接以epoll连接的最大项数为参数，肯定 > 0
-    m_epollhandle = epoll_create(m_worker_connections);
-    if (m_epollhandle == -1)
+    // 配置了 io_uring 且内核支持，就用 io_uring 代替 epoll，否则退回 epoll
+    if (m_useUring == 1 && ngx_uring_init() == false)
     {
-        // 创建失败直接退出
-        ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中epoll_create()失败.");
-        exit(2);
+        ngx_log_error_core(NGX_LOG_WARN, 0, "CSocekt::ngx_epoll_init()中io_uring初始化失败，退回epoll!");
+    }
+
+    if (m_uringFd != -1)
+    {
+        // io_uring 的 multishot 请求没有触发模式之分
+        m_epollET = 0;
+
+        // 零拷贝发送的完成通知在错误队列里，只有 epoll 的 EPOLLERR 分支会去取，io_uring 下收不到，发送的内存会一直不释放
+        if (m_zeroCopyThreshold > 0)
+        {
+            ngx_log_error_core(NGX_LOG_WARN, 0, "CSocekt::ngx_epoll_init()中使用io_uring时不支持零拷贝发送，Sock_ZeroCopyThreshold不起作用!");
+            m_zeroCopyThreshold = 0;
+        }
+    }
+    else
+    {
+        // 很多内核版本不处理 epoll_create 的参数，只要该参数 >0 即可
+        // 创建一个epoll对象，其中包含一个红黑树和一个双向链表
+
+        // 直接以epoll连接的最大项数为参数，肯定 > 0
+        m_epollhandle = epoll_create(m_worker_connections);
+        if (m_epollhandle == -1)
+        {
+            // 创建失败直接退出
+            ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中epoll_create()失败.");
+            exit(2);
+        }
     }
 
     // 创建连接池【数组】，后续用于处理所有客户端的连接
@@ -353,10 +700,12 @@ int CSocekt::ngx_epoll_init()
                                 ) == -1)
                                 */
 
+        // AF_UNIX 监听套接字总是各 worker 共享的，也用 EPOLLEXCLUSIVE 避免惊群
         if (ngx_epoll_oper_event(
                 (*pos)->fd,           // socekt句柄
                 EPOLL_CTL_ADD,        // 事件类型，这里是增加
-                EPOLLIN | EPOLLRDHUP, // 标志，这里代表要增加的标志，EPOLLIN：可读，EPOLLRDHUP：TCP连接的远端关闭或者半关闭
+                (m_listenMode == 2 || (*pos)->path[0] != 0) ? (EPOLLIN | EPOLLEXCLUSIVE) : (EPOLLIN | EPOLLRDHUP), // 标志，这里代表要增加的标志，EPOLLIN：可读，EPOLLRDHUP：TCP连接的远端关闭或者半关闭，
+                                                                           // EPOLLEXCLUSIVE：来连接时只唤醒一个 worker，它只能和 EPOLLIN 等少数标志一起用
                 0,                    // 对于事件类型为增加的，不需要这个参数
                 p_Conn                // 连接池中的连接
                 ) == -1)
@@ -366,6 +715,80 @@ int CSocekt::ngx_epoll_init()
 
     } // end for
 
+    // UDP 端口同样分配一个连接，数据报由 ngx_udp_recv_handler() 收，应答经过这个连接的发送队列发出
+    if (m_UdpSocketList.size() > 0)
+    {
+        m_udpRecvBuf = (char *)CMemory::GetInstance()->AllocMemory(NGX_UDP_BATCH * NGX_UDP_DGRAM_MAX, false);
+    }
+    for (auto pos = m_UdpSocketList.begin(); pos != m_UdpSocketList.end(); ++pos)
+    {
+        lpngx_connection_t p_Conn = ngx_get_connection((*pos)->fd);
+        if (p_Conn == NULL)
+        {
+            ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中ngx_get_connection()失败.");
+            exit(2);
+        }
+        p_Conn->listening = (*pos);
+        (*pos)->connection = p_Conn;
+        p_Conn->rhandler = &CSocekt::ngx_udp_recv_handler;
+
+        if (ngx_epoll_oper_event((*pos)->fd, EPOLL_CTL_ADD, (m_listenMode == 2) ? (EPOLLIN | EPOLLEXCLUSIVE) : EPOLLIN, 0, p_Conn) == -1)
+        {
+            exit(2);
+        }
+    }
+
+    // 备用句柄，句柄用尽时关掉它，腾出位置把连接接进来再关掉
+    m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (m_spareFd == -1)
+    {
+        ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中open(/dev/null)失败.");
+    }
+
+    // 由 epoll 线程发送数据时，msgSend() 通过 eventfd 唤醒 epoll_wait()
+    if (m_reactorSend == 1)
+    {
+        m_sendEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_sendEventFd == -1)
+        {
+            ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中eventfd()失败.");
+            exit(2);
+        }
+
+        lpngx_connection_t p_Conn = ngx_get_connection(m_sendEventFd);
+        p_Conn->rhandler = &CSocekt::ngx_send_event_handler;
+        if (ngx_epoll_oper_event(m_sendEventFd, EPOLL_CTL_ADD, EPOLLIN, 0, p_Conn) == -1)
+        {
+            exit(2); // 有问题，直接退出，日志 已经写过了
+        }
+    }
+
+    // 定时任务和踢人时钟共用一个 timerfd，到期时由 epoll 线程处理，不需要轮询的线程
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd == -1)
+    {
+        ngx_log_stderr(errno, "CSocekt::ngx_epoll_init()中timerfd_create()失败.");
+        exit(2);
+    }
+    m_schedWheel.Init(ngx_timer_now_ms());
+    {
+        lpngx_connection_t p_Conn = ngx_get_connection(m_timerFd);
+        p_Conn->rhandler = &CSocekt::ngx_timerfd_handler;
+        if (ngx_epoll_oper_event(m_timerFd, EPOLL_CTL_ADD, EPOLLIN, 0, p_Conn) == -1)
+        {
+            exit(2);
+        }
+    }
+
+    if (m_uringFd != -1)
+    {
+        ngx_log_error_core(NGX_LOG_INFO, 0, "客户端连接使用io_uring，收包缓冲区%d个，数据由%s发送!", m_bufCount, (m_reactorSend == 1) ? "epoll线程" : "发送线程");
+    }
+    else
+    {
+        ngx_log_error_core(NGX_LOG_INFO, 0, "客户端连接使用epoll %s 模式，数据由%s发送!", (m_epollET == 1) ? "ET" : "LT", (m_reactorSend == 1) ? "epoll线程" : "发送线程");
+    }
+
     return 1;
 }
 
@@ -380,6 +803,12 @@ int CSocekt::ngx_epoll_init()
  **************************************************************/
 int CSocekt::ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag, int bcaction, lpngx_connection_t pConn)
 {
+    // io_uring 模式下翻译成对应的请求
+    if (m_uringFd != -1)
+    {
+        return ngx_uring_oper_event(fd, eventtype, flag, bcaction, pConn);
+    }
+
     // 临时变量，一个 epoll_event 事件，对待编辑的 TCP 连接和对连接的编辑选项进行封装，将来用于加入到红黑树中
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
@@ -425,9 +854,14 @@ int CSocekt::ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag, int
     // 删除节点
     else
     {
-        // 删除红黑树中节点，目前没这个需求
-        // socket关闭这项会自动从红黑树移除
-        return 1; // 先直接返回1表示成功
+        // 删除红黑树中节点，socket关闭这项会自动从红黑树移除，目前只有暂停 accept 时才需要
+        if (epoll_ctl(m_epollhandle, EPOLL_CTL_DEL, fd, NULL) == -1)
+        {
+            ngx_log_stderr(errno, "CSocekt::ngx_epoll_oper_event()中epoll_ctl(%d,EPOLL_CTL_DEL)失败.", fd);
+            return -1;
+        }
+        pConn->events = 0;
+        return 1;
     }
 
     // 原来的理解中，绑定ptr这个事，只在EPOLL_CTL_ADD的时候做一次即可，但是发现EPOLL_CTL_MOD似乎会破坏掉.data.ptr，因此不管是EPOLL_CTL_ADD，还是EPOLL_CTL_MOD，都给进去
@@ -455,6 +889,28 @@ int CSocekt::ngx_epoll_oper_event(int fd, uint32_t eventtype, uint32_t flag, int
  **************************************************************/
 int CSocekt::ngx_epoll_process_events(int timer)
 {
+    // 暂停 accept 期间，最多等到暂停结束，时间到了就恢复
+    if (m_acceptPauseUntil != 0)
+    {
+        struct timeval sCurrTime;
+        gettimeofday(&sCurrTime, NULL);
+        uint64_t iCurrTime = (sCurrTime.tv_sec * 1000 + sCurrTime.tv_usec / 1000);
+        if (iCurrTime >= m_acceptPauseUntil)
+        {
+            ngx_accept_resume();
+        }
+        else if (timer < 0 || (uint64_t)timer > m_acceptPauseUntil - iCurrTime)
+        {
+            timer = (int)(m_acceptPauseUntil - iCurrTime);
+        }
+    }
+
+    // io_uring 模式下从完成队列中取事件
+    if (m_uringFd != -1)
+    {
+        return ngx_uring_process_events(timer);
+    }
+
     /***************************************************************
      *  @brief     等待事件，将事件返回，可能会返回多个时间，也不返回任何事件，取决于是否有事件发生
      *  @param     m_epollhandle    epoll 对象句柄，事件来源
@@ -578,6 +1034,15 @@ int CSocekt::ngx_epoll_process_events(int timer)
         // 将事件取出准备处理
         revents = m_events[i].events;
 
+        // 零拷贝发送的完成通知放在 socket 的错误队列里，同样以 EPOLLERR 报告，先收掉，只有通知的话不能当成连接出错
+        if ((revents & EPOLLERR) && p_Conn->ifZeroCopy == 1 && p_Conn->fd != -1)
+        {
+            if (ngx_zerocopy_reap(p_Conn) > 0 && (revents & (EPOLLHUP | EPOLLRDHUP)) == 0)
+            {
+                revents &= ~EPOLLERR;
+            }
+        }
+
         /*
         if(revents & (EPOLLERR|EPOLLHUP)) //例如对方close掉套接字，这里会感应到【换句话说：如果发生了错误或者客户端断连】
         {
@@ -608,6 +1073,26 @@ int CSocekt::ngx_epoll_process_events(int timer)
         // 如果是写事件【对方关闭连接也触发这个，再研究。。。。。。】，
         // 注意上边的 if(revents & (EPOLLERR|EPOLLHUP))  revents |= EPOLLIN|EPOLLOUT; 读写标记都给加上了
         {
+            // ET 模式下 EPOLLOUT 在 accept 时就一次性注册好了，每次缓冲区由满变为可写都会来一个边沿，
+            // 这个边沿并不意味着投递过写事件，所以不能照搬下边 LT 的处理
+            if (m_epollET == 1)
+            {
+                // 连接已经在上边的读事件中被关闭，或者对端断开，收尾都由读流程负责
+                if (p_Conn->fd == -1 || (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)))
+                {
+                    continue;
+                }
+
+                // 先记下这个边沿，再判断是否有待发送的数据，和 ngx_epoll_arm_write() 中的顺序相反，
+                // 这样两个线程至少有一方能看到对方，边沿不会丢失；谁抢到 iWriteEdge 谁负责后续处理
+                p_Conn->iWriteEdge = 1;
+                if (p_Conn->iThrowsendCount > 0 && p_Conn->iWriteEdge.exchange(0) == 1)
+                {
+                    (this->*(p_Conn->whandler))(p_Conn);
+                }
+                continue;
+            }
+
             // ngx_log_stderr(errno,"22222222222222222222.");
 
             if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) // 客户端关闭，如果服务器端挂着一个写通知事件，则这里个条件是可能成立的
@@ -651,6 +1136,11 @@ void CSocekt::zdClosesocketProc(lpngx_connection_t p_Conn)
     // 句柄未关闭
     if (p_Conn->fd != -1)
     {
+        // io_uring 的请求持有 socket 的引用，只 close() 的话挂着的 multishot 请求不会结束，先 shutdown()
+        if (m_uringFd != -1)
+        {
+            shutdown(p_Conn->fd, SHUT_RDWR);
+        }
         // 这个socket关闭，关闭后epoll就会被从红黑树中删除，所以这之后无法收到任何epoll事件
         close(p_Conn->fd);
         p_Conn->fd = -1;
@@ -669,24 +1159,93 @@ void CSocekt::zdClosesocketProc(lpngx_connection_t p_Conn)
     return;
 }
 
+/***************************************************************
+ *  @brief     关闭并释放已经打开的 TCP、UDP 监听套接字，不写日志
+ *  @note      SO_REUSEPORT 模式下 master 试着打开端口之后调用；打开到一半失败时，已经打开的也在这里关掉；
+ *             AF_UNIX 监听套接字在这之前已经打开，也在同一个监听队列里，要留着给 worker 用
+ **************************************************************/
+void CSocekt::ngx_drop_listening_sockets()
+{
+    for (auto pos = m_ListenSocketList.begin(); pos != m_ListenSocketList.end();)
+    {
+        if ((*pos)->path[0] != 0)
+        {
+            ++pos;
+            continue;
+        }
+        close((*pos)->fd);
+        delete (*pos);
+        pos = m_ListenSocketList.erase(pos);
+    }
+
+    for (auto pos = m_UdpSocketList.begin(); pos != m_UdpSocketList.end(); ++pos)
+    {
+        close((*pos)->fd);
+        delete (*pos);
+    }
+    m_UdpSocketList.clear();
+}
+
 /***************************************************************
  *  @brief     关闭监听端口绑定的 socket 套接字
  **************************************************************/
 void CSocekt::ngx_close_listening_sockets()
 {
-    // 遍历监听队列中全部监听链接
-    for (int i = 0; i < m_ListenPortCount; i++)
+    // 遍历监听队列中全部监听链接，SO_REUSEPORT 模式下 master 进程的监听队列是空的
+    for (size_t i = 0; i < m_ListenSocketList.size(); i++)
     {
         // ngx_log_stderr(0,"端口是%d,socketid是%d.",m_ListenSocketList[i]->port,m_ListenSocketList[i]->fd);
 
         // 关闭连接的套接字
         close(m_ListenSocketList[i]->fd);
         // 输出日志
-        ngx_log_error_core(NGX_LOG_INFO, 0, "关闭监听端口%d!", m_ListenSocketList[i]->port);
+        if (m_ListenSocketList[i]->path[0] != 0)
+        {
+            ngx_log_error_core(NGX_LOG_INFO, 0, "关闭监听路径%s!", m_ListenSocketList[i]->path);
+        }
+        else
+        {
+            ngx_log_error_core(NGX_LOG_INFO, 0, "关闭监听端口%d!", m_ListenSocketList[i]->port);
+        }
     } // end for(int i = 0; i < m_ListenPortCount; i++)
+
+    for (size_t i = 0; i < m_UdpSocketList.size(); i++)
+    {
+        close(m_UdpSocketList[i]->fd);
+        ngx_log_error_core(NGX_LOG_INFO, 0, "关闭UDP端口%d!", m_UdpSocketList[i]->port);
+    }
     return;
 }
 
+/***************************************************************
+ *  @brief     发送缓冲区满，把剩余数据的发送交给 epoll 驱动，由 ngx_write_request_handler() 继续发送
+ *  @param     pConn    待发送数据的 TCP 连接，调用前 psendbuf、isendlen 已经记录好，iThrowsendCount 已经 +1
+ *  @return    成功返回 1，失败返回 -1
+ *  @note      LT 模式下要把 EPOLLOUT 加到 epoll 中，发送完再去掉；ET 模式下 EPOLLOUT 已常驻，一般什么都不用做，
+ *             只有可写边沿恰好在 iThrowsendCount +1 之前到来并且被 epoll 线程错过时，才用 EPOLL_CTL_MOD 重新武装一次，让内核再报一次
+ **************************************************************/
+int CSocekt::ngx_epoll_arm_write(lpngx_connection_t pConn)
+{
+    if (m_epollET == 0)
+    {
+        return ngx_epoll_oper_event(
+            pConn->fd,     // socket句柄
+            EPOLL_CTL_MOD, // 事件类型，这里是增加【因为我们准备增加个写通知】
+            EPOLLOUT,      // 标志，这里代表要增加的标志,EPOLLOUT：可写【可写的时候通知我】
+            0,             // 对于事件类型为增加的，EPOLL_CTL_MOD需要这个参数, 0：增加   1：去掉 2：完全覆盖
+            pConn          // 连接池中的连接
+        );
+    }
+
+    // 抢到了边沿，说明 epoll 线程看到边沿时 iThrowsendCount 还是 0，没有去发送，这个边沿只能由我们补回去
+    if (pConn->iWriteEdge.exchange(0) == 1)
+    {
+        return ngx_epoll_oper_event(pConn->fd, EPOLL_CTL_MOD, 0, 0, pConn);
+    }
+
+    return 1;
+}
+
 /***************************************************************
  *  @brief     设置 socket 连接为非阻塞，调用系统函数
  *  @param     sockfd    待设置 socket 句柄
@@ -752,9 +1311,46 @@ void CSocekt::printTDInfo()
         // 输出
         ngx_log_stderr(0, "------------------------------------begin--------------------------------------");
         ngx_log_stderr(0, "当前在线人数/总人数(%d/%d)。", tmpoLUC, m_worker_connections);
-        ngx_log_stderr(0, "连接池中空闲连接/总连接/要释放的连接(%d/%d/%d)。", m_freeconnectionList.size(), m_connectionList.size(), m_recyconnectionList.size());
-        ngx_log_stderr(0, "当前时间队列大小(%d)。", m_timerQueuemap.size());
-        ngx_log_stderr(0, "当前收消息队列/发消息队列大小分别为(%d/%d)，丢弃的待发送数据包数量为%d。", tmprmqc, tmpsmqc, m_iDiscardSendPkgCount);
+        ngx_log_stderr(0, "本worker进程(pid=%P)累计接受连接数%L。", ngx_pid, (int64_t)m_iAcceptCount);
+        if (m_iAcceptPauseCount > 0)
+        {
+            ngx_log_stderr(0, "句柄用尽暂停accept次数/接进来直接关掉的连接数(%L/%L)。", m_iAcceptPauseCount, m_iAcceptDropCount);
+        }
+        ngx_log_stderr(0, "连接池中空闲连接/总连接/要释放的连接(%d/%d/%d)。", (int)m_free_connection_n, (int)m_total_connection_n, (int)m_totol_recyconnection_n);
+        ngx_log_stderr(0, "当前时间轮中的踢人时钟数(%d)。", (int)m_timerWheel.Size());
+        ngx_log_stderr(0, "当前收消息队列/发消息队列大小分别为(%d/%d)，丢弃的待发送数据包数量为%d。", tmprmqc, tmpsmqc, (int)m_iDiscardSendPkgCount);
+
+        // 平均每次发送系统调用发出的包数，越大说明合并发送越有效
+        int64_t tmpspc = m_iSendPkgCount;
+        int64_t tmpscc = m_iSendCallCount;
+        ngx_log_stderr(0, "已发送数据包/发送系统调用次数(%L/%L)，平均每次系统调用发送%.2f个包。", tmpspc, tmpscc, (tmpscc > 0) ? (double)tmpspc / tmpscc : 0.0);
+        ngx_log_stderr(0, "其中处理线程直接发送的系统调用次数为%L。", (int64_t)m_iDirectSendCount);
+        if (m_zeroCopyThreshold > 0)
+        {
+            ngx_log_stderr(0, "零拷贝发送次数/其中内核退化为拷贝的次数(%L/%L)。", (int64_t)m_iZeroCopySendCount, (int64_t)m_iZeroCopyCopiedCount);
+        }
+        if (m_UdpSocketList.size() > 0)
+        {
+            int64_t tmpurc = m_iUdpRecvCount;
+            int64_t tmpurcc = m_iUdpRecvCallCount;
+            int64_t tmpusc = m_iUdpSendCount;
+            int64_t tmpuscc = m_iUdpSendCallCount;
+            ngx_log_stderr(0, "UDP收到数据报/recvmmsg()次数(%L/%L)，发出数据报/sendmmsg()次数(%L/%L)，丢弃的数据报%L个。", tmpurc, tmpurcc, tmpusc, tmpuscc, (int64_t)m_iUdpDropCount);
+        }
+        {
+            CLock lock(&m_schedMutex);
+            ngx_log_stderr(0, "等待中的定时任务数(%d)。", (int)m_schedTasks.size());
+        }
+        if (m_shmListenPath[0] != 0)
+        {
+            ngx_log_stderr(0, "共享内存通道数%d，收到的包数/eventfd唤醒次数(%L/%L)。", (int)m_iShmChannelCount, m_iShmPkgCount, m_iShmWakeupCount);
+        }
+        if (m_uringFd != -1)
+        {
+            int64_t tmpuec = m_iUringEnterCount;
+            int64_t tmpucc = m_iUringCqeCount;
+            ngx_log_stderr(0, "io_uring_enter()次数/完成事件个数(%L/%L)，平均每次系统调用处理%.2f个事件。", tmpuec, tmpucc, (tmpuec > 0) ? (double)tmpucc / tmpuec : 0.0);
+        }
 
         // 收到消息过多
         if (tmprmqc > 100000)
@@ -770,26 +1366,43 @@ void CSocekt::printTDInfo()
 }
 
 /***************************************************************
- *  @brief     清空 TCP 发消息队列
- *  @note      调用示例
+ *  @brief     清空所有连接的发送队列
+ *  @note      程序退出时调用，此时发送线程已经结束
  **************************************************************/
 void CSocekt::clearMsgSendQueue()
+{
+    for (int i = 0; i < m_connSlabCount * NGX_CONN_SLAB_SIZE; ++i)
+    {
+        clearConnSendQueue(ngx_conn_by_index(i));
+    }
+    m_sendReadyList.clear();
+}
+
+/***************************************************************
+ *  @brief     清空一个连接的发送队列，释放其中全部消息
+ *  @param     pConn    TCP 连接
+ **************************************************************/
+void CSocekt::clearConnSendQueue(lpngx_connection_t pConn)
 {
     // 临时变量
     char *sTmpMempoint;
     // 内存对象
     CMemory *p_memory = CMemory::GetInstance();
 
+    CLock lock(&pConn->sendMutex);
+
     // 队列非空
-    while (!m_MsgSendQueue.empty())
+    while (pConn->psendQueueHead != NULL)
     {
-        // 获取队首元素
-        sTmpMempoint = m_MsgSendQueue.front();
-        // 弹出队首元素
-        m_MsgSendQueue.pop_front();
+        // 取出队首元素
+        sTmpMempoint = pConn->psendQueueHead;
+        pConn->psendQueueHead = ((LPSTRUC_MSG_HEADER)sTmpMempoint)->pNext;
+        --pConn->iSendCount;
+        --m_iSendMsgQueueCount;
         // 释放内存
         p_memory->FreeMemory(sTmpMempoint);
     }
+    pConn->psendQueueTail = NULL;
 }
 
 /***************************************************************
@@ -799,6 +1412,8 @@ void CSocekt::clearMsgSendQueue()
  **************************************************************/
 bool CSocekt::Initialize_subproc()
 {
+    int err;
+
     // 进入子进程，在开始工作前，需要初始化全部互斥量
 
     // 发消息互斥量初始化
@@ -821,6 +1436,17 @@ bool CSocekt::Initialize_subproc()
         ngx_log_stderr(0, "CSocekt::Initialize_subproc()中pthread_mutex_init(&m_recyconnqueueMutex)失败.");
         return false;
     }
+    // 回收线程按到期时间等待，用单调时钟，不受改系统时间影响
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    err = pthread_cond_init(&m_recyconnqueueCond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    if (err != 0)
+    {
+        ngx_log_stderr(err, "CSocekt::Initialize_subproc()中pthread_cond_init(&m_recyconnqueueCond)失败.");
+        return false;
+    }
 
     // 和时间处理队列有关的互斥量初始化
     if (pthread_mutex_init(&m_timequeueMutex, NULL) != 0)
@@ -829,6 +1455,13 @@ bool CSocekt::Initialize_subproc()
         return false;
     }
 
+    // 和定时任务有关的互斥量初始化
+    if (pthread_mutex_init(&m_timerFdMutex, NULL) != 0 || pthread_mutex_init(&m_schedMutex, NULL) != 0)
+    {
+        ngx_log_stderr(0, "CSocekt::Initialize_subproc()中pthread_mutex_init(&m_schedMutex)失败.");
+        return false;
+    }
+
     // 初始化发消息相关信号量，信号量用于进程/线程 之间的同步，虽然 互斥量[pthread_mutex_lock]和 条件变量[pthread_cond_wait]都是线程之间的同步手段，但
     // 这里用信号量实现 则 更容易理解，更容易简化问题，使用书写的代码短小且清晰；
     // 第二个参数=0，表示信号量在线程之间共享，确实如此 ，如果非0，表示在进程之间共享
@@ -841,18 +1474,20 @@ bool CSocekt::Initialize_subproc()
 
     // 创建线程
 
-    int err;
-
-    // 临时变量，用于发送数据
-    ThreadItem *pSendQueue;
-    // 创建 一个新线程对象 并入到容器中
-    m_threadVector.push_back(pSendQueue = new ThreadItem(this));
-    // 创建一个线程到线程对象中
-    err = pthread_create(&pSendQueue->_Handle, NULL, ServerSendQueueThread, pSendQueue);
-    if (err != 0)
+    // 由 epoll 线程发送数据时不需要专门的发送线程
+    if (m_reactorSend == 0)
     {
-        ngx_log_stderr(0, "CSocekt::Initialize_subproc()中pthread_create(ServerSendQueueThread)失败.");
-        return false;
+        // 临时变量，用于发送数据
+        ThreadItem *pSendQueue;
+        // 创建 一个新线程对象 并入到容器中
+        m_threadVector.push_back(pSendQueue = new ThreadItem(this));
+        // 创建一个线程到线程对象中
+        err = pthread_create(&pSendQueue->_Handle, NULL, ServerSendQueueThread, pSendQueue);
+        if (err != 0)
+        {
+            ngx_log_stderr(0, "CSocekt::Initialize_subproc()中pthread_create(ServerSendQueueThread)失败.");
+            return false;
+        }
     }
 
     // 回收连接的线程
@@ -866,19 +1501,11 @@ bool CSocekt::Initialize_subproc()
         return false;
     }
 
-    // 如果开启踢人时钟，则创建用于处理非法用户的线程
-    // 是否开启踢人时钟，1：开启   0：不开启
+    // 是否开启踢人时钟，1：开启   0：不开启；到期由 ngx_epoll_init() 中创建的 timerfd 驱动，不再需要专门的线程
     if (m_ifkickTimeCount == 1)
     {
-        // 专门用来处理到期不发心跳包的用户踢出的线程
-        ThreadItem *pTimemonitor;
-        m_threadVector.push_back(pTimemonitor = new ThreadItem(this));
-        err = pthread_create(&pTimemonitor->_Handle, NULL, ServerTimerQueueMonitorThread, pTimemonitor);
-        if (err != 0)
-        {
-            ngx_log_stderr(0, "CSocekt::Initialize_subproc()中pthread_create(ServerTimerQueueMonitorThread)失败.");
-            return false;
-        }
+        // 时间轮从现在开始走
+        m_timerWheel.Init(ngx_timer_now_ms());
     }
 
     return true;
@@ -904,25 +1531,25 @@ bool CSocekt::TestFlood(lpngx_connection_t pConn)
     iCurrTime = (sCurrTime.tv_sec * 1000 + sCurrTime.tv_usec / 1000);
 
     // 收到包的时间差 < 100毫秒
-    if ((iCurrTime - pConn->FloodkickLastTime) < m_floodTimeInterval)
+    if ((iCurrTime - pConn->cold->FloodkickLastTime) < m_floodTimeInterval)
     {
         // 发包太频繁，记录下来
         // 攻击次数增加
-        pConn->FloodAttackCount++;
+        pConn->cold->FloodAttackCount++;
         // 发包时间更新
-        pConn->FloodkickLastTime = iCurrTime;
+        pConn->cold->FloodkickLastTime = iCurrTime;
     }
     else
     {
         // 恢复默认值
-        pConn->FloodAttackCount = 0;
-        pConn->FloodkickLastTime = iCurrTime;
+        pConn->cold->FloodAttackCount = 0;
+        pConn->cold->FloodkickLastTime = iCurrTime;
     }
 
-    // ngx_log_stderr(0,"pConn->FloodAttackCount=%d,m_floodKickCount=%d.",pConn->FloodAttackCount,m_floodKickCount);
+    // ngx_log_stderr(0,"pConn->cold->FloodAttackCount=%d,m_floodKickCount=%d.",pConn->cold->FloodAttackCount,m_floodKickCount);
 
     // 攻击次数超出指定值
-    if (pConn->FloodAttackCount >= m_floodKickCount)
+    if (pConn->cold->FloodAttackCount >= m_floodKickCount)
     {
         // 判断结果为成立
         reco = true;
@@ -944,6 +1571,11 @@ void CSocekt::Shutdown_subproc()
         ngx_log_stderr(0, "CSocekt::Shutdown_subproc()中sem_post(&m_semEventSendQueue)失败.");
     }
 
+    // 让卡在 pthread_cond_wait() 中的 ServerRecyConnectionThread() 走下来，持锁通知，不会在它检查 g_stopEvent 之后、等待之前丢掉
+    pthread_mutex_lock(&m_recyconnqueueMutex);
+    pthread_cond_signal(&m_recyconnqueueCond);
+    pthread_mutex_unlock(&m_recyconnqueueMutex);
+
     // 等待 socket 线程容器中全部线程运行结束
     for (auto iter = m_threadVector.begin(); iter != m_threadVector.end(); iter++)
     {
@@ -961,29 +1593,57 @@ void CSocekt::Shutdown_subproc()
 
     // 清空成员队列容器的元素
     clearMsgSendQueue();
-    clearconnection();
+    // 时间轮的节点在连接里，要在释放连接池之前清掉
     clearAllFromTimerQueue();
+    clearAllSchedule();
+    clearconnection();
 
     // 释放全部互斥量
     pthread_mutex_destroy(&m_connectionMutex);       // 连接相关互斥量释放
     pthread_mutex_destroy(&m_sendMessageQueueMutex); // 发消息互斥量释放
     pthread_mutex_destroy(&m_recyconnqueueMutex);    // 连接回收队列相关的互斥量释放
+    pthread_cond_destroy(&m_recyconnqueueCond);
     pthread_mutex_destroy(&m_timequeueMutex);        // 时间处理队列相关的互斥量释放
+    pthread_mutex_destroy(&m_schedMutex);            // 定时任务相关的互斥量释放
+    pthread_mutex_destroy(&m_timerFdMutex);
     sem_destroy(&m_semEventSendQueue);               // 发消息相关线程信号量释放
+
+    if (m_sendEventFd != -1)
+    {
+        close(m_sendEventFd);
+        m_sendEventFd = -1;
+    }
+    if (m_timerFd != -1)
+    {
+        close(m_timerFd);
+        m_timerFd = -1;
+    }
+
+    ngx_uring_close();
+
+    if (m_udpRecvBuf != NULL)
+    {
+        CMemory::GetInstance()->FreeMemory(m_udpRecvBuf);
+        m_udpRecvBuf = NULL;
+    }
+
+    if (m_spareFd != -1)
+    {
+        close(m_spareFd);
+        m_spareFd = -1;
+    }
 }
 
 /***************************************************************
- *  @brief     将待发送的消息放入发消息队列中
+ *  @brief     将待发送的消息放入对应连接的发送队列中
  *  @param     psendbuf    待发送消息
+ *  @note      只有连接从无到有待发送数据、并且没有在等 epoll 驱动发送时，才把连接放进发送就绪列表、唤醒发送线程
  **************************************************************/
 void CSocekt::msgSend(char *psendbuf)
 {
     // 内存对象
     CMemory *p_memory = CMemory::GetInstance();
 
-    // 访问发送消息队列，上锁
-    CLock lock(&m_sendMessageQueueMutex); // 互斥量
-
     // 发送消息队列过大也可能给服务器带来风险，判断发消息队列大小
     if (m_iSendMsgQueueCount > 50000)
     {
@@ -1007,6 +1667,19 @@ void CSocekt::msgSend(char *psendbuf)
     // 取出消息头中的 TCP 连接
     lpngx_connection_t p_Conn = pMsgHeader->pConn;
 
+    // UDP 应答不经过 TCP 的发送队列，也谈不上积压踢人
+    if (p_Conn->rhandler == &CSocekt::ngx_udp_recv_handler)
+    {
+        msgSendUdp(p_Conn, psendbuf);
+        return;
+    }
+    // 共享内存通道的应答直接写进环里，不经过 socket
+    if (p_Conn->rhandler == &CSocekt::ngx_shm_recv_handler)
+    {
+        msgSendShm(p_Conn, psendbuf);
+        return;
+    }
+
     // 发送消息数过大，但却不接收消息，超出指定值则踢出
     if (p_Conn->iSendCount > 400)
     {
@@ -1018,19 +1691,133 @@ void CSocekt::msgSend(char *psendbuf)
         return;
     }
 
-    // TCP 连接发送消息数增加
-    ++p_Conn->iSendCount;
-    // 放入发送队列
-    m_MsgSendQueue.push_back(psendbuf);
-    // 发送队列大小增加
-    ++m_iSendMsgQueueCount;
+    // 是否需要把连接放进发送就绪列表
+    bool ifReady = false;
+
+    pMsgHeader->pNext = NULL;
+    {
+        // 访问本连接的发送队列，上锁
+        CLock lock(&p_Conn->sendMutex);
+
+        // 连接空闲：队列里没有数据，发送线程和 epoll 都没在发，直接在当前线程发送，省掉入队、唤醒发送线程的开销
+        if (m_directSend == 1 && p_Conn->psendQueueHead == NULL && p_Conn->ifSendReady == 0 && p_Conn->iThrowsendCount == 0 && p_Conn->iCurrsequence == pMsgHeader->iCurrsequence)
+        {
+            msgSendDirect(p_Conn, psendbuf);
+            return;
+        }
+
+        // 放到本连接发送队列的末尾
+        if (p_Conn->psendQueueTail == NULL)
+        {
+            p_Conn->psendQueueHead = psendbuf;
+        }
+        else
+        {
+            ((LPSTRUC_MSG_HEADER)p_Conn->psendQueueTail)->pNext = psendbuf;
+        }
+        p_Conn->psendQueueTail = psendbuf;
+
+        // TCP 连接发送消息数增加
+        ++p_Conn->iSendCount;
+        // 发送队列大小增加
+        ++m_iSendMsgQueueCount;
+
+        // 发送缓冲区满的连接由 ngx_write_request_handler() 发完后再放进就绪列表
+        if (p_Conn->ifSendReady == 0 && p_Conn->iThrowsendCount == 0)
+        {
+            p_Conn->ifSendReady = 1;
+            ifReady = true;
+        }
+    }
+
+    if (ifReady)
+    {
+        inSendReadyList(p_Conn);
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     在调用者线程中直接发送一个包
+ *  @param     pConn    TCP 连接，调用者已经持有 sendMutex，并确认没有其他线程在发送这个连接的数据
+ *  @param     psendbuf    待发送的消息，消息头+包头+包体
+ *  @note      持有 sendMutex 期间只做一次非阻塞 send()，没发完的部分和 ngx_flush_send_ready() 一样交给 epoll 驱动继续发送
+ **************************************************************/
+void CSocekt::msgSendDirect(lpngx_connection_t pConn, char *psendbuf)
+{
+    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(psendbuf + m_iLenMsgHeader);
+    size_t pkglen = ntohs(pPkgHeader->pkgLen);
+
+    // ET 模式下，在 send() 之前到来的可写边沿和本次发送无关，清掉，免得移交时误判
+    pConn->iWriteEdge = 0;
+    ssize_t sendsize = sendproc(pConn, (char *)pPkgHeader, pkglen);
+    ++m_iSendCallCount;
+    ++m_iDirectSendCount;
+
+    if (sendsize == 0 || sendsize == -2 || (size_t)sendsize == pkglen)
+    {
+        // 发送完毕，或者对端断开了，等待recv()来做断开socket以及回收资源
+        if (sendsize > 0)
+        {
+            ++m_iSendPkgCount;
+        }
+        sendMemFree(pConn, psendbuf);
+        return;
+    }
+
+    // 发送缓冲区已经满了【一个字节都没发出去，说明发送 缓冲区当前正好是满的】
+    if (sendsize == -1)
+    {
+        sendsize = 0;
+    }
+
+    // 没有全部发送完毕，剩下的交给 epoll 驱动继续发送
+    pConn->psendMemPointer = psendbuf;
+    pConn->psendbuf = (char *)pPkgHeader + sendsize;
+    pConn->isendlen = pkglen - sendsize;
+    ++pConn->iThrowsendCount;
+
+    if (ngx_epoll_arm_write(pConn) == -1)
+    {
+        // 有这情况发生？这可比较麻烦，不过先do nothing
+        ngx_log_stderr(errno, "CSocekt::msgSendDirect()ngx_epoll_oper_event()失败.");
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     把有数据待发送的连接放进发送就绪列表，并唤醒发送线程
+ *  @param     pConn    TCP 连接，调用者已经在 sendMutex 保护下把 ifSendReady 置为 1
+ **************************************************************/
+void CSocekt::inSendReadyList(lpngx_connection_t pConn)
+{
+    {
+        CLock lock(&m_sendMessageQueueMutex);
+        m_sendReadyList.push_back(pConn);
+    }
+
+    if (m_reactorSend == 1)
+    {
+        // 唤醒 epoll 线程，上一次唤醒还没被处理的话就不用重复唤醒了
+        if (m_sendEventPending.exchange(1) == 0)
+        {
+            uint64_t one = 1;
+            if (write(m_sendEventFd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+            {
+                ngx_log_stderr(errno, "CSocekt::inSendReadyList()中write(eventfd)失败.");
+            }
+        }
+        return;
+    }
 
     // 将信号量的值+1，这样其他卡在sem_wait的就可以走下去
 
-    // 激活 ServerSendQueueThread() 流程，处理发送队列中的信息
+    // 激活 ServerSendQueueThread() 流程，处理发送就绪列表中的连接
     if (sem_post(&m_semEventSendQueue) == -1)
     {
-        ngx_log_stderr(0, "CSocekt::msgSend()中sem_post(&m_semEventSendQueue)失败.");
+        ngx_log_stderr(0, "CSocekt::inSendReadyList()中sem_post(&m_semEventSendQueue)失败.");
     }
 
     return;
@@ -1112,6 +1899,27 @@ int CSocekt::ngx_epoll_add_event(int fd,
 }
 */
 
+/***************************************************************
+ *  @brief     eventfd 的读处理函数，Sock_ReactorSend = 1 时由 epoll 线程调用，发送所有就绪连接中的数据
+ *  @param     pConn    eventfd 对应的连接池中的连接
+ **************************************************************/
+void CSocekt::ngx_send_event_handler(lpngx_connection_t pConn)
+{
+    uint64_t cnt;
+
+    // 把计数读掉，否则 LT 模式下会一直通知
+    if (read(pConn->fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+    {
+        ngx_log_stderr(errno, "CSocekt::ngx_send_event_handler()中read(eventfd)失败.");
+    }
+
+    // 先清标记再取就绪列表，之后放进就绪列表的连接会再唤醒一次
+    m_sendEventPending = 0;
+    ngx_flush_send_ready();
+
+    return;
+}
+
 /***************************************************************
  *  @brief     专门处理发送消息队列的线程入口函数
  *  @param     threadData    线程对象
@@ -1123,13 +1931,52 @@ void *CSocekt::ServerSendQueueThread(void *threadData)
     ThreadItem *pThread = static_cast<ThreadItem *>(threadData);
     // 记录所属线程池
     CSocekt *pSocketObj = pThread->_pThis;
+
+    // 不退出程序
+    while (g_stopEvent == 0)
+    {
+        // 如果信号量值>0，则 -1(减1) 并走下去，否则卡这里卡着【为了让信号量值+1，可以在其他线程调用sem_post达到，
+        // 实际上在CSocekt::inSendReadyList()调用sem_post就达到了让这里sem_wait走下去的目的】
+        // 如果被某个信号中断，sem_wait也可能过早的返回，错误为EINTR；
+        // 整个程序退出之前，也要sem_post()一下，确保如果本线程卡在sem_wait()，也能走下去从而让本线程成功返回
+
+        if (sem_wait(&pSocketObj->m_semEventSendQueue) == -1)
+        {
+            // 失败？及时报告，其他的也不好干啥
+            if (errno != EINTR) // 这个我就不算个错误了【当阻塞于某个慢系统调用的一个进程捕获某个信号且相应信号处理函数返回时，该系统调用可能返回一个EINTR错误。】
+                ngx_log_stderr(errno, "CSocekt::ServerSendQueueThread()中sem_wait(&pSocketObj->m_semEventSendQueue)失败.");
+        }
+
+        // 需要处理发送数据
+
+        // 退出标志，则退出
+        if (g_stopEvent != 0)
+            break;
+
+        // 发送所有就绪连接中的数据
+        pSocketObj->ngx_flush_send_ready();
+    } // end while
+
+    return (void *)0;
+}
+
+/***************************************************************
+ *  @brief     发送所有就绪连接中的数据，同一连接的多个包合并成一次 writev()
+ *  @note      同一时刻只有一个线程调用本函数：独立的发送线程，或者 Sock_ReactorSend = 1 时的 epoll 线程
+ **************************************************************/
+void CSocekt::ngx_flush_send_ready()
+{
     // 错误代码
     int err;
 
-    std::list<char *>::iterator pos, pos2, posend;
+    // 本轮取出的发送就绪连接
+    std::list<lpngx_connection_t> readyConns;
+    std::list<lpngx_connection_t>::iterator pos, posend;
 
     // 保存待发送数据
     char *pMsgBuf;
+    // 下一条待发送数据
+    char *pNext;
     // 消息头
     LPSTRUC_MSG_HEADER pMsgHeader;
     // 包头
@@ -1137,183 +1984,211 @@ void *CSocekt::ServerSendQueueThread(void *threadData)
     // TCP 连接
     lpngx_connection_t p_Conn;
 
-    unsigned short itmp;
     // 待发送数据宽度
     ssize_t sendsize;
 
+    // 一次 writev() 合并发送的各个包
+    struct iovec iov[IOV_MAX];
+    // 本次合并发送的包数、其中已经完整发出的包数
+    int iovcnt, iSent;
+    // 已经处理到 m_sendMsgs 中的第几条消息
+    size_t i, k;
+    // 摘下来的、放回去的消息条数
+    int iTaken, iBack;
+    // 本线程是否摘下了这个连接的发送队列、剩余数据是否已经交给 epoll 驱动发送
+    bool ifTaken, ifThrow;
+    // 发送期间又有新数据入队，需要把连接放回就绪列表
+    bool ifReady;
+
     // 内存对象
     CMemory *p_memory = CMemory::GetInstance();
 
-    // 不退出程序
-    while (g_stopEvent == 0)
+    // 把就绪列表整个取出来，只在交换时占用互斥量，msgSend() 不会被发送过程卡住
+    err = pthread_mutex_lock(&m_sendMessageQueueMutex);
+    if (err != 0)
+        ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()中pthread_mutex_lock()失败，返回的错误码为%d!", err);
+
+    readyConns.swap(m_sendReadyList);
+
+    err = pthread_mutex_unlock(&m_sendMessageQueueMutex);
+    if (err != 0)
+        ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()pthread_mutex_unlock()失败，返回的错误码为%d!", err);
+
+    // 只处理有数据可发的连接，发送缓冲区满的连接根本不会出现在这里
+    pos = readyConns.begin();
+    posend = readyConns.end();
+    for (; pos != posend; ++pos)
     {
-        // 如果信号量值>0，则 -1(减1) 并走下去，否则卡这里卡着【为了让信号量值+1，可以在其他线程调用sem_post达到，
-        // 实际上在CSocekt::msgSend()调用sem_post就达到了让这里sem_wait走下去的目的】
-        // 如果被某个信号中断，sem_wait也可能过早的返回，错误为EINTR；
-        // 整个程序退出之前，也要sem_post()一下，确保如果本线程卡在sem_wait()，也能走下去从而让本线程成功返回
+        p_Conn = (*pos);
 
-        if (sem_wait(&pSocketObj->m_semEventSendQueue) == -1)
+        // 把这个连接的发送队列整个摘下来
+        err = pthread_mutex_lock(&p_Conn->sendMutex);
+        if (err != 0)
+            ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()中pthread_mutex_lock(sendMutex)失败，返回的错误码为%d!", err);
+
+        pMsgBuf = NULL;
+        ifTaken = (p_Conn->iThrowsendCount == 0 && p_Conn->psendQueueHead != NULL);
+        if (ifTaken)
         {
-            // 失败？及时报告，其他的也不好干啥
-            if (errno != EINTR) // 这个我就不算个错误了【当阻塞于某个慢系统调用的一个进程捕获某个信号且相应信号处理函数返回时，该系统调用可能返回一个EINTR错误。】
-                ngx_log_stderr(errno, "CSocekt::ServerSendQueueThread()中sem_wait(&pSocketObj->m_semEventSendQueue)失败.");
+            // ifSendReady 保持为 1，直到本线程发完这批数据，这期间 msgSend() 既不会把连接再放进就绪列表，也不会直接发送
+            pMsgBuf = p_Conn->psendQueueHead;
+            p_Conn->psendQueueHead = p_Conn->psendQueueTail = NULL;
+            iTaken = p_Conn->iSendCount.exchange(0); // 发送队列中有的数据条目数清零
+            m_iSendMsgQueueCount -= iTaken;
+        }
+        else
+        {
+            // 靠系统驱动来发送消息，所以这里不能再发送，ngx_write_request_handler() 发完后会再把连接放进就绪列表
+            p_Conn->ifSendReady = 0;
         }
 
-        // 需要处理发送数据
-
-        // 退出标志，则退出
-        if (g_stopEvent != 0)
-            break;
+        err = pthread_mutex_unlock(&p_Conn->sendMutex);
+        if (err != 0)
+            ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()pthread_mutex_unlock(sendMutex)失败，返回的错误码为%d!", err);
 
-        // 发送队列大小大于 0，即有消息待发送
-        if (pSocketObj->m_iSendMsgQueueCount > 0)
+        while (pMsgBuf != NULL)
         {
-            // 上锁
-            err = pthread_mutex_lock(&pSocketObj->m_sendMessageQueueMutex);
-            if (err != 0)
-                ngx_log_stderr(err, "CSocekt::ServerSendQueueThread()中pthread_mutex_lock()失败，返回的错误码为%d!", err);
+            pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf; // 拿到的每个消息都是 消息头+包头+包体【但要注意，我们是不发送消息头给客户端的】
+            pNext = pMsgHeader->pNext;
 
-            // 遍历待发送消息队列
-            pos = pSocketObj->m_MsgSendQueue.begin();
-            posend = pSocketObj->m_MsgSendQueue.end();
+            // 包过期，因为如果 这个连接被回收，比如在ngx_close_connection(),inRecyConnectQueue()中都会自增iCurrsequence
+            // 只要下面条件成立，肯定是客户端连接已断，要发送的数据肯定不需要发送了
+            if (p_Conn->iCurrsequence != pMsgHeader->iCurrsequence)
+            {
+                p_memory->FreeMemory(pMsgBuf);
+            }
+            else
+            {
+                m_sendMsgs.push_back(pMsgBuf);
+            }
+            pMsgBuf = pNext;
+        }
 
-            while (pos != posend)
+        // 这里是重点，我们采用 epoll水平触发的策略，能走到这里的，都应该是还没有投递 写事件 到epoll中
+        // epoll水平触发发送数据的改进方案：
+        // 开始不把socket写事件通知加入到epoll,当我需要写数据的时候，直接调用writev发送数据；
+        // 如果返回了EAGIN【发送缓冲区满了，需要等待可写事件才能继续往缓冲区里写数据】，此时，我再把写事件通知加入到epoll，
+        // 此时，就变成了在epoll驱动下写数据，全部数据发送完毕后，再把写事件通知从epoll中干掉；
+        // 优点：数据不多的时候，可以避免epoll的写事件的增加/删除，提高了程序的执行效率；
+        // 同一个连接的多个包用一次 writev() 发出去，一次最多 IOV_MAX 个
+        i = 0;
+        ifThrow = false;
+        while (i < m_sendMsgs.size())
+        {
+            iovcnt = 0;
+            while (i + iovcnt < m_sendMsgs.size() && iovcnt < IOV_MAX)
             {
-                pMsgBuf = (*pos);                                                        // 拿到的每个消息都是 消息头+包头+包体【但要注意，我们是不发送消息头给客户端的】
-                pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;                                // 指向消息头
-                pPkgHeader = (LPCOMM_PKG_HEADER)(pMsgBuf + pSocketObj->m_iLenMsgHeader); // 指向包头
-                p_Conn = pMsgHeader->pConn;
-
-                // 包过期，因为如果 这个连接被回收，比如在ngx_close_connection(),inRecyConnectQueue()中都会自增iCurrsequence
-                // 而且这里有没必要针对 本连接 来用m_connectionMutex临界 ,只要下面条件成立，肯定是客户端连接已断，要发送的数据肯定不需要发送了
-                if (p_Conn->iCurrsequence != pMsgHeader->iCurrsequence)
-                {
-                    // 本包中保存的序列号与p_Conn【连接池中连接】中实际的序列号已经不同，丢弃此消息，小心处理该消息的删除
-                    pos2 = pos;
-                    pos++;
-                    pSocketObj->m_MsgSendQueue.erase(pos2);
-                    --pSocketObj->m_iSendMsgQueueCount; // 发送消息队列容量少1
-                    p_memory->FreeMemory(pMsgBuf);
-                    continue;
-                } // end if
+                pPkgHeader = (LPCOMM_PKG_HEADER)(m_sendMsgs[i + iovcnt] + m_iLenMsgHeader);
+                iov[iovcnt].iov_base = pPkgHeader;
+                iov[iovcnt].iov_len = ntohs(pPkgHeader->pkgLen); // 包头+包体 长度 ，打包时用了htons【本机序转网络序】，所以这里为了得到该数值，用了个ntohs【网络序转本机序】；
+                ++iovcnt;
+            }
 
-                if (p_Conn->iThrowsendCount > 0)
+            // ET 模式下，在 writev() 之前到来的可写边沿和本次发送无关，清掉，免得移交时误判
+            p_Conn->iWriteEdge = 0;
+            sendsize = sendprocv(p_Conn, iov, iovcnt);
+            ++m_iSendCallCount;
+
+            if (sendsize == 0 || sendsize == -2)
+            {
+                // 发送0个字节或者出错，一般就认为对端断开了，等待recv()来做断开socket以及回收资源
+                // 这个连接剩下的包都干掉，不发送了
+                for (; i < m_sendMsgs.size(); ++i)
                 {
-                    // 靠系统驱动来发送消息，所以这里不能再发送
-                    pos++;
-                    continue;
+                    p_memory->FreeMemory(m_sendMsgs[i]);
                 }
+                break;
+            }
 
-                --p_Conn->iSendCount; // 发送队列中有的数据条目数-1；
-
-                // 走到这里，可以发送消息，一些必须的信息记录，要发送的东西也要从发送队列里干掉
-                p_Conn->psendMemPointer = pMsgBuf; // 发送后释放用的，因为这段内存是new出来的
-                pos2 = pos;
-                pos++;
-                pSocketObj->m_MsgSendQueue.erase(pos2);
-                --pSocketObj->m_iSendMsgQueueCount;    // 发送消息队列容量少1
-                p_Conn->psendbuf = (char *)pPkgHeader; // 要发送的数据的缓冲区指针，因为发送数据不一定全部都能发送出去，我们要记录数据发送到了哪里，需要知道下次数据从哪里开始发送
-                itmp = ntohs(pPkgHeader->pkgLen);      // 包头+包体 长度 ，打包时用了htons【本机序转网络序】，所以这里为了得到该数值，用了个ntohs【网络序转本机序】；
-                p_Conn->isendlen = itmp;               // 要发送多少数据，因为发送数据不一定全部都能发送出去，我们需要知道剩余有多少数据还没发送
-
-                // 这里是重点，我们采用 epoll水平触发的策略，能走到这里的，都应该是还没有投递 写事件 到epoll中
-                // epoll水平触发发送数据的改进方案：
-                // 开始不把socket写事件通知加入到epoll,当我需要写数据的时候，直接调用write/send发送数据；
-                // 如果返回了EAGIN【发送缓冲区满了，需要等待可写事件才能继续往缓冲区里写数据】，此时，我再把写事件通知加入到epoll，
-                // 此时，就变成了在epoll驱动下写数据，全部数据发送完毕后，再把写事件通知从epoll中干掉；
-                // 优点：数据不多的时候，可以避免epoll的写事件的增加/删除，提高了程序的执行效率；
-                //(1)直接调用write或者send发送数据
-                // ngx_log_stderr(errno,"即将发送数据%ud。",p_Conn->isendlen);
-
-                sendsize = pSocketObj->sendproc(p_Conn, p_Conn->psendbuf, p_Conn->isendlen); // 注意参数
-                if (sendsize > 0)
-                {
-                    if (sendsize == p_Conn->isendlen) // 成功发送出去了数据，一下就发送出去这很顺利
-                    {
-                        // 成功发送的和要求发送的数据相等，说明全部发送成功了 发送缓冲区去了【数据全部发完】
-                        p_memory->FreeMemory(p_Conn->psendMemPointer); // 释放内存
-                        p_Conn->psendMemPointer = NULL;
-                        p_Conn->iThrowsendCount = 0; // 这行其实可以没有，因此此时此刻这东西就是=0的
-                        // ngx_log_stderr(0,"CSocekt::ServerSendQueueThread()中数据发送完毕，很好。"); //做个提示吧，商用时可以干掉
-                    }
-                    else // 没有全部发送完毕(EAGAIN)，数据只发出去了一部分，但肯定是因为 发送缓冲区满了,那么
-                    {
-                        // 发送到了哪里，剩余多少，记录下来，方便下次sendproc()时使用
-                        p_Conn->psendbuf = p_Conn->psendbuf + sendsize;
-                        p_Conn->isendlen = p_Conn->isendlen - sendsize;
-                        // 因为发送缓冲区慢了，所以 现在我要依赖系统通知来发送数据了
-                        ++p_Conn->iThrowsendCount; // 标记发送缓冲区满了，需要通过epoll事件来驱动消息的继续发送【原子+1，且不可写成p_Conn->iThrowsendCount = p_Conn->iThrowsendCount +1 ，这种写法不是原子+1】
-                        // 投递此事件后，我们将依靠epoll驱动调用ngx_write_request_handler()函数发送数据
-                        if (pSocketObj->ngx_epoll_oper_event(
-                                p_Conn->fd,    // socket句柄
-                                EPOLL_CTL_MOD, // 事件类型，这里是增加【因为我们准备增加个写通知】
-                                EPOLLOUT,      // 标志，这里代表要增加的标志,EPOLLOUT：可写【可写的时候通知我】
-                                0,             // 对于事件类型为增加的，EPOLL_CTL_MOD需要这个参数, 0：增加   1：去掉 2：完全覆盖
-                                p_Conn         // 连接池中的连接
-                                ) == -1)
-                        {
-                            // 有这情况发生？这可比较麻烦，不过先do nothing
-                            ngx_log_stderr(errno, "CSocekt::ServerSendQueueThread()ngx_epoll_oper_event()失败.");
-                        }
+            // 发送缓冲区已经满了【一个字节都没发出去，说明发送 缓冲区当前正好是满的】
+            if (sendsize == -1)
+            {
+                sendsize = 0;
+            }
 
-                        // ngx_log_stderr(errno,"CSocekt::ServerSendQueueThread()中数据没发送完毕【发送缓冲区满】，整个要发送%d，实际发送了%d。",p_Conn->isendlen,sendsize);
+            // 完整发出去的包可以释放了
+            for (iSent = 0; iSent < iovcnt && (size_t)sendsize >= iov[iSent].iov_len; ++iSent)
+            {
+                sendsize -= iov[iSent].iov_len;
+                sendMemFree(p_Conn, m_sendMsgs[i + iSent]);
+            }
+            m_iSendPkgCount += iSent;
+            i += iSent;
 
-                    }         // end if(sendsize > 0)
-                    continue; // 继续处理其他消息
-                }             // end if(sendsize > 0)
+            if (iSent == iovcnt)
+            {
+                // 本批全部发送成功，继续发这个连接剩下的包
+                continue;
+            }
 
-                // 能走到这里，应该是有点问题的
-                else if (sendsize == 0)
-                {
-                    // 发送0个字节，首先因为我发送的内容不是0个字节的；
-                    // 然后如果发送 缓冲区满则返回的应该是-1，而错误码应该是EAGAIN，所以我综合认为，这种情况我就把这个发送的包丢弃了【按对端关闭了socket处理】
-                    // 这个打印下日志，我还真想观察观察是否真有这种现象发生
-                    // ngx_log_stderr(errno,"CSocekt::ServerSendQueueThread()中sendproc()居然返回0？"); //如果对方关闭连接出现send=0，那么这个日志可能会常出现，商用时就 应该干掉
-                    // 然后这个包干掉，不发送了
-                    p_memory->FreeMemory(p_Conn->psendMemPointer); // 释放内存
-                    p_Conn->psendMemPointer = NULL;
-                    p_Conn->iThrowsendCount = 0; // 这行其实可以没有，因此此时此刻这东西就是=0的
-                    continue;
-                }
+            // 没有全部发送完毕(EAGAIN)，发送缓冲区满了，发了一半的包记录下来，交给 epoll 驱动继续发送
+            p_Conn->psendMemPointer = m_sendMsgs[i]; // 发送后释放用的，因为这段内存是new出来的
+            p_Conn->psendbuf = (char *)iov[iSent].iov_base + sendsize;
+            p_Conn->isendlen = iov[iSent].iov_len - sendsize;
+            ++i;
+
+            err = pthread_mutex_lock(&p_Conn->sendMutex);
+            if (err != 0)
+                ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()中pthread_mutex_lock(sendMutex)失败，返回的错误码为%d!", err);
 
-                // 能走到这里，继续处理问题
-                else if (sendsize == -1)
+            // 剩下还没动过的包原样放回发送队列的最前面，排在这期间新来的包前面
+            iBack = (int)(m_sendMsgs.size() - i);
+            if (iBack > 0)
+            {
+                for (k = i; k + 1 < m_sendMsgs.size(); ++k)
                 {
-                    // 发送缓冲区已经满了【一个字节都没发出去，说明发送 缓冲区当前正好是满的】
-                    ++p_Conn->iThrowsendCount; // 标记发送缓冲区满了，需要通过epoll事件来驱动消息的继续发送
-                    // 投递此事件后，我们将依靠epoll驱动调用ngx_write_request_handler()函数发送数据
-                    if (pSocketObj->ngx_epoll_oper_event(
-                            p_Conn->fd,    // socket句柄
-                            EPOLL_CTL_MOD, // 事件类型，这里是增加【因为我们准备增加个写通知】
-                            EPOLLOUT,      // 标志，这里代表要增加的标志,EPOLLOUT：可写【可写的时候通知我】
-                            0,             // 对于事件类型为增加的，EPOLL_CTL_MOD需要这个参数, 0：增加   1：去掉 2：完全覆盖
-                            p_Conn         // 连接池中的连接
-                            ) == -1)
-                    {
-                        // 有这情况发生？这可比较麻烦，不过先do nothing
-                        ngx_log_stderr(errno, "CSocekt::ServerSendQueueThread()中ngx_epoll_add_event()_2失败.");
-                    }
-                    continue;
+                    ((LPSTRUC_MSG_HEADER)m_sendMsgs[k])->pNext = m_sendMsgs[k + 1];
                 }
-
-                else
+                ((LPSTRUC_MSG_HEADER)m_sendMsgs[k])->pNext = p_Conn->psendQueueHead;
+                if (p_Conn->psendQueueHead == NULL)
                 {
-                    // 能走到这里的，应该就是返回值-2了，一般就认为对端断开了，等待recv()来做断开socket以及回收资源
-                    p_memory->FreeMemory(p_Conn->psendMemPointer); // 释放内存
-                    p_Conn->psendMemPointer = NULL;
-                    p_Conn->iThrowsendCount = 0; // 这行其实可以没有，因此此时此刻这东西就是=0的
-                    continue;
+                    p_Conn->psendQueueTail = m_sendMsgs[k];
                 }
+                p_Conn->psendQueueHead = m_sendMsgs[i];
+                p_Conn->iSendCount += iBack;
+                m_iSendMsgQueueCount += iBack;
+            }
 
-            } // end while(pos != posend)
+            // 因为发送缓冲区满了，所以 现在我要依赖系统通知来发送数据了
+            ++p_Conn->iThrowsendCount; // 标记发送缓冲区满了，需要通过epoll事件来驱动消息的继续发送【原子+1，且不可写成p_Conn->iThrowsendCount = p_Conn->iThrowsendCount +1 ，这种写法不是原子+1】
+            p_Conn->ifSendReady = 0;
+            ifThrow = true;
 
-// 解锁
-            err = pthread_mutex_unlock(&pSocketObj->m_sendMessageQueueMutex);
+            err = pthread_mutex_unlock(&p_Conn->sendMutex);
             if (err != 0)
-                ngx_log_stderr(err, "CSocekt::ServerSendQueueThread()pthread_mutex_unlock()失败，返回的错误码为%d!", err);
+                ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()pthread_mutex_unlock(sendMutex)失败，返回的错误码为%d!", err);
 
-        } // if(pSocketObj->m_iSendMsgQueueCount > 0)
-    }     // end while
+            // 投递此事件后，我们将依靠epoll驱动调用ngx_write_request_handler()函数发送数据
+            if (ngx_epoll_arm_write(p_Conn) == -1)
+            {
+                // 有这情况发生？这可比较麻烦，不过先do nothing
+                ngx_log_stderr(errno, "CSocekt::ngx_flush_send_ready()ngx_epoll_oper_event()失败.");
+            }
+            break;
+        } // end while(i < m_sendMsgs.size())
 
-    return (void *)0;
+        // 这批数据处理完了（发完或者连接出错），期间又有新数据入队的话，把连接放回就绪列表
+        if (ifTaken && ifThrow == false)
+        {
+            err = pthread_mutex_lock(&p_Conn->sendMutex);
+            if (err != 0)
+                ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()中pthread_mutex_lock(sendMutex)失败，返回的错误码为%d!", err);
+
+            ifReady = (p_Conn->psendQueueHead != NULL);
+            p_Conn->ifSendReady = ifReady ? 1 : 0;
+
+            err = pthread_mutex_unlock(&p_Conn->sendMutex);
+            if (err != 0)
+                ngx_log_stderr(err, "CSocekt::ngx_flush_send_ready()pthread_mutex_unlock(sendMutex)失败，返回的错误码为%d!", err);
+
+            if (ifReady)
+            {
+                inSendReadyList(p_Conn);
+            }
+        }
+
+        m_sendMsgs.clear();
+    } // end for(; pos != posend; ++pos)
+
+    return;
 }
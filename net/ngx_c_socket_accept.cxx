@@ -26,7 +26,8 @@
  *  @param     oldc    原有的 TCP 连接
  *  @note      因为 listen 套接字上用的不是ET【边缘触发】，而是LT【水平触发】，
  *             意味着客户端连入如果我要不处理，这个函数会被多次调用，
- *             所以，我这里可以不必多次accept()，可以只执行一次accept()，这也可以避免本函数被卡太久，
+ *             重连风暴时一次只 accept() 一个会白白多出很多次 epoll_wait()，所以一次最多 accept() m_acceptBatch 个，
+ *             剩下的留给下一轮，这也可以避免本函数被卡太久，
  *             注意，本函数应该尽快返回，以免阻塞程序运行；
  **************************************************************/
 void CSocekt::ngx_event_accept(lpngx_connection_t oldc)
@@ -40,18 +41,19 @@ void CSocekt::ngx_event_accept(lpngx_connection_t oldc)
     int err; // 保存错误信息
     int level;
     int s;
+    // 本次已经 accept 的连接数
+    int iAccepted = 0;
 
     // 优先使用 accept4() 函数
     static int use_accept4 = 1;
-    // 连接池中的一个新连接
-    lpngx_connection_t newc;
-    // 取地址长度
-    socklen = sizeof(mysockaddr);
 
     // ngx_log_stderr(0,"这是几个\n"); 这里会惊群，也就是说，epoll技术本身有惊群的问题
 
     do
     {
+        // 取地址长度，每次 accept 都会被改写
+        socklen = sizeof(mysockaddr);
+
         // 接收客户端连接请求
         if (use_accept4)
         {
@@ -105,7 +107,7 @@ void CSocekt::ngx_event_accept(lpngx_connection_t oldc)
             // accept()没准备好，这个EAGAIN错误EWOULDBLOCK是一样的
             if (err == EAGAIN)
             {
-                // 除非你用一个循环不断的accept()取走所有的连接，不然一般不会有这个错误【我们这里只取一个连接，也就是accept()一次】
+                // 已完成连接队列取空了
                 return;
             }
 
@@ -147,14 +149,22 @@ void CSocekt::ngx_event_accept(lpngx_connection_t oldc)
             // 对方关闭了套接字
             if (err == ECONNABORTED)
             {
-                // 这个错误因为可以忽略，所以不用干啥
-                // do nothing
+                // 这个错误因为可以忽略，接着取下一个连接
+                continue;
             }
 
             if (err == EMFILE || err == ENFILE)
             {
-                // do nothing，这个官方做法是先把读事件从listen socket上移除，然后再弄个定时器，定时器到了则继续执行该函数，但是定时器到了有个标记，会把读事件增加到listen socket上去；
-                // 我这里目前先不处理吧【因为上边已经写这个日志了】；
+                // 监听套接字一直可读，LT 模式下不处理的话 epoll_wait() 会一直返回，把 CPU 跑满；
+                // 官方做法是先把读事件从listen socket上移除，然后再弄个定时器，定时器到了再把读事件加回来
+                ngx_log_error_core(level, err, "CSocekt::ngx_event_accept()中accept4()失败!");
+                ngx_accept_overload(oldc);
+            }
+            else if (err == ENOBUFS || err == ENOMEM)
+            {
+                // 内存不够，同样先停一下
+                ngx_log_error_core(level, err, "CSocekt::ngx_event_accept()中accept4()失败!");
+                ngx_accept_pause();
             }
 
             return;
@@ -163,139 +173,286 @@ void CSocekt::ngx_event_accept(lpngx_connection_t oldc)
 
         // 返回套接字 accept4()/accept() 成功，可以开始处理
 
-        // 用户连接数过多，关闭该用户socket
-        if (m_onlineUserCount >= m_worker_connections)
+        // 如果未使用 accept4() 函数，则手动设置非阻塞
+        if (!use_accept4)
         {
-            // ngx_log_stderr(0,"超出系统允许的最大连入用户数(最大允许连入数%d)，关闭连入请求(%d)。",m_worker_connections,s);
-
-            // 关闭套接字句柄，返回
-            close(s);
-            return;
+            // 如果不是用accept4()取得的socket，那么就要设置为非阻塞【因为用accept4()的已经被accept4()设置为非阻塞了】
+            if (setnonblocking(s) == false)
+            {
+                // 设置非阻塞居然失败，这时还没有分配连接，直接关闭 socket 即可
+                close(s);
+                return;
+            }
         }
 
-        // 如果某些恶意用户连上来发了1条数据就断，不断连接，会导致频繁调用 ngx_get_connection() 使用我们短时间内产生大量连接，危及本服务器安全
+        ngx_event_accept_proc(oldc, s, &mysockaddr, socklen);
 
-        // 判断连接池大小是否已经远超规定的连接上限
-        if (m_connectionList.size() > (m_worker_connections * 5))
+        // 本轮接够了，剩下的等下一次 epoll_wait()，LT 模式下不会丢
+        if (++iAccepted >= m_acceptBatch)
         {
-            // 比如你允许同时最大2048个连接，但连接池却有了 2048*5这么大的容量，
-            // 这肯定是表示短时间内 产生大量连接/断开，因为我们的延迟回收机制，这里连接还在垃圾池里没有被回收
+            break;
+        }
 
-            // 空闲连接却少于规定连接数，证明存在恶意连接
-            if (m_freeconnectionList.size() < m_worker_connections)
-            {
-                // 整个连接池这么大了，而空闲连接却这么少了，所以我认为是  短时间内 产生大量连接，发一个包后就断开，我们不可能让这种情况持续发生，所以必须断开新入用户的连接
-                // 一直到m_freeconnectionList变得足够大【连接池中连接被回收的足够多】
+    } while (1);
 
-                // 关闭，返回
-                close(s);
-                return;
-            }
-        }
+    return;
+}
 
-        // ngx_log_stderr(errno,"accept4成功s=%d",s); //s这里就是 一个句柄了
+/***************************************************************
+ *  @brief     accept 成功后的处理：检查连接数，从连接池中分配连接，设置读写处理函数，加入事件驱动
+ *  @param     oldc    监听套接字对应的连接
+ *  @param     s    accept 得到的新 socket，已经是非阻塞的
+ *  @param     psockaddr    客户端地址
+ *  @param     socklen    客户端地址长度
+ *  @note      epoll 模式下由 ngx_event_accept() 调用，io_uring 模式下由 multishot accept 的完成事件调用
+ **************************************************************/
+void CSocekt::ngx_event_accept_proc(lpngx_connection_t oldc, int s, struct sockaddr *psockaddr, socklen_t socklen)
+{
+    // 连接池中的一个新连接
+    lpngx_connection_t newc;
+
+    // 用户连接数过多，关闭该用户socket
+    if (m_onlineUserCount >= m_worker_connections)
+    {
+        // ngx_log_stderr(0,"超出系统允许的最大连入用户数(最大允许连入数%d)，关闭连入请求(%d)。",m_worker_connections,s);
+
+        // 关闭套接字句柄，返回
+        close(s);
+        return;
+    }
 
-        // 安全状态下，为 socket 句柄获取一个连接池连接
-        newc = ngx_get_connection(s);
-        // 连接池连接数量不足
-        if (newc == NULL)
+    // 如果某些恶意用户连上来发了1条数据就断，不断连接，会导致频繁调用 ngx_get_connection() 使用我们短时间内产生大量连接，危及本服务器安全
+
+    // 判断连接池大小是否已经远超规定的连接上限
+    if (m_total_connection_n > (m_worker_connections * 5))
+    {
+        // 比如你允许同时最大2048个连接，但连接池却有了 2048*5这么大的容量，
+        // 这肯定是表示短时间内 产生大量连接/断开，因为我们的延迟回收机制，这里连接还在垃圾池里没有被回收
+
+        // 空闲连接却少于规定连接数，证明存在恶意连接
+        if (m_free_connection_n < m_worker_connections)
         {
-            // 连接池中连接不够用，那么就得把这个socekt直接关闭并返回了，因为在ngx_get_connection()中已经写日志了，所以这里不需要写日志了
-            if (close(s) == -1)
-            {
-                ngx_log_error_core(NGX_LOG_ALERT, errno, "CSocekt::ngx_event_accept()中close(%d)失败!", s);
-            }
+            // 整个连接池这么大了，而空闲连接却这么少了，所以我认为是  短时间内 产生大量连接，发一个包后就断开，我们不可能让这种情况持续发生，所以必须断开新入用户的连接
+            // 一直到空闲连接变得足够多【连接池中连接被回收的足够多】
 
+            // 关闭，返回
+            close(s);
             return;
         }
+    }
 
-        //...........将来这里会判断是否连接超过最大允许连接数，现在，这里可以不处理
+    // ngx_log_stderr(errno,"accept4成功s=%d",s); //s这里就是 一个句柄了
 
-        // 成功的拿到了连接池中的一个连接
-        // 拷贝客户端地址到连接对象【要转成字符串ip地址参考函数ngx_sock_ntop()】
-        memcpy(&newc->s_sockaddr, &mysockaddr, socklen);
+    // 安全状态下，为 socket 句柄获取一个连接池连接
+    newc = ngx_get_connection(s);
+    // 连接池连接数量不足
+    if (newc == NULL)
+    {
+        // 连接池中连接不够用，那么就得把这个socekt直接关闭并返回了，因为在ngx_get_connection()中已经写日志了，所以这里不需要写日志了
+        if (close(s) == -1)
+        {
+            ngx_log_error_core(NGX_LOG_ALERT, errno, "CSocekt::ngx_event_accept_proc()中close(%d)失败!", s);
+        }
 
-        //{
-        //    //测试将收到的地址弄成字符串，格式形如"192.168.1.126:40904"或者"192.168.1.126"
-        //    u_char ipaddr[100]; memset(ipaddr,0,sizeof(ipaddr));
-        //    ngx_sock_ntop(&newc->s_sockaddr,1,ipaddr,sizeof(ipaddr)-10); //宽度给小点
-        //    ngx_log_stderr(0,"ip信息为%s\n",ipaddr);
-        //}
+        return;
+    }
 
-        // 如果未使用 accept4() 函数，则手动设置非阻塞
-        if (!use_accept4)
+    //...........将来这里会判断是否连接超过最大允许连接数，现在，这里可以不处理
+
+    // 成功的拿到了连接池中的一个连接
+    // 拷贝客户端地址到连接对象【要转成字符串ip地址参考函数ngx_sock_ntop()】
+    // AF_UNIX 的对端路径可能比 s_sockaddr 长，accept() 返回的是完整长度，只保存放得下的部分
+    if (socklen > sizeof(newc->cold->s_sockaddr))
+    {
+        socklen = sizeof(newc->cold->s_sockaddr);
+    }
+    memcpy(&newc->cold->s_sockaddr, psockaddr, socklen);
+    newc->cold->s_socklen = socklen;
+
+    //{
+    //    //测试将收到的地址弄成字符串，格式形如"192.168.1.126:40904"、"192.168.1.126"或者"unix:"
+    //    u_char ipaddr[100]; memset(ipaddr,0,sizeof(ipaddr));
+    //    ngx_sock_ntop(&newc->cold->s_sockaddr,newc->cold->s_socklen,1,ipaddr,sizeof(ipaddr)-10); //宽度给小点
+    //    ngx_log_stderr(0,"ip信息为%s\n",ipaddr);
+    //}
+
+    // 按配置开启零拷贝发送，内核不支持时只报一次，之后不再尝试；AF_UNIX 连接不支持 MSG_ZEROCOPY，本来也没有网卡拷贝可省
+    if (m_zeroCopyThreshold > 0 && psockaddr->sa_family == AF_INET)
+    {
+        int one = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
         {
-            // 如果不是用accept4()取得的socket，那么就要设置为非阻塞【因为用accept4()的已经被accept4()设置为非阻塞了】
-            if (setnonblocking(s) == false)
-            {
-                // 设置非阻塞居然失败
-                ngx_close_connection(newc); // 关闭socket,这种可以立即回收这个连接，无需延迟，因为其上还没有数据收发，谈不到业务逻辑因此无需延迟；
-                return;                     // 直接返回
-            }
+            newc->ifZeroCopy = 1;
+        }
+        else
+        {
+            ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_event_accept_proc()中setsockopt(SO_ZEROCOPY)失败，不再使用零拷贝发送!");
+            m_zeroCopyThreshold = 0;
         }
+    }
 
-        // 将原连接的监听对象赋值给新的连接
-        newc->listening = oldc->listening; // 连接对象 和监听对象关联，方便通过连接对象找监听对象【关联到监听端口】
+    // 将原连接的监听对象赋值给新的连接
+    newc->listening = oldc->listening; // 连接对象 和监听对象关联，方便通过连接对象找监听对象【关联到监听端口】
 
-        // 标记可以写，新连接写事件肯定是ready的；【从连接池拿出一个连接时这个连接的所有成员都是0】
-        //  newc->w_ready = 1;
+    // 标记可以写，新连接写事件肯定是ready的；【从连接池拿出一个连接时这个连接的所有成员都是0】
+    //  newc->w_ready = 1;
 
-        // 设置数据来时的读处理函数，其实官方nginx中是ngx_http_wait_request_handler()
-        newc->rhandler = &CSocekt::ngx_read_request_handler;
-        // 设置数据发送时的写处理函数
-        newc->whandler = &CSocekt::ngx_write_request_handler;
+    // 设置数据来时的读处理函数，其实官方nginx中是ngx_http_wait_request_handler()
+    newc->rhandler = &CSocekt::ngx_read_request_handler;
+    // 设置数据发送时的写处理函数
+    newc->whandler = &CSocekt::ngx_write_request_handler;
 
-        // 客户端应该主动发送第一次的数据，这里将读事件加入epoll监控，这样当客户端发送数据来时，会触发ngx_wait_request_handler()被ngx_epoll_process_events()调用
-        if (ngx_epoll_oper_event(
-                s,                    // socekt句柄
-                EPOLL_CTL_ADD,        // 事件类型，这里是增加
-                EPOLLIN | EPOLLRDHUP, // 标志，这里代表要增加的标志,EPOLLIN：可读，EPOLLRDHUP：TCP连接的远端关闭或者半关闭 ，如果边缘触发模式可以增加 EPOLLET
-                0,                    // 对于事件类型为增加的，不需要这个参数
-                newc                  // 连接池中的连接
-                ) == -1)
+    // 共享内存通道的握手连接上只收一次握手消息，之后数据都走共享内存
+    if (newc->listening->shm == 1)
+    {
+        newc->rhandler = &CSocekt::ngx_shm_sock_handler;
+    }
+
+    // 要注册的事件，ET 模式下把 EPOLLOUT 一次性加上，之后发送缓冲区满时不再需要反复 EPOLL_CTL_MOD
+    uint32_t connevents = EPOLLIN | EPOLLRDHUP;
+    if (m_epollET == 1 && newc->listening->shm == 0)
+    {
+        connevents |= EPOLLOUT | EPOLLET;
+    }
+
+    // 客户端应该主动发送第一次的数据，这里将读事件加入epoll监控，这样当客户端发送数据来时，会触发ngx_wait_request_handler()被ngx_epoll_process_events()调用
+    if (ngx_epoll_oper_event(
+            s,                    // socekt句柄
+            EPOLL_CTL_ADD,        // 事件类型，这里是增加
+            connevents,           // 标志，这里代表要增加的标志,EPOLLIN：可读，EPOLLRDHUP：TCP连接的远端关闭或者半关闭 ，边缘触发模式再增加 EPOLLOUT | EPOLLET
+            0,                    // 对于事件类型为增加的，不需要这个参数
+            newc                  // 连接池中的连接
+            ) == -1)
+    {
+        // 增加事件失败，失败日志在ngx_epoll_add_event中写过了，因此这里不多写啥；
+        ngx_close_connection(newc); // 关闭socket,这种可以立即回收这个连接，无需延迟，因为其上还没有数据收发，谈不到业务逻辑因此无需延迟；
+        return;                     // 直接返回
+    }
+    /*
+    else
+    {
+        //打印下发送缓冲区大小
+        int           n;
+        socklen_t     len;
+        len = sizeof(int);
+        getsockopt(s,SOL_SOCKET,SO_SNDBUF, &n, &len);
+        ngx_log_stderr(0,"发送缓冲区的大小为%d!",n); //87040
+
+        n = 0;
+        getsockopt(s,SOL_SOCKET,SO_RCVBUF, &n, &len);
+        ngx_log_stderr(0,"接收缓冲区的大小为%d!",n); //374400
+
+        int sendbuf = 2048;
+        if (setsockopt(s, SOL_SOCKET, SO_SNDBUF,(const void *) &sendbuf,n) == 0)
         {
-            // 增加事件失败，失败日志在ngx_epoll_add_event中写过了，因此这里不多写啥；
-            ngx_close_connection(newc); // 关闭socket,这种可以立即回收这个连接，无需延迟，因为其上还没有数据收发，谈不到业务逻辑因此无需延迟；
-            return;                     // 直接返回
+            ngx_log_stderr(0,"发送缓冲区大小成功设置为%d!",sendbuf);
         }
-        /*
-        else
-        {
-            //打印下发送缓冲区大小
-            int           n;
-            socklen_t     len;
-            len = sizeof(int);
-            getsockopt(s,SOL_SOCKET,SO_SNDBUF, &n, &len);
-            ngx_log_stderr(0,"发送缓冲区的大小为%d!",n); //87040
-
-            n = 0;
-            getsockopt(s,SOL_SOCKET,SO_RCVBUF, &n, &len);
-            ngx_log_stderr(0,"接收缓冲区的大小为%d!",n); //374400
-
-            int sendbuf = 2048;
-            if (setsockopt(s, SOL_SOCKET, SO_SNDBUF,(const void *) &sendbuf,n) == 0)
-            {
-                ngx_log_stderr(0,"发送缓冲区大小成功设置为%d!",sendbuf);
-            }
 
-             getsockopt(s,SOL_SOCKET,SO_SNDBUF, &n, &len);
-            ngx_log_stderr(0,"发送缓冲区的大小为%d!",n); //87040
+         getsockopt(s,SOL_SOCKET,SO_SNDBUF, &n, &len);
+        ngx_log_stderr(0,"发送缓冲区的大小为%d!",n); //87040
+    }
+    */
+
+    // 是否开启踢人时钟，共享内存通道靠握手连接断开发现客户端退出，不参与
+    if (m_ifkickTimeCount == 1 && newc->listening->shm == 0)
+    {
+        AddToTimerQueue(newc);
+    }
+
+    // 连入用户数量增加
+    ++m_onlineUserCount;
+    ++m_iAcceptCount;
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     句柄用尽（EMFILE/ENFILE）时的处理
+ *  @param     oldc    监听套接字对应的连接
+ *  @note      先关掉备用句柄腾出一个位置，把已完成连接队列头上的连接接进来立即关掉，客户端马上就知道连不上，
+ *             不会一直挂着等待；然后暂停 accept 一小段时间，避免监听套接字一直可读导致空转
+ **************************************************************/
+void CSocekt::ngx_accept_overload(lpngx_connection_t oldc)
+{
+    if (m_spareFd != -1)
+    {
+        close(m_spareFd);
+        m_spareFd = -1;
+
+        int s = accept(oldc->fd, NULL, NULL);
+        if (s != -1)
+        {
+            close(s);
+            ++m_iAcceptDropCount;
         }
-        */
 
-        // 是否开启踢人时钟
-        if (m_ifkickTimeCount == 1)
+        // 重新占住备用句柄，失败了下次就没有备用句柄可用，只能单纯暂停
+        m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    ngx_accept_pause();
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     暂停所有监听套接字上的 accept，m_acceptPauseMs 毫秒后由 ngx_epoll_process_events() 恢复
+ *  @note      epoll 模式下把监听套接字从 epoll 中删掉；io_uring 模式下 multishot accept 出错时自己就结束了，
+ *             由完成事件的处理函数标记暂停，不再重新提交
+ **************************************************************/
+void CSocekt::ngx_accept_pause()
+{
+    if (m_acceptPauseMs <= 0 || m_acceptPauseUntil != 0)
+    {
+        return;
+    }
+
+    struct timeval sCurrTime;
+    gettimeofday(&sCurrTime, NULL);
+    m_acceptPauseUntil = (sCurrTime.tv_sec * 1000 + sCurrTime.tv_usec / 1000) + m_acceptPauseMs;
+    ++m_iAcceptPauseCount;
+
+    if (m_uringFd != -1)
+    {
+        return;
+    }
+
+    for (auto pos = m_ListenSocketList.begin(); pos != m_ListenSocketList.end(); ++pos)
+    {
+        if ((*pos)->paused == 0 && ngx_epoll_oper_event((*pos)->fd, EPOLL_CTL_DEL, 0, 0, (*pos)->connection) == 1)
         {
-            AddToTimerQueue(newc);
+            (*pos)->paused = 1;
         }
+    }
 
-        // 连入用户数量增加
-        ++m_onlineUserCount;
+    return;
+}
 
-        // 成功则直接跳出
-        break;
+/***************************************************************
+ *  @brief     恢复被暂停的监听套接字上的 accept
+ **************************************************************/
+void CSocekt::ngx_accept_resume()
+{
+    m_acceptPauseUntil = 0;
 
-    } while (1);
+    for (auto pos = m_ListenSocketList.begin(); pos != m_ListenSocketList.end(); ++pos)
+    {
+        if ((*pos)->paused == 0)
+        {
+            continue;
+        }
+
+        // 和 ngx_epoll_init() 中加入时的标志一样
+        if (ngx_epoll_oper_event(
+                (*pos)->fd,
+                EPOLL_CTL_ADD,
+                (m_listenMode == 2 || (*pos)->path[0] != 0) ? (EPOLLIN | EPOLLEXCLUSIVE) : (EPOLLIN | EPOLLRDHUP),
+                0,
+                (*pos)->connection) == 1)
+        {
+            (*pos)->paused = 0;
+        }
+    }
 
     return;
 }
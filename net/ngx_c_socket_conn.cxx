@@ -17,6 +17,7 @@
 #include <errno.h>     //errno
 //#include <sys/socket.h>
 #include <sys/ioctl.h> //ioctl
+#include <sys/mman.h>  //munmap
 #include <arpa/inet.h>
 
 #include "ngx_c_conf.h"
@@ -32,11 +33,29 @@
 ngx_connection_s::ngx_connection_s()//构造函数
 {		
     iCurrsequence = 0;    
-    pthread_mutex_init(&logicPorcMutex, NULL); //互斥量初始化
+    precvChunk = NULL;                         //收包缓冲区在有数据到来时才分配
+    psendQueueHead = psendQueueTail = NULL;    //发送队列为空
+    ifSendReady = 0;                           //不在发送就绪列表中，连接回收再取用时也不重置，以免在列表中重复出现
+    shm = NULL;                                //不属于共享内存通道
+    timerNode.prev = timerNode.next = NULL;    //不在时间轮中，关闭连接时从时间轮中删除，回收再取用时也不用重置
+    timerNode.data = this;
+    ifInRecy = 0;                              //不在回收队列中，出队时清零
+    recyNext = NULL;
+    cold = NULL;                               //由连接池创建连接时设置
+    pthread_mutex_init(&sendMutex, NULL);      //互斥量初始化
 }
 ngx_connection_s::~ngx_connection_s()//析构函数
 {
-    pthread_mutex_destroy(&logicPorcMutex);    //互斥量释放
+    pthread_mutex_destroy(&sendMutex);         //互斥量释放
+}
+ngx_connection_cold_s::ngx_connection_cold_s()//构造函数
+{
+    s_socklen = 0;
+    pthread_mutex_init(&zcMutex, NULL);        //互斥量初始化
+}
+ngx_connection_cold_s::~ngx_connection_cold_s()//析构函数
+{
+    pthread_mutex_destroy(&zcMutex);           //互斥量释放
 }
 //分配出去一个连接的时候初始化一些内容,原来内容放在 ngx_get_connection()里，现在放在这里
 void ngx_connection_s::GetOneToUse()
@@ -45,18 +64,25 @@ void ngx_connection_s::GetOneToUse()
 
     fd  = -1;                                         //开始先给-1
     curStat = _PKG_HD_INIT;                           //收包状态处于 初始状态，准备接收数据包头【状态机】
-    precvbuf = dataHeadInfo;                          //收包我要先收到这里来，因为我要先收包头，所以收数据的buff直接就是dataHeadInfo
-    irecvlen = sizeof(COMM_PKG_HEADER);               //这里指定收数据的长度，这里先要求收包头这么长字节的数据
+    precvbuf = NULL;                                  //只有接收装不进收包缓冲区的大包时才用到
+    irecvlen = 0;                                     
     
     precvMemPointer   = NULL;                         //既然没new内存，那自然指向的内存地址先给NULL
+    irecvChunkLen     = 0;                            //收包缓冲区中还没有数据
     iThrowsendCount   = 0;                            //原子的
+    iWriteEdge        = 0;                            //原子的，ET模式下未被消费的可写边沿
     psendMemPointer   = NULL;                         //发送数据头指针记录
     events            = 0;                            //epoll事件先给0 
     lastPingTime      = time(NULL);                   //上次ping的时间
 
-    FloodkickLastTime = 0;                            //Flood攻击上次收到包的时间
-	FloodAttackCount  = 0;	                          //Flood攻击在该时间内收到包的次数统计
+    cold->FloodkickLastTime = 0;                      //Flood攻击上次收到包的时间
+	cold->FloodAttackCount  = 0;	                  //Flood攻击在该时间内收到包的次数统计
     iSendCount        = 0;                            //发送队列中有的数据条目数，若client只发不收，则可能造成此数过大，依据此数做出踢出处理 
+    ifZeroCopy        = 0;                            //accept之后按配置再决定是否开启零拷贝发送
+    cold->izcNextId   = 0;                            //新socket的零拷贝发送序号从0开始
+    iUringWantWrite   = 0;                            //io_uring模式下没有在等待可写
+    iUringPollOut     = 0;                            //io_uring模式下没有等待可写的请求
+    shm               = NULL;                         //握手完成后才属于共享内存通道
 }
 
 //回收回来一个连接的时候做一些事
@@ -73,70 +99,255 @@ void ngx_connection_s::PutOneToFree()
         CMemory::GetInstance()->FreeMemory(psendMemPointer);
         psendMemPointer = NULL;
     }
+    if(precvChunk != NULL)      //收包缓冲区随连接一起回收，空闲连接不占这块内存
+    {
+        CMemory::GetInstance()->FreeMemory(precvChunk);
+        precvChunk = NULL;
+    }
+    //零拷贝发送还没等到完成通知的内存：socket早已关闭，又经过了回收等待时间，内核肯定不再使用这些内存了
+    while(!cold->zcPendingList.empty())
+    {
+        if(cold->zcPendingList.front().pMemPointer != NULL)
+            CMemory::GetInstance()->FreeMemory(cold->zcPendingList.front().pMemPointer);
+        cold->zcPendingList.pop_front();
+    }
+
+    //共享内存通道由eventfd对应的连接负责释放，这时处理线程肯定不再往环里写了
+    if(shm != NULL)
+    {
+        if(shm->pEventConn == this)
+        {
+            munmap(shm->area, shm->areaSize);
+            close(shm->notifyFd);
+            delete shm;
+        }
+        shm = NULL;
+    }
 
     iThrowsendCount = 0;                              //设置不设置感觉都行         
 }
 
 //---------------------------------------------------------------
+//每个线程自己的空闲连接缓存，取用和归还大多数时候不用碰全局空闲链表
+//进程中只有一个CSocekt对象(g_socket)，所以不用区分是哪个对象的连接
+struct ngx_conn_cache_s
+{
+    int n;
+    lpngx_connection_t conns[NGX_CONN_CACHE_SIZE];
+};
+static thread_local ngx_conn_cache_s t_connCache;
+
 //初始化连接池
 void CSocekt::initconnection()
 {
-    lpngx_connection_t p_Conn;
-    CMemory *p_memory = CMemory::GetInstance();   
+    m_connStride = (sizeof(ngx_connection_t) + 63) & ~(size_t)63; //每个连接从缓存行开头开始
+    m_connSlabs = new char*[NGX_CONN_SLAB_MAX];
+    m_connSlabCount = 0;
+    m_freeConnHead = 0;
+    m_free_connection_n = m_total_connection_n = 0;
+
+    //先创建这么多个连接，后续不够再增加；第一次的连接放在一整块连续内存里
+    int n = (m_worker_connections + NGX_CONN_SLAB_SIZE - 1) / NGX_CONN_SLAB_SIZE * NGX_CONN_SLAB_SIZE;
+    CLock lock(&m_connectionMutex);
+    if(ngx_grow_connection(n) == false)
+    {
+        ngx_log_stderr(0,"CSocekt::initconnection()中ngx_grow_connection()失败，连接池为空!");
+    }
+    return;
+}
+
+//连接池扩容n个连接，新连接全部放进全局空闲链表；调用者持有m_connectionMutex
+bool CSocekt::ngx_grow_connection(int n)
+{
+    int iSlabs = n / NGX_CONN_SLAB_SIZE;
+    if(m_connSlabCount + iSlabs > NGX_CONN_SLAB_MAX)
+    {
+        ngx_log_stderr(0,"CSocekt::ngx_grow_connection()中连接池已经达到上限%d!",NGX_CONN_SLAB_SIZE * NGX_CONN_SLAB_MAX);
+        return false;
+    }
+
+    void *pBlock = ngx_alloc_connection_block(m_connStride * n);
+    if(pBlock == NULL)
+    {
+        return false;
+    }
+
+    //不常用的部分另放一块，收发数据时连接池这块内存更紧凑
+    void *pColdBlock = ngx_alloc_connection_block(sizeof(ngx_connection_cold_t) * n);
+    if(pColdBlock == NULL)
+    {
+        ngx_free_connection_block(m_connBlocks.back());
+        m_connBlocks.pop_back();
+        return false;
+    }
 
-    int ilenconnpool = sizeof(ngx_connection_t);    
-    for(int i = 0; i < m_worker_connections; ++i) //先创建这么多个连接，后续不够再增加
+    //先在块表里登记，别的线程按编号找连接之前这里一定已经写好了【放进空闲链表时有release语义】
+    uint32_t iBase = (uint32_t)m_connSlabCount * NGX_CONN_SLAB_SIZE;
+    for(int i = 0; i < iSlabs; ++i)
     {
-        p_Conn = (lpngx_connection_t)p_memory->AllocMemory(ilenconnpool,true); 
-        p_Conn = new(p_Conn) ngx_connection_t(); 	
+        m_connSlabs[m_connSlabCount + i] = (char *)pBlock + m_connStride * NGX_CONN_SLAB_SIZE * i;
+    }
+    m_connSlabCount += iSlabs;
+
+    lpngx_connection_t p_Conn, pPrev = NULL;
+    for(int i = n - 1; i >= 0; --i) //倒着串，编号小的在栈顶，先被取用
+    {
+        p_Conn = new((char *)pBlock + m_connStride * i) ngx_connection_t();
+        p_Conn->cold = new((ngx_connection_cold_t *)pColdBlock + i) ngx_connection_cold_t();
         p_Conn->GetOneToUse();
-        m_connectionList.push_back(p_Conn);     
-        m_freeconnectionList.push_back(p_Conn); 
-    } //end for
-    m_free_connection_n = m_total_connection_n = m_connectionList.size(); 
-    return;
+        p_Conn->iPoolIndex = iBase + i;
+        p_Conn->iFreeNext.store((pPrev == NULL) ? 0 : pPrev->iPoolIndex + 1, std::memory_order_relaxed);
+        pPrev = p_Conn;
+    }
+    m_total_connection_n += n;
+    m_free_connection_n += n;
+    ngx_push_free_connection(pPrev, ngx_conn_by_index(iBase + n - 1));
+    return true;
+}
+
+//为连接池申请一块清零的内存，按缓存行对齐，登记到m_connBlocks中；调用者持有m_connectionMutex
+//arena模式下用mmap映射，按配置使用大页、预先缺页：第一次的一大块在worker启动时就全部缺页完毕，涨连接时不再有缺页的延迟
+void *CSocekt::ngx_alloc_connection_block(size_t size)
+{
+    void *pBlock = NULL;
+    size_t mapSize = 0;
+
+    if(m_memHugePages != NGX_MEM_HUGE_NONE || m_memPrefault != NGX_MEM_PREFAULT_NONE)
+    {
+        pBlock = CMemory::MapArena(size, m_memHugePages, m_memPrefault, &mapSize); //匿名映射本来就是清零的
+        if(pBlock == NULL)
+        {
+            ngx_log_stderr(0,"CSocekt::ngx_alloc_connection_block()中CMemory::MapArena()失败!");
+            return NULL;
+        }
+    }
+    else
+    {
+        int err = posix_memalign(&pBlock, 64, size);
+        if(err != 0)
+        {
+            ngx_log_stderr(err,"CSocekt::ngx_alloc_connection_block()中posix_memalign()失败!");
+            return NULL;
+        }
+        memset(pBlock, 0, size);
+    }
+    m_connBlocks.push_back(std::make_pair(pBlock, mapSize));
+    return pBlock;
+}
+
+//释放ngx_alloc_connection_block()得到的内存，映射大小为0的是posix_memalign()申请的
+void CSocekt::ngx_free_connection_block(const std::pair<void *, size_t> &block)
+{
+    if(block.second == 0)
+        free(block.first);
+    else
+        CMemory::UnmapArena(block.first, block.second);
 }
 
 //最终回收连接池，释放内存
 void CSocekt::clearconnection()
 {
+    for(int i = 0; i < m_connSlabCount; ++i)
+    {
+        for(int j = 0; j < NGX_CONN_SLAB_SIZE; ++j)
+        {
+            lpngx_connection_t p_Conn = ngx_conn_by_index(i * NGX_CONN_SLAB_SIZE + j);
+            p_Conn->cold->~ngx_connection_cold_t(); //手工调用析构函数
+            p_Conn->~ngx_connection_t();
+        }
+    }
+    for(size_t i = 0; i < m_connBlocks.size(); ++i)
+    {
+        ngx_free_connection_block(m_connBlocks[i]);
+    }
+    m_connBlocks.clear();
+    m_connSlabCount = 0;
+    delete[] m_connSlabs;
+    m_connSlabs = NULL;
+    m_freeConnHead = 0;
+    t_connCache.n = 0;
+}
+
+//从全局无锁空闲链表的栈顶取一个连接，空了返回NULL
+//连接的内存一直到进程退出都不释放，所以读到一个已经被别的线程取走的连接的iFreeNext也没关系，版本号变了CAS会失败重来
+lpngx_connection_t CSocekt::ngx_pop_free_connection()
+{
+    uint64_t head = m_freeConnHead.load(std::memory_order_acquire);
+    uint64_t newhead;
     lpngx_connection_t p_Conn;
-	CMemory *p_memory = CMemory::GetInstance();
-	
-	while(!m_connectionList.empty())
-	{
-		p_Conn = m_connectionList.front();
-		m_connectionList.pop_front(); 
-        p_Conn->~ngx_connection_t();     //手工调用析构函数
-		p_memory->FreeMemory(p_Conn);
-	}
+    do
+    {
+        if((uint32_t)head == 0)
+            return NULL;
+        p_Conn = ngx_conn_by_index((uint32_t)head - 1);
+        newhead = (((head >> 32) + 1) << 32) | p_Conn->iFreeNext.load(std::memory_order_relaxed);
+    } while(!m_freeConnHead.compare_exchange_weak(head, newhead, std::memory_order_acquire, std::memory_order_acquire));
+    return p_Conn;
+}
+
+//把pHead到pTail已经用iFreeNext串好的一串连接一次放回全局空闲链表
+void CSocekt::ngx_push_free_connection(lpngx_connection_t pHead, lpngx_connection_t pTail)
+{
+    uint64_t head = m_freeConnHead.load(std::memory_order_relaxed);
+    uint64_t newhead;
+    do
+    {
+        pTail->iFreeNext.store((uint32_t)head, std::memory_order_relaxed);
+        newhead = (((head >> 32) + 1) << 32) | (pHead->iPoolIndex + 1);
+    } while(!m_freeConnHead.compare_exchange_weak(head, newhead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+//把本线程缓存的空闲连接全部串起来放回全局空闲链表
+//只归还不取用的线程（回收线程）要调用，否则缓存里的连接别的线程永远拿不到
+void CSocekt::ngx_flush_conn_cache()
+{
+    ngx_conn_cache_s *pCache = &t_connCache;
+    if(pCache->n == 0)
+        return;
+    for(int i = 0; i < pCache->n - 1; ++i)
+    {
+        pCache->conns[i]->iFreeNext.store(pCache->conns[i + 1]->iPoolIndex + 1, std::memory_order_relaxed);
+    }
+    ngx_push_free_connection(pCache->conns[0], pCache->conns[pCache->n - 1]);
+    pCache->n = 0;
 }
 
 //从连接池中获取一个空闲连接【当一个客户端连接TCP进入，我希望把这个连接和我的 连接池中的 一个连接【对象】绑到一起，后续 我可以通过这个连接，把这个对象拿到，因为对象里边可以记录各种信息】
 lpngx_connection_t CSocekt::ngx_get_connection(int isock)
 {
-    //因为可能有其他线程要访问m_freeconnectionList，m_connectionList【比如可能有专门的释放线程要释放/或者主线程要释放】之类的，所以应该临界一下
-    CLock lock(&m_connectionMutex);  
+    //先从本线程的缓存里取，没有再从全局空闲链表里取一批放进缓存，都不用加锁
+    ngx_conn_cache_s *pCache = &t_connCache;
+    lpngx_connection_t p_Conn;
+    if(pCache->n == 0)
+    {
+        while(pCache->n < NGX_CONN_CACHE_SIZE / 2 && (p_Conn = ngx_pop_free_connection()) != NULL)
+        {
+            pCache->conns[pCache->n++] = p_Conn;
+        }
+    }
 
-    if(!m_freeconnectionList.empty())
+    if(pCache->n == 0)
     {
-        //有空闲的，自然是从空闲的中摘取
-        lpngx_connection_t p_Conn = m_freeconnectionList.front(); //返回第一个元素但不检查元素存在与否
-        m_freeconnectionList.pop_front();                         //移除第一个元素但不返回	
-        p_Conn->GetOneToUse();
-        --m_free_connection_n; 
-        p_Conn->fd = isock;
-        return p_Conn;
+        //走到这里，表示没空闲的连接了，那就考虑扩容一块；扩容要互斥，拿到锁以后先看看别的线程是不是已经扩过了
+        CLock lock(&m_connectionMutex);
+
+        if((p_Conn = ngx_pop_free_connection()) == NULL)
+        {
+            if(ngx_grow_connection(NGX_CONN_SLAB_SIZE) == false)
+                return NULL;
+            p_Conn = ngx_pop_free_connection();
+        }
+        if(p_Conn == NULL) //扩容出来的又被别的线程取光了，极少见，下次再来
+            return NULL;
+    }
+    else
+    {
+        p_Conn = pCache->conns[--pCache->n];
     }
 
-    //走到这里，表示没空闲的连接了，那就考虑重新创建一个连接
-    CMemory *p_memory = CMemory::GetInstance();
-    lpngx_connection_t p_Conn = (lpngx_connection_t)p_memory->AllocMemory(sizeof(ngx_connection_t),true);
-    p_Conn = new(p_Conn) ngx_connection_t();
     p_Conn->GetOneToUse();
-    m_connectionList.push_back(p_Conn); //入到总表中来，但不能入到空闲表中来，因为凡是调这个函数的，肯定是要用这个连接的
-    ++m_total_connection_n;             
-    p_Conn->fd = isock;
+    --m_free_connection_n; 
+    p_Conn->fd = isock;                //收包缓冲区等到有数据到来时再分配，监听套接字、eventfd之类的连接根本用不到
     return p_Conn;
 
     //因为我们要采用延迟释放的手段来释放连接，因此这种 instance就没啥用，这种手段用来处理立即释放才有用。
@@ -189,14 +400,24 @@ lpngx_connection_t CSocekt::ngx_get_connection(int isock)
 //归还参数pConn所代表的连接到到连接池中，注意参数类型是lpngx_connection_t
 void CSocekt::ngx_free_connection(lpngx_connection_t pConn) 
 {
-    //因为有线程可能要动连接池中连接，所以在合理互斥也是必要的
-    CLock lock(&m_connectionMutex);  
-
-    //首先明确一点，连接，所有连接全部都在m_connectionList里；
+    //首先明确一点，连接，所有连接全部都在连接池的块里，这里只是放回空闲链表
+    clearConnSendQueue(pConn);   //还没来得及发送的数据不用发了
     pConn->PutOneToFree();
 
-    //扔到空闲连接列表里
-    m_freeconnectionList.push_back(pConn);
+    //先放进本线程的缓存，缓存满了把一半串起来，一次放回全局空闲链表
+    ngx_conn_cache_s *pCache = &t_connCache;
+    if(pCache->n == NGX_CONN_CACHE_SIZE)
+    {
+        int iHalf = NGX_CONN_CACHE_SIZE / 2;
+        for(int i = 0; i < iHalf - 1; ++i)
+        {
+            pCache->conns[i]->iFreeNext.store(pCache->conns[i + 1]->iPoolIndex + 1, std::memory_order_relaxed);
+        }
+        ngx_push_free_connection(pCache->conns[0], pCache->conns[iHalf - 1]);
+        memmove(pCache->conns, pCache->conns + iHalf, sizeof(lpngx_connection_t) * (NGX_CONN_CACHE_SIZE - iHalf));
+        pCache->n -= iHalf;
+    }
+    pCache->conns[pCache->n++] = pConn;
 
     //空闲连接数+1
     ++m_free_connection_n;
@@ -230,81 +451,99 @@ void CSocekt::ngx_free_connection(lpngx_connection_t pConn)
 
 //将要回收的连接放到一个队列中来，后续有专门的线程会处理这个队列中的连接的回收
 //有些连接，我们不希望马上释放，要隔一段时间后再释放以确保服务器的稳定，所以，我们把这种隔一段时间才释放的连接先放到一个队列中来
+//回收队列是按入队时间排好的单向链表，入队、判重都是O(1)，大量连接同时断开时也不会卡住
 void CSocekt::inRecyConnectQueue(lpngx_connection_t pConn)
 {
-    //ngx_log_stderr(0,"哎呀我去");
-
     //ngx_log_stderr(0,"CSocekt::inRecyConnectQueue()执行，连接入到回收队列中.");
 
-    std::list<lpngx_connection_t>::iterator pos;
-    bool iffind = false;
-        
-    CLock lock(&m_recyconnqueueMutex); //针对连接回收列表的互斥量，因为线程ServerRecyConnectionThread()也有要用到这个回收列表；
+    CLock lock(&m_recyconnqueueMutex); //针对连接回收队列的互斥量，因为线程ServerRecyConnectionThread()也有要用到这个回收队列；
 
-    //如下判断防止连接被多次扔到回收站中来
-    for(pos = m_recyconnectionList.begin(); pos != m_recyconnectionList.end(); ++pos)
-	{
-		if((*pos) == pConn)		
-		{	
-			iffind = true;
-			break;			
-		}
-	}
-    if(iffind == true) //找到了，不必再入了
+    //防止连接被多次扔到回收站中来
+    if(pConn->ifInRecy == 1) 
 	{
 		//我有义务保证这个只入一次嘛
         return;
     }
 
-    pConn->inRecyTime = time(NULL);        //记录回收时间
+    pConn->ifInRecy = 1;
+    pConn->inRecyTime = ngx_timer_now_ms(); //记录回收时间
+    pConn->recyNext = NULL;
     ++pConn->iCurrsequence;
-    m_recyconnectionList.push_back(pConn); //等待ServerRecyConnectionThread线程自会处理 
+
+    //等待时间都一样，挂到队尾，队列自然按到期时间排好
+    if(m_recyconnectionTail == NULL)
+    {
+        m_recyconnectionHead = pConn;
+        //队列原来是空的，回收线程在无限期等待，要叫醒它按这个连接的到期时间重新等待；队列不空时队头没变，不用叫
+        pthread_cond_signal(&m_recyconnqueueCond);
+    }
+    else
+    {
+        m_recyconnectionTail->recyNext = pConn;
+    }
+    m_recyconnectionTail = pConn;
+
     ++m_totol_recyconnection_n;            //待释放连接队列大小+1
     --m_onlineUserCount;                   //连入用户数量-1
     return;
 }
 
 //处理连接回收的线程
+//队列空时一直睡，否则睡到队头连接的到期时间，醒来从队头摘下所有到期的连接，放锁之后再归还到连接池
 void* CSocekt::ServerRecyConnectionThread(void* threadData)
 {
     ThreadItem *pThread = static_cast<ThreadItem*>(threadData);
     CSocekt *pSocketObj = pThread->_pThis;
     
-    time_t currtime;
+    uint64_t waittime = (uint64_t)pSocketObj->m_RecyConnectionWaitTime * 1000;
+    uint64_t currtime, expire;
+    struct timespec abstime;
     int err;
-    std::list<lpngx_connection_t>::iterator pos,posend;
-    lpngx_connection_t p_Conn;
+    lpngx_connection_t p_Conn, pExpired, pExpiredTail;
     
+    err = pthread_mutex_lock(&pSocketObj->m_recyconnqueueMutex);  
+    if(err != 0) ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()中pthread_mutex_lock()失败，返回的错误码为%d!",err);
+
     while(1)
     {
-        //为简化问题，我们直接每次休息200毫秒
-        usleep(200 * 1000);  //单位是微妙,又因为1毫秒=1000微妙，所以 200 *1000 = 200毫秒
-
-        //不管啥情况，先把这个条件成立时该做的动作做了
-        if(pSocketObj->m_totol_recyconnection_n > 0)
+        //要退出整个程序时不管到没到时间都得硬释放
+        pExpired = pExpiredTail = NULL;
+        currtime = ngx_timer_now_ms();
+        while(pSocketObj->m_recyconnectionHead != NULL)
         {
-            currtime = time(NULL);
-            err = pthread_mutex_lock(&pSocketObj->m_recyconnqueueMutex);  
-            if(err != 0) ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()中pthread_mutex_lock()失败，返回的错误码为%d!",err);
+            p_Conn = pSocketObj->m_recyconnectionHead;
+            if(p_Conn->inRecyTime + waittime > currtime && g_stopEvent == 0)
+            {
+                break; //队头没到释放的时间，后边的肯定也没到
+            }
+
+            pSocketObj->m_recyconnectionHead = p_Conn->recyNext;
+            if(pSocketObj->m_recyconnectionHead == NULL)
+                pSocketObj->m_recyconnectionTail = NULL;
+            p_Conn->ifInRecy = 0;
+            --pSocketObj->m_totol_recyconnection_n;        //待释放连接队列大小-1
+
+            //到期的连接先串到本地链表上
+            p_Conn->recyNext = NULL;
+            if(pExpiredTail == NULL)
+                pExpired = p_Conn;
+            else
+                pExpiredTail->recyNext = p_Conn;
+            pExpiredTail = p_Conn;
+        }
+
+        if(pExpired != NULL)
+        {
+            //归还连接时不占着回收队列的锁，关连接的线程不会被卡住
+            err = pthread_mutex_unlock(&pSocketObj->m_recyconnqueueMutex); 
+            if(err != 0)  ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()pthread_mutex_unlock()失败，返回的错误码为%d!",err);
 
-lblRRTD:
-            pos    = pSocketObj->m_recyconnectionList.begin();
-			posend = pSocketObj->m_recyconnectionList.end();
-            for(; pos != posend; ++pos)
+            while(pExpired != NULL)
             {
-                p_Conn = (*pos);
-                if(
-                    ( (p_Conn->inRecyTime + pSocketObj->m_RecyConnectionWaitTime) > currtime)  && (g_stopEvent == 0) //如果不是要整个系统退出，你可以continue，否则就得要强制释放
-                    )
-                {
-                    continue; //没到释放的时间
-                }    
-                //到释放的时间了: 
-                //......这将来可能还要做一些是否能释放的判断[在我们写完发送数据代码之后吧]，先预留位置
-                //....
+                p_Conn = pExpired;
+                pExpired = p_Conn->recyNext;
 
                 //我认为，凡是到释放时间的，iThrowsendCount都应该为0；这里我们加点日志判断下
-                //if(p_Conn->iThrowsendCount != 0)
                 if(p_Conn->iThrowsendCount > 0)
                 {
                     //这确实不应该，打印个日志吧；
@@ -312,44 +551,40 @@ lblRRTD:
                     //其他先暂时啥也不敢，路程继续往下走，继续去释放吧。
                 }
 
-                //流程走到这里，表示可以释放，那我们就开始释放
-                --pSocketObj->m_totol_recyconnection_n;        //待释放连接队列大小-1
-                pSocketObj->m_recyconnectionList.erase(pos);   //迭代器已经失效，但pos所指内容在p_Conn里保存着呢
-
                 //ngx_log_stderr(0,"CSocekt::ServerRecyConnectionThread()执行，连接%d被归还.",p_Conn->fd);
 
                 pSocketObj->ngx_free_connection(p_Conn);	   //归还参数pConn所代表的连接到到连接池中
-                goto lblRRTD; 
-            } //end for
-            err = pthread_mutex_unlock(&pSocketObj->m_recyconnqueueMutex); 
-            if(err != 0)  ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()pthread_mutex_unlock()失败，返回的错误码为%d!",err);
-        } //end if
+            }
+            //回收线程从不取连接，这一轮归还的连接不能留在它自己的缓存里
+            pSocketObj->ngx_flush_conn_cache();
 
-        if(g_stopEvent == 1) //要退出整个程序，那么肯定要先退出这个循环
+            err = pthread_mutex_lock(&pSocketObj->m_recyconnqueueMutex);  
+            if(err != 0) ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()中pthread_mutex_lock2()失败，返回的错误码为%d!",err);
+            continue; //放锁期间可能又有连接入队，重新看一遍队头
+        }
+
+        if(g_stopEvent != 0) //要退出整个程序，队列也已经清空了
+            break;
+
+        if(pSocketObj->m_recyconnectionHead == NULL)
         {
-            if(pSocketObj->m_totol_recyconnection_n > 0)
-            {
-                //因为要退出，所以就得硬释放了【不管到没到时间，不管有没有其他不 允许释放的需求，都得硬释放】
-                err = pthread_mutex_lock(&pSocketObj->m_recyconnqueueMutex);  
-                if(err != 0) ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()中pthread_mutex_lock2()失败，返回的错误码为%d!",err);
-
-        lblRRTD2:
-                pos    = pSocketObj->m_recyconnectionList.begin();
-			    posend = pSocketObj->m_recyconnectionList.end();
-                for(; pos != posend; ++pos)
-                {
-                    p_Conn = (*pos);
-                    --pSocketObj->m_totol_recyconnection_n;        //待释放连接队列大小-1
-                    pSocketObj->m_recyconnectionList.erase(pos);   //迭代器已经失效，但pos所指内容在p_Conn里保存着呢
-                    pSocketObj->ngx_free_connection(p_Conn);	   //归还参数pConn所代表的连接到到连接池中
-                    goto lblRRTD2; 
-                } //end for
-                err = pthread_mutex_unlock(&pSocketObj->m_recyconnqueueMutex); 
-                if(err != 0)  ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()pthread_mutex_unlock2()失败，返回的错误码为%d!",err);
-            } //end if
-            break; //整个程序要退出了，所以break;
-        }  //end if
+            //队列空，等到有连接入队或者要退出
+            err = pthread_cond_wait(&pSocketObj->m_recyconnqueueCond, &pSocketObj->m_recyconnqueueMutex);
+        }
+        else
+        {
+            //睡到队头的到期时间，期间入队的连接到期更晚，不影响
+            expire = pSocketObj->m_recyconnectionHead->inRecyTime + waittime;
+            abstime.tv_sec = expire / 1000;
+            abstime.tv_nsec = (expire % 1000) * 1000000;
+            err = pthread_cond_timedwait(&pSocketObj->m_recyconnqueueCond, &pSocketObj->m_recyconnqueueMutex, &abstime);
+        }
+        if(err != 0 && err != ETIMEDOUT) 
+            ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()中pthread_cond_wait()失败，返回的错误码为%d!",err);
     } //end while    
+
+    err = pthread_mutex_unlock(&pSocketObj->m_recyconnqueueMutex); 
+    if(err != 0)  ngx_log_stderr(err,"CSocekt::ServerRecyConnectionThread()pthread_mutex_unlock2()失败，返回的错误码为%d!",err);
     
     return (void*)0;
 }
@@ -362,6 +597,8 @@ void CSocekt::ngx_close_connection(lpngx_connection_t pConn)
     ngx_free_connection(pConn); 
     if(pConn->fd != -1)
     {
+        if(m_uringFd != -1)
+            shutdown(pConn->fd, SHUT_RDWR);  //io_uring模式下先shutdown()，让挂在这个socket上的multishot请求结束
         close(pConn->fd);
         pConn->fd = -1;
     }    
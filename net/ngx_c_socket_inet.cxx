@@ -11,6 +11,7 @@
 #include <fcntl.h>     //open
 #include <errno.h>     //errno
 #include <sys/ioctl.h> //ioctl
+#include <stddef.h>    //offsetof
 #include <arpa/inet.h>
 // #include <sys/socket.h>
 
@@ -23,16 +24,19 @@
 /***************************************************************
  *  @brief     将 socket 绑定的地址信息（信标签）转换为文本格式，即根据参数1给定的信息，获取地址端口字符串，返回这个字符串的长度
  *  @param     sa    客户端的 ip 等信息（信标签）
+ *  @param     socklen    sa 中有效内容的长度
  *  @param     port    是否包含端口信息，1：包含端口信息到字符串，0：不包含端口信息
  *  @param     text    存放书写后的文本信息
  *  @param     len    最大文本信息宽度
  *  @return    字符串长度
- *  @note      调用示例
+ *  @note      AF_UNIX 的对端格式为 "unix:路径"，抽象地址为 "unix:@名字"，客户端没有 bind() 时只有 "unix:"
  **************************************************************/
-size_t CSocekt::ngx_sock_ntop(struct sockaddr *sa, int port, u_char *text, size_t len)
+size_t CSocekt::ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, int port, u_char *text, size_t len)
 {
     // 临时变量
     struct sockaddr_in *sin;
+    struct sockaddr_un *saun;
+    size_t n;
     u_char *p;
 
     // 根据不同协议族进行不同处理
@@ -55,6 +59,32 @@ size_t CSocekt::ngx_sock_ntop(struct sockaddr *sa, int port, u_char *text, size_
         return (p - text);
         break;
 
+    case AF_UNIX:
+        saun = (struct sockaddr_un *)sa;
+
+        // 路径部分的长度，ngx_snprintf() 不支持指定 %s 的长度，路径也不一定以 '\0' 结尾，所以自己拷贝
+        n = (socklen > offsetof(struct sockaddr_un, sun_path)) ? socklen - offsetof(struct sockaddr_un, sun_path) : 0;
+        if (n > 0 && saun->sun_path[0] != 0)
+        {
+            n = strnlen(saun->sun_path, n);
+        }
+
+        p = ngx_snprintf(text, len, "unix:");
+        if (n > 0 && (size_t)(p - text) < len)
+        {
+            // 抽象地址以 '\0' 开头，显示成 '@'
+            n = ngx_min(n, len - (p - text));
+            memcpy(p, saun->sun_path, n);
+            if (p[0] == 0)
+            {
+                p[0] = '@';
+            }
+            p += n;
+        }
+
+        return (p - text);
+        break;
+
     default:
 
         return 0;
@@ -15,6 +15,8 @@
 #include <pthread.h>   //多线程
 #include <arpa/inet.h>
 // #include <sys/socket.h>
+#include <netinet/in.h>      //IPPROTO_IP
+#include <linux/errqueue.h>  //sock_extended_err
 
 #include "ngx_c_conf.h"
 #include "ngx_macro.h"
@@ -27,25 +29,28 @@
 /***************************************************************
  *  @brief     根据指定要求接收客户端数据
  *  @param     pConn    TCP 连接，客户端数据来源
- *  @param     buff    存放接收到的数据
- *  @param     buflen    待接收数据长度
+ *  @param     iov    存放接收到的数据的若干段内存，按顺序依次填满
+ *  @param     iovcnt    iov 的段数
  *  @return    -1: 发生错误，已处理；>0: 收到的数据长度
  *  @note      如果遇到断线、错误等情况，直接在本函数中释放连接到连接池，关闭 socket 句柄
  **************************************************************/
-ssize_t CSocekt::recvproc(lpngx_connection_t pConn, char *buff, ssize_t buflen)
+ssize_t CSocekt::recvproc(lpngx_connection_t pConn, struct iovec *iov, int iovcnt)
 {
     // 接收数据长度
     ssize_t n;
 
     /***************************************************************
-     *  @brief     recv()系统函数，接收缓冲区数据，最后一个参数 flag 一般为0
+     *  @brief     readv()系统函数，一次调用把数据依次收进多段内存
      *  @param     fd    socket 句柄，数据来源
-     *  @param     buff    存放接收到的数据
-     *  @param     buflen    待接收数据长度
-     *  @return    读取到的数据长度
-     *  @note      调用示例
+     *  @param     iov    存放接收到的数据的若干段内存
+     *  @param     iovcnt    iov 的段数
+     *  @return    读取到的数据长度，0 表示对端关闭
      **************************************************************/
-    n = recv(pConn->fd, buff, buflen, 0);
+    // ET 模式下被信号打断不能就此返回，否则剩下的数据不会再有边沿通知，这里直接重收
+    do
+    {
+        n = readv(pConn->fd, iov, iovcnt);
+    } while (n < 0 && errno == EINTR && m_epollET == 1);
 
     // 未接收到数据，客户端关闭
     if (n == 0)
@@ -70,6 +75,12 @@ ssize_t CSocekt::recvproc(lpngx_connection_t pConn, char *buff, ssize_t buflen)
         // 但LT模式下一般是来事件才收，所以不该出现这个返回值
         if (errno == EAGAIN || errno == EWOULDBLOCK)
         {
+            // ET 模式下一直收到 EAGAIN 为止，这是正常的结束条件
+            if (m_epollET == 1)
+            {
+                return -1;
+            }
+
             // 我认为LT模式不该出现这个errno，而且这个其实也不是错误，所以不当做错误处理
             // epoll为LT模式不应该出现这个返回值，所以直接打印出来瞧瞧
             ngx_log_stderr(errno, "CSocekt::recvproc()中errno == EAGAIN || errno == EWOULDBLOCK成立, 出乎我意料！");
@@ -130,104 +141,77 @@ ssize_t CSocekt::recvproc(lpngx_connection_t pConn, char *buff, ssize_t buflen)
     return n;
 }
 
-6 /***************************************************************
-   *  @brief     当收到数据时，调用本函数进行处理
-   *  @param     pConn    数据来源的 TCP 连接，类内成员保存收到的数据
-   *  @return    返回值
-   *  @note      本函数会被 ngx_epoll_process_events() 所调用，仅读取一次数据，若未读完，则交由上层循环调用本函数读取完整数据
-   **************************************************************/
-    void
-    CSocekt::ngx_read_request_handler(lpngx_connection_t pConn)
+/***************************************************************
+ *  @brief     当收到数据时，调用本函数进行处理
+ *  @param     pConn    数据来源的 TCP 连接，类内成员保存收到的数据
+ *  @note      本函数会被 ngx_epoll_process_events() 所调用，LT 模式下仅读取一次数据，若未读完，则交由上层循环调用本函数读取完整数据；
+ *             ET 模式下一直读到 recvproc() 返回 EAGAIN 为止，否则剩余数据不会再有通知
+ *             每次用 readv() 尽量多收数据到连接的收包缓冲区 precvChunk 中，再一次性拆出其中所有完整的包，
+ *             客户端连发多个小包时，只需一次系统调用、一次内存分配
+ **************************************************************/
+void CSocekt::ngx_read_request_handler(lpngx_connection_t pConn)
 {
     // 是否flood攻击
     bool isflood = false;
 
-    // 收包，注意我们用的第二个和第三个参数，我们用的始终是这两个参数，
-    // 因此必须保证 c->precvbuf 指向正确的收包位置，保证c->irecvlen指向正确的收包宽度
+    // 本次收到的数据长度
+    ssize_t reco;
 
-    // 从 pConn 连接中读取 irecvlen 长度的数据到 precvbuf 中
-    ssize_t reco = recvproc(pConn, pConn->precvbuf, pConn->irecvlen);
+    // 本次收包使用的内存段
+    struct iovec iov[2];
+    int iovcnt;
 
-    // 错误已经处理过，此处直接返回
-    if (reco <= 0)
+    do
     {
-        return;
-    }
+        iovcnt = 0;
 
-    // 成功受到一些数据，开始处理
-
-    // 初始状态下，一定是准备接受包头状态
-    if (pConn->curStat == _PKG_HD_INIT)
-    {
-        // 收到数据长度恰好等于包头长度
-        if (reco == m_iLenPkgHeader)
+        // 正在接收一个装不进收包缓冲区的大包，包体直接收到它自己的内存中，收包缓冲区跟在后面接住后续的包
+        if (pConn->precvMemPointer != NULL)
         {
-            // 处理完整包头数据
-            ngx_wait_request_handler_proc_p1(pConn, isflood);
+            iov[iovcnt].iov_base = pConn->precvbuf;
+            iov[iovcnt].iov_len = pConn->irecvlen;
+            ++iovcnt;
         }
-        else
-        {
-            // 收到的包头不完整--我们不能预料每个包的长度，也不能预料各种拆包/粘包情况，所以收到不完整包头【也算是缺包】是很可能的；
-
-            // 收到的包头不完整，则先保存已收到的数据
 
-            // 调整状态为正在接受包头
-            pConn->curStat = _PKG_HD_RECVING;
-            // 待接收内存向后移动
-            pConn->precvbuf = pConn->precvbuf + reco;
-            // 需要接受的内存长度减少，保证先收到完整包头
-            pConn->irecvlen = pConn->irecvlen - reco;
-        } // end  if(reco == m_iLenPkgHeader)
-    }
-    // 收到一部分包头，继续接受包头
-    else if (pConn->curStat == _PKG_HD_RECVING)
-    {
-        // 剩余待接收包头长度与收到的数据长度相等
-        if (pConn->irecvlen == reco)
+        // 收包缓冲区有数据到来时才分配
+        if (pConn->precvChunk == NULL)
         {
-            // 包头接受完整，处理包头数据
-            ngx_wait_request_handler_proc_p1(pConn, isflood);
+            pConn->precvChunk = (char *)CMemory::GetInstance()->AllocMemory(m_iLenMsgHeader + m_iRecvBufSize, false);
         }
-        else
+
+        // 收包缓冲区剩余的空间，缓冲区中最多只残留一个不完整的包，所以这里肯定还有空间
+        iov[iovcnt].iov_base = pConn->precvChunk + m_iLenMsgHeader + pConn->irecvChunkLen;
+        iov[iovcnt].iov_len = m_iRecvBufSize - pConn->irecvChunkLen;
+        ++iovcnt;
+
+        reco = recvproc(pConn, iov, iovcnt);
+
+        // 错误已经处理过（ET 模式下也包括读到 EAGAIN），此处直接返回
+        if (reco <= 0)
         {
-            // 包头依然不完整，继续接受
-            // pConn->curStat = _PKG_HD_RECVING;         // 实际不需要
-            // 待接收内存向后移动
-            pConn->precvbuf = pConn->precvbuf + reco;
-            // 需要接受的内存长度减少，保证先收到完整包头
-            pConn->irecvlen = pConn->irecvlen - reco;
+            // C1M 模式下，刚为这次读分配的收包缓冲区没有收到数据，还回去
+            if (m_c1mMode == 1 && pConn->irecvChunkLen == 0 && pConn->precvChunk != NULL)
+            {
+                CMemory::GetInstance()->FreeMemory(pConn->precvChunk);
+                pConn->precvChunk = NULL;
+            }
+            return;
         }
-    }
-    // 包头刚好收完，准备接收包体
-    else if (pConn->curStat == _PKG_BD_INIT)
-    {
-        // 恰好收到整个包体
-        if (reco == pConn->irecvlen)
+
+        // 先补齐正在接收的大包
+        if (pConn->precvMemPointer != NULL)
         {
-            // 收到的宽度等于要收的宽度，包体也收完整了
-            if (m_floodAkEnable == 1)
+            if ((size_t)reco < pConn->irecvlen)
             {
-                // Flood攻击检测是否开启
-                isflood = TestFlood(pConn);
+                // 大包还没收完整，继续收
+                pConn->precvbuf = pConn->precvbuf + reco;
+                pConn->irecvlen = pConn->irecvlen - reco;
+                continue;
             }
 
-            // 直接准备处理
-            ngx_wait_request_handler_proc_plast(pConn, isflood);
-        }
-        else
-        {
-            // 收到的宽度小于要收的宽度
-            pConn->curStat = _PKG_BD_RECVING;
-            pConn->precvbuf = pConn->precvbuf + reco;
-            pConn->irecvlen = pConn->irecvlen - reco;
-        }
-    }
-    else if (pConn->curStat == _PKG_BD_RECVING)
-    {
-        // 接收包体中，包体不完整，继续接收中
-        if (pConn->irecvlen == reco)
-        {
-            // 包体收完整了
+            // 大包收完整了，多出来的数据在收包缓冲区里
+            reco = reco - pConn->irecvlen;
+
             if (m_floodAkEnable == 1)
             {
                 // Flood攻击检测是否开启
@@ -236,152 +220,192 @@ ssize_t CSocekt::recvproc(lpngx_connection_t pConn, char *buff, ssize_t buflen)
 
             ngx_wait_request_handler_proc_plast(pConn, isflood);
         }
-        else
+
+        if (isflood == false && reco > 0)
         {
-            // 包体没收完整，继续收
-            pConn->precvbuf = pConn->precvbuf + reco;
-            pConn->irecvlen = pConn->irecvlen - reco;
+            // 收包缓冲区中有新数据，拆出其中所有完整的包
+            pConn->irecvChunkLen = pConn->irecvChunkLen + reco;
+            ngx_wait_request_handler_proc_p1(pConn, isflood);
         }
-    } // end if(c->curStat == _PKG_HD_INIT)
 
-    // flood 攻击
-    if (isflood == true)
-    {
-        // 客户端flood服务器，则直接把客户端踢掉
-        // ngx_log_stderr(errno,"发现客户端flood，干掉该客户端!");
-        zdClosesocketProc(pConn);
-    }
+        // flood 攻击
+        if (isflood == true)
+        {
+            // 客户端flood服务器，则直接把客户端踢掉
+            // ngx_log_stderr(errno,"发现客户端flood，干掉该客户端!");
+            zdClosesocketProc(pConn);
+            return;
+        }
+
+    } while (m_epollET == 1);
 
     return;
 }
 
 /***************************************************************
- *  @brief     处理收到的完整的数据包包头，将消息头和包头信息写入 TCP 连接中的成员变量
- *  @param     pConn    包头来源的 TCP 连接
+ *  @brief     从收包缓冲区中拆出所有完整的数据包，交给线程池处理
+ *  @param     pConn    数据来源的 TCP 连接
  *  @param     isflood    是否 flood 攻击
- *  @note      专门处理收到完整包头，是数据处理第一步，后续有专门处理完整包的函数
+ *  @note      完整的包原地不动，一起作为一条消息交给线程池；最后剩下的半个包留在缓冲区开头等待后续数据；
+ *             若剩下的包比整个收包缓冲区还大，则单独分配内存，后续包体直接收到那块内存中
  **************************************************************/
 void CSocekt::ngx_wait_request_handler_proc_p1(lpngx_connection_t pConn, bool &isflood)
 {
     CMemory *p_memory = CMemory::GetInstance();
 
-    // 初始化一个包头变量
-    LPCOMM_PKG_HEADER pPkgHeader;
-    // 将已收到的包头信息拷贝出来
-    pPkgHeader = (LPCOMM_PKG_HEADER)pConn->dataHeadInfo; // 正好收到包头时，包头信息肯定是在dataHeadInfo里；
-
+    // 收包缓冲区中数据的起始位置
+    char *pData = pConn->precvChunk + m_iLenMsgHeader;
+    // 已拆出的完整包的总长度，完整包连续存放在缓冲区开头
+    size_t iDataLen = 0;
+    // 已拆出的完整包个数
+    unsigned int iPkgCount = 0;
+    // 缓冲区中还未拆的数据长度
+    size_t iLeft;
+
+    // 包头，缓冲区中的包头不一定对齐，拷贝出来再用
+    COMM_PKG_HEADER pkgHeader;
     // 临时变量，保存数据包总长度
     unsigned short e_pkgLen;
 
-    // 注意这里网络序转本机序，所有传输到网络上的2字节数据，都要用htons()转成网络序，所有从网络上收到的2字节数据，都要用ntohs()转成本机序
-    // ntohs/htons的目的就是保证不同操作系统数据之间收发的正确性，【不管客户端/服务器是什么操作系统，发送的数字是多少，收到的就是多少】
-    // 不明白的同学，直接百度搜索"网络字节序" "主机字节序" "c++ 大端" "c++ 小端"
+    while (true)
+    {
+        iLeft = pConn->irecvChunkLen - iDataLen;
 
-    // 网络序转换为本机字节序
-    e_pkgLen = ntohs(pPkgHeader->pkgLen);
+        // 包头还没收完整
+        if (iLeft < m_iLenPkgHeader)
+        {
+            pConn->curStat = (iLeft == 0) ? _PKG_HD_INIT : _PKG_HD_RECVING;
+            break;
+        }
 
-    // 判断是否存在恶意包或者错误包
+        memcpy(&pkgHeader, pData + iDataLen, m_iLenPkgHeader);
 
-    // 包总长小于包头长度
-    if (e_pkgLen < m_iLenPkgHeader)
-    {
-        // 伪造包/或者包错误，否则整个包长怎么可能比包头还小
-        // 报文总长度 < 包头长度，认定非法用户，废包
-        // 状态和接收位置都复原，这些值都有必要，因为有可能在其他状态比如_PKG_HD_RECVING状态调用这个函数
-
-        // 非法数据包，恢复原状态，进行下一次读取
-
-        // 重置接收数据状态
-        pConn->curStat = _PKG_HD_INIT;
-        // 保存读取数据内存从包头开始
-        pConn->precvbuf = pConn->dataHeadInfo;
-        // 期待读取长度为包头长度
-        pConn->irecvlen = m_iLenPkgHeader;
-    }
-    // 包长超过最大规定长度，判断为恶意包
-    else if (e_pkgLen > (_PKG_MAX_LENGTH - 1000))
-    {
-        // 恶意包，太大，认定非法用户，废包【包头中说这个包总长度这么大，这不行】
-        // 状态和接收位置都复原，这些值都有必要，因为有可能在其他状态比如_PKG_HD_RECVING状态调用这个函数
+        // 网络序转换为本机字节序
+        e_pkgLen = ntohs(pkgHeader.pkgLen);
 
-        // 恢复状态
-        pConn->curStat = _PKG_HD_INIT;
-        pConn->precvbuf = pConn->dataHeadInfo;
-        pConn->irecvlen = m_iLenPkgHeader;
-    }
-    // 包长符合要求，判断为正常包，开始处理包头
-    else
-    {
-        // 我现在要分配内存开始收包体，因为包体长度并不是固定的，所以内存肯定要new出来；
-
-        // 动态分配指定长度的内存，用来接收包体，分配内存长度为 消息头长度  + 包头长度 + 包体长度
-        char *pTmpBuffer = (char *)p_memory->AllocMemory(m_iLenMsgHeader + e_pkgLen, false);
-        // 将得到的内存空间指向 TCP 连接中待接收首地址
-        pConn->precvMemPointer = pTmpBuffer;
+        // 包总长小于包头长度，或者超过最大规定长度，判断为恶意包或者错误包
+        if (e_pkgLen < m_iLenPkgHeader || e_pkgLen > (_PKG_MAX_LENGTH - 1000))
+        {
+            // 非法数据包，丢掉这个包头，后面的数据挪上来重新当作包头解析，保证完整包始终连续存放
+            memmove(pData + iDataLen, pData + iDataLen + m_iLenPkgHeader, iLeft - m_iLenPkgHeader);
+            pConn->irecvChunkLen = pConn->irecvChunkLen - m_iLenPkgHeader;
+            continue;
+        }
 
-        // 写入消息头内容
+        // 包还没收完整
+        if (e_pkgLen > iLeft)
+        {
+            // 正好收到完整包头，还没有包体
+            pConn->curStat = (iLeft == m_iLenPkgHeader) ? _PKG_BD_INIT : _PKG_BD_RECVING;
 
-        // 初始化一个消息头指针
-        LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pTmpBuffer;
-        ptmpMsgHeader->pConn = pConn;
-        // 保存收到包时的连接序号
-        ptmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
+            if (e_pkgLen > (size_t)m_iRecvBufSize)
+            {
+                // 整个收包缓冲区都放不下这个包，单独分配内存，分配内存长度为 消息头长度  + 包头长度 + 包体长度
+                char *pTmpBuffer = (char *)p_memory->AllocMemory(m_iLenMsgHeader + e_pkgLen, false);
+                pConn->precvMemPointer = pTmpBuffer;
 
-        // 写入包头内容
+                // 把已收到的部分拷贝过去，后续数据直接收到包的剩余位置
+                memcpy(pTmpBuffer + m_iLenMsgHeader, pData + iDataLen, iLeft);
+                pConn->precvbuf = pTmpBuffer + m_iLenMsgHeader + iLeft;
+                pConn->irecvlen = e_pkgLen - iLeft;
 
-        // 指针移动到写完消息头后的下一个可写位置
-        pTmpBuffer += m_iLenMsgHeader;
-        // 将包头信息拷贝到此处
-        memcpy(pTmpBuffer, pPkgHeader, m_iLenPkgHeader);
+                // 收包缓冲区中只留下完整的包
+                pConn->irecvChunkLen = iDataLen;
+            }
+            break;
+        }
 
-        // 包总长度等于包头长度
-        if (e_pkgLen == m_iLenPkgHeader)
+        // 收到完整包
+        if (m_floodAkEnable == 1)
         {
-            // 该报文只有包头无包体【我们允许一个包只有包头，没有包体】
-            // 收到完整包，直接进行后续处理
-
-            // 开启 flood 检测
-            if (m_floodAkEnable == 1)
+            // Flood攻击检测是否开启
+            isflood = TestFlood(pConn);
+            if (isflood == true)
             {
-                isflood = TestFlood(pConn);
+                // 对于有攻击倾向的恶人，他的包直接丢掉，连接由调用者关闭
+                return;
             }
-
-            ngx_wait_request_handler_proc_plast(pConn, isflood);
         }
-        else
-        {
-            // 仅收到完整包头，还未接收包体
 
-            // 改变收包状态，开始接受包体
-            pConn->curStat = _PKG_BD_INIT;
-            // 待接收位置移动到包头末尾，开始接受包体
-            pConn->precvbuf = pTmpBuffer + m_iLenPkgHeader;
-            // 期待接收数据长度修改为包体长度
-            pConn->irecvlen = e_pkgLen - m_iLenPkgHeader;
+        iDataLen = iDataLen + e_pkgLen;
+        ++iPkgCount;
+    }
+
+    if (iPkgCount > 0)
+    {
+        ngx_wait_request_handler_proc_batch(pConn, iDataLen, iPkgCount);
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     把收包缓冲区开头的若干个完整包作为一条消息放入消息队列，剩余数据挪到缓冲区开头
+ *  @param     pConn    数据包来源的 TCP 连接
+ *  @param     iDataLen    完整包的总长度
+ *  @param     iPkgCount    完整包的个数
+ *  @note      完整包占了缓冲区的一大半时，整块缓冲区直接交给线程池，连接换一块新的缓冲区；
+ *             否则只把完整包拷贝出来，避免为几个小包占用整块缓冲区；
+ *             C1M 模式下没有剩下半个包时连接不再留着收包缓冲区，下次有数据到来时再分配
+ **************************************************************/
+void CSocekt::ngx_wait_request_handler_proc_batch(lpngx_connection_t pConn, size_t iDataLen, unsigned int iPkgCount)
+{
+    CMemory *p_memory = CMemory::GetInstance();
+
+    char *pData = pConn->precvChunk + m_iLenMsgHeader;
+    // 完整包后面剩下的半个包的长度
+    size_t iRest = pConn->irecvChunkLen - iDataLen;
+    // 交给线程池的消息
+    char *pMsgBuf;
+
+    if (iDataLen * 2 >= (size_t)m_iRecvBufSize || (m_c1mMode == 1 && iRest == 0))
+    {
+        pMsgBuf = pConn->precvChunk;
+        pConn->precvChunk = NULL;
+        if (m_c1mMode == 0 || iRest > 0)
+        {
+            pConn->precvChunk = (char *)p_memory->AllocMemory(m_iLenMsgHeader + m_iRecvBufSize, false);
+            memcpy(pConn->precvChunk + m_iLenMsgHeader, pData + iDataLen, iRest);
         }
+    }
+    else
+    {
+        pMsgBuf = (char *)p_memory->AllocMemory(m_iLenMsgHeader + iDataLen, false);
+        memcpy(pMsgBuf + m_iLenMsgHeader, pData, iDataLen);
+        memmove(pData, pData + iDataLen, iRest);
+    }
+    pConn->irecvChunkLen = iRest;
 
-    } // end if(e_pkgLen < m_iLenPkgHeader)
+    // 写入消息头内容
+    LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+    ptmpMsgHeader->pConn = pConn;
+    // 保存收到包时的连接序号
+    ptmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
+    ptmpMsgHeader->iPkgCount = iPkgCount;
+
+    // 放入消息队列等候下一步处理，专门有线程处理收到的数据包
+    g_threadpool.inMsgRecvQueueAndSignal(pMsgBuf);
 
     return;
 }
 
 /***************************************************************
- *  @brief     处理收到的完整的数据包，将数据包放入指定队列，恢复收包状态
+ *  @brief     处理收到的完整的大包，将数据包放入指定队列，恢复收包状态
  *  @param     pConn    数据包来源的 TCP 连接
  *  @param     isflood    是否 flood 攻击
- *  @note      调用示例
  **************************************************************/
 void CSocekt::ngx_wait_request_handler_proc_plast(lpngx_connection_t pConn, bool &isflood)
 {
-    // 把这段内存放到消息队列中来；
-    // int irmqc = 0;  //消息队列当前信息数量
-    // inMsgRecvQueue(c->precvMemPointer,irmqc); //返回消息队列当前信息数量irmqc，是调用本函数后的消息队列中消息数量
-    // 激发线程池中的某个线程来处理业务逻辑
-    // g_threadpool.Call(irmqc);
-
     // 是否 flood 攻击
     if (isflood == false)
     {
+        // 写入消息头内容
+        LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pConn->precvMemPointer;
+        ptmpMsgHeader->pConn = pConn;
+        // 保存收到包时的连接序号
+        ptmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
+        ptmpMsgHeader->iPkgCount = 1;
+
         // 放入消息队列等候下一步处理，专门有线程处理收到的数据包
         g_threadpool.inMsgRecvQueueAndSignal(pConn->precvMemPointer);
     }
@@ -398,10 +422,9 @@ void CSocekt::ngx_wait_request_handler_proc_plast(lpngx_connection_t pConn, bool
     pConn->precvMemPointer = NULL;
     // 收包状态机的状态恢复为原始态，为收下一个包做准备
     pConn->curStat = _PKG_HD_INIT;
-    // 设置好收包的位置
-    pConn->precvbuf = pConn->dataHeadInfo;
-    // 设置好要接收数据的大小
-    pConn->irecvlen = m_iLenPkgHeader;
+    // 大包相关的收包位置不再使用
+    pConn->precvbuf = NULL;
+    pConn->irecvlen = 0;
 
     return;
 }
@@ -422,20 +445,28 @@ void CSocekt::threadRecvProcFunc(char *pMsgBuf)
  *  @param     buff    待发送信息
  *  @param     size    发送信息长度
  *  @return    成功发送的字节数
+ *  @note      连接开启了零拷贝并且 size 不小于 Sock_ZeroCopyThreshold 时使用 MSG_ZEROCOPY，之后要用 sendMemFree() 释放内存
  **************************************************************/
 ssize_t CSocekt::sendproc(lpngx_connection_t c, char *buff, ssize_t size)
 {
     // 这里参考借鉴了官方nginx函数ngx_unix_send()的写法
     ssize_t n;
+    // 是否零拷贝发送
+    int flags = (c->ifZeroCopy == 1 && size >= m_zeroCopyThreshold) ? MSG_ZEROCOPY : 0;
 
     for (;;)
     {
         // 调用系统函数发送数据
-        n = send(c->fd, buff, size, 0);
+        n = send(c->fd, buff, size, flags);
 
         // 成功发送部分数据
         if (n > 0)
         {
+            if (flags != 0)
+            {
+                ngx_zerocopy_sent(c);
+            }
+
             // 发送成功一些数据，但发送了多少，我们这里不关心，也不需要再次send
             // 这里有两种情况
             //(1) n == size也就是想发送多少都发送成功了，这表示完全发完毕了
@@ -460,6 +491,13 @@ ssize_t CSocekt::sendproc(lpngx_connection_t c, char *buff, ssize_t size)
             return -1; // 表示发送缓冲区满了
         }
 
+        if (errno == ENOBUFS && flags != 0)
+        {
+            // 未完成的零拷贝通知太多，超出了 socket 的 optmem 限制，这次改用普通方式发送
+            flags = 0;
+            continue;
+        }
+
         if (errno == EINTR)
         {
             // 这个应该也不算错误 ，收到某个信号导致send产生这个错误？
@@ -475,6 +513,84 @@ ssize_t CSocekt::sendproc(lpngx_connection_t c, char *buff, ssize_t size)
     } // end for
 }
 
+/***************************************************************
+ *  @brief     把多段数据用一次系统调用发送出去，用于把同一连接的多个包合并发送
+ *  @param     c    TCP 连接
+ *  @param     iov    待发送的各段数据，每段是一个完整的包
+ *  @param     iovcnt    段数，不超过 IOV_MAX
+ *  @return    >0: 成功发送的总字节数，可能只发出了一部分；0: 对端可能断开；-1: 发送缓冲区满；-2: 其他错误
+ *  @note      返回值和 sendproc() 一致，零拷贝的规则也和 sendproc() 一致，按本次发送的总长度判断
+ **************************************************************/
+ssize_t CSocekt::sendprocv(lpngx_connection_t c, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+    // 是否零拷贝发送
+    int flags = 0;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    if (c->ifZeroCopy == 1)
+    {
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            total += iov[i].iov_len;
+        }
+        if (total >= (size_t)m_zeroCopyThreshold)
+        {
+            flags = MSG_ZEROCOPY;
+        }
+    }
+
+    for (;;)
+    {
+        n = sendmsg(c->fd, &msg, flags);
+
+        // 成功发送部分或全部数据，发了多少由调用者自己根据各段长度去算
+        if (n > 0)
+        {
+            if (flags != 0)
+            {
+                ngx_zerocopy_sent(c);
+            }
+            return n;
+        }
+
+        if (n == 0)
+        {
+            // 和 sendproc() 一样，断开由 recv 那边统一处理
+            return 0;
+        }
+
+        if (errno == EAGAIN)
+        {
+            // 内核缓冲区满，这个不算错误
+            return -1;
+        }
+
+        if (errno == ENOBUFS && flags != 0)
+        {
+            // 未完成的零拷贝通知太多，这次改用普通方式发送
+            flags = 0;
+            continue;
+        }
+
+        if (errno == EINTR)
+        {
+            // 被信号打断，重新发送一次
+            ngx_log_stderr(errno, "CSocekt::sendprocv()中sendmsg()失败.");
+        }
+        else
+        {
+            // 其他错误，等待recv()来统一处理断开
+            return -2;
+        }
+    } // end for
+}
+
 /***************************************************************
  *  @brief     连接的写处理函数
  *  @param     pConn    待处理连接
@@ -482,13 +598,11 @@ ssize_t CSocekt::sendproc(lpngx_connection_t c, char *buff, ssize_t size)
  **************************************************************/
 void CSocekt::ngx_write_request_handler(lpngx_connection_t pConn)
 {
-    // 内存对象
-    CMemory *p_memory = CMemory::GetInstance();
-
     // 这些代码的书写可以参照 void* CSocekt::ServerSendQueueThread(void* threadData)
 
     // 调用函数通过系统函数直接发送
     ssize_t sendsize = sendproc(pConn, pConn->psendbuf, pConn->isendlen);
+    ++m_iSendCallCount;
 
     // 成功发送一部分但不完全发送
     if (sendsize > 0 && sendsize != pConn->isendlen)
@@ -497,20 +611,24 @@ void CSocekt::ngx_write_request_handler(lpngx_connection_t pConn)
         pConn->psendbuf = pConn->psendbuf + sendsize;
         // 待发送长度减少
         pConn->isendlen = pConn->isendlen - sendsize;
-        // 返回
+        // 只发出去一部分说明发送缓冲区又满了，ET 模式下内核会在腾出空间时再给一个边沿，这里不必继续 send 到 EAGAIN
         return;
     }
     // 缓冲区满，一般不会出现
     else if (sendsize == -1)
     {
-        // 这不太可能，可以发送数据时通知我发送数据，我发送时你却通知我发送缓冲区满？
-        ngx_log_stderr(errno, "CSocekt::ngx_write_request_handler()时if(sendsize == -1)成立，这很怪异。");
+        // ET 模式下 ngx_epoll_arm_write() 补发的边沿可能已经过时，等下一个边沿即可
+        if (m_epollET == 0)
+        {
+            // 这不太可能，可以发送数据时通知我发送数据，我发送时你却通知我发送缓冲区满？
+            ngx_log_stderr(errno, "CSocekt::ngx_write_request_handler()时if(sendsize == -1)成立，这很怪异。");
+        }
 
         return;
     }
 
-    // 完成发送
-    if (sendsize > 0 && sendsize == pConn->isendlen)
+    // 完成发送，ET 模式下 EPOLLOUT 常驻，不需要从 epoll 中去掉
+    if (sendsize > 0 && sendsize == pConn->isendlen && m_epollET == 0)
     {
         // 如果是成功的发送完毕数据，则把写事件通知从epoll中干掉吧；其他情况，那就是断线了，等着系统内核把连接从红黑树中干掉即可；
 
@@ -545,15 +663,161 @@ void CSocekt::ngx_write_request_handler(lpngx_connection_t pConn)
 
     // 2019.4.2调整成新顺序
 
+    // 剩下的部分发完，这个包才算完整发出
+    if (sendsize > 0)
+    {
+        ++m_iSendPkgCount;
+    }
+
     // 释放内存
-    p_memory->FreeMemory(pConn->psendMemPointer);
+    sendMemFree(pConn, pConn->psendMemPointer);
     // 发送数据指针置空
     pConn->psendMemPointer = NULL;
-    // 缓冲区满变量减少
-    --pConn->iThrowsendCount;
+    // 缓冲区满变量减少，期间又有新数据入队的话，把连接放回发送就绪列表，让发送线程接着发
+    bool ifReady = false;
+    {
+        CLock lock(&pConn->sendMutex);
+        --pConn->iThrowsendCount;
+        if (pConn->psendQueueHead != NULL && pConn->ifSendReady == 0)
+        {
+            pConn->ifSendReady = 1;
+            ifReady = true;
+        }
+    }
+
+    if (ifReady)
+    {
+        inSendReadyList(pConn);
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     释放一条已经发送完的消息
+ *  @param     pConn    TCP 连接
+ *  @param     pMemPointer    消息的内存首地址，消息头+包头+包体
+ *  @note      开启零拷贝的连接上，只要还有零拷贝发送没等到完成通知，就挂到最后一次零拷贝发送的后面，
+ *             等它以及它之前的发送全部完成后再释放；这条消息即使本身没有零拷贝发送，也可能有一部分已经被零拷贝发出
+ **************************************************************/
+void CSocekt::sendMemFree(lpngx_connection_t pConn, char *pMemPointer)
+{
+    if (pConn->ifZeroCopy == 1)
+    {
+        CLock lock(&pConn->cold->zcMutex);
+        if (!pConn->cold->zcPendingList.empty())
+        {
+            STRUC_ZC_PENDING item = pConn->cold->zcPendingList.back();
+            item.pMemPointer = pMemPointer;
+            pConn->cold->zcPendingList.push_back(item);
+            return;
+        }
+    }
+
+    // 所有零拷贝发送都已经完成，直接释放
+    CMemory::GetInstance()->FreeMemory(pMemPointer);
+
+    return;
+}
 
-    if (sem_post(&m_semEventSendQueue) == -1)
-        ngx_log_stderr(0, "CSocekt::ngx_write_request_handler()中sem_post(&m_semEventSendQueue)失败.");
+/***************************************************************
+ *  @brief     登记一次成功的零拷贝发送，发出了至少一个字节的 MSG_ZEROCOPY 发送都会让内核的序号 +1
+ *  @param     pConn    TCP 连接
+ **************************************************************/
+void CSocekt::ngx_zerocopy_sent(lpngx_connection_t pConn)
+{
+    STRUC_ZC_PENDING item;
+
+    CLock lock(&pConn->cold->zcMutex);
+    item.id = pConn->cold->izcNextId++;
+    item.done = 0;
+    item.pMemPointer = NULL;
+    pConn->cold->zcPendingList.push_back(item);
+    ++m_iZeroCopySendCount;
 
     return;
 }
+
+/***************************************************************
+ *  @brief     收取 socket 错误队列中的零拷贝发送完成通知，释放已经完成的内存
+ *  @param     pConn    TCP 连接
+ *  @return    收到的通知个数
+ *  @note      由 epoll 线程在收到 EPOLLERR 时调用；通知报告的是一段序号 [ee_info, ee_data]，
+ *             不保证按顺序到达，所以先标记，再从链表头部把连续完成的部分释放掉
+ **************************************************************/
+int CSocekt::ngx_zerocopy_reap(lpngx_connection_t pConn)
+{
+    // 收到的通知个数
+    int count = 0;
+    // 控制信息缓冲区
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    uint32_t lo, hi;
+    std::list<STRUC_ZC_PENDING>::iterator pos;
+
+    CMemory *p_memory = CMemory::GetInstance();
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // 错误队列空了
+        if (recvmsg(pConn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            ++count;
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                // 内核实际还是拷贝了数据，比如本机回环或者网卡不支持，这种情况多的话零拷贝就没有意义了
+                m_iZeroCopyCopiedCount += (int64_t)(hi - lo) + 1;
+            }
+
+            CLock lock(&pConn->cold->zcMutex);
+            for (pos = pConn->cold->zcPendingList.begin(); pos != pConn->cold->zcPendingList.end(); ++pos)
+            {
+                // 序号会回绕，用差值判断是否在 [lo, hi] 之间
+                if ((uint32_t)(pos->id - lo) <= (uint32_t)(hi - lo))
+                {
+                    pos->done = 1;
+                }
+            }
+        }
+    }
+
+    if (count > 0)
+    {
+        CLock lock(&pConn->cold->zcMutex);
+        while (!pConn->cold->zcPendingList.empty() && pConn->cold->zcPendingList.front().done == 1)
+        {
+            if (pConn->cold->zcPendingList.front().pMemPointer != NULL)
+            {
+                p_memory->FreeMemory(pConn->cold->zcPendingList.front().pMemPointer);
+            }
+            pConn->cold->zcPendingList.pop_front();
+        }
+    }
+
+    return count;
+}
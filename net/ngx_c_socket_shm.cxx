@@ -0,0 +1,396 @@
+﻿// 本文件存放共享内存通道相关函数的实现
+// 同一台机器上的客户端连上 ShmListenPath，用 SCM_RIGHTS 把一块共享内存（memfd）和两个 eventfd 交给服务器，
+// 共享内存中有两个单生产者单消费者的环，包格式和 TCP 上一样（包头+包体）；
+// 客户端写完包后，只有服务器准备睡眠时才写 eventfd 唤醒 epoll，应答也一样，收发数据不需要任何 socket 系统调用
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>    //uintptr_t
+#include <unistd.h>    //close
+#include <errno.h>     //errno
+#include <fcntl.h>     //fcntl
+#include <pthread.h>   //多线程
+#include <sys/mman.h>  //mmap
+#include <sys/stat.h>  //fstat
+#include <arpa/inet.h>
+
+#include "ngx_c_conf.h"
+#include "ngx_macro.h"
+#include "ngx_global.h"
+#include "ngx_func.h"
+#include "ngx_c_socket.h"
+#include "ngx_c_memory.h"
+#include "ngx_c_lockmutex.h"
+
+/***************************************************************
+ *  @brief     共享内存通道握手连接的读处理函数
+ *  @param     pConn    握手用的 AF_UNIX 连接
+ *  @note      握手完成之前收到的是共享内存和 eventfd；握手之后客户端不会再发数据，可读就说明客户端断开了
+ **************************************************************/
+void CSocekt::ngx_shm_sock_handler(lpngx_connection_t pConn)
+{
+    if (pConn->shm == NULL)
+    {
+        if (ngx_shm_attach(pConn) == false)
+        {
+            zdClosesocketProc(pConn);
+        }
+        return;
+    }
+
+    // 多余的数据一律读掉
+    char buf[64];
+    ssize_t n;
+    while ((n = recv(pConn->fd, buf, sizeof(buf), 0)) > 0)
+        ;
+
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        ngx_shm_close(pConn->shm);
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     共享内存通道的握手：收下共享内存和两个 eventfd，检查共享内存的格式，为 eventfd 分配连接加入 epoll，回一个字节的确认
+ *  @param     pConn    握手用的 AF_UNIX 连接
+ *  @return    握手失败返回 false，由调用者关闭连接；还没收到握手消息也返回 true
+ *  @note      三个句柄的顺序：共享内存、客户端写服务器读的 eventfd、服务器写客户端读的 eventfd
+ **************************************************************/
+bool CSocekt::ngx_shm_attach(lpngx_connection_t pConn)
+{
+    char flag;
+    struct iovec iov;
+    struct msghdr msg;
+    union
+    {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[3] = {-1, -1, -1};
+    int nfds = 0;
+
+    iov.iov_base = &flag;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    ssize_t n = recvmsg(pConn->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return true;
+    }
+    if (n <= 0)
+    {
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < cnt; ++i)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (nfds < 3)
+                {
+                    fds[nfds++] = fd;
+                }
+                else
+                {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    ngx_shm_area_t *area = (ngx_shm_area_t *)MAP_FAILED;
+    size_t areaSize = 0;
+    struct stat st;
+    int seals;
+    uint32_t ringSize = 0;
+    lpngx_connection_t pEventConn = NULL;
+
+    if (nfds != 3 || (msg.msg_flags & MSG_CTRUNC) != 0)
+    {
+        ngx_log_stderr(0, "CSocekt::ngx_shm_attach()中没有收到共享内存和eventfd.");
+        goto lblfail;
+    }
+
+    // 客户端留着 memfd，必须封住大小，否则映射之后客户端把它截短，服务器访问数据区时会收到 SIGBUS
+    seals = fcntl(fds[0], F_GET_SEALS);
+    if (seals == -1 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW))
+    {
+        ngx_log_stderr(0, "CSocekt::ngx_shm_attach()中共享内存没有封住大小(F_SEAL_SHRINK|F_SEAL_GROW).");
+        goto lblfail;
+    }
+
+    // 映射之后句柄就没用了
+    if (fstat(fds[0], &st) == 0 && st.st_size >= (off_t)sizeof(ngx_shm_area_t))
+    {
+        areaSize = st.st_size;
+        area = (ngx_shm_area_t *)mmap(NULL, areaSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    close(fds[0]);
+    fds[0] = -1;
+    if (area == MAP_FAILED)
+    {
+        ngx_log_stderr(errno, "CSocekt::ngx_shm_attach()中映射共享内存失败.");
+        goto lblfail;
+    }
+
+    // 环的大小是客户端定的，必须检查，否则对环大小取模、计算数据区位置都会越界；
+    // 只读一次存到局部变量，检查的和以后用的是同一个值，客户端之后再改共享内存也没用
+    ringSize = ((volatile ngx_shm_area_t *)area)->ringSize;
+    if (area->magic != NGX_SHM_MAGIC || area->version != NGX_SHM_VERSION ||
+        ringSize < NGX_SHM_RING_MIN || ringSize > NGX_SHM_RING_MAX || (ringSize & (ringSize - 1)) != 0 ||
+        areaSize < ngx_shm_area_size(ringSize))
+    {
+        ngx_log_stderr(0, "CSocekt::ngx_shm_attach()中共享内存格式不对.");
+        goto lblfail;
+    }
+
+    // 服务器读这个 eventfd，必须是非阻塞的
+    if (setnonblocking(fds[1]) == false)
+    {
+        goto lblfail;
+    }
+
+    pEventConn = ngx_get_connection(fds[1]);
+    if (pEventConn == NULL)
+    {
+        goto lblfail;
+    }
+    fds[1] = -1;
+
+    {
+        lpngx_shm_channel_t pChannel = new ngx_shm_channel_t;
+        pChannel->area = area;
+        pChannel->areaSize = areaSize;
+        pChannel->ringSize = ringSize;
+        pChannel->iBroken = 0;
+        pChannel->notifyFd = fds[2];
+        pChannel->pSockConn = pConn;
+        pChannel->pEventConn = pEventConn;
+        pConn->shm = pChannel;
+        pEventConn->shm = pChannel;
+        pEventConn->listening = pConn->listening;
+        pEventConn->rhandler = &CSocekt::ngx_shm_recv_handler;
+        ++m_iShmChannelCount;
+
+        if (ngx_epoll_oper_event(pEventConn->fd, EPOLL_CTL_ADD, EPOLLIN, 0, pEventConn) == -1)
+        {
+            ngx_shm_close(pChannel);
+            return true;
+        }
+    }
+
+    // 回一个字节，客户端收到后才开始往环里写
+    flag = 0;
+    if (send(pConn->fd, &flag, 1, MSG_NOSIGNAL) != 1)
+    {
+        ngx_shm_close(pConn->shm);
+    }
+
+    return true;
+
+lblfail:
+    if (area != MAP_FAILED)
+    {
+        munmap(area, areaSize);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+        }
+    }
+    return false;
+}
+
+/***************************************************************
+ *  @brief     客户端写 eventfd 通知有数据时的处理函数，把环中所有完整的包分批交给线程池
+ *  @param     pConn    客户端 eventfd 对应的连接
+ *  @note      每条消息最多装 m_iRecvBufSize 字节左右的包，让多个处理线程可以并行；
+ *             读空之后标记准备睡眠再检查一次，这期间客户端新写的数据不会漏掉
+ **************************************************************/
+void CSocekt::ngx_shm_recv_handler(lpngx_connection_t pConn)
+{
+    lpngx_shm_channel_t pChannel = pConn->shm;
+    if (pChannel == NULL)
+    {
+        return;
+    }
+    ngx_shm_area_t *area = pChannel->area;
+    uint32_t ringSize = pChannel->ringSize;
+
+    uint64_t counter;
+    if (read(pConn->fd, &counter, sizeof(counter)) == sizeof(counter))
+    {
+        ++m_iShmWakeupCount;
+    }
+
+    if (pChannel->iBroken.load(std::memory_order_relaxed) != 0)
+    {
+        ngx_log_stderr(0, "CSocekt::ngx_shm_recv_handler()中应答环的读位置不对，关闭通道.");
+        ngx_shm_close(pChannel);
+        return;
+    }
+
+    CMemory *p_memory = CMemory::GetInstance();
+    // 包头，环中的包头不一定对齐，拷贝出来再用
+    COMM_PKG_HEADER pkgHeader;
+    unsigned short e_pkgLen;
+    uint32_t used, total;
+    unsigned int iPkgCount;
+
+    do
+    {
+        used = ngx_shm_ring_used(area, NGX_SHM_RING_C2S);
+        if (used > ringSize)
+        {
+            // 读写位置被写坏了，这个通道不能再用
+            ngx_log_stderr(0, "CSocekt::ngx_shm_recv_handler()中共享内存的读写位置不对，关闭通道.");
+            ngx_shm_close(pChannel);
+            return;
+        }
+
+        while (used >= m_iLenPkgHeader)
+        {
+            // 拆出一批完整的包
+            total = 0;
+            iPkgCount = 0;
+            while (used - total >= m_iLenPkgHeader && total < (uint32_t)m_iRecvBufSize)
+            {
+                ngx_shm_ring_peek(area, ringSize, NGX_SHM_RING_C2S, total, &pkgHeader, m_iLenPkgHeader);
+                e_pkgLen = ntohs(pkgHeader.pkgLen);
+                if (e_pkgLen < m_iLenPkgHeader || e_pkgLen > (_PKG_MAX_LENGTH - 1000))
+                {
+                    // 环里的数据是连续的包，包头错了后边就没法再对齐
+                    ngx_log_stderr(0, "CSocekt::ngx_shm_recv_handler()中收到非法包头，关闭通道.");
+                    ngx_shm_close(pChannel);
+                    return;
+                }
+                if (used - total < e_pkgLen)
+                {
+                    break;
+                }
+                total += e_pkgLen;
+                ++iPkgCount;
+            }
+
+            if (iPkgCount == 0)
+            {
+                break;
+            }
+
+            char *pMsgBuf = (char *)p_memory->AllocMemory(m_iLenMsgHeader + total, false);
+            ngx_shm_ring_peek(area, ringSize, NGX_SHM_RING_C2S, 0, pMsgBuf + m_iLenMsgHeader, total);
+            ngx_shm_ring_consume(area, NGX_SHM_RING_C2S, total);
+            used -= total;
+            m_iShmPkgCount += iPkgCount;
+
+            LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+            ptmpMsgHeader->pConn = pConn;
+            ptmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
+            ptmpMsgHeader->iPkgCount = iPkgCount;
+            ptmpMsgHeader->pNext = NULL;
+
+            // 放入消息队列等候下一步处理，专门有线程处理收到的数据包
+            g_threadpool.inMsgRecvQueueAndSignal(pMsgBuf);
+        }
+    } while (ngx_shm_ring_prepare_wait(area, NGX_SHM_RING_C2S) == false);
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     共享内存通道的应答直接写进服务器发给客户端的环里，客户端准备睡眠时再写 eventfd 唤醒它
+ *  @param     pConn    客户端 eventfd 对应的连接
+ *  @param     psendbuf    待发送消息
+ *  @note      几个处理线程可能同时应答，用 sendMutex 保证环只有一个生产者；环满了说明客户端不收数据，丢掉这个包；
+ *             环的读位置被客户端写坏了就标记通道，之后的应答都丢掉，等 epoll 线程关闭通道
+ **************************************************************/
+void CSocekt::msgSendShm(lpngx_connection_t pConn, char *psendbuf)
+{
+    LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)psendbuf;
+    LPCOMM_PKG_HEADER pPkgHeader = (LPCOMM_PKG_HEADER)(psendbuf + m_iLenMsgHeader);
+    lpngx_shm_channel_t pChannel = NULL;
+    bool ifWakeup = false;
+
+    {
+        CLock lock(&pConn->sendMutex);
+
+        // 通道已经关闭的，不用再发
+        if (pConn->iCurrsequence == pMsgHeader->iCurrsequence && pConn->shm != NULL && pConn->shm->iBroken.load(std::memory_order_relaxed) == 0)
+        {
+            pChannel = pConn->shm;
+            int iRet = ngx_shm_ring_write(pChannel->area, pChannel->ringSize, NGX_SHM_RING_S2C, pPkgHeader, ntohs(pPkgHeader->pkgLen));
+            if (iRet == 1)
+            {
+                ++m_iSendPkgCount;
+                ifWakeup = ngx_shm_ring_need_wakeup(pChannel->area, NGX_SHM_RING_S2C);
+            }
+            else
+            {
+                ++m_iDiscardSendPkgCount;
+                if (iRet == -1)
+                {
+                    pChannel->iBroken.store(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    // 通道关闭后要等回收时间过了才释放，这里用 pChannel 是安全的
+    if (ifWakeup)
+    {
+        uint64_t one = 1;
+        if (write(pChannel->notifyFd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        {
+            ngx_log_stderr(errno, "CSocekt::msgSendShm()中write(eventfd)失败.");
+        }
+    }
+
+    CMemory::GetInstance()->FreeMemory(psendbuf);
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     关闭一个共享内存通道的两个连接，只在 epoll 线程中调用
+ *  @param     pChannel    共享内存通道
+ *  @note      共享内存和客户端的 eventfd 等到 eventfd 对应的连接回收时再释放，那时肯定没有处理线程在用了
+ **************************************************************/
+void CSocekt::ngx_shm_close(lpngx_shm_channel_t pChannel)
+{
+    lpngx_connection_t pEventConn = pChannel->pEventConn;
+    lpngx_connection_t pSockConn = pChannel->pSockConn;
+
+    if (pEventConn->fd != -1)
+    {
+        // 客户端手里还有这个 eventfd，只 close() 的话它不会从 epoll 中删掉，要先删
+        ngx_epoll_oper_event(pEventConn->fd, EPOLL_CTL_DEL, 0, 0, pEventConn);
+        // 事件连接不算在线用户，回收时在线用户数会减一，先补上
+        ++m_onlineUserCount;
+        zdClosesocketProc(pEventConn);
+        --m_iShmChannelCount;
+    }
+
+    if (pSockConn->fd != -1)
+    {
+        // 握手连接不负责释放共享内存
+        pSockConn->shm = NULL;
+        zdClosesocketProc(pSockConn);
+    }
+
+    return;
+}
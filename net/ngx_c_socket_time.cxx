@@ -1,5 +1,6 @@
 ﻿
-// 本文件存放和网络中时间相关的函数实现
+// 本文件存放和网络中时间相关的函数实现，包括踢人时钟和定时任务
+// 两者各有一个时间轮，共用 epoll 中的一个 timerfd，timerfd 总是定在两个时间轮中最早可能到期的时刻
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +13,7 @@
 #include <fcntl.h>	   //open
 #include <errno.h>	   //errno
 #include <sys/ioctl.h> //ioctl
+#include <sys/timerfd.h> //timerfd
 // #include <sys/socket.h>
 #include <arpa/inet.h>
 
@@ -23,289 +25,344 @@
 #include "ngx_c_memory.h"
 #include "ngx_c_lockmutex.h"
 
-// 设置踢出时钟(向multimap表中增加内容)，用户三次握手成功连入，然后我们开启了踢人开关【Sock_WaitTimeEnable = 1】，那么本函数被调用；
-
 /***************************************************************
- *  @brief     设置踢人时钟，将指定链接加入到时间队列中
+ *  @brief     设置踢人时钟，将指定链接的节点加入到时间轮中
  *  @param     pConn    TCP 连接
- *  @note      踢人开关开启时，用户三次握手接入服务器后，本函数将会被调用
+ *  @note      踢人开关开启时，用户三次握手接入服务器后，本函数将会被调用；节点就在连接里，不分配内存
  **************************************************************/
 void CSocekt::AddToTimerQueue(lpngx_connection_t pConn)
 {
-	CMemory *p_memory = CMemory::GetInstance();
+	uint64_t futtime = ngx_timer_now_ms() + (uint64_t)m_iWaitTime * 1000;
 
-	time_t futtime = time(NULL);
-	// 检查时间
-	futtime += m_iWaitTime;
+	{
+		// 互斥，访问时间轮
+		CLock lock(&m_timequeueMutex);
 
-	// 互斥，访问时间队列
-	CLock lock(&m_timequeueMutex);
+		pConn->timerNode.data = pConn;
+		m_timerWheel.Add(&pConn->timerNode, futtime);
+	}
 
-	// 初始化消息头
-	LPSTRUC_MSG_HEADER tmpMsgHeader = (LPSTRUC_MSG_HEADER)p_memory->AllocMemory(m_iLenMsgHeader, false);
-	// 将连接赋值到消息头
-	tmpMsgHeader->pConn = pConn;
-	// 消息头序号
-	tmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
-	// 将时间和消息头放入队列
-	m_timerQueuemap.insert(std::make_pair(futtime, tmpMsgHeader));
-	// 时间队列大小增加
-	m_cur_size_++;
+	ngx_timerfd_arm(futtime);
 
-	// 将计时队列头部时间值保存到m_timer_value_里
-	m_timer_value_ = GetEarliestTime();
+	return;
+}
+
+/***************************************************************
+ *  @brief     把时间轮中到期的连接全部取出来
+ *  @param     cur_msec    当前时间，单位毫秒
+ *  @param     expired    到期的连接和它们此刻的序号追加在这里
+ *  @note      调用者负责互斥；不要求超时就踢出的，节点马上重新加入，下次到期时再检查心跳
+ **************************************************************/
+void CSocekt::GetOverTimeTimer(uint64_t cur_msec, std::vector<STRUC_TIMER_EXPIRED> &expired)
+{
+	STRUC_TIMER_EXPIRED item;
+
+	m_timerWheel.Expire(cur_msec, m_timerExpired);
+
+	for (size_t i = 0; i < m_timerExpired.size(); ++i)
+	{
+		item.pConn = (lpngx_connection_t)m_timerExpired[i]->data;
+		item.iCurrsequence = item.pConn->iCurrsequence;
+		expired.push_back(item);
+
+		// 超时是否踢出
+		if (/*m_ifkickTimeCount == 1 && */ m_ifTimeOutKick != 1)
+		{
+			// 因为下次超时的时间我们也依然要判断，所以还要把这个节点加回来
+			m_timerWheel.Add(m_timerExpired[i], cur_msec + (uint64_t)m_iWaitTime * 1000);
+		}
+	}
+	m_timerExpired.clear();
 
 	return;
 }
 
 /***************************************************************
- *  @brief     取出时间队列中最早的时间
- *  @return    时间
- *  @note      因为时间队列按序放入，因此第一个元素的时间一定是最早的，本函数不互斥，由调用者负责
+ *  @brief     将指定的 TCP 连接从时间轮中移除
+ *  @param     pConn    指定链接
  **************************************************************/
-time_t CSocekt::GetEarliestTime()
+void CSocekt::DeleteFromTimerQueue(lpngx_connection_t pConn)
 {
-	std::multimap<time_t, LPSTRUC_MSG_HEADER>::iterator pos;
-	pos = m_timerQueuemap.begin();
-	return pos->first;
+	// 上锁，访问时间轮
+	CLock lock(&m_timequeueMutex);
+
+	m_timerWheel.Del(&pConn->timerNode);
+
+	return;
 }
 
-// 从m_timeQueuemap移除最早的时间，并把最早这个时间所在的项的值所对应的指针 返回，调用者负责互斥，所以本函数不用互斥，
+/***************************************************************
+ *  @brief     清空时间轮中的全部链接
+ **************************************************************/
+void CSocekt::clearAllFromTimerQueue()
+{
+	CLock lock(&m_timequeueMutex);
+
+	m_timerWheel.Clear();
+}
 
 /***************************************************************
- *  @brief     移除时间队列中最早的时间，即队首元素，并将对应的消息头返回
- *  @return    最早的消息头
- *  @note      由上层函数负责互斥
+ *  @brief     检测心跳包是否超时
+ *  @param     pConn    到期的连接
+ *  @param     iCurrsequence    到期时连接的序号
+ *  @param     cur_time    当前时间
  **************************************************************/
-LPSTRUC_MSG_HEADER CSocekt::RemoveFirstTimer()
+void CSocekt::procPingTimeOutChecking(lpngx_connection_t pConn, uint64_t iCurrsequence, time_t cur_time)
 {
-	std::multimap<time_t, LPSTRUC_MSG_HEADER>::iterator pos;
+	// 基类什么也不做，由子类重写
+	(void)pConn;
+	(void)iCurrsequence;
+	(void)cur_time;
+	return;
+}
 
-	// 消息头指针
-	LPSTRUC_MSG_HEADER p_tmp;
+/***************************************************************
+ *  @brief     需要的话把 timerfd 提前到 expire 时刻
+ *  @param     expire    到期时间，单位毫秒，和 ngx_timer_now_ms() 同一个时钟
+ *  @note      timerfd 已经定在更早的时刻时什么也不做，大多数情况下只是加锁比较一下，不用系统调用
+ **************************************************************/
+void CSocekt::ngx_timerfd_arm(uint64_t expire)
+{
+	CLock lock(&m_timerFdMutex);
 
-	// 时间队列大小
-	if (m_cur_size_ <= 0)
+	if (m_timerFd == -1 || expire >= m_timerFdExpire)
 	{
-		return NULL;
+		return;
 	}
 
-	// 取出队首元素
-	pos = m_timerQueuemap.begin();
-	// 取出消息头
-	p_tmp = pos->second;
-	// 删除元素
-	m_timerQueuemap.erase(pos);
-	// 队列大小减少
-	--m_cur_size_;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = expire / 1000;
+	its.it_value.tv_nsec = (expire % 1000) * 1000000;
+	if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+	{
+		// 全 0 表示取消定时
+		its.it_value.tv_nsec = 1;
+	}
+
+	// 用绝对时间，已经过去的时刻会立即到期
+	if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+	{
+		ngx_log_stderr(errno, "CSocekt::ngx_timerfd_arm()中timerfd_settime()失败.");
+		return;
+	}
+	m_timerFdExpire = expire;
 
-	return p_tmp;
+	return;
 }
 
 /***************************************************************
- *  @brief     查询超出给定时间的元素，从队列中移除并返回
- *  @param     cur_time    给定时间
- *  @return    超时的消息头
- *  @note      调用者负责互斥，所以本函数不用互
+ *  @brief     timerfd 可读时的处理函数，由 epoll 线程调用
+ *  @param     pConn    timerfd 对应的连接池中的连接
+ *  @note      到期的定时任务和心跳检查都交给线程池执行，epoll 线程只负责走时间轮；最后把 timerfd 定到下次可能到期的时刻
  **************************************************************/
-LPSTRUC_MSG_HEADER CSocekt::GetOverTimeTimer(time_t cur_time)
+void CSocekt::ngx_timerfd_handler(lpngx_connection_t pConn)
 {
-	// 内存对象
-	CMemory *p_memory = CMemory::GetInstance();
-	// 临时变量，保存取出的元素
-	LPSTRUC_MSG_HEADER ptmp;
+	uint64_t cnt;
 
-	// 队列为空，直接返回，两个条件应当同时成立或不成立
-	if (m_cur_size_ == 0 || m_timerQueuemap.empty())
-		return NULL;
+	// 把到期次数读掉，否则 LT 模式下会一直通知
+	if (read(pConn->fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+	{
+		ngx_log_stderr(errno, "CSocekt::ngx_timerfd_handler()中read(timerfd)失败.");
+	}
 
-	// 查询最早时间
-	time_t earliesttime = GetEarliestTime();
+	// timerfd 已经到期，这之后加入的更早的定时会重新设置它
+	{
+		CLock lock(&m_timerFdMutex);
+		m_timerFdExpire = UINT64_MAX;
+	}
+
+	uint64_t cur_msec = ngx_timer_now_ms();
+	// 下次可能到期的时刻
+	uint64_t next = UINT64_MAX;
+	uint64_t wait;
 
-	// 最早的时间早于指定时间
-	if (earliesttime <= cur_time)
+	// 定时任务
 	{
-		// 存在超时节点，移除并返回
-		ptmp = RemoveFirstTimer();
+		CLock lock(&m_schedMutex);
 
-		// 超时是否踢出
-		if (/*m_ifkickTimeCount == 1 && */ m_ifTimeOutKick != 1)
+		m_schedWheel.Expire(cur_msec, m_schedExpired);
+		for (size_t i = 0; i < m_schedExpired.size(); ++i)
 		{
-			// 如果不是要求超时就提出，则才做这里的事：
-
-			// 因为下次超时的时间我们也依然要判断，所以还要把这个节点加回来
-			time_t newinqueutime = cur_time + (m_iWaitTime);
-			LPSTRUC_MSG_HEADER tmpMsgHeader = (LPSTRUC_MSG_HEADER)p_memory->AllocMemory(sizeof(STRUC_MSG_HEADER), false);
-			tmpMsgHeader->pConn = ptmp->pConn;
-			tmpMsgHeader->iCurrsequence = ptmp->iCurrsequence;
-			m_timerQueuemap.insert(std::make_pair(newinqueutime, tmpMsgHeader)); // 自动排序 小->大
-			m_cur_size_++;
+			LPSTRUC_SCHED_TASK pTask = (LPSTRUC_SCHED_TASK)m_schedExpired[i]->data;
+			if (pTask->interval > 0)
+			{
+				// 周期任务按上次的到期时间往后排，不累积误差；落后太多（比如线程池太忙）就从现在开始算
+				m_schedReady.push_back(pTask->fn);
+				uint64_t expire = pTask->node.expire + pTask->interval;
+				if (expire <= cur_msec)
+				{
+					expire = cur_msec + pTask->interval;
+				}
+				m_schedWheel.Add(&pTask->node, expire);
+			}
+			else
+			{
+				m_schedReady.push_back(std::function<void()>());
+				m_schedReady.back().swap(pTask->fn);
+				m_schedTasks.erase(pTask->id);
+				m_schedTaskPool.destroy(pTask);
+				m_schedTaskPool.deallocate(pTask);
+			}
 		}
+		m_schedExpired.clear();
 
-		// 时间队列还存在元素
-		if (m_cur_size_ > 0)
+		if (m_schedWheel.Size() > 0)
 		{
-			// 更新队列最早时间
-			m_timer_value_ = GetEarliestTime();
+			wait = m_schedWheel.NextTimeout(cur_msec, UINT64_MAX - cur_msec);
+			next = ngx_min(next, cur_msec + wait);
 		}
-
-		return ptmp;
 	}
 
-	return NULL;
-}
-
-/***************************************************************
- *  @brief     将指定的 TCP 连接从时间队列中移除
- *  @param     pConn    指定链接
- **************************************************************/
-void CSocekt::DeleteFromTimerQueue(lpngx_connection_t pConn)
-{
-	std::multimap<time_t, LPSTRUC_MSG_HEADER>::iterator pos, posend;
-	CMemory *p_memory = CMemory::GetInstance();
-
-	// 上锁，访问时间队列
-	CLock lock(&m_timequeueMutex);
+	for (size_t i = 0; i < m_schedReady.size(); ++i)
+	{
+		g_threadpool.inTaskQueueAndSignal(m_schedReady[i]);
+	}
+	m_schedReady.clear();
 
-	// 因为实际情况可能比较复杂，将来可能还扩充代码等等，所以如下我们遍历整个队列找 一圈，而不是找到一次就拉倒，以免出现什么遗漏
+	// 踢人时钟
+	if (m_ifkickTimeCount == 1)
+	{
+		std::vector<STRUC_TIMER_EXPIRED> expired;
+		{
+			CLock lock(&m_timequeueMutex);
 
-lblMTQM:
-	pos = m_timerQueuemap.begin();
-	posend = m_timerQueuemap.end();
+			GetOverTimeTimer(cur_msec, expired);
+			if (m_timerWheel.Size() > 0)
+			{
+				wait = m_timerWheel.NextTimeout(cur_msec, UINT64_MAX - cur_msec);
+				next = ngx_min(next, cur_msec + wait);
+			}
+		}
 
-	// 遍历查找指定连接
-	for (; pos != posend; ++pos)
-	{
-		// 连接匹配
-		if (pos->second->pConn == pConn)
+		// 检查是否超时，超时则踢出；在线程池中做，epoll 线程不被卡住
+		if (!expired.empty())
 		{
-			// 释放内存
-			p_memory->FreeMemory(pos->second); // 释放内存
-			// 删除元素
-			m_timerQueuemap.erase(pos);
-			// 队列元素减少
-			--m_cur_size_;
-
-			goto lblMTQM;
+			time_t cur_time = time(NULL);
+			g_threadpool.inTaskQueueAndSignal([this, expired, cur_time]()
+			{
+				for (size_t i = 0; i < expired.size(); ++i)
+				{
+					procPingTimeOutChecking(expired[i].pConn, expired[i].iCurrsequence, cur_time);
+				}
+			});
 		}
 	}
 
-	// 时间队列仍存在元素，更新时间
-	if (m_cur_size_ > 0)
+	if (next != UINT64_MAX)
 	{
-		m_timer_value_ = GetEarliestTime();
+		ngx_timerfd_arm(next);
 	}
 
 	return;
 }
 
 /***************************************************************
- *  @brief     清空时间队列中的全部链接
+ *  @brief     加入一个定时任务
+ *  @param     delay    多少毫秒后第一次执行
+ *  @param     interval    周期任务的间隔，单位毫秒，0 表示只执行一次
+ *  @param     fn    任务
+ *  @return    任务号，失败返回 0
  **************************************************************/
-void CSocekt::clearAllFromTimerQueue()
+uint64_t CSocekt::ScheduleTask(uint64_t delay, uint64_t interval, const std::function<void()> &fn)
 {
-	std::multimap<time_t, LPSTRUC_MSG_HEADER>::iterator pos, posend;
+	// 还没有 timerfd（比如在 master 进程中），没法定时
+	if (m_timerFd == -1 || !fn)
+	{
+		return 0;
+	}
 
-	CMemory *p_memory = CMemory::GetInstance();
-	pos = m_timerQueuemap.begin();
-	posend = m_timerQueuemap.end();
+	LPSTRUC_SCHED_TASK pTask = m_schedTaskPool.allocate();
+	m_schedTaskPool.construct(pTask);
+	pTask->node.prev = pTask->node.next = NULL;
+	pTask->node.data = pTask;
+	pTask->interval = interval;
+	pTask->fn = fn;
 
-	for (; pos != posend; ++pos)
+	uint64_t expire = ngx_timer_now_ms() + delay;
+	uint64_t id;
 	{
-		// 释放内存
-		p_memory->FreeMemory(pos->second);
-		--m_cur_size_;
+		CLock lock(&m_schedMutex);
+
+		id = pTask->id = m_schedNextId++;
+		m_schedTasks[id] = pTask;
+		m_schedWheel.Add(&pTask->node, expire);
 	}
 
-	// 清空队列
-	m_timerQueuemap.clear();
+	ngx_timerfd_arm(expire);
+
+	return id;
 }
 
 /***************************************************************
- *  @brief     检测心跳包是否超时
- *  @param     tmpmsg    消息头
- *  @param     cur_time    当前时间
+ *  @brief     delay 毫秒后在线程池中执行一次 fn
+ *  @param     delay    延迟，单位毫秒
+ *  @param     fn    任务
+ *  @return    任务号，失败返回 0
  **************************************************************/
-void CSocekt::procPingTimeOutChecking(LPSTRUC_MSG_HEADER tmpmsg, time_t cur_time)
+uint64_t CSocekt::ScheduleAfter(uint64_t delay, const std::function<void()> &fn)
 {
-	CMemory *p_memory = CMemory::GetInstance();
-	p_memory->FreeMemory(tmpmsg);
+	return ScheduleTask(delay, 0, fn);
 }
 
 /***************************************************************
- *  @brief     监控时间队列线程的入口函数，处理到期不发心跳包的连接
- *  @param     threadData    线程对象
+ *  @brief     每隔 interval 毫秒在线程池中执行一次 fn
+ *  @param     interval    间隔，单位毫秒，不能为 0
+ *  @param     fn    任务
+ *  @return    任务号，失败返回 0
+ *  @note      上一次还没执行完时下一次也会照常交给线程池，fn 要能并发执行
  **************************************************************/
-void *CSocekt::ServerTimerQueueMonitorThread(void *threadData)
+uint64_t CSocekt::ScheduleEvery(uint64_t interval, const std::function<void()> &fn)
 {
-	// 线程对象
-	ThreadItem *pThread = static_cast<ThreadItem *>(threadData);
-	// 取出线程池指针
-	CSocekt *pSocketObj = pThread->_pThis;
-
-	// 临时变量
-	time_t absolute_time, cur_time;
-	int err;
+	if (interval == 0)
+	{
+		return 0;
+	}
+	return ScheduleTask(interval, interval, fn);
+}
 
-	// 不退出程序
-	while (g_stopEvent == 0)
+/***************************************************************
+ *  @brief     取消定时任务
+ *  @param     id    ScheduleAfter()、ScheduleEvery() 返回的任务号
+ *  @return    任务还在等待时返回 true，已经执行过的一次性任务或者不存在的任务号返回 false
+ **************************************************************/
+bool CSocekt::CancelSchedule(uint64_t id)
+{
+	LPSTRUC_SCHED_TASK pTask;
 	{
-		// 暂时无需互斥判断，先判断队列中是否存在元素
+		CLock lock(&m_schedMutex);
 
-		// 队列存在元素
-		if (pSocketObj->m_cur_size_ > 0)
+		std::unordered_map<uint64_t, LPSTRUC_SCHED_TASK>::iterator pos = m_schedTasks.find(id);
+		if (pos == m_schedTasks.end())
 		{
-			// 记录最先发生的事件事件
-			absolute_time = pSocketObj->m_timer_value_;
-
-			// 取得当前时间
-			cur_time = time(NULL);
-
-			// 最先发生事件的时间小于当前时间
-			if (absolute_time < cur_time)
-			{
-				// 时间到了，可以处理
-
-				// 消息头队列，存放待处理元素
-				std::list<LPSTRUC_MSG_HEADER> m_lsIdleList;
-				// 消息头结构体
-				LPSTRUC_MSG_HEADER result;
-
-				// 先上锁，访问时间队列
-				err = pthread_mutex_lock(&pSocketObj->m_timequeueMutex);
-				if (err != 0)
-					ngx_log_stderr(err, "CSocekt::ServerTimerQueueMonitorThread()中pthread_mutex_lock()失败，返回的错误码为%d!", err);
-
-				// 将队列中发生在当前时间之前的元素全部取出，准备后续检查
-				while ((result = pSocketObj->GetOverTimeTimer(cur_time)) != NULL)
-				{
-					m_lsIdleList.push_back(result);
-				}
-
-				// 解锁
-				err = pthread_mutex_unlock(&pSocketObj->m_timequeueMutex);
-				if (err != 0)
-					ngx_log_stderr(err, "CSocekt::ServerTimerQueueMonitorThread()pthread_mutex_unlock()失败，返回的错误码为%d!", err);
-
-				// 消息头结构体
-				LPSTRUC_MSG_HEADER tmpmsg;
-				// 队列非空
-				while (!m_lsIdleList.empty())
-				{
-					// 取出并删除队首元素
-					tmpmsg = m_lsIdleList.front();
-					m_lsIdleList.pop_front();
+			return false;
+		}
+		pTask = pos->second;
+		m_schedWheel.Del(&pTask->node);
+		m_schedTasks.erase(pos);
+	}
 
-					// 检查是否超时，超时则踢出
-					pSocketObj->procPingTimeOutChecking(tmpmsg, cur_time);
-				}
-			}
+	// 任务里可能带着别的对象，放锁之后再释放
+	m_schedTaskPool.destroy(pTask);
+	m_schedTaskPool.deallocate(pTask);
 
-		} // end if(pSocketObj->m_cur_size_ > 0)
+	return true;
+}
 
-		// 每间隔 500 毫秒循环一次，检测队列
-		usleep(500 * 1000);
-	} // end while
+/***************************************************************
+ *  @brief     清理全部定时任务
+ **************************************************************/
+void CSocekt::clearAllSchedule()
+{
+	CLock lock(&m_schedMutex);
 
-	return (void *)0;
+	m_schedWheel.Clear();
+	for (std::unordered_map<uint64_t, LPSTRUC_SCHED_TASK>::iterator pos = m_schedTasks.begin(); pos != m_schedTasks.end(); ++pos)
+	{
+		m_schedTaskPool.destroy(pos->second);
+		m_schedTaskPool.deallocate(pos->second);
+	}
+	m_schedTasks.clear();
+	// 任务都没了，空出来的内存还给系统
+	m_schedTaskPool.trim();
 }
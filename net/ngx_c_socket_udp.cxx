@@ -0,0 +1,255 @@
+﻿// 本文件存放 UDP 收发相关函数的实现
+// 心跳、上报之类不需要 TCP 顺序保证的小包可以直接发到 UDP 端口，包格式和 TCP 上一样（包头+包体），一个数据报可以装多个包；
+// 收包用 recvmmsg() 批量收，每个数据报作为一条消息交给线程池，应答用 sendmmsg() 批量发回对端地址
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>    //uintptr_t
+#include <unistd.h>    //close
+#include <errno.h>     //errno
+#include <pthread.h>   //多线程
+#include <arpa/inet.h>
+
+#include "ngx_c_conf.h"
+#include "ngx_macro.h"
+#include "ngx_global.h"
+#include "ngx_func.h"
+#include "ngx_c_socket.h"
+#include "ngx_c_memory.h"
+#include "ngx_c_lockmutex.h"
+
+/***************************************************************
+ *  @brief     UDP 套接字可读时的处理函数，用 recvmmsg() 一次收多个数据报
+ *  @param     pConn    UDP 套接字对应的连接
+ *  @note      一直收到不满一批为止，io_uring 的 multishot poll 只在新数据到来时通知，不能留下没收的数据报
+ **************************************************************/
+void CSocekt::ngx_udp_recv_handler(lpngx_connection_t pConn)
+{
+    struct mmsghdr msgs[NGX_UDP_BATCH];
+    struct iovec iov[NGX_UDP_BATCH];
+    struct sockaddr_in addrs[NGX_UDP_BATCH];
+    int n;
+
+    do
+    {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < NGX_UDP_BATCH; ++i)
+        {
+            iov[i].iov_base = m_udpRecvBuf + (size_t)i * NGX_UDP_DGRAM_MAX;
+            iov[i].iov_len = NGX_UDP_DGRAM_MAX;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        n = recvmmsg(pConn->fd, msgs, NGX_UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                ngx_log_stderr(errno, "CSocekt::ngx_udp_recv_handler()中recvmmsg()失败.");
+            }
+            return;
+        }
+        ++m_iUdpRecvCallCount;
+
+        for (int i = 0; i < n; ++i)
+        {
+            // 比收包区还大的数据报被截断了，肯定不合法
+            if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0)
+            {
+                ++m_iUdpDropCount;
+                continue;
+            }
+            ngx_udp_recv_proc(pConn, (char *)iov[i].iov_base, msgs[i].msg_len, &addrs[i]);
+        }
+    } while (n == NGX_UDP_BATCH);
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     检查一个数据报，里边是整数个合法的包时，拷贝出来作为一条消息交给线程池
+ *  @param     pConn    UDP 套接字对应的连接
+ *  @param     pData    数据报内容
+ *  @param     len    数据报长度
+ *  @param     paddr    数据报的来源地址
+ *  @note      数据报不会只到一半，所以半个包、非法包头都说明整个数据报不可信，直接丢掉
+ **************************************************************/
+void CSocekt::ngx_udp_recv_proc(lpngx_connection_t pConn, char *pData, size_t len, struct sockaddr_in *paddr)
+{
+    // 包头，数据报中的包头不一定对齐，拷贝出来再用
+    COMM_PKG_HEADER pkgHeader;
+    unsigned short e_pkgLen;
+    size_t iOffset = 0;
+    unsigned int iPkgCount = 0;
+
+    while (iOffset < len)
+    {
+        if (len - iOffset < m_iLenPkgHeader)
+        {
+            ++m_iUdpDropCount;
+            return;
+        }
+
+        memcpy(&pkgHeader, pData + iOffset, m_iLenPkgHeader);
+        e_pkgLen = ntohs(pkgHeader.pkgLen);
+        if (e_pkgLen < m_iLenPkgHeader || e_pkgLen > (_PKG_MAX_LENGTH - 1000) || e_pkgLen > len - iOffset)
+        {
+            ++m_iUdpDropCount;
+            return;
+        }
+
+        iOffset += e_pkgLen;
+        ++iPkgCount;
+    }
+
+    if (iPkgCount == 0)
+    {
+        // 空数据报
+        return;
+    }
+    ++m_iUdpRecvCount;
+
+    CMemory *p_memory = CMemory::GetInstance();
+    char *pMsgBuf = (char *)p_memory->AllocMemory(m_iLenMsgHeader + len, false);
+    memcpy(pMsgBuf + m_iLenMsgHeader, pData, len);
+
+    // 写入消息头内容，对端地址随消息头一起走，应答时原样带回
+    LPSTRUC_MSG_HEADER ptmpMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+    ptmpMsgHeader->pConn = pConn;
+    ptmpMsgHeader->iCurrsequence = pConn->iCurrsequence;
+    ptmpMsgHeader->iPkgCount = iPkgCount;
+    ptmpMsgHeader->pNext = NULL;
+    memcpy(&ptmpMsgHeader->udpAddr, paddr, sizeof(struct sockaddr_in));
+
+    // 放入消息队列等候下一步处理，专门有线程处理收到的数据包
+    g_threadpool.inMsgRecvQueueAndSignal(pMsgBuf);
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     发送一个 UDP 应答
+ *  @param     pConn    UDP 套接字对应的连接
+ *  @param     psendbuf    待发送消息，消息头中的 udpAddr 是对端地址
+ *  @note      应答先挂到 UDP 套接字的发送队列上；已经有线程在发时直接返回，由那个线程顺带发掉，
+ *             否则当前线程负责把队列发空，几个处理线程同时应答时就自然合成一次 sendmmsg()
+ **************************************************************/
+void CSocekt::msgSendUdp(lpngx_connection_t pConn, char *psendbuf)
+{
+    LPSTRUC_MSG_HEADER pMsgHeader = (LPSTRUC_MSG_HEADER)psendbuf;
+    pMsgHeader->pNext = NULL;
+
+    {
+        CLock lock(&pConn->sendMutex);
+
+        if (pConn->psendQueueTail == NULL)
+        {
+            pConn->psendQueueHead = psendbuf;
+        }
+        else
+        {
+            ((LPSTRUC_MSG_HEADER)pConn->psendQueueTail)->pNext = psendbuf;
+        }
+        pConn->psendQueueTail = psendbuf;
+
+        // 已经有线程在发了
+        if (pConn->ifSendReady == 1)
+        {
+            return;
+        }
+        pConn->ifSendReady = 1;
+    }
+
+    ngx_udp_flush(pConn);
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     把 UDP 套接字发送队列中的应答全部发出去，直到队列为空
+ *  @param     pConn    UDP 套接字对应的连接，调用前已经把 ifSendReady 置 1
+ *  @note      发送缓冲区满（EAGAIN）时剩下的数据报直接丢掉，UDP 本来就不保证送达，不值得交给 epoll 驱动重发
+ **************************************************************/
+void CSocekt::ngx_udp_flush(lpngx_connection_t pConn)
+{
+    CMemory *p_memory = CMemory::GetInstance();
+
+    struct mmsghdr msgs[NGX_UDP_BATCH];
+    struct iovec iov[NGX_UDP_BATCH];
+    char *sendMsgs[NGX_UDP_BATCH];
+    LPSTRUC_MSG_HEADER pMsgHeader;
+    LPCOMM_PKG_HEADER pPkgHeader;
+    char *pMsgBuf = NULL;
+    int n, iSent, r;
+
+    while (true)
+    {
+        // 本批发完了，再从发送队列上整个摘一次
+        if (pMsgBuf == NULL)
+        {
+            CLock lock(&pConn->sendMutex);
+
+            pMsgBuf = pConn->psendQueueHead;
+            pConn->psendQueueHead = pConn->psendQueueTail = NULL;
+            if (pMsgBuf == NULL)
+            {
+                // 队列空了，以后来的应答由它自己的线程来发
+                pConn->ifSendReady = 0;
+                break;
+            }
+        }
+
+        memset(msgs, 0, sizeof(msgs));
+        for (n = 0; pMsgBuf != NULL && n < NGX_UDP_BATCH; ++n)
+        {
+            pMsgHeader = (LPSTRUC_MSG_HEADER)pMsgBuf;
+            pPkgHeader = (LPCOMM_PKG_HEADER)(pMsgBuf + m_iLenMsgHeader);
+            iov[n].iov_base = pPkgHeader;
+            iov[n].iov_len = ntohs(pPkgHeader->pkgLen);
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            msgs[n].msg_hdr.msg_name = &pMsgHeader->udpAddr;
+            msgs[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            sendMsgs[n] = pMsgBuf;
+            pMsgBuf = pMsgHeader->pNext;
+        }
+
+        for (iSent = 0; iSent < n;)
+        {
+            r = sendmmsg(pConn->fd, msgs + iSent, n - iSent, MSG_DONTWAIT);
+            if (r > 0)
+            {
+                iSent += r;
+                m_iUdpSendCount += r;
+                ++m_iUdpSendCallCount;
+                continue;
+            }
+            if (r == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // 某个数据报发不出去（比如对端地址不可达），跳过它，后边的接着发
+                ngx_log_stderr(errno, "CSocekt::ngx_udp_flush()中sendmmsg()失败.");
+                ++iSent;
+                ++m_iUdpDropCount;
+                continue;
+            }
+            // 发送缓冲区满了，本批剩下的丢掉
+            m_iUdpDropCount += n - iSent;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            p_memory->FreeMemory(sendMsgs[i]);
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,662 @@
+﻿// 本文件存放用 io_uring 代替 epoll 的事件驱动相关函数实现
+// 监听套接字上用 multishot accept，客户端连接上用 multishot recv 从提供给内核的缓冲区环中收数据，
+// 可写通知和 eventfd 等其他句柄用 poll 请求；发送数据仍走原来的 writev()/send() 流程
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>    //uintptr_t
+#include <unistd.h>    //syscall
+#include <errno.h>     //errno
+#include <poll.h>      //POLLIN
+#include <pthread.h>   //多线程
+#include <sys/mman.h>  //mmap
+#include <sys/syscall.h>
+#include <sys/utsname.h> //uname
+
+#include "ngx_c_conf.h"
+#include "ngx_macro.h"
+#include "ngx_global.h"
+#include "ngx_func.h"
+#include "ngx_c_socket.h"
+#include "ngx_c_memory.h"
+#include "ngx_c_lockmutex.h"
+
+// 请求的种类，保存在 user_data 的低 3 位，连接对象的地址至少是 8 字节对齐的
+#define NGX_URING_ACCEPT  0 // 监听套接字上的 multishot accept
+#define NGX_URING_RECV    1 // 客户端连接上的 multishot recv
+#define NGX_URING_POLLIN  2 // 其他句柄（如 eventfd）上的 multishot poll，可读时调用 rhandler
+#define NGX_URING_POLLOUT 3 // 发送缓冲区满时等待可写的一次性 poll，可写时调用 whandler
+#define NGX_URING_POLLREMOVE 4 // 取消连接上的 multishot poll，用于别的进程也持有、close() 后不会失效的句柄
+#define NGX_URING_TYPE_MASK 7
+
+// 收包缓冲区环的组号
+#define NGX_URING_BGID 0
+
+/***************************************************************
+ *  @brief     初始化 io_uring：创建队列、映射内存、注册收包缓冲区环
+ *  @return    true: 成功，false: 内核不支持或者失败，调用者退回 epoll
+ *  @note      multishot recv 要求内核 6.0 及以上
+ **************************************************************/
+bool CSocekt::ngx_uring_init()
+{
+    struct utsname uts;
+    int major = 0, minor = 0;
+    if (uname(&uts) == 0)
+    {
+        sscanf(uts.release, "%d.%d", &major, &minor);
+    }
+    if (major < 6)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, 0, "CSocekt::ngx_uring_init()中内核版本%s不支持multishot recv!", uts.release);
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = NGX_URING_ENTRIES * 4;
+
+    int fd = (int)syscall(__NR_io_uring_setup, NGX_URING_ENTRIES, &params);
+    if (fd == -1)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_uring_init()中io_uring_setup()失败!");
+        return false;
+    }
+    pthread_mutex_init(&m_uringMutex, NULL);
+
+    // 完成队列满了内核也不丢事件，提交、完成队列可以一次映射
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ngx_log_error_core(NGX_LOG_WARN, 0, "CSocekt::ngx_uring_init()中io_uring缺少需要的特性(%ud)!", params.features);
+        m_uringFd = fd;
+        ngx_uring_close();
+        return false;
+    }
+
+    size_t sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    m_sqRingSize = (sqsize > cqsize) ? sqsize : cqsize;
+    m_sqRingPtr = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_sqRingPtr == MAP_FAILED)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_uring_init()中mmap(IORING_OFF_SQ_RING)失败!");
+        m_sqRingPtr = NULL;
+        m_uringFd = fd;
+        ngx_uring_close();
+        return false;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_uring_init()中mmap(IORING_OFF_SQES)失败!");
+        m_sqes = NULL;
+        m_uringFd = fd;
+        ngx_uring_close();
+        return false;
+    }
+
+    char *ring = (char *)m_sqRingPtr;
+    m_sqHead = (unsigned *)(ring + params.sq_off.head);
+    m_sqTail = (unsigned *)(ring + params.sq_off.tail);
+    m_sqMask = (unsigned *)(ring + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_cqHead = (unsigned *)(ring + params.cq_off.head);
+    m_cqTail = (unsigned *)(ring + params.cq_off.tail);
+    m_cqMask = (unsigned *)(ring + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // sqe 数组的下标和提交队列中的位置一一对应，以后不再修改
+    unsigned *sqArray = (unsigned *)(ring + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i)
+    {
+        sqArray[i] = i;
+    }
+    m_sqLocalTail = *m_sqTail;
+    m_sqToSubmit = 0;
+
+    // 收包缓冲区环，内存要按页对齐
+    m_bufRingSize = m_bufCount * sizeof(struct io_uring_buf);
+    m_bufRing = (struct io_uring_buf_ring *)mmap(NULL, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_bufRing == MAP_FAILED)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_uring_init()中mmap(buf_ring)失败!");
+        m_bufRing = NULL;
+        m_uringFd = fd;
+        ngx_uring_close();
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_bufRing;
+    reg.ring_entries = m_bufCount;
+    reg.bgid = NGX_URING_BGID;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        ngx_log_error_core(NGX_LOG_WARN, errno, "CSocekt::ngx_uring_init()中io_uring_register(IORING_REGISTER_PBUF_RING)失败!");
+        m_uringFd = fd;
+        ngx_uring_close();
+        return false;
+    }
+
+    // 把全部缓冲区交给内核；头文件中的 bufs 在 C++ 下会被编译器放到偏移 8 处，直接按 io_uring_buf 数组访问
+    m_bufBase = (char *)CMemory::GetInstance()->AllocMemory((size_t)m_bufCount * m_iRecvBufSize, false);
+    for (int i = 0; i < m_bufCount; ++i)
+    {
+        struct io_uring_buf *buf = (struct io_uring_buf *)m_bufRing + i;
+        buf->addr = (uint64_t)(uintptr_t)(m_bufBase + (size_t)i * m_iRecvBufSize);
+        buf->len = m_iRecvBufSize;
+        buf->bid = (unsigned short)i;
+    }
+    m_bufTail = (unsigned short)m_bufCount;
+    __atomic_store_n(&m_bufRing->tail, m_bufTail, __ATOMIC_RELEASE);
+
+    m_uringFd = fd;
+    m_uringOwner = pthread_self();
+
+
+    return true;
+}
+
+/***************************************************************
+ *  @brief     释放 io_uring 相关资源
+ **************************************************************/
+void CSocekt::ngx_uring_close()
+{
+    if (m_uringFd == -1)
+    {
+        return;
+    }
+
+    if (m_bufRing != NULL)
+    {
+        munmap(m_bufRing, m_bufRingSize);
+        m_bufRing = NULL;
+    }
+    if (m_sqes != NULL)
+    {
+        munmap(m_sqes, m_sqesSize);
+        m_sqes = NULL;
+    }
+    if (m_sqRingPtr != NULL)
+    {
+        munmap(m_sqRingPtr, m_sqRingSize);
+        m_sqRingPtr = NULL;
+    }
+    close(m_uringFd);
+    m_uringFd = -1;
+    pthread_mutex_destroy(&m_uringMutex);
+
+    // 内核已经不再使用收包缓冲区了
+    if (m_bufBase != NULL)
+    {
+        CMemory::GetInstance()->FreeMemory(m_bufBase);
+        m_bufBase = NULL;
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     取一个空闲的 sqe
+ *  @return    清零后的 sqe
+ *  @note      调用者持有 m_uringMutex；提交队列满时先把已填好的提交掉；
+ *             取出的 sqe 还不在队列中，填好后调用 ngx_uring_commit_sqe() 才对内核可见
+ **************************************************************/
+struct io_uring_sqe *CSocekt::ngx_uring_get_sqe()
+{
+    while (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+    {
+        ngx_uring_submit();
+    }
+
+    struct io_uring_sqe *sqe = &m_sqes[m_sqLocalTail & *m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/***************************************************************
+ *  @brief     把 ngx_uring_get_sqe() 取出并填好的 sqe 放进提交队列
+ *  @note      调用者持有 m_uringMutex；先填 sqe 再移动队尾，内核不会看到填了一半的 sqe
+ **************************************************************/
+void CSocekt::ngx_uring_commit_sqe()
+{
+    ++m_sqLocalTail;
+    ++m_sqToSubmit;
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+}
+
+/***************************************************************
+ *  @brief     把已经填好、还没提交的 sqe 全部提交给内核，不等待完成
+ *  @note      调用者持有 m_uringMutex
+ **************************************************************/
+void CSocekt::ngx_uring_submit()
+{
+    while (m_sqToSubmit > 0)
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, m_uringFd, m_sqToSubmit, 0, 0, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ngx_log_stderr(errno, "CSocekt::ngx_uring_submit()中io_uring_enter()失败.");
+            return;
+        }
+        m_sqToSubmit -= ret;
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     为连接提交一个请求
+ *  @param     pConn    连接池中的连接
+ *  @param     type    请求种类，NGX_URING_xxx
+ *  @note      epoll 线程自己提交的请求攒到下次 io_uring_enter() 一起提交，其他线程提交的请求立即提交，
+ *             因为 epoll 线程可能正卡在 io_uring_enter() 里等待
+ **************************************************************/
+void CSocekt::ngx_uring_prep(lpngx_connection_t pConn, int type)
+{
+    CLock lock(&m_uringMutex);
+
+    struct io_uring_sqe *sqe = ngx_uring_get_sqe();
+    sqe->fd = pConn->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)pConn | (uint64_t)type;
+
+    switch (type)
+    {
+    case NGX_URING_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        break;
+    case NGX_URING_RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = NGX_URING_BGID;
+        break;
+    case NGX_URING_POLLIN:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+        break;
+    case NGX_URING_POLLREMOVE:
+        // 要取消的请求由 addr 中的 user_data 指定
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)pConn | (uint64_t)NGX_URING_POLLIN;
+        break;
+    default: // NGX_URING_POLLOUT
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+        break;
+    }
+    ngx_uring_commit_sqe();
+
+    if (!pthread_equal(pthread_self(), m_uringOwner))
+    {
+        ngx_uring_submit();
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     io_uring 模式下的 ngx_epoll_oper_event()，参数含义一样，把 epoll 的操作翻译成对应的请求
+ *  @return    成功返回 1
+ *  @note      监听套接字：multishot accept；客户端连接：multishot recv；其他句柄：multishot poll；
+ *             增加 EPOLLOUT：提交等待可写的 poll；去掉 EPOLLOUT：以后不再等待可写；
+ *             删除：只对其他句柄有意义，取消它的 multishot poll，套接字在关闭时自然结束请求
+ **************************************************************/
+int CSocekt::ngx_uring_oper_event(int fd, uint32_t eventtype, uint32_t flag, int bcaction, lpngx_connection_t pConn)
+{
+    // 句柄从 pConn 中取，fd 只是为了和 ngx_epoll_oper_event() 参数一致
+    (void)fd;
+
+    if (eventtype == EPOLL_CTL_ADD)
+    {
+        if (pConn->rhandler == &CSocekt::ngx_event_accept)
+        {
+            ngx_uring_prep(pConn, NGX_URING_ACCEPT);
+        }
+        else if (pConn->rhandler == &CSocekt::ngx_read_request_handler)
+        {
+            pConn->iUringWantWrite = 0;
+            pConn->iUringPollOut = 0;
+            ngx_uring_prep(pConn, NGX_URING_RECV);
+        }
+        else
+        {
+            ngx_uring_prep(pConn, NGX_URING_POLLIN);
+        }
+        return 1;
+    }
+
+    if (eventtype == EPOLL_CTL_DEL)
+    {
+        if (pConn->rhandler != &CSocekt::ngx_event_accept && pConn->rhandler != &CSocekt::ngx_read_request_handler)
+        {
+            ngx_uring_prep(pConn, NGX_URING_POLLREMOVE);
+        }
+        return 1;
+    }
+
+    if (eventtype == EPOLL_CTL_MOD && (flag & EPOLLOUT))
+    {
+        if (bcaction == 0)
+        {
+            // 同一时刻只能有一个等待可写的请求，否则 whandler 会被多调用
+            pConn->iUringWantWrite = 1;
+            if (pConn->iUringPollOut.exchange(1) == 0)
+            {
+                ngx_uring_prep(pConn, NGX_URING_POLLOUT);
+            }
+        }
+        else if (bcaction == 1)
+        {
+            pConn->iUringWantWrite = 0;
+        }
+    }
+
+    return 1;
+}
+
+/***************************************************************
+ *  @brief     io_uring 模式下的 ngx_epoll_process_events()：提交攒下的请求，等待并处理完成事件
+ *  @param     timer    等待时长，单位毫秒，-1: 一直等，0: 不等
+ *  @return    1 正常返回 ，0 有问题返回
+ *  @note      提交和填 sqe 一样在 m_uringMutex 下进行；等待时不提交（to_submit 为 0），
+ *             不持锁也不会让内核读到其他线程正在填的 sqe
+ **************************************************************/
+int CSocekt::ngx_uring_process_events(int timer)
+{
+    {
+        CLock lock(&m_uringMutex);
+        if (m_sqToSubmit > 0)
+        {
+            ngx_uring_submit();
+            ++m_iUringEnterCount;
+        }
+    }
+
+    unsigned flags = 0, waitnr = 0;
+    void *arg = NULL;
+    size_t argsz = 0;
+    struct io_uring_getevents_arg getarg;
+    struct __kernel_timespec ts;
+
+    // 完成队列中已经有事件就不用等了
+    if (timer != 0 && __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) == *m_cqHead)
+    {
+        flags = IORING_ENTER_GETEVENTS;
+        waitnr = 1;
+        if (timer > 0)
+        {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (long long)(timer % 1000) * 1000000;
+            memset(&getarg, 0, sizeof(getarg));
+            getarg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &getarg;
+            argsz = sizeof(getarg);
+        }
+    }
+
+    int ret = 0;
+    if (flags != 0)
+    {
+        ret = (int)syscall(__NR_io_uring_enter, m_uringFd, 0, waitnr, flags, arg, argsz);
+        ++m_iUringEnterCount;
+    }
+
+    if (ret < 0 && errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+    {
+        ngx_log_error_core(NGX_LOG_ALERT, errno, "CSocekt::ngx_uring_process_events()中io_uring_enter()失败!");
+        return 0;
+    }
+
+    // 处理全部完成事件
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    unsigned short bufTail = m_bufTail;
+    for (; head != tail; ++head)
+    {
+        struct io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+
+        ngx_uring_handle_cqe(cqe);
+
+        // 用过的收包缓冲区还给内核
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            struct io_uring_buf *buf = (struct io_uring_buf *)m_bufRing + (m_bufTail & (m_bufCount - 1));
+            buf->addr = (uint64_t)(uintptr_t)(m_bufBase + (size_t)bid * m_iRecvBufSize);
+            buf->len = m_iRecvBufSize;
+            buf->bid = bid;
+            ++m_bufTail;
+        }
+        ++m_iUringCqeCount;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    if (bufTail != m_bufTail)
+    {
+        __atomic_store_n(&m_bufRing->tail, m_bufTail, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+
+/***************************************************************
+ *  @brief     处理一个完成事件
+ *  @param     cqe    完成事件
+ *  @note      连接已经关闭（fd == -1）的事件是过期事件，不处理；关闭时用 shutdown() 让 multishot 请求尽快结束
+ **************************************************************/
+void CSocekt::ngx_uring_handle_cqe(struct io_uring_cqe *cqe)
+{
+    lpngx_connection_t p_Conn = (lpngx_connection_t)(uintptr_t)(cqe->user_data & ~(uint64_t)NGX_URING_TYPE_MASK);
+    int type = (int)(cqe->user_data & NGX_URING_TYPE_MASK);
+    // multishot 请求是否还继续有效
+    bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    int res = cqe->res;
+
+    // 每个请求都带着连接，没有连接的完成事件不是本程序提交的，不处理
+    if (p_Conn == NULL)
+    {
+        return;
+    }
+
+    switch (type)
+    {
+    case NGX_URING_ACCEPT:
+        if (res >= 0)
+        {
+            struct sockaddr mysockaddr;
+            socklen_t socklen = sizeof(mysockaddr);
+            memset(&mysockaddr, 0, sizeof(mysockaddr));
+            getpeername(res, &mysockaddr, &socklen);
+            ngx_event_accept_proc(p_Conn, res, &mysockaddr, socklen);
+        }
+        else if (res == -EMFILE || res == -ENFILE)
+        {
+            ngx_log_error_core(NGX_LOG_CRIT, -res, "CSocekt::ngx_uring_handle_cqe()中accept失败!");
+            ngx_accept_overload(p_Conn);
+        }
+        else if (res == -ENOBUFS || res == -ENOMEM)
+        {
+            ngx_log_error_core(NGX_LOG_ALERT, -res, "CSocekt::ngx_uring_handle_cqe()中accept失败!");
+            ngx_accept_pause();
+        }
+        else if (res != -EAGAIN && res != -ECONNABORTED && res != -EINTR)
+        {
+            ngx_log_error_core(NGX_LOG_ALERT, -res, "CSocekt::ngx_uring_handle_cqe()中accept失败!");
+        }
+        if (!more && p_Conn->fd != -1)
+        {
+            if (m_acceptPauseUntil != 0)
+            {
+                // 暂停期间不再提交，由 ngx_accept_resume() 重新提交
+                p_Conn->listening->paused = 1;
+            }
+            else
+            {
+                ngx_uring_prep(p_Conn, NGX_URING_ACCEPT);
+            }
+        }
+        break;
+
+    case NGX_URING_RECV:
+        if (p_Conn->fd == -1)
+        {
+            break;
+        }
+        if (res > 0)
+        {
+            ngx_uring_recv_data(p_Conn, m_bufBase + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * m_iRecvBufSize, res);
+        }
+        else if (res == 0 || (res != -ENOBUFS && res != -EINTR && res != -EAGAIN))
+        {
+            // 对端关闭或者出错，和 recvproc() 一样处理
+            if (res < 0 && res != -ECONNRESET && res != -EBADF)
+            {
+                ngx_log_stderr(-res, "CSocekt::ngx_uring_handle_cqe()中recv发生错误，我打印出来看看是啥错误！");
+            }
+            zdClosesocketProc(p_Conn);
+            break;
+        }
+        // 收包缓冲区用完了等原因，请求结束了，重新提交
+        if (!more && p_Conn->fd != -1)
+        {
+            ngx_uring_prep(p_Conn, NGX_URING_RECV);
+        }
+        break;
+
+    case NGX_URING_POLLIN:
+        if (p_Conn->fd == -1)
+        {
+            break;
+        }
+        if (res > 0)
+        {
+            (this->*(p_Conn->rhandler))(p_Conn);
+        }
+        if (!more && p_Conn->fd != -1)
+        {
+            ngx_uring_prep(p_Conn, NGX_URING_POLLIN);
+        }
+        break;
+
+    case NGX_URING_POLLREMOVE:
+        // 被取消的 poll 自己还会有一个结束事件，那时 fd 已经是 -1，不用处理
+        break;
+
+    default: // NGX_URING_POLLOUT
+        if (p_Conn->fd != -1 && p_Conn->iUringWantWrite == 1)
+        {
+            if (res < 0 || (res & (POLLERR | POLLHUP)))
+            {
+                // 和 LT 模式一样，投递了写事件但对端断开，iThrowsendCount 减回来，收尾由读流程负责
+                p_Conn->iUringWantWrite = 0;
+                --p_Conn->iThrowsendCount;
+            }
+            else
+            {
+                // 发完了会通过 ngx_epoll_oper_event() 去掉 EPOLLOUT，也就是把 iUringWantWrite 清零
+                (this->*(p_Conn->whandler))(p_Conn);
+            }
+        }
+
+        // 还要等可写就接着等；否则清掉标记，再看一眼这期间有没有其他线程要求等待可写
+        if (p_Conn->fd != -1 && p_Conn->iUringWantWrite == 1)
+        {
+            ngx_uring_prep(p_Conn, NGX_URING_POLLOUT);
+        }
+        else
+        {
+            p_Conn->iUringPollOut = 0;
+            if (p_Conn->fd != -1 && p_Conn->iUringWantWrite == 1 && p_Conn->iUringPollOut.exchange(1) == 0)
+            {
+                ngx_uring_prep(p_Conn, NGX_URING_POLLOUT);
+            }
+        }
+        break;
+    }
+
+    return;
+}
+
+/***************************************************************
+ *  @brief     把 io_uring 收到的一段数据交给收包流程，和 ngx_read_request_handler() 中 readv() 之后的处理一致
+ *  @param     pConn    数据来源的 TCP 连接
+ *  @param     pData    内核放到收包缓冲区环中的数据
+ *  @param     len    数据长度
+ *  @note      数据先拷贝到大包的内存或者连接的收包缓冲区中，再原地拆包
+ **************************************************************/
+void CSocekt::ngx_uring_recv_data(lpngx_connection_t pConn, char *pData, size_t len)
+{
+    // 是否flood攻击
+    bool isflood = false;
+    // 本次拷贝的长度
+    size_t n;
+
+    while (len > 0)
+    {
+        if (pConn->precvMemPointer != NULL)
+        {
+            // 先补齐正在接收的大包
+            n = (len < pConn->irecvlen) ? len : pConn->irecvlen;
+            memcpy(pConn->precvbuf, pData, n);
+            pConn->precvbuf = pConn->precvbuf + n;
+            pConn->irecvlen = pConn->irecvlen - n;
+            pData += n;
+            len -= n;
+
+            if (pConn->irecvlen > 0)
+            {
+                // 大包还没收完整
+                break;
+            }
+
+            if (m_floodAkEnable == 1)
+            {
+                // Flood攻击检测是否开启
+                isflood = TestFlood(pConn);
+            }
+            ngx_wait_request_handler_proc_plast(pConn, isflood);
+        }
+        else
+        {
+            // 收包缓冲区有数据到来时才分配
+            if (pConn->precvChunk == NULL)
+            {
+                pConn->precvChunk = (char *)CMemory::GetInstance()->AllocMemory(m_iLenMsgHeader + m_iRecvBufSize, false);
+            }
+
+            // 收包缓冲区中最多只残留一个不完整的包，所以这里肯定还有空间
+            n = m_iRecvBufSize - pConn->irecvChunkLen;
+            n = (len < n) ? len : n;
+            memcpy(pConn->precvChunk + m_iLenMsgHeader + pConn->irecvChunkLen, pData, n);
+            pConn->irecvChunkLen = pConn->irecvChunkLen + n;
+            pData += n;
+            len -= n;
+
+            ngx_wait_request_handler_proc_p1(pConn, isflood);
+        }
+
+        // flood 攻击
+        if (isflood == true)
+        {
+            // 客户端flood服务器，则直接把客户端踢掉
+            zdClosesocketProc(pConn);
+            return;
+        }
+    }
+
+    return;
+}
@@ -8,9 +8,13 @@
 #include <errno.h>  //errno
 #include <unistd.h>
 
+#include <vector>
+
 #include "ngx_func.h"
 #include "ngx_macro.h"
 #include "ngx_c_conf.h"
+#include "ngx_c_memory.h"
+#include "ngx_global.h"
 
 // 本文件内函数声明
 
@@ -24,6 +28,9 @@ static void ngx_worker_process_init(int inum);
 // 主进程标题
 static u_char master_process[] = "master process";
 
+// 创建出的 worker 进程，master 停止服务时用
+static std::vector<pid_t> ngx_worker_pids;
+
 /***************************************************************
  *  @brief     创建worker子进程
  **************************************************************/
@@ -122,6 +129,18 @@ void ngx_master_process_cycle()
         // 此时master进程完全靠信号驱动干活
         sigsuspend(&set);
 
+        // 有 worker 无法工作（比如打不开监听端口），结束其余 worker 后返回，由 main() 释放资源退出；
+        // worker 没有处理 SIGTERM，只能用 SIGKILL
+        if (ngx_terminate)
+        {
+            for (size_t i = 0; i < ngx_worker_pids.size(); i++)
+            {
+                kill(ngx_worker_pids[i], SIGKILL);
+            }
+            ngx_log_error_core(NGX_LOG_ALERT, 0, "worker进程无法工作，master进程停止服务!");
+            break;
+        }
+
         // printf("执行一次 sigsuspend() \n");
 
         // printf("master 进程休息1秒\n");
@@ -146,7 +165,11 @@ static void ngx_start_worker_processes(int threadnums)
     for (int i = 0; i < threadnums; i++)
     {
         // 创建一个子进程并指定子进程标题
-        ngx_spawn_process(i, "worker process");
+        pid_t pid = ngx_spawn_process(i, "worker process");
+        if (pid > 0)
+        {
+            ngx_worker_pids.push_back(pid);
+        }
     } // end for
 
     return;
@@ -216,9 +239,23 @@ static void ngx_worker_process_init(int inum)
     // 信号取消屏蔽设置成功
     // 开始对工作环境初始化
 
+    CConfig *p_config = CConfig::GetInstance();
+
+    // 消息内存的 arena，在创建线程之前预留好，配置项 Mem_ArenaMB 为 0 时不预留
+    int arenaMB = p_config->GetIntDefault("Mem_ArenaMB", 0);
+    if (arenaMB > 0)
+    {
+        int hugePages = p_config->GetIntDefault("Mem_HugePages", NGX_MEM_HUGE_NONE);
+        int prefault = p_config->GetIntDefault("Mem_Prefault", NGX_MEM_PREFAULT_NONE);
+        if (CMemory::GetInstance()->InitArena((size_t)arenaMB * 1024 * 1024, hugePages, prefault) == false)
+        {
+            // 预留失败不影响使用，内存照常向系统申请
+            ngx_log_error_core(NGX_LOG_ALERT, 0, "ngx_worker_process_init()中CMemory::InitArena()失败!");
+        }
+    }
+
     // 最先创建线程池代码
     // 读取配置文件中线程池的创建参数
-    CConfig *p_config = CConfig::GetInstance();
     // 处理接收到的消息的线程池中线程数量
     int tmpthreadnums = p_config->GetIntDefault("ProcMsgRecvWorkThreadCount", 5);
     // 创建指定数量线程的线程池
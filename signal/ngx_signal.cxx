@@ -275,6 +275,13 @@ static void ngx_process_get_status(void)
         {
             // WEXITSTATUS()获取子进程传递给exit或者_exit参数的低八位
             ngx_log_error_core(NGX_LOG_NOTICE, 0, "pid = %P exited with code %d!", pid, WEXITSTATUS(status));
+
+            // worker 打不开监听端口，重新创建也一样打不开，通知 master 停止整个服务
+            if (WEXITSTATUS(status) == NGX_EXIT_LISTEN)
+            {
+                ngx_log_error_core(NGX_LOG_ALERT, 0, "pid = %P 打开监听端口失败，master 进程将停止服务!", pid);
+                ngx_terminate = 1;
+            }
         }
 
     } // end for